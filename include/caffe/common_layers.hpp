@@ -91,6 +91,7 @@ class ConcatLayer : public Layer<Dtype> {
   virtual inline const char* type() const { return "Concat"; }
   virtual inline int MinBottomBlobs() const { return 2; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool BackwardUsesTopData(int top_id) const { return false; }
 
  protected:
   /**
@@ -147,6 +148,12 @@ class ConcatLayer : public Layer<Dtype> {
   int concat_axis_;
 };
 
+/**
+ * @brief Concatenates two compressed region blobs (holding the channels of
+ *        the active pixels only) along the channels, image by image.
+ *        bottom[2] is the region index of the mask (MaskLayer's second top),
+ *        which holds the active pixel count of each image.
+ */
 template <typename Dtype>
 class RegionConcatLayer : public Layer<Dtype> {
  public:
@@ -174,6 +181,12 @@ class RegionConcatLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 };
 
+/**
+ * @brief Adds a compressed region blob to a dense one at the active pixels:
+ *        coeff(0) * bottom[0] + coeff(1) * bottom[1] wherever the mask
+ *        bottom[2] is not -1. bottom[3] is the region index of the mask
+ *        (MaskLayer's second top), which holds the active pixel counts.
+ */
 template <typename Dtype>
 class RegionSumLayer : public Layer<Dtype> {
  public:
@@ -200,7 +213,23 @@ class RegionSumLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  /// CPU workers over the (image, channel) planes [begin, end) of the batch.
+  void forward_planes(const Dtype* data0, const Dtype* data1,
+      const Dtype* mask_data, const int* mask_counts, Dtype* top_data,
+      int thread_id, int begin, int end);
+  void backward_planes(const Dtype* top_diff, const Dtype* mask_data,
+      const int* mask_counts, Dtype* diff0, Dtype* diff1, int thread_id,
+      int begin, int end);
+  /// Reads the active pixel count of each image from the region index.
+  const int* mask_counts(const Blob<Dtype>& index);
+
   Dtype op1_, op2_;
+  int channels_;
+  int spatial_dim_;
+  /// the size of an image of the compressed bottom[1]
+  int data1_dim_;
+  int num_threads_;
+  vector<int> mask_counts_;
 };
 
 
@@ -223,6 +252,9 @@ class EltwiseLayer : public Layer<Dtype> {
   virtual inline const char* type() const { return "Eltwise"; }
   virtual inline int MinBottomBlobs() const { return 2; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool BackwardUsesTopData(int top_id) const {
+    return op_ == EltwiseParameter_EltwiseOp_PROD;
+  }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -379,6 +411,7 @@ class InnerProductLayer : public Layer<Dtype> {
   virtual inline const char* type() const { return "InnerProduct"; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  virtual inline bool BackwardUsesTopData(int top_id) const { return false; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -806,6 +839,12 @@ class BNLayer : public Layer<Dtype> {
   virtual inline const char* type() const { return "BN"; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  // batch renorm clips against the moving averages updated in Forward
+  virtual inline bool AllowRecompute() const { return !rebn_; }
+  // Backward works from the saved normalized inputs, and the output when
+  // masking by the fused ReLU
+  virtual inline bool AllowInPlace() const { return true; }
+  virtual inline bool BackwardUsesTopData(int top_id) const { return relu_; }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -824,6 +863,7 @@ class BNLayer : public Layer<Dtype> {
 
   bool frozen_;
   bool rebn_;
+  bool relu_;
   Dtype bn_momentum_;
   Dtype bn_eps_;
   Dtype max_r_;
@@ -872,6 +912,8 @@ class CuDNNBNLayer : public BNLayer<Dtype> {
   virtual inline const char* type() const { return "BN"; }
   virtual inline int ExactNumBottomBlobs() const { return 1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  // cuDNN computes the gradients from the bottom data
+  virtual inline bool AllowInPlace() const { return false; }
 
  protected:
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
@@ -903,6 +945,7 @@ class SyncBNLayer : public Layer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "SyncBN"; }
+  virtual inline bool AllowRecompute() const { return false; }
   virtual inline int ExactNumBottomBlobs() const { return -1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
@@ -929,6 +972,10 @@ class SyncBNLayer : public Layer<Dtype> {
 };
 #endif
 
+/**
+ * @brief Batch normalization whose training statistics are those of the
+ *        whole batch across all MPI ranks.
+ */
 template <typename Dtype>
 class BNDataLayer : public BNLayer<Dtype> {
 public:
@@ -940,6 +987,8 @@ public:
     const  vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const {return "BNData";}
+  virtual inline bool AllowRecompute() const { return false; }
+  virtual inline bool AllowInPlace() const { return false; }
 
 protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -951,6 +1000,18 @@ protected:
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down,  const vector<Blob<Dtype>*>& bottom);
 
+  /// CPU workers over the channels [begin, end).
+  void statistics_channels(const Dtype* bottom_data, Dtype* mean, Dtype* var,
+      Dtype* mean_sq, int thread_id, int begin, int end);
+  void normalize_channels(const Dtype* bottom_data, const Dtype* coeffs,
+      Dtype* x_norm, Dtype* top_data, int thread_id, int begin, int end);
+  void gradient_sums_channels(const Dtype* top_diff, const Dtype* x_norm,
+      Dtype* sum_diff, Dtype* sum_diff_x_norm, int thread_id, int begin,
+      int end);
+  void bottom_diff_channels(const Dtype* top_diff, const Dtype* x_norm,
+      const Dtype* coeffs, Dtype* bottom_diff, int thread_id, int begin,
+      int end);
+
   Blob<Dtype> x_norm_, x_std_;
 
   Dtype *x_norm_gpu_data_, *x_norm_cpu_data_;
@@ -972,6 +1033,14 @@ protected:
   Blob<Dtype>* blob_var_;
   Blob<Dtype>* blob_scale_;
   Blob<Dtype>* blob_shift_;
+
+  // CPU only: the mean of the squared per rank means, the per channel
+  // affine coefficients of the current pass, whether the last forward pass
+  // used the batch statistics, and the number of threads
+  Blob<Dtype> mean_sq_;
+  Blob<Dtype> channel_coeffs_;
+  bool batch_stats_;
+  int num_threads_;
 };
 
 /**
@@ -1018,6 +1087,9 @@ public:
     virtual inline int MinBottomBlobs() const { return 1; }
     virtual inline int MaxBottomBlobs() const { return 2; }
     virtual inline int ExactNumTopBlobs() const { return 1; }
+    // in place, the bottom is saved to temp_ for the scale gradient
+    virtual inline bool AllowInPlace() const { return true; }
+    virtual inline bool BackwardUsesTopData(int top_id) const { return false; }
 
 protected:
     /**
@@ -1083,6 +1155,8 @@ public:
     virtual inline int MinBottomBlobs() const { return 1; }
     virtual inline int MaxBottomBlobs() const { return 2; }
     virtual inline int ExactNumTopBlobs() const { return 1; }
+    virtual inline bool AllowInPlace() const { return true; }
+    virtual inline bool BackwardUsesTopData(int top_id) const { return false; }
 
     virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
                              const vector<Blob<Dtype>*>& top);
@@ -1130,6 +1204,16 @@ protected:
     virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
                               const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+    /// @brief CPU workers over the positions [begin, end) of each step
+    void forward_steps(const Dtype* bottom_data, Dtype* top_data,
+                       int thread_id, int begin, int end);
+    void backward_steps(const Dtype* top_diff, const Dtype* bottom_data,
+                        Dtype* bottom_diff, int thread_id, int begin, int end);
+    void forward_topk(const Dtype* bottom_data, Dtype* top_data,
+                      int thread_id, int begin, int end);
+    void backward_topk(const Dtype* top_diff, Dtype* bottom_diff,
+                       int thread_id, int begin, int end);
+
     /// @brief the reduction operation performed by the layer
     ReductionParameter_ReductionOp op_;
     /// @brief the index of the first input axis to reduce
@@ -1145,7 +1229,11 @@ protected:
     vector<int> levels_;
     vector<int> ticks_;
 
-    Blob<Dtype> argsort_idx_;
+    /// @brief the k of top-k reduction
+    int k_;
+    /// @brief whether each input was among the top k of its position
+    vector<unsigned char> topk_mask_;
+    int num_threads_;
 };
 
 }  // namespace caffe
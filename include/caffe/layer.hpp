@@ -10,6 +10,7 @@
 #include "caffe/layer_factory.hpp"
 #include "caffe/proto/caffe.pb.h"
 #include "caffe/util/device_alternate.hpp"
+#include "caffe/workspace.hpp"
 
 namespace caffe {
 
@@ -35,6 +36,8 @@ class Layer {
     : layer_param_(param) {
       // Set phase and copy blobs (if there are any).
       phase_ = param.phase();
+      recomputing_ = false;
+      workspace_ = NULL;
       if (layer_param_.blobs_size() > 0) {
         blobs_.resize(layer_param_.blobs_size());
         for (int i = 0; i < layer_param_.blobs_size(); ++i) {
@@ -314,6 +317,52 @@ class Layer {
   virtual inline bool is_sharing_data(int top_id, int bottom_id){return false;}
   virtual inline bool is_sharing_diff(int top_id, int bottom_id){return false;}
 
+  /**
+   * @brief Return whether the layer can be run forward a second time on the
+   *        same bottoms to regenerate tops discarded by activation
+   *        recomputation.
+   *
+   * Layers whose output is not a pure function of the bottoms and parameters
+   * (e.g. random masks) should override this to return false.
+   */
+  virtual inline bool AllowRecompute() const { return true; }
+
+  /**
+   * @brief Return whether the first top may take over the data and diff
+   *        storage of the first bottom.
+   *
+   * The memory optimizer then runs the layer in place even when the top is a
+   * different blob. Forward and Backward must be correct when the two share
+   * memory, and Backward must not rely on the bottom data beyond what the
+   * top data tells (e.g. its sign).
+   */
+  virtual inline bool AllowInPlace() const { return false; }
+
+  /**
+   * @brief Return whether Backward reads the data of the given top.
+   *
+   * The memory optimizer does not let a following layer overwrite a top
+   * that is still needed here. Layers running in place read their bottom
+   * data through the top, so they should keep the default.
+   */
+  virtual inline bool BackwardUsesTopData(int top_id) const { return true; }
+
+  /**
+   * @brief Set by the Net while it recomputes discarded activations. Layers
+   *        with side effects in Forward (e.g. moving averages) skip them.
+   */
+  inline void set_recomputing(bool value) { recomputing_ = value; }
+  inline bool recomputing() const { return recomputing_; }
+
+  /**
+   * @brief Set the scratch memory used by the layer. A Net hands its own
+   *        workspace to its layers before setting them up; otherwise the
+   *        workspace of the calling thread is used.
+   */
+  inline void set_workspace(Workspace* workspace) { workspace_ = workspace; }
+  inline Workspace* workspace() const {
+    return workspace_ ? workspace_ : Workspace::ThreadLocal();
+  }
 
  protected:
   /** The protobuf that stores the layer parameters */
@@ -328,6 +377,10 @@ class Layer {
   /** The vector that indicates whether each top blob has a non-zero weight in
    *  the objective function. */
   vector<Dtype> loss_;
+  /** Whether the current Forward is a recomputation of discarded tops. */
+  bool recomputing_;
+  /** The scratch memory shared with the other layers of the net. */
+  Workspace* workspace_;
 
   #ifdef USE_MPI
   /**
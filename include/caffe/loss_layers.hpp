@@ -746,6 +746,13 @@ class SoftmaxWithLossLayer : public LossLayer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  /// CPU workers over the tiles [begin, end) of pixels of the batch.
+  void forward_tiles(const Dtype* bottom_data, const Dtype* label,
+      Dtype* prob_data, Dtype* thread_loss, int* thread_count,
+      int thread_id, int begin, int end);
+  void backward_tiles(const Dtype* prob_data, const Dtype* label,
+      const Dtype scale, Dtype* bottom_diff, int thread_id, int begin,
+      int end);
 
   /// The internal SoftmaxLayer used to map predictions to a distribution.
   shared_ptr<Layer<Dtype> > softmax_layer_;
@@ -765,9 +772,17 @@ class SoftmaxWithLossLayer : public LossLayer<Dtype> {
 
   int softmax_axis_, outer_num_, inner_num_;
   vector<Dtype> temp;
+  int num_threads_;
 };
 
 
+/**
+ * @brief Computes the smooth L1 loss of Fast R-CNN between bottom[0] and
+ *        bottom[1], summed and divided by the batch size. The optional
+ *        bottom[2] (inside weights) scales the differences before the loss
+ *        and the optional bottom[3] (outside weights) the loss of each
+ *        element.
+ */
 template <typename Dtype>
 class SmoothL1LossLayer : public LossLayer<Dtype> {
 public:
@@ -782,7 +797,7 @@ public:
 
     virtual inline int ExactNumBottomBlobs() const { return -1; }
     virtual inline int MinBottomBlobs() const { return 2; }
-    virtual inline int MaxBottomBlobs() const { return 3; }
+    virtual inline int MaxBottomBlobs() const { return 4; }
 
     /**
     * Unlike most loss layers, in the SmoothL1LossLayer we can backpropagate
@@ -803,9 +818,20 @@ protected:
     virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
                               const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+    /// @brief CPU worker over the elements [begin, end): adds the loss to
+    ///        partial_loss_[thread_id] and saves its gradient in diff, the
+    ///        data of diff_.
+    void forward_range(const Dtype* data0, const Dtype* data1,
+        const Dtype* inside_weights, const Dtype* outside_weights,
+        Dtype* diff, int thread_id, int begin, int end);
+
     Blob<Dtype> diff_;
     Blob<Dtype> errors_;
     bool has_weights_;
+    bool has_outside_weights_;
+    Dtype sigma2_;
+    int num_threads_;
+    vector<Dtype> partial_loss_;
 };
 
 
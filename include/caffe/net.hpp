@@ -11,6 +11,7 @@
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/proto/caffe.pb.h"
+#include "caffe/workspace.hpp"
 
 namespace caffe {
 
@@ -178,6 +179,15 @@ class Net {
   bool has_layer(const string& layer_name) const;
   const shared_ptr<Layer<Dtype> > layer_by_name(const string& layer_name) const;
 
+  /// @brief returns the bytes of scratch memory shared by the layers
+  inline size_t workspace_size() const { return workspace_->size(); }
+  /**
+   * @brief returns the distinct memory holding the activations: the data and
+   *        diffs of the blobs, the slots recomputed and widened activations
+   *        are moved into, and the packed copies of reduced precision ones.
+   */
+  vector<SyncedMemory*> activation_storages() const;
+
   void set_debug_info(const bool value) { debug_info_ = value; }
 
   // Helpers for Init.
@@ -228,6 +238,23 @@ class Net {
   void MemoryOptimize();
   void MemoryOptimize_v2();
 
+  /// @brief Regenerate the discarded activations of a recompute segment.
+  void RecomputeSegment(int segment_id);
+  /// @brief Hand the recomputed activations' memory back to the shared slots.
+  void ReleaseSegment(int segment_id);
+  /// @brief Pack an activation into 16 bits once the forward pass is done.
+  void CompressBlob(int compress_id);
+  /// @brief Widen a packed activation back for the backward pass.
+  void WidenBlob(int compress_id);
+  /// @brief Hand the widened activation's memory back to the shared slots.
+  void ReleaseWidenedBlob(int compress_id);
+  /// @brief Find the layers each Mask layer's exit makes pointless.
+  void PlanCascadeExit();
+  /// @brief Whether a Mask layer selected no pixel of any image.
+  bool MaskExited(int layer_id) const;
+  /// @brief Make a skipped Mask layer's tops select no pixel.
+  void ClearMask(int layer_id);
+
   /// @brief The network name
   string name_;
   /// @brief The phase: TRAIN or TEST
@@ -289,6 +316,47 @@ class Net {
   bool optimize_memory_;
   vector< shared_ptr<SyncedMemory> > shared_storage_;
   std::set<string> excluded_blob_names_;
+  /// The scratch memory shared by the layers, e.g. for im2col.
+  shared_ptr<Workspace> workspace_;
+  /// Whether to free the workspace after every forward and backward pass.
+  bool release_workspace_;
+  /// Whether to run layers allowing it in place on their bottom storage.
+  bool in_place_;
+
+  /// Activation recomputation related stuff.
+  bool recompute_;
+  /// the segment each layer belongs to, or -1
+  vector<int> recompute_segment_ids_;
+  /// first and last layer of each segment
+  vector<pair<int, int> > recompute_segments_;
+  /// whether a layer is run again when its segment is recomputed
+  vector<bool> layer_recompute_;
+  /// the blobs whose data is regenerated for each segment
+  vector<vector<int> > recompute_blob_ids_;
+  /// data storage of a discarded blob in the forward pass and during recompute
+  vector<shared_ptr<SyncedMemory> > forward_data_storage_;
+  vector<shared_ptr<SyncedMemory> > recompute_data_storage_;
+
+  /// Reduced precision activation storage related stuff.
+  /// the blobs sharing the data of each packed activation, owner first
+  vector<vector<int> > compress_blob_ids_;
+  /// first and last layer touching each packed activation
+  vector<pair<int, int> > compress_ranges_;
+  vector<LayerParameter_StoragePrecision> compress_precisions_;
+  /// the 16-bit copies held between the forward and the backward pass
+  vector<shared_ptr<SyncedMemory> > compress_storage_;
+  vector<bool> compress_widened_;
+  /// the activations packed after the forward pass of each layer
+  vector<vector<int> > layer_compress_ids_;
+
+  /// Cascade early exit related stuff.
+  bool cascade_early_exit_;
+  /// the Mask layers whose exit lets each layer be skipped
+  vector<vector<int> > layer_exit_masks_;
+  /// whether each Mask layer selected nothing in the last forward pass
+  vector<bool> mask_exited_;
+  /// whether each layer is a Mask layer
+  vector<bool> mask_layer_;
 
   DISABLE_COPY_AND_ASSIGN(Net);
 };
@@ -167,6 +167,10 @@ class DropoutLayer : public NeuronLayer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Dropout"; }
+  // the dropout mask is resampled on every forward pass
+  virtual inline bool AllowRecompute() const { return false; }
+  virtual inline bool AllowInPlace() const { return true; }
+  virtual inline bool BackwardUsesTopData(int top_id) const { return false; }
 
  protected:
   /**
@@ -354,6 +358,13 @@ class PowerLayer : public NeuronLayer<Dtype> {
       const vector<Blob<Dtype>*>& top);
 
   virtual inline const char* type() const { return "Power"; }
+  // only the affine case has a gradient independent of the bottom
+  virtual inline bool AllowInPlace() const {
+    return power_ == Dtype(1) || diff_scale_ == Dtype(0);
+  }
+  virtual inline bool BackwardUsesTopData(int top_id) const {
+    return power_ != Dtype(1) && power_ != Dtype(2) && diff_scale_ != Dtype(0);
+  }
 
  protected:
   /**
@@ -423,6 +434,10 @@ class ReLULayer : public NeuronLayer<Dtype> {
       : NeuronLayer<Dtype>(param) {}
 
   virtual inline const char* type() const { return "ReLU"; }
+  // the top keeps the sign of the bottom used by Backward
+  virtual inline bool AllowInPlace() const {
+    return this->layer_param_.relu_param().negative_slope() >= 0;
+  }
 
  protected:
   /**
@@ -519,6 +534,7 @@ class SigmoidLayer : public NeuronLayer<Dtype> {
       : NeuronLayer<Dtype>(param) {}
 
   virtual inline const char* type() const { return "Sigmoid"; }
+  virtual inline bool AllowInPlace() const { return true; }
 
  protected:
   /**
@@ -603,6 +619,7 @@ class TanHLayer : public NeuronLayer<Dtype> {
       : NeuronLayer<Dtype>(param) {}
 
   virtual inline const char* type() const { return "TanH"; }
+  virtual inline bool AllowInPlace() const { return true; }
 
  protected:
   /**
@@ -0,0 +1,44 @@
+#ifndef _CAFFE_UTIL_CONV_DIRECT_HPP_
+#define _CAFFE_UTIL_CONV_DIRECT_HPP_
+
+namespace caffe {
+
+// Direct grouped convolution of a single image, without the im2col buffer.
+// Meant for depthwise and other convolutions with few channels per group,
+// where the gemms over the unrolled input degenerate to a handful of rows.
+// The filters are laid out (num_output, channels / group, kernel_h,
+// kernel_w) and the output size follows from the im2col arithmetic.
+//
+// These are scalar kernels, with no intrinsics and no channel blocking. Their
+// inner loops run over a row of the output with unit stride and no bounds
+// checks, which the compiler vectorizes when it is asked to (-O3, or
+// -ftree-vectorize before GCC 12).
+
+// data_out = conv(data_im, weights)
+template <typename Dtype>
+void conv_direct_forward_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const int group,
+    const Dtype* weights, const int num_output, Dtype* data_out);
+
+// data_im = the gradient of the input given the gradient data_out
+template <typename Dtype>
+void conv_direct_backward_cpu(const Dtype* data_out, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const int group,
+    const Dtype* weights, const int num_output, Dtype* data_im);
+
+// weights_diff += the gradient of the filters given the input and the
+// gradient data_out
+template <typename Dtype>
+void conv_direct_weight_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const int group,
+    const Dtype* data_out, const int num_output, Dtype* weights_diff);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_CONV_DIRECT_HPP_
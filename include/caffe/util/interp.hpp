@@ -11,11 +11,14 @@ namespace caffe {
 // Bi-linear interpolation
 // IN : [channels height1 width1] cropped from a bigger [Height1 Width1] image
 // OUT: [channels height2 width2] cropped from a bigger [Height2 Width2] image
+// The CPU versions split the channels over num_threads threads (0 for all
+// hardware threads).
 
 template <typename Dtype, bool packed>
 void caffe_cpu_interp2(const int channels,
     const Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
-          Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2);
+          Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2,
+    const int num_threads = 1);
 
 template <typename Dtype, bool packed>
 void caffe_gpu_interp2(const int channels,
@@ -26,7 +29,8 @@ void caffe_gpu_interp2(const int channels,
 template <typename Dtype, bool packed>
 void caffe_cpu_interp2_backward(const int channels,
 	  Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
-    const Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2);
+    const Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2,
+    const int num_threads = 1);
 
 template <typename Dtype, bool packed>
 void caffe_gpu_interp2_backward(const int channels,
@@ -0,0 +1,47 @@
+#ifndef CAFFE_UTIL_MEM_REPORT_H_
+#define CAFFE_UTIL_MEM_REPORT_H_
+
+#include <vector>
+
+#include "caffe/net.hpp"
+
+namespace caffe {
+
+/**
+ * @brief The memory a net takes, as reported by the mem command of the caffe
+ *        tool.
+ *
+ * Storage is allocated on first use and kept for the life of the net, so the
+ * numbers of each layer are the bytes allocated so far once a forward and
+ * backward pass has stepped through it. They add up over the pass and are
+ * not the bytes of the values live at that layer.
+ */
+struct MemoryReport {
+  /// the data and diffs of the parameters
+  size_t param_bytes;
+  /// every activation's data and diff in a storage of its own
+  size_t activation_raw_bytes;
+  /// the storages the net holds its activations in, including the slots of
+  /// recomputed and widened activations and the packed copies
+  size_t activation_bytes;
+  /// the scratch memory of the layers, counted in full from the start
+  size_t workspace_bytes;
+  /// the bytes allocated at the end of the pass
+  size_t peak_bytes;
+  vector<size_t> layer_top_bytes;
+  vector<size_t> layer_param_bytes;
+  /// the bytes allocated after the forward, then the backward, of each layer
+  vector<size_t> forward_allocated_bytes;
+  vector<size_t> backward_allocated_bytes;
+};
+
+/**
+ * @brief Runs one forward and backward pass of net, a layer at a time, and
+ *        reports the memory it allocates.
+ */
+template <typename Dtype>
+void ReportMemory(Net<Dtype>* net, MemoryReport* report);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_MEM_REPORT_H_
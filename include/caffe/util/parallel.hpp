@@ -0,0 +1,31 @@
+#ifndef CAFFE_UTIL_PARALLEL_H_
+#define CAFFE_UTIL_PARALLEL_H_
+
+#include <boost/function.hpp>
+
+namespace caffe {
+
+/// @brief Returns the number of hardware threads, at least 1.
+int caffe_hardware_threads();
+
+/**
+ * @brief Splits [0, count) into up to num_threads contiguous ranges and calls
+ *        func(thread_id, begin, end) for each of them on its own thread.
+ *
+ * The calling thread handles the first range and returns once all of them
+ * are done. The other ranges go to a pool of workers that each calling thread
+ * creates on first use and keeps for its lifetime. A num_threads of 0 uses
+ * all hardware threads; a call made from inside func runs serially. The
+ * workers do not share the Caffe context of the caller, so func should only
+ * run plain CPU code (BLAS, im2col and the like).
+ *
+ * Returns the number of ranges func was called for, whose thread_ids are
+ * 0 to that number minus one. It can be less than num_threads, so per-thread
+ * results should only be reduced over the ranges that ran.
+ */
+int caffe_parallel_for(const int count, int num_threads,
+    const boost::function<void(int, int, int)>& func);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_PARALLEL_H_
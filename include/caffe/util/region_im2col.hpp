@@ -3,23 +3,51 @@
 
 namespace caffe {
 
+// pixels lists the linear indices of the mask_cnt active pixels, as in the
+// pixels of a region index (see region_index.hpp). The CPU versions split
+// the active pixels over num_threads threads, and can unroll the columns of
+// a chunk of col_count active pixels starting at col_begin instead of all of
+// them. col2im then adds the chunks after the first one to data_im, so the
+// chunks must come in order.
 template <typename Dtype>
-void region_im2col_cpu(const Dtype* data_im, const int channels,
-    const int height, const int width, const int kernel_h, const int kernel_w,
-    const int pad_h, const int pad_w, const int stride_h,
-    const int stride_w, const int dilation_h, const int dilation_w,
-    Dtype* data_col);
+void region_im2col_cpu(const Dtype* data_im,
+    const int* pixels, const int mask_cnt,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int dilation_h, const int dilation_w, Dtype* data_col,
+    const int num_threads = 1, const int col_begin = 0,
+    const int col_count = -1);
 
 template <typename Dtype>
-void region_col2im_cpu(const Dtype* data_col, const int channels,
-    const int height, const int width, const int kernel_h, const int kernel_w,
-    const int pad_h, const int pad_w, const int stride_h,
-    const int stride_w, const int dilation_h, const int dilation_w,
-    Dtype* data_im);
+void compression_region_im2col_cpu(const Dtype* data_im,
+    const Dtype* data_mask, const int* pixels,
+    const int mask_cnt, const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int dilation_h, const int dilation_w, Dtype* data_col,
+    const int num_threads = 1, const int col_begin = 0,
+    const int col_count = -1);
+
+template <typename Dtype>
+void region_col2im_cpu(const Dtype* data_col,
+    const int* pixels, const Dtype* data_mask,
+    const int mask_cnt, const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int dilation_h, const int dilation_w, Dtype* data_im,
+    const int num_threads = 1, const int col_begin = 0,
+    const int col_count = -1);
+
+template <typename Dtype>
+void compression_region_col2im_cpu(const Dtype* data_col,
+    const int* pixels, const Dtype* data_mask,
+    const int mask_cnt, const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int dilation_h, const int dilation_w, Dtype* data_im,
+    const int num_threads = 1, const int col_begin = 0,
+    const int col_count = -1);
 
 template <typename Dtype>
 void region_im2col_gpu(const Dtype* data_im,
-    const Dtype* index_1, const Dtype* index_2, const int mask_cnt, const int channels,
+    const int* pixels, const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int dilation_h, const int dilation_w,
@@ -27,7 +55,7 @@ void region_im2col_gpu(const Dtype* data_im,
 
 template <typename Dtype>
 void compression_region_im2col_gpu(const Dtype* data_im, const Dtype* data_mask,
-    const Dtype* index_1, const Dtype* index_2, const int mask_cnt, const int channels,
+    const int* pixels, const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int dilation_h, const int dilation_w,
@@ -35,7 +63,7 @@ void compression_region_im2col_gpu(const Dtype* data_im, const Dtype* data_mask,
 
 template <typename Dtype>
 void region_col2im_gpu(const Dtype* data_col, 
-    const Dtype* index_1, const Dtype* index_2, const Dtype* data_mask,
+    const int* pixels, const Dtype* data_mask,
     const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w, const int dilation_h, const int dilation_w,
@@ -43,7 +71,7 @@ void region_col2im_gpu(const Dtype* data_col,
 
 template <typename Dtype>
 void compression_region_col2im_gpu(const Dtype* data_col, 
-    const Dtype* index_1, const Dtype* index_2, const Dtype* data_mask,
+    const int* pixels, const Dtype* data_mask,
     const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w, const int dilation_h, const int dilation_w,
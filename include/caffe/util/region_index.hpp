@@ -0,0 +1,72 @@
+#ifndef CAFFE_UTIL_REGION_INDEX_H_
+#define CAFFE_UTIL_REGION_INDEX_H_
+
+#include "caffe/blob.hpp"
+
+namespace caffe {
+
+/**
+ * @brief The sparse region descriptor MaskLayer emits as its second top and
+ *        the region layers read to find the active pixels of each image.
+ *
+ * Every image owns region_index_width<Dtype>(spatial_dim) elements of the
+ * blob, whose storage holds int32 values rather than Dtype:
+ *   - [0] the number of active pixels, cnt;
+ *   - [1] the number of runs, the maximal spans of active pixels with
+ *     consecutive linear indices;
+ *   - [2, 2 + cnt) the linear index h * width + w of each active pixel in
+ *     raster order, so that entry m is column m of the compressed layout;
+ *   - then a (first linear index, length) pair per run.
+ * MaskLayer fills it on the host, so the counts are read from cpu_data()
+ * without waiting on the device. The bits are not Dtype values, so the blob
+ * is never held in reduced precision storage.
+ */
+
+/// @brief The int32 values an image needs at most. A run is followed by an
+///        inactive pixel or the end of the image, so runs <= spatial_dim -
+///        cnt + 1 and cnt + 2 * runs <= 3 * (spatial_dim + 1) / 2.
+inline int region_index_size(const int spatial_dim) {
+  return 2 + (3 * (spatial_dim + 1) + 1) / 2;
+}
+
+/// @brief The Dtype elements each image of the index blob takes.
+template <typename Dtype>
+inline int region_index_width(const int spatial_dim) {
+  CHECK_GE(sizeof(Dtype), sizeof(int)) << "the index needs whole int32 slots";
+  return (region_index_size(spatial_dim) * sizeof(int) + sizeof(Dtype) - 1) /
+      sizeof(Dtype);
+}
+
+template <typename Dtype>
+inline const int* region_index_cpu(const Blob<Dtype>& blob, const int n) {
+  return reinterpret_cast<const int*>(blob.cpu_data() + blob.offset(n));
+}
+
+template <typename Dtype>
+inline int* region_index_mutable_cpu(Blob<Dtype>* blob, const int n) {
+  return reinterpret_cast<int*>(blob->mutable_cpu_data() + blob->offset(n));
+}
+
+template <typename Dtype>
+inline const int* region_index_gpu(const Blob<Dtype>& blob, const int n) {
+  return reinterpret_cast<const int*>(blob.gpu_data() + blob.offset(n));
+}
+
+inline int region_index_count(const int* index) { return index[0]; }
+inline int region_index_num_runs(const int* index) { return index[1]; }
+inline const int* region_index_pixels(const int* index) { return index + 2; }
+inline int* region_index_pixels(int* index) { return index + 2; }
+inline const int* region_index_runs(const int* index) {
+  return index + 2 + index[0];
+}
+
+/**
+ * @brief Finishes the index of one image whose first cnt pixels, in raster
+ *        order, have been written to index + 2: stores the count and appends
+ *        the runs.
+ */
+void region_index_finish(const int cnt, int* index);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_REGION_INDEX_H_
@@ -0,0 +1,32 @@
+#ifndef CAFFE_UTIL_WINOGRAD_H_
+#define CAFFE_UTIL_WINOGRAD_H_
+
+namespace caffe {
+
+/**
+ * @brief Fills the matrices of the Winograd minimal filtering algorithm
+ *        F(m x m, 3 x 3) for output tiles of m = 2 or 4, whose input tiles
+ *        have alpha = m + 2 elements per side.
+ *
+ * All matrices are row-major: BT is B^T (alpha x alpha), G is alpha x 3 and
+ * AT is A^T (m x alpha). A convolution tile is then Y = A^T [(G g G^T) .*
+ * (B^T d B)] A.
+ */
+template <typename Dtype>
+void winograd_matrices(const int tile, Dtype* BT, Dtype* G, Dtype* AT);
+
+/**
+ * @brief Computes out = L in L^T for the rows x cols matrix L, taking a
+ *        cols x cols tile to a rows x rows one.
+ *
+ * Element (i, j) of a tile of size s is read from in[(i * s + j) * in_stride]
+ * and written to out[(i * s + j) * out_stride], so that the transformed tiles
+ * can be scattered straight into the layout of the batched products.
+ */
+template <typename Dtype>
+void winograd_transform(const Dtype* L, const int rows, const int cols,
+    const Dtype* in, const int in_stride, Dtype* out, const int out_stride);
+
+}  // namespace caffe
+
+#endif  // CAFFE_UTIL_WINOGRAD_H_
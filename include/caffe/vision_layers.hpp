@@ -35,6 +35,7 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   virtual inline int MinBottomBlobs() const { return 1; }
   virtual inline int MinTopBlobs() const { return 1; }
   virtual inline bool EqualNumBottomTopBlobs() const { return true; }
+  virtual inline bool BackwardUsesTopData(int top_id) const { return false; }
 
  protected:
   // Helper functions that abstract away the column buffer and gemm arguments.
@@ -48,6 +49,13 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   void weight_cpu_gemm(const Dtype* input, const Dtype* output, Dtype*
       weights);
   void backward_cpu_bias(Dtype* bias, const Dtype* input);
+  // Minibatch versions of the above, splitting the images over num_threads_
+  // threads that unroll batch_im2col_ images at a time. The optional
+  // arguments may be NULL when the bias or gradient is not needed.
+  void forward_cpu_minibatch(const Dtype* input, const Dtype* weights,
+      const Dtype* bias, Dtype* output);
+  void backward_cpu_minibatch(const Dtype* input, const Dtype* output_diff,
+      const Dtype* weights, Dtype* weights_diff, Dtype* input_diff);
 
 #ifndef CPU_ONLY
   void forward_gpu_gemm(const Dtype* col_input, const Dtype* weights,
@@ -78,6 +86,19 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int height_out_, width_out_;
   bool bias_term_;
   bool is_1x1_;
+  int num_threads_;
+  // the images unrolled at a time, at most the batch_im2col parameter
+  int batch_im2col_;
+  // whether to convolve directly instead of through im2col and gemm, as
+  // chosen at Reshape for depthwise and other narrow groups
+  bool direct_;
+  // whether to unroll band_rows_ output rows at a time, as dilated
+  // convolutions do to bound the column buffer
+  bool banded_;
+  int band_rows_;
+  // the number of threads splitting the current minibatch
+  inline int cpu_threads() const { return cpu_threads_; }
+  int cpu_threads_;
 
  private:
   // wrap im2col/col2im so we don't have to remember the (long) argument lists
@@ -89,6 +110,67 @@ class BaseConvolutionLayer : public Layer<Dtype> {
     col2im_cpu(col_buff, conv_in_channels_, conv_in_height_, conv_in_width_,
         kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_, dilation_h_, dilation_w_, data);
   }
+  inline void conv_im2col_cpu(const Dtype* data, Dtype* col_buff,
+      int col_stride) {
+    im2col_cpu(data, conv_in_channels_, conv_in_height_, conv_in_width_,
+        kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_, dilation_h_, dilation_w_, col_stride, col_buff);
+  }
+  inline void conv_col2im_cpu(const Dtype* col_buff, Dtype* data,
+      int col_stride) {
+    col2im_cpu(col_buff, conv_in_channels_, conv_in_height_, conv_in_width_,
+        kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_, dilation_h_, dilation_w_, col_stride, data);
+  }
+  inline void conv_im2col_rows_cpu(const Dtype* data, int row_begin,
+      int row_end, Dtype* col_buff) {
+    im2col_rows_cpu(data, conv_in_channels_, conv_in_height_, conv_in_width_,
+        kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_, stride_w_,
+        dilation_h_, dilation_w_, row_begin, row_end, col_buff);
+  }
+  inline void conv_col2im_rows_cpu(const Dtype* col_buff, int row_begin,
+      int row_end, Dtype* data) {
+    col2im_rows_cpu(col_buff, conv_in_channels_, conv_in_height_,
+        conv_in_width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_,
+        stride_w_, dilation_h_, dilation_w_, row_begin, row_end, data);
+  }
+  // The gemm helpers for a single image in bands of band_rows_ output rows,
+  // with the column and output bands in buffer.
+  void forward_cpu_banded(const Dtype* input, const Dtype* weights,
+      Dtype* output, Dtype* buffer);
+  void backward_cpu_banded(const Dtype* output, const Dtype* weights,
+      Dtype* input, Dtype* buffer);
+  void weight_cpu_banded(const Dtype* input, const Dtype* output,
+      Dtype* weights, Dtype* buffer);
+  inline void direct_forward_cpu(const Dtype* input, const Dtype* weights,
+      Dtype* output) {
+    conv_direct_forward_cpu(input, conv_in_channels_, conv_in_height_,
+        conv_in_width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_,
+        stride_w_, dilation_h_, dilation_w_, group_, weights,
+        conv_out_channels_, output);
+  }
+  inline void direct_backward_cpu(const Dtype* output, const Dtype* weights,
+      Dtype* input) {
+    conv_direct_backward_cpu(output, conv_in_channels_, conv_in_height_,
+        conv_in_width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_,
+        stride_w_, dilation_h_, dilation_w_, group_, weights,
+        conv_out_channels_, input);
+  }
+  inline void direct_weight_cpu(const Dtype* input, const Dtype* output,
+      Dtype* weights) {
+    conv_direct_weight_cpu(input, conv_in_channels_, conv_in_height_,
+        conv_in_width_, kernel_h_, kernel_w_, pad_h_, pad_w_, stride_h_,
+        stride_w_, dilation_h_, dilation_w_, group_, output,
+        conv_out_channels_, weights);
+  }
+  // Sizes the per-thread buffers for the current batch_im2col_, bands and
+  // threads, and returns the workspace elements they need in all.
+  size_t cpu_buffer_size();
+  // the part of forward/backward_cpu_minibatch run by one thread on images
+  // [begin, end), using its share of the workspace
+  void forward_cpu_images(const Dtype* input, const Dtype* weights,
+      const Dtype* bias, Dtype* output, int thread_id, int begin, int end);
+  void backward_cpu_images(const Dtype* input, const Dtype* output_diff,
+      const Dtype* weights, Dtype* weights_diff, Dtype* input_diff,
+      int thread_id, int begin, int end);
 #ifndef CPU_ONLY
   inline void conv_im2col_gpu(const Dtype* data, Dtype* col_buff) {
     im2col_gpu(data, conv_in_channels_, conv_in_height_, conv_in_width_,
@@ -109,8 +191,12 @@ class BaseConvolutionLayer : public Layer<Dtype> {
   int weight_offset_;
   int col_offset_;
   int output_offset_;
+  int conv_out_height_, conv_out_width_;
+  // workspace elements used by each thread of the minibatch helpers, and
+  // the start of the workspace while they run
+  size_t thread_buffer_size_;
+  Dtype* thread_buffers_;
 
-  static Blob<Dtype> *col_buffer_;
   Blob<Dtype> bias_multiplier_;
 };
 
@@ -180,6 +266,12 @@ class ConvolutionLayer : public BaseConvolutionLayer<Dtype> {
 };
 
 
+/**
+ * @brief Convolves the active pixels of an image only. bottom[1] and
+ *        bottom[2] are the mask map and region index MaskLayer emits; the
+ *        optional bottom[3], of the shape of the dense output, is added to
+ *        it with the eltwise_param coefficients as RegionSumLayer would.
+ */
 template <typename Dtype>
 class RegionConvolutionLayer : public Layer<Dtype> {
  public:
@@ -192,7 +284,8 @@ class RegionConvolutionLayer : public Layer<Dtype> {
   virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top);
 
-  virtual inline int ExactNumBottomBlobs() const { return 3; }
+  virtual inline int MinBottomBlobs() const { return 3; }
+  virtual inline int MaxBottomBlobs() const { return 4; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
 
   virtual inline const char* type() const { return "RegionConvolution"; }
@@ -231,10 +324,18 @@ class RegionConvolutionLayer : public Layer<Dtype> {
   bool input_compression_;
   bool output_compression_;
 
-  static Blob<Dtype> *col_buffer_;
-  static Blob<Dtype> *top_buffer_;
+  // offset of the output buffer behind the im2col buffer in the workspace
+  int top_buffer_offset_;
+  // the active pixels unrolled at a time on CPU, and the offset of the
+  // buffer their output passes through when that is not all of them
+  int chunk_pixels_;
+  int chunk_buffer_offset_;
   Blob<Dtype> bias_multiplier_;
-  
+  int num_threads_;
+
+  // whether bottom[3] is summed with the output, and its coefficients
+  bool fuse_sum_;
+  Dtype sum_op1_, sum_op2_;
 };
 
 /**
@@ -272,6 +373,67 @@ class DeconvolutionLayer : public BaseConvolutionLayer<Dtype> {
   virtual void compute_output_shape();
 };
 
+/**
+ * @brief Winograd implementation of ConvolutionLayer for 3x3, stride 1
+ *        filters. Falls back to ConvolutionLayer for GPU mode.
+ *
+ * Every m x m output tile is computed with the minimal filtering algorithm
+ * F(m x m, 3 x 3), which needs (m + 2)^2 multiplies per filter instead of
+ * 9 m^2: 2.25x fewer for m = 2 and 4x fewer for m = 4, the latter at some
+ * cost in precision (ConvolutionParameter.winograd_tile). The products of
+ * all tiles, filters and channels are batched into one gemm per element of
+ * the transformed tiles.
+ *
+ * The transformed filters are cached and only recomputed once the weights
+ * have been modified, e.g. by Blob::Update.
+ */
+template <typename Dtype>
+class WinogradConvolutionLayer : public ConvolutionLayer<Dtype> {
+ public:
+  explicit WinogradConvolutionLayer(const LayerParameter& param)
+      : ConvolutionLayer<Dtype>(param), cached_weights_(NULL),
+        cached_version_(0) {}
+  virtual void LayerSetUp(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Reshape(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+
+ protected:
+  virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
+      const vector<Blob<Dtype>*>& top);
+  virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
+      const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+
+  // Transforms the filters unless the cached ones are still current.
+  void transform_weights();
+  // Transforms the tiles of one group of one image to and from the Winograd
+  // domain, laid out (alpha^2, channels, tiles).
+  void transform_input(const Dtype* input, Dtype* tiles);
+  void transform_output_diff(const Dtype* output_diff, Dtype* tiles);
+  void inverse_output(const Dtype* tiles, Dtype* output);
+  void inverse_input_diff(const Dtype* tiles, Dtype* input_diff);
+  // the part of the passes run by one thread on images [begin, end)
+  void forward_images(const Dtype* input, const Dtype* weights,
+      const Dtype* bias, Dtype* output, int thread_id, int begin, int end);
+  void backward_images(const Dtype* input, const Dtype* output_diff,
+      const Dtype* weights, Dtype* input_diff, bool weight_gradient,
+      int thread_id, int begin, int end);
+
+  int tile_, alpha_;
+  int tiles_h_, tiles_w_;
+  // the transforms B^T, G, A^T and their transposes
+  vector<Dtype> bt_, g_, at_;
+  vector<Dtype> b_, gt_, a_;
+  // the filters in the Winograd domain, (group, alpha^2, output channels,
+  // input channels), and the version of the weights they came from
+  Blob<Dtype> transformed_weights_;
+  const SyncedMemory* cached_weights_;
+  unsigned int cached_version_;
+  // workspace elements used by each thread, and the start of the workspace
+  size_t winograd_buffer_size_;
+  Dtype* winograd_buffers_;
+};
+
 #ifdef USE_CUDNN
 /*
  * @brief cuDNN implementation of ConvolutionLayer.
@@ -437,6 +599,14 @@ class LRNLayer : public Layer<Dtype> {
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   virtual void WithinChannelBackward(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+  // The cross channel passes over the images [begin, end), a tile of
+  // positions at a time.
+  void cross_channel_forward_images(const Dtype* bottom_data,
+      Dtype* scale_data, Dtype* top_data, int thread_id, int begin, int end);
+  void cross_channel_backward_images(const Dtype* top_diff,
+      const Dtype* top_data, const Dtype* bottom_data,
+      const Dtype* scale_data, Dtype* bottom_diff, int thread_id, int begin,
+      int end);
 
   int size_;
   int pre_pad_;
@@ -447,6 +617,7 @@ class LRNLayer : public Layer<Dtype> {
   int channels_;
   int height_;
   int width_;
+  int num_threads_;
 
   // Fields used for normalization ACROSS_CHANNELS
   // scale_ stores the intermediate summing results
@@ -496,6 +667,10 @@ class PoolingLayer : public Layer<Dtype> {
     return (this->layer_param_.pooling_param().pool() ==
             PoolingParameter_PoolMethod_MAX) ? 2 : 1;
   }
+  // only the mask top is read back in Backward
+  virtual inline bool BackwardUsesTopData(int top_id) const {
+    return top_id > 0;
+  }
 
  protected:
   virtual void Forward_cpu(const vector<Blob<Dtype>*>& bottom,
@@ -507,6 +682,24 @@ class PoolingLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+  // The CPU passes over the (num, channel) planes [begin, end), split over
+  // threads by caffe_parallel_for. Max pooling records its argmax in
+  // whichever of top_mask, mask and offsets is given; stochastic pooling
+  // samples with the thresholds in rand_idx, or takes the weighted average
+  // at test time when it is NULL, and goes backward like max pooling.
+  void max_forward_planes(const Dtype* bottom_data, Dtype* top_data,
+      Dtype* top_mask, int* mask, unsigned char* offsets, int thread_id,
+      int begin, int end);
+  void ave_forward_planes(const Dtype* bottom_data, Dtype* top_data,
+      int thread_id, int begin, int end);
+  void sto_forward_planes(const Dtype* bottom_data, Dtype* rand_idx,
+      Dtype* top_data, int thread_id, int begin, int end);
+  void max_backward_planes(const Dtype* top_diff, const Dtype* top_mask,
+      const int* mask, const unsigned char* offsets, Dtype* bottom_diff,
+      int thread_id, int begin, int end);
+  void ave_backward_planes(const Dtype* top_diff, Dtype* bottom_diff,
+      int thread_id, int begin, int end);
+
   int kernel_h_, kernel_w_;
   int stride_h_, stride_w_;
   int pad_h_, pad_w_;
@@ -514,8 +707,13 @@ class PoolingLayer : public Layer<Dtype> {
   int height_, width_;
   int pooled_height_, pooled_width_;
   bool global_pooling_;
+  int num_threads_;
   Blob<Dtype> rand_idx_;
   Blob<int> max_idx_;
+  // On CPU, windows of at most 256 elements keep the argmax as its offset
+  // within the window, a byte per output, in place of max_idx_.
+  bool compact_mask_;
+  shared_ptr<SyncedMemory> max_offset_;
 };
 
 #ifdef USE_CUDNN
@@ -536,6 +734,8 @@ class CuDNNPoolingLayer : public PoolingLayer<Dtype> {
   // Currently, cuDNN does not support the extra top blob.
   virtual inline int MinTopBlobs() const { return -1; }
   virtual inline int ExactNumTopBlobs() const { return 1; }
+  // cuDNN reads the pooled outputs back in Backward
+  virtual inline bool BackwardUsesTopData(int top_id) const { return true; }
 
  protected:
   virtual void Forward_gpu(const vector<Blob<Dtype>*>& bottom,
@@ -646,6 +846,15 @@ class SPPLayer : public Layer<Dtype> {
                                   const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
         virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
                                   const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
+        // Max pools the ROIs [begin, end).
+        void forward_rois(const Dtype* bottom_data, const int batch_size,
+                          const Dtype* bottom_rois, Dtype* top_data, int* argmax_data,
+                          int thread_id, int begin, int end);
+        // Routes the top diff of all the ROIs to the channels [begin, end)
+        // of the bottom diff.
+        void backward_channels(const Dtype* top_diff, const Dtype* bottom_rois,
+                               const int num_rois, const int* argmax_data, Dtype* bottom_diff,
+                               int thread_id, int begin, int end);
 
         int channels_;
         int height_;
@@ -653,13 +862,20 @@ class SPPLayer : public Layer<Dtype> {
         int pooled_height_;
         int pooled_width_;
         Dtype spatial_scale_;
+        int num_threads_;
         Blob<int> max_idx_;
     };
 
 
   /**
-   * @brief Tests whether the input exceeds a threshold: outputs 1 for inputs
-   *        above threshold; 0 otherwise.
+   * @brief Selects the pixels no class is confident about, i.e. whose
+   *        probabilities stay at or below the threshold.
+   *
+   * top[0] maps each pixel to its column in the compressed layout, or -1;
+   * top[1] is the region index of the selected pixels (see
+   * util/region_index.hpp); the optional top[2] holds their count. An image
+   * left with fewer than mask_param.exit_fraction of its pixels selects
+   * none, so that the later stages of a cascade skip it.
    */
   template <typename Dtype>
   class MaskLayer : public Layer<Dtype> {
@@ -693,11 +909,24 @@ class SPPLayer : public Layer<Dtype> {
     virtual void Backward_cpu(const vector<Blob<Dtype>*>& top,
         const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
 
+    /// CPU workers over the tiles [begin, end) of pixels of the batch.
+    void select_tiles(const Dtype* prob, const Dtype* prev_mask,
+        const Dtype* label, int thread_id, int begin, int end);
+    void scatter_tiles(Dtype* mask, int* index, const int index_stride,
+        int thread_id, int begin, int end);
+
     Dtype threshold_;
     bool prev_mask_;
     int ignore_label_;
+    float exit_fraction_;
     int spatial_dim_;
     int num_;
+    int channels_;
+    int tiles_;
+    int num_threads_;
+    /// whether each pixel is selected, and the first column of each tile
+    vector<unsigned char> keep_;
+    vector<int> tile_start_;
   };
 
 
@@ -738,6 +967,7 @@ class InterpLayer : public Layer<Dtype> {
   int pad_beg_, pad_end_;
   int height_in_eff_, width_in_eff_;
   string interp_type_;
+  int num_threads_;
 };
 
 
@@ -746,10 +976,12 @@ template <typename Dtype>
 class WarpingLayer : public Layer<Dtype> {
  public:
   /**
-   * @param param provides ThresholdParameter threshold_param,
-   *     with ThresholdLayer options:
-   *   - threshold (\b optional, default 0).
-   *     the threshold value @f$ t @f$ to which the input values are compared.
+   * @brief Warps bottom[0] along the flow bottom[1], whose channels are the
+   *        (w, h) displacements: each output pixel bilinearly samples the
+   *        input at its own position plus the flow, clamped to the image.
+   *
+   * @param param provides WarpingParameter warping_param, with options:
+   *   - num_threads (\b optional, default 1). CPU only.
    */
   explicit WarpingLayer(const LayerParameter& param)
       : Layer<Dtype>(param) {}
@@ -775,10 +1007,28 @@ class WarpingLayer : public Layer<Dtype> {
   virtual void Backward_gpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom);
   
+  /// CPU workers: over the rows [begin, end) of the batch, or the
+  /// (image, channel) planes for backward_data_planes.
+  void compute_taps(const Dtype* flow_data, int thread_id, int begin,
+      int end);
+  void forward_rows(const Dtype* bottom_data, Dtype* top_data,
+      int thread_id, int begin, int end);
+  void backward_data_planes(const Dtype* top_diff, Dtype* bottom_diff,
+      int thread_id, int begin, int end);
+  void backward_flow_rows(const Dtype* top_diff, const Dtype* bottom_data,
+      Dtype* flow_diff, int thread_id, int begin, int end);
+
   int num_, channels_, height_, width_;
   int spatial_dim_, edge_cnt_;
 
   Blob<Dtype> head_, edge_;
+
+  /// the four bilinear taps of each pixel of the batch, computed once by
+  /// Forward_cpu and shared by all channels: the source pixels (top-left,
+  /// bottom-left, top-right, bottom-right) and their weights
+  vector<int> tap_index_;
+  vector<Dtype> tap_weight_;
+  int num_threads_;
 };
 
 
@@ -0,0 +1,58 @@
+#ifndef CAFFE_WORKSPACE_HPP_
+#define CAFFE_WORKSPACE_HPP_
+
+#include "caffe/common.hpp"
+#include "caffe/syncedmem.hpp"
+
+namespace caffe {
+
+/**
+ * @brief Scratch memory shared by the layers of one net.
+ *
+ * Layers announce the scratch size they need in Reshape() through Reserve()
+ * and fetch the buffer when they run, so the region is reused by every layer
+ * of the net and only grows to the largest single request. A Net owns one
+ * workspace and is driven by a single thread; layers used outside of a Net
+ * fall back to a workspace private to the calling thread. The contents are
+ * not preserved across layers.
+ */
+class Workspace {
+ public:
+  /// @param limit the maximum size in bytes, or 0 for no limit.
+  explicit Workspace(size_t limit = 0)
+      : mem_(new SyncedMemory()), reserved_(0), limit_(limit) {}
+
+  /// @brief Makes sure the workspace holds at least the given bytes.
+  void Reserve(size_t bytes);
+  /// @brief Frees the memory; it is reallocated lazily on next use.
+  void Release();
+
+  /// @brief Returns the buffer as Dtype, starting at the given element.
+  template <typename Dtype>
+  inline Dtype* mutable_cpu_data(size_t offset = 0) {
+    return static_cast<Dtype*>(mem_->mutable_cpu_data()) + offset;
+  }
+  template <typename Dtype>
+  inline Dtype* mutable_gpu_data(size_t offset = 0) {
+    return static_cast<Dtype*>(mem_->mutable_gpu_data()) + offset;
+  }
+
+  /// @brief the largest request so far, i.e. the peak scratch memory
+  inline size_t size() const { return reserved_; }
+  inline size_t limit() const { return limit_; }
+  inline void set_limit(size_t limit) { limit_ = limit; }
+
+  /// @brief Returns the default workspace of the calling thread.
+  static Workspace* ThreadLocal();
+
+ private:
+  shared_ptr<SyncedMemory> mem_;
+  size_t reserved_;
+  size_t limit_;
+
+  DISABLE_COPY_AND_ASSIGN(Workspace);
+};  // class Workspace
+
+}  // namespace caffe
+
+#endif  // CAFFE_WORKSPACE_HPP_
@@ -38,6 +38,9 @@ shared_ptr<Layer<Dtype> > GetConvolutionLayer(
   }
   if (engine == ConvolutionParameter_Engine_CAFFE) {
     return shared_ptr<Layer<Dtype> >(new ConvolutionLayer<Dtype>(param));
+  } else if (engine == ConvolutionParameter_Engine_WINOGRAD) {
+    return shared_ptr<Layer<Dtype> >(
+        new WinogradConvolutionLayer<Dtype>(param));
 #ifdef USE_CUDNN
   } else if (engine == ConvolutionParameter_Engine_CUDNN) {
     return shared_ptr<Layer<Dtype> >(new CuDNNConvolutionLayer<Dtype>(param));
@@ -179,7 +182,10 @@ shared_ptr<Layer<Dtype> > GetBNLayer(const LayerParameter& param) {
     engine = BNParameter_Engine_CAFFE;
 #if defined(USE_CUDNN)
 #if CUDNN_VERSION_MIN(5, 0, 0)
-     engine = BNParameter_Engine_CUDNN;
+    // cuDNN has no fused ReLU
+    if (!param.bn_param().relu()) {
+      engine = BNParameter_Engine_CUDNN;
+    }
 #endif
 #endif
   }
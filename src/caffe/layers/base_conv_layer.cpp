@@ -1,16 +1,24 @@
+#include <algorithm>
 #include <vector>
 
+#include "boost/bind/bind.hpp"
+
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
+#include "caffe/util/conv_direct.hpp"
 #include "caffe/util/im2col.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
-template <typename Dtype>
-Blob<Dtype>* BaseConvolutionLayer<Dtype>::col_buffer_ = new Blob<Dtype>();
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
 
+// The most channels per group, on either side, that are convolved directly.
+static const int kMaxDirectGroupChannels = 4;
 
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
@@ -108,6 +116,11 @@ void BaseConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   }
   // Propagate gradients to the parameters (as directed by backward pass).
   this->param_propagate_down_.resize(this->blobs_.size(), true);
+  // Configure the splitting of the minibatch on CPU.
+  num_threads_ = conv_param.num_threads() ? conv_param.num_threads()
+      : caffe_hardware_threads();
+  batch_im2col_ = conv_param.batch_im2col();
+  CHECK_GT(batch_im2col_, 0) << "batch_im2col must be positive.";
 }
 
 template <typename Dtype>
@@ -138,25 +151,70 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   if (reverse_dimensions()) {
     conv_in_height_ = height_out_;
     conv_in_width_ = width_out_;
-    conv_out_spatial_dim_ = height_ * width_;
+    conv_out_height_ = height_;
+    conv_out_width_ = width_;
   } else {
     conv_in_height_ = height_;
     conv_in_width_ = width_;
-    conv_out_spatial_dim_ = height_out_ * width_out_;
+    conv_out_height_ = height_out_;
+    conv_out_width_ = width_out_;
   }
+  conv_out_spatial_dim_ = conv_out_height_ * conv_out_width_;
   kernel_dim_ = conv_in_channels_ * kernel_h_ * kernel_w_;
   weight_offset_ = conv_out_channels_ * kernel_dim_ / group_ / group_;
   col_offset_ = kernel_dim_ * conv_out_spatial_dim_ / group_;
   output_offset_ = conv_out_channels_ * conv_out_spatial_dim_ / group_;
-  // The im2col result buffer will only hold one image at a time to avoid
-  // overly large memory usage. In the special case of 1x1 convolution
-  // it goes lazily unused to save memory.
-  if (reverse_dimensions()) {
-    if (col_buffer_->count() < kernel_dim_ * height_ * width_)
-      col_buffer_->Reshape(1, kernel_dim_, height_, width_);
-  } else {
-    if (col_buffer_->count() < kernel_dim_ * height_out_ * width_out_)
-      col_buffer_->Reshape(1, kernel_dim_, height_out_, width_out_);
+  // Depthwise and other convolutions with few channels per group would
+  // issue gemms of a few rows over the full column buffer, so convolve them
+  // directly instead.
+  direct_ = group_ > 1 && !is_1x1_
+      && conv_in_channels_ / group_ <= kMaxDirectGroupChannels
+      && conv_out_channels_ / group_ <= kMaxDirectGroupChannels;
+  // Dilated kernels reach far apart, so their column buffer is both large
+  // and poorly cached. Unroll them im2col_band output pixels at a time.
+  const int band_size = this->layer_param_.convolution_param().im2col_band();
+  band_rows_ = conv_out_height_;
+  if (!direct_ && band_size > 0 && (dilation_h_ > 1 || dilation_w_ > 1)) {
+    band_rows_ = std::min(conv_out_height_,
+        std::max(1, band_size / conv_out_width_));
+  }
+  banded_ = band_rows_ < conv_out_height_;
+  // The im2col result buffer will only hold batch_im2col_ images per thread
+  // at a time to avoid overly large memory usage, along with the batched
+  // output when there are several. It lives in the workspace shared by the
+  // layers of the net, followed by the weight gradients of all threads but
+  // the first. In the special cases of direct convolution and 1x1
+  // convolution of single images it goes unused to save memory. Banded
+  // convolutions only hold one band of a single image and its output.
+  // Under a workspace limit, unroll fewer images at a time, then split over
+  // fewer threads, and last unroll single images in smaller bands.
+  batch_im2col_ = this->layer_param_.convolution_param().batch_im2col();
+  cpu_threads_ = std::max(1, std::min(num_threads_, num_));
+  const size_t limit = this->workspace()->limit() / sizeof(Dtype);
+  size_t workspace_size = cpu_buffer_size();
+  while (limit > 0 && workspace_size > limit) {
+    if (batch_im2col_ > 1) {
+      batch_im2col_ /= 2;
+    } else if (cpu_threads_ > 1) {
+      --cpu_threads_;
+    } else if (!direct_ && band_rows_ > 1) {
+      band_rows_ = (band_rows_ + 1) / 2;
+      banded_ = true;
+    } else {
+      break;
+    }
+    workspace_size = cpu_buffer_size();
+  }
+#ifndef CPU_ONLY
+  // The GPU path has no direct or banded kernels and always unrolls whole
+  // images.
+  if (Caffe::mode() == Caffe::GPU && !is_1x1_) {
+    workspace_size = std::max(workspace_size,
+        static_cast<size_t>(kernel_dim_) * conv_out_spatial_dim_);
+  }
+#endif
+  if (workspace_size > 0) {
+    this->workspace()->Reserve(sizeof(Dtype) * workspace_size);
   }
   // Set up the all ones "bias multiplier" for adding biases by BLAS
   if (bias_term_) {
@@ -167,15 +225,44 @@ void BaseConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
+template <typename Dtype>
+size_t BaseConvolutionLayer<Dtype>::cpu_buffer_size() {
+  const size_t cols = batch_im2col_ * conv_out_spatial_dim_;
+  thread_buffer_size_ = 0;
+  if (banded_) {
+    thread_buffer_size_ = (kernel_dim_ + conv_out_channels_)
+        * band_rows_ * conv_out_width_;
+  } else if (!direct_) {
+    if (!is_1x1_ || batch_im2col_ > 1) {
+      thread_buffer_size_ += kernel_dim_ * cols;
+    }
+    if (batch_im2col_ > 1) {
+      thread_buffer_size_ += conv_out_channels_ * cols;
+    }
+  }
+  return thread_buffer_size_ * cpu_threads_
+      + (cpu_threads_ - 1) * this->blobs_[0]->count();
+}
+
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::forward_cpu_gemm(const Dtype* input,
     const Dtype* weights, Dtype* output, bool skip_im2col) {
+  if (direct_) {
+    direct_forward_cpu(input, weights, output);
+    return;
+  }
+  if (banded_) {
+    forward_cpu_banded(input, weights, output,
+        this->workspace()->template mutable_cpu_data<Dtype>());
+    return;
+  }
   const Dtype* col_buff = input;
   if (!is_1x1_) {
+    Dtype* col_buffer = this->workspace()->template mutable_cpu_data<Dtype>();
     if (!skip_im2col) {
-      conv_im2col_cpu(input, col_buffer_->mutable_cpu_data());
+      conv_im2col_cpu(input, col_buffer);
     }
-    col_buff = col_buffer_->cpu_data();
+    col_buff = col_buffer;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
@@ -196,9 +283,18 @@ void BaseConvolutionLayer<Dtype>::forward_cpu_bias(Dtype* output,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
     const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_->mutable_cpu_data();
-  if (is_1x1_) {
-    col_buff = input;
+  if (direct_) {
+    direct_backward_cpu(output, weights, input);
+    return;
+  }
+  if (banded_) {
+    backward_cpu_banded(output, weights, input,
+        this->workspace()->template mutable_cpu_data<Dtype>());
+    return;
+  }
+  Dtype* col_buff = input;
+  if (!is_1x1_) {
+    col_buff = this->workspace()->template mutable_cpu_data<Dtype>();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_ / group_,
@@ -214,10 +310,20 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_gemm(const Dtype* output,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::weight_cpu_gemm(const Dtype* input,
     const Dtype* output, Dtype* weights) {
+  if (direct_) {
+    direct_weight_cpu(input, output, weights);
+    return;
+  }
+  if (banded_) {
+    weight_cpu_banded(input, output, weights,
+        this->workspace()->template mutable_cpu_data<Dtype>());
+    return;
+  }
   const Dtype* col_buff = input;
   if (!is_1x1_) {
-    conv_im2col_cpu(input, col_buffer_->mutable_cpu_data());
-    col_buff = col_buffer_->cpu_data();
+    Dtype* col_buffer = this->workspace()->template mutable_cpu_data<Dtype>();
+    conv_im2col_cpu(input, col_buffer);
+    col_buff = col_buffer;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
@@ -234,6 +340,277 @@ void BaseConvolutionLayer<Dtype>::backward_cpu_bias(Dtype* bias,
       input, bias_multiplier_.cpu_data(), 1., bias);
 }
 
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_banded(const Dtype* input,
+    const Dtype* weights, Dtype* output, Dtype* buffer) {
+  for (int row = 0; row < conv_out_height_; row += band_rows_) {
+    const int row_end = std::min(conv_out_height_, row + band_rows_);
+    const int cols = (row_end - row) * conv_out_width_;
+    Dtype* output_band = buffer + kernel_dim_ * cols;
+    conv_im2col_rows_cpu(input, row, row_end, buffer);
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
+          group_, cols, kernel_dim_ / group_,
+          (Dtype)1., weights + weight_offset_ * g,
+          buffer + kernel_dim_ / group_ * cols * g,
+          (Dtype)0., output_band + conv_out_channels_ / group_ * cols * g);
+    }
+    // Scatter the band back into the rows of each output channel.
+    for (int c = 0; c < conv_out_channels_; ++c) {
+      std::copy(output_band + c * cols, output_band + (c + 1) * cols,
+          output + c * conv_out_spatial_dim_ + row * conv_out_width_);
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_banded(const Dtype* output,
+    const Dtype* weights, Dtype* input, Dtype* buffer) {
+  caffe_set(conv_in_channels_ * conv_in_height_ * conv_in_width_, Dtype(0),
+      input);
+  for (int row = 0; row < conv_out_height_; row += band_rows_) {
+    const int row_end = std::min(conv_out_height_, row + band_rows_);
+    const int cols = (row_end - row) * conv_out_width_;
+    Dtype* output_band = buffer + kernel_dim_ * cols;
+    for (int c = 0; c < conv_out_channels_; ++c) {
+      const Dtype* output_row =
+          output + c * conv_out_spatial_dim_ + row * conv_out_width_;
+      std::copy(output_row, output_row + cols, output_band + c * cols);
+    }
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_ / group_,
+          cols, conv_out_channels_ / group_,
+          (Dtype)1., weights + weight_offset_ * g,
+          output_band + conv_out_channels_ / group_ * cols * g,
+          (Dtype)0., buffer + kernel_dim_ / group_ * cols * g);
+    }
+    conv_col2im_rows_cpu(buffer, row, row_end, input);
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::weight_cpu_banded(const Dtype* input,
+    const Dtype* output, Dtype* weights, Dtype* buffer) {
+  for (int row = 0; row < conv_out_height_; row += band_rows_) {
+    const int row_end = std::min(conv_out_height_, row + band_rows_);
+    const int cols = (row_end - row) * conv_out_width_;
+    Dtype* output_band = buffer + kernel_dim_ * cols;
+    conv_im2col_rows_cpu(input, row, row_end, buffer);
+    for (int c = 0; c < conv_out_channels_; ++c) {
+      const Dtype* output_row =
+          output + c * conv_out_spatial_dim_ + row * conv_out_width_;
+      std::copy(output_row, output_row + cols, output_band + c * cols);
+    }
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans,
+          conv_out_channels_ / group_, kernel_dim_ / group_, cols,
+          (Dtype)1., output_band + conv_out_channels_ / group_ * cols * g,
+          buffer + kernel_dim_ / group_ * cols * g,
+          (Dtype)1., weights + weight_offset_ * g);
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_minibatch(const Dtype* input,
+    const Dtype* weights, const Dtype* bias, Dtype* output) {
+  thread_buffers_ = NULL;
+  if (thread_buffer_size_ > 0) {
+    thread_buffers_ = this->workspace()->template mutable_cpu_data<Dtype>();
+  }
+  caffe_parallel_for(num_, cpu_threads(), boost::bind(
+      &BaseConvolutionLayer<Dtype>::forward_cpu_images, this,
+      input, weights, bias, output, _1, _2, _3));
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_minibatch(const Dtype* input,
+    const Dtype* output_diff, const Dtype* weights, Dtype* weights_diff,
+    Dtype* input_diff) {
+  const int threads = cpu_threads();
+  thread_buffers_ = NULL;
+  if (thread_buffer_size_ > 0 || threads > 1) {
+    thread_buffers_ = this->workspace()->template mutable_cpu_data<Dtype>();
+  }
+  const int ranges = caffe_parallel_for(num_, threads, boost::bind(
+      &BaseConvolutionLayer<Dtype>::backward_cpu_images, this,
+      input, output_diff, weights, weights_diff, input_diff, _1, _2, _3));
+  // Reduce the weight gradients of the other threads into the first one.
+  // Only the threads that ran have cleared theirs: a call made from inside
+  // another parallel loop runs as a single range.
+  if (weights_diff) {
+    const int count = this->blobs_[0]->count();
+    const Dtype* thread_weights_diff =
+        thread_buffers_ + threads * thread_buffer_size_;
+    for (int t = 1; t < ranges; ++t, thread_weights_diff += count) {
+      caffe_axpy<Dtype>(count, Dtype(1), thread_weights_diff, weights_diff);
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::forward_cpu_images(const Dtype* input,
+    const Dtype* weights, const Dtype* bias, Dtype* output,
+    int thread_id, int begin, int end) {
+  const int input_dim = conv_in_channels_ * conv_in_height_ * conv_in_width_;
+  const int output_dim = conv_out_channels_ * conv_out_spatial_dim_;
+  const bool unroll = !is_1x1_ || batch_im2col_ > 1;
+  Dtype* col_buffer = thread_buffers_ + thread_id * thread_buffer_size_;
+  Dtype* output_buffer =
+      col_buffer + kernel_dim_ * batch_im2col_ * conv_out_spatial_dim_;
+  if (direct_) {
+    for (int n = begin; n < end; ++n) {
+      direct_forward_cpu(input + n * input_dim, weights,
+          output + n * output_dim);
+      if (bias) {
+        forward_cpu_bias(output + n * output_dim, bias);
+      }
+    }
+    return;
+  }
+  if (banded_) {
+    for (int n = begin; n < end; ++n) {
+      forward_cpu_banded(input + n * input_dim, weights,
+          output + n * output_dim, col_buffer);
+      if (bias) {
+        forward_cpu_bias(output + n * output_dim, bias);
+      }
+    }
+    return;
+  }
+  for (int n = begin; n < end; n += batch_im2col_) {
+    const int batch = std::min(batch_im2col_, end - n);
+    const int cols = batch * conv_out_spatial_dim_;
+    // Unroll the images side by side: column block b belongs to image n + b.
+    const Dtype* col_buff = input + n * input_dim;
+    if (unroll) {
+      for (int b = 0; b < batch; ++b) {
+        conv_im2col_cpu(input + (n + b) * input_dim,
+            col_buffer + b * conv_out_spatial_dim_, cols);
+      }
+      col_buff = col_buffer;
+    }
+    Dtype* output_buff = (batch > 1) ? output_buffer : output + n * output_dim;
+    for (int g = 0; g < group_; ++g) {
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
+          group_, cols, kernel_dim_ / group_,
+          (Dtype)1., weights + weight_offset_ * g,
+          col_buff + col_offset_ * batch * g,
+          (Dtype)0., output_buff + output_offset_ * batch * g);
+    }
+    for (int b = 0; b < batch; ++b) {
+      Dtype* image_output = output + (n + b) * output_dim;
+      if (batch > 1) {
+        for (int c = 0; c < conv_out_channels_; ++c) {
+          const Dtype* row = output_buff + c * cols + b * conv_out_spatial_dim_;
+          std::copy(row, row + conv_out_spatial_dim_,
+              image_output + c * conv_out_spatial_dim_);
+        }
+      }
+      if (bias) {
+        forward_cpu_bias(image_output, bias);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void BaseConvolutionLayer<Dtype>::backward_cpu_images(const Dtype* input,
+    const Dtype* output_diff, const Dtype* weights, Dtype* weights_diff,
+    Dtype* input_diff, int thread_id, int begin, int end) {
+  const int input_dim = conv_in_channels_ * conv_in_height_ * conv_in_width_;
+  const int output_dim = conv_out_channels_ * conv_out_spatial_dim_;
+  const bool unroll = !is_1x1_ || batch_im2col_ > 1;
+  Dtype* col_buffer = thread_buffers_ + thread_id * thread_buffer_size_;
+  Dtype* output_buffer =
+      col_buffer + kernel_dim_ * batch_im2col_ * conv_out_spatial_dim_;
+  // All threads but the first accumulate their weight gradient separately.
+  if (weights_diff && thread_id > 0) {
+    const int count = this->blobs_[0]->count();
+    weights_diff = thread_buffers_ + cpu_threads() * thread_buffer_size_
+        + (thread_id - 1) * count;
+    caffe_set(count, Dtype(0), weights_diff);
+  }
+  if (direct_) {
+    for (int n = begin; n < end; ++n) {
+      if (weights_diff) {
+        direct_weight_cpu(input + n * input_dim, output_diff + n * output_dim,
+            weights_diff);
+      }
+      if (input_diff) {
+        direct_backward_cpu(output_diff + n * output_dim, weights,
+            input_diff + n * input_dim);
+      }
+    }
+    return;
+  }
+  if (banded_) {
+    for (int n = begin; n < end; ++n) {
+      if (weights_diff) {
+        weight_cpu_banded(input + n * input_dim, output_diff + n * output_dim,
+            weights_diff, col_buffer);
+      }
+      if (input_diff) {
+        backward_cpu_banded(output_diff + n * output_dim, weights,
+            input_diff + n * input_dim, col_buffer);
+      }
+    }
+    return;
+  }
+  for (int n = begin; n < end; n += batch_im2col_) {
+    const int batch = std::min(batch_im2col_, end - n);
+    const int cols = batch * conv_out_spatial_dim_;
+    // Gather the output gradients side by side like the unrolled inputs.
+    const Dtype* output_diff_buff = output_diff + n * output_dim;
+    if (batch > 1) {
+      for (int b = 0; b < batch; ++b) {
+        for (int c = 0; c < conv_out_channels_; ++c) {
+          const Dtype* row = output_diff + (n + b) * output_dim
+              + c * conv_out_spatial_dim_;
+          std::copy(row, row + conv_out_spatial_dim_,
+              output_buffer + c * cols + b * conv_out_spatial_dim_);
+        }
+      }
+      output_diff_buff = output_buffer;
+    }
+    // gradient w.r.t. weight. Note that we will accumulate diffs.
+    if (weights_diff) {
+      const Dtype* col_buff = input + n * input_dim;
+      if (unroll) {
+        for (int b = 0; b < batch; ++b) {
+          conv_im2col_cpu(input + (n + b) * input_dim,
+              col_buffer + b * conv_out_spatial_dim_, cols);
+        }
+        col_buff = col_buffer;
+      }
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans,
+            conv_out_channels_ / group_, kernel_dim_ / group_, cols,
+            (Dtype)1., output_diff_buff + output_offset_ * batch * g,
+            col_buff + col_offset_ * batch * g,
+            (Dtype)1., weights_diff + weight_offset_ * g);
+      }
+    }
+    // gradient w.r.t. bottom data, if necessary.
+    if (input_diff) {
+      Dtype* col_buff = unroll ? col_buffer : input_diff + n * input_dim;
+      for (int g = 0; g < group_; ++g) {
+        caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_ / group_,
+            cols, conv_out_channels_ / group_,
+            (Dtype)1., weights + weight_offset_ * g,
+            output_diff_buff + output_offset_ * batch * g,
+            (Dtype)0., col_buff + col_offset_ * batch * g);
+      }
+      if (unroll) {
+        for (int b = 0; b < batch; ++b) {
+          conv_col2im_cpu(col_buffer + b * conv_out_spatial_dim_,
+              input_diff + (n + b) * input_dim, cols);
+        }
+      }
+    }
+  }
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
@@ -241,10 +618,11 @@ void BaseConvolutionLayer<Dtype>::forward_gpu_gemm(const Dtype* input,
     const Dtype* weights, Dtype* output, bool skip_im2col) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
+    Dtype* col_buffer = this->workspace()->template mutable_gpu_data<Dtype>();
     if (!skip_im2col) {
-      conv_im2col_gpu(input, col_buffer_->mutable_gpu_data());
+      conv_im2col_gpu(input, col_buffer);
     }
-    col_buff = col_buffer_->gpu_data();
+    col_buff = col_buffer;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_ /
@@ -265,9 +643,9 @@ void BaseConvolutionLayer<Dtype>::forward_gpu_bias(Dtype* output,
 template <typename Dtype>
 void BaseConvolutionLayer<Dtype>::backward_gpu_gemm(const Dtype* output,
     const Dtype* weights, Dtype* input) {
-  Dtype* col_buff = col_buffer_->mutable_gpu_data();
-  if (is_1x1_) {
-    col_buff = input;
+  Dtype* col_buff = input;
+  if (!is_1x1_) {
+    col_buff = this->workspace()->template mutable_gpu_data<Dtype>();
   }
   for (int g = 0; g < group_; ++g) {
     caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_ / group_,
@@ -285,8 +663,9 @@ void BaseConvolutionLayer<Dtype>::weight_gpu_gemm(const Dtype* input,
     const Dtype* output, Dtype* weights) {
   const Dtype* col_buff = input;
   if (!is_1x1_) {
-    conv_im2col_gpu(input, col_buffer_->mutable_gpu_data());
-    col_buff = col_buffer_->gpu_data();
+    Dtype* col_buffer = this->workspace()->template mutable_gpu_data<Dtype>();
+    conv_im2col_gpu(input, col_buffer);
+    col_buff = col_buffer;
   }
   for (int g = 0; g < group_; ++g) {
     caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_ / group_,
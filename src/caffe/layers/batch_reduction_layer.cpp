@@ -1,14 +1,23 @@
 #include <algorithm>
 #include <cfloat>
+#include <cmath>
+#include <utility>
 #include <vector>
 #include <caffe/caffe.hpp>
 
+#include "boost/bind/bind.hpp"
+
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
 template <typename Dtype>
 void BatchReductionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -40,7 +49,11 @@ void BatchReductionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   if (op_ == ReductionParameter_ReductionOp_TOPK){
     CHECK(n_level <= 1)<<"For now top-k reduction only works with 1 level";
   }
+  k_ = this->layer_param_.batch_reduction_param().reduction_param().k();
 
+  const int num_threads =
+      this->layer_param_.batch_reduction_param().num_threads();
+  num_threads_ = num_threads ? num_threads : caffe_hardware_threads();
 }
 
 template <typename Dtype>
@@ -79,144 +92,182 @@ void BatchReductionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   //LOG_INFO<<num_<<" "<<step_;
   CHECK_EQ(step_ * num_ * levels_.size(), top[0]->count());
 
-  // will add these later
-  if (op_ == ReductionParameter_ReductionOp_SUMSQ || op_ == ReductionParameter_ReductionOp_ASUM){
-    NOT_IMPLEMENTED;
-  }
-
   ticks_blob_.Reshape(ticks_.size(), 1, 1, 1);
   Dtype* tick_data = ticks_blob_.mutable_cpu_data();
   for (int i = 0; i < levels_.size(); ++i){
     tick_data[i] = ticks_[i];
   }
 
-  // reshape idx blob in top-k case
+  // one selection flag per input in top-k case
   if (op_ == ReductionParameter_ReductionOp_TOPK){
-    argsort_idx_.Reshape(bottom[0]->shape());
+    CHECK_GE(k_, 1);
+    CHECK_LE(k_, ticks_[0]) << "k must not exceed the reduced dimension";
+    topk_mask_.resize(bottom[0]->count());
   }else{
-    argsort_idx_.Reshape(1,1,1,1);
+    topk_mask_.clear();
   }
 }
 
+// Orders by descending value, then ascending input index so that ties are
+// broken the same way whatever the selection algorithm does.
 template <typename Dtype>
-bool comparator( const std::pair<Dtype, int>& left, const std::pair<Dtype, int>& right){
-  return left.first >= right.first; // use descending order here
+bool topk_greater(const std::pair<Dtype, int>& left,
+    const std::pair<Dtype, int>& right) {
+  return left.first > right.first ||
+      (left.first == right.first && left.second < right.second);
 }
 
 template <typename Dtype>
 void BatchReductionLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-
+  // Every position of a step is reduced independently, so the positions
+  // are split over the threads.
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  Dtype* idx_data = argsort_idx_.mutable_cpu_data();
-
-
-  caffe_set(top[0]->count(), Dtype(0), top_data);
-
   if (op_ != ReductionParameter_ReductionOp_TOPK) {
-    for (int n = 0; n < num_; ++n) {
-      //printf(" levels: %d\n", levels_.size());
-      for (int l = 0; l < levels_.size(); ++l) {
-        int tick = ticks_[l];
-        Dtype coeff = (op_ == ReductionParameter_ReductionOp_MEAN) ? Dtype(1) / Dtype(tick) : Dtype(1);
-        for (int t = 0; t < tick; ++t) {
-          caffe_cpu_axpby(step_, coeff, bottom_data, Dtype(1), top_data);
-          int stride = (t == (tick -1))?1:tick+1;
-          bottom_data += (pos_)?step_*stride:step_;
-        }
-        top_data += step_;
-      }
-    }
-  }else {
-    int k = this->layer_param_.batch_reduction_param().reduction_param().k();
-    int tick = ticks_[0];
-
-    vector<std::pair<Dtype, int> > buffer;
-    buffer.resize(tick);
-
-
-    // num_ outer loops
     caffe_set(top[0]->count(), Dtype(0), top_data);
-    caffe_set(bottom[0]->count(), Dtype(0), idx_data);
-    for (int n = 0; n < num_; ++n) {
-      // step_ inner loops
-      for (int i = 0; i < step_; ++i) {
-        //fill data
-        for (int t = 0; t < tick; ++t){
-          buffer[t] = std::make_pair(bottom_data[t * step_ + i], t);
-        }
-        // perform sort
-        std::sort(buffer.begin(), buffer.end(), comparator<Dtype>);
-
-        // obtain output and index
-        Dtype accum = 0;
-        for (int k_out = 0; k_out < k; ++k_out){
-          std::pair<Dtype, int>& p = buffer[k_out];
-          accum += p.first;
-          idx_data[p.second*step_ + i] = k_out+1;
+    caffe_parallel_for(step_, num_threads_, boost::bind(
+        &BatchReductionLayer<Dtype>::forward_steps, this, bottom_data,
+        top_data, _1, _2, _3));
+  } else {
+    caffe_parallel_for(step_, num_threads_, boost::bind(
+        &BatchReductionLayer<Dtype>::forward_topk, this, bottom_data,
+        top_data, _1, _2, _3));
+  }
+}
+
+template <typename Dtype>
+void BatchReductionLayer<Dtype>::forward_steps(const Dtype* bottom_data,
+    Dtype* top_data, int thread_id, int begin, int end) {
+  const int len = end - begin;
+  bottom_data += begin;
+  top_data += begin;
+  for (int n = 0; n < num_; ++n) {
+    for (int l = 0; l < levels_.size(); ++l) {
+      int tick = ticks_[l];
+      Dtype coeff = (op_ == ReductionParameter_ReductionOp_MEAN) ? Dtype(1) / Dtype(tick) : Dtype(1);
+      for (int t = 0; t < tick; ++t) {
+        switch (op_) {
+        case ReductionParameter_ReductionOp_SUMSQ:
+          for (int j = 0; j < len; ++j) {
+            top_data[j] += bottom_data[j] * bottom_data[j];
+          }
+          break;
+        case ReductionParameter_ReductionOp_ASUM:
+          for (int j = 0; j < len; ++j) {
+            top_data[j] += std::fabs(bottom_data[j]);
+          }
+          break;
+        default:
+          caffe_axpy(len, coeff, bottom_data, top_data);
         }
-        // set top data
-        top_data[i] = accum / Dtype(k);
+        int stride = (t == (tick -1))?1:tick+1;
+        bottom_data += (pos_)?step_*stride:step_;
       }
       top_data += step_;
-      bottom_data += tick*step_;
-      idx_data += tick*step_;
-
     }
-
-
   }
+}
 
-
+template <typename Dtype>
+void BatchReductionLayer<Dtype>::forward_topk(const Dtype* bottom_data,
+    Dtype* top_data, int thread_id, int begin, int end) {
+  // Only the set of the k largest inputs matters, which nth_element finds
+  // in linear time instead of sorting all of them.
+  const int tick = ticks_[0];
+  vector<std::pair<Dtype, int> > buffer(tick);
+  for (int n = 0; n < num_; ++n) {
+    const Dtype* bottom_n = bottom_data + n * tick * step_;
+    unsigned char* mask_n = &topk_mask_[n * tick * step_];
+    for (int i = begin; i < end; ++i) {
+      for (int t = 0; t < tick; ++t) {
+        buffer[t] = std::make_pair(bottom_n[t * step_ + i], t);
+        mask_n[t * step_ + i] = 0;
+      }
+      std::nth_element(buffer.begin(), buffer.begin() + k_ - 1, buffer.end(),
+          topk_greater<Dtype>);
+      Dtype accum = 0;
+      for (int k_out = 0; k_out < k_; ++k_out) {
+        accum += buffer[k_out].first;
+        mask_n[buffer[k_out].second * step_ + i] = 1;
+      }
+      top_data[n * step_ + i] = accum / Dtype(k_);
+    }
+  }
 }
 
 template <typename Dtype>
 void BatchReductionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   if (!propagate_down[0]) { return; }
-  // Get bottom_data, if needed.
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Dtype* idx_data = argsort_idx_.mutable_cpu_data();
 
-  if (pos_){
-    caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
+  if (op_ != ReductionParameter_ReductionOp_TOPK) {
+    if (pos_){
+      caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
+    }
+    caffe_parallel_for(step_, num_threads_, boost::bind(
+        &BatchReductionLayer<Dtype>::backward_steps, this, top_diff,
+        bottom[0]->cpu_data(), bottom_diff, _1, _2, _3));
+  } else {
+    caffe_parallel_for(step_, num_threads_, boost::bind(
+        &BatchReductionLayer<Dtype>::backward_topk, this, top_diff,
+        bottom_diff, _1, _2, _3));
   }
+}
 
-  if (op_ != ReductionParameter_ReductionOp_TOPK) {
-    for (int i = 0; i < num_; ++i) {
-      for (int l = 0; l < levels_.size(); ++l) {
-        int tick = ticks_[l];
-        Dtype coeff = (op_ == ReductionParameter_ReductionOp_MEAN) ? Dtype(1) / Dtype(tick) : Dtype(1);
-        for (int t = 0; t < tick; ++t) {
-          caffe_cpu_axpby(step_, coeff, top_diff, Dtype(0), bottom_diff);
-          //offset bottom_data each input step
-          int stride = (t == (tick -1))?1:tick+1;
-          bottom_diff += (pos_)?step_*stride:step_;
+template <typename Dtype>
+void BatchReductionLayer<Dtype>::backward_steps(const Dtype* top_diff,
+    const Dtype* bottom_data, Dtype* bottom_diff, int thread_id, int begin,
+    int end) {
+  const int len = end - begin;
+  top_diff += begin;
+  bottom_data += begin;
+  bottom_diff += begin;
+  for (int i = 0; i < num_; ++i) {
+    for (int l = 0; l < levels_.size(); ++l) {
+      int tick = ticks_[l];
+      Dtype coeff = (op_ == ReductionParameter_ReductionOp_MEAN) ? Dtype(1) / Dtype(tick) : Dtype(1);
+      for (int t = 0; t < tick; ++t) {
+        switch (op_) {
+        case ReductionParameter_ReductionOp_SUMSQ:
+          for (int j = 0; j < len; ++j) {
+            bottom_diff[j] = 2 * bottom_data[j] * top_diff[j];
+          }
+          break;
+        case ReductionParameter_ReductionOp_ASUM:
+          for (int j = 0; j < len; ++j) {
+            bottom_diff[j] = ((Dtype(0) < bottom_data[j]) -
+                (bottom_data[j] < Dtype(0))) * top_diff[j];
+          }
+          break;
+        default:
+          caffe_cpu_scale(len, coeff, top_diff, bottom_diff);
         }
-        //offset bottom_data each output step
-        top_diff += step_;
+        //offset bottom_data each input step
+        int stride = (t == (tick -1))?1:tick+1;
+        bottom_data += (pos_)?step_*stride:step_;
+        bottom_diff += (pos_)?step_*stride:step_;
       }
+      //offset bottom_data each output step
+      top_diff += step_;
     }
-  }else {
-    int tick = ticks_[0];
-    int k = this->layer_param_.batch_reduction_param().reduction_param().k();
-
-    // num_ outer loops
-    for (int n = 0; n < num_; ++n) {
-      // step_ inner loops
-      for (int i = 0; i < step_; ++i) {
-        //fill data
-        Dtype diff = top_diff[i] / Dtype(k);
-        for (int t = 0; t < tick; ++t){
-          bottom_diff[t * step_ + i] = (idx_data[t * step_ + i] >= 1)?diff:0;
-        }
+  }
+}
 
+template <typename Dtype>
+void BatchReductionLayer<Dtype>::backward_topk(const Dtype* top_diff,
+    Dtype* bottom_diff, int thread_id, int begin, int end) {
+  const int tick = ticks_[0];
+  for (int n = 0; n < num_; ++n) {
+    const unsigned char* mask_n = &topk_mask_[n * tick * step_];
+    Dtype* bottom_n = bottom_diff + n * tick * step_;
+    for (int i = begin; i < end; ++i) {
+      const Dtype diff = top_diff[n * step_ + i] / Dtype(k_);
+      for (int t = 0; t < tick; ++t) {
+        bottom_n[t * step_ + i] = mask_n[t * step_ + i] ? diff : Dtype(0);
       }
-      top_diff += step_;
-      bottom_diff += tick*step_;
-      idx_data += tick*step_;
     }
   }
 }
@@ -38,7 +38,8 @@ __global__ void BatchReductionForwardKer(const int step, const int num,
 template <typename Dtype>
 void BatchReductionLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-    if ((op_ != ReductionParameter_ReductionOp_TOPK)){
+    if (op_ == ReductionParameter_ReductionOp_SUM ||
+        op_ == ReductionParameter_ReductionOp_MEAN){
         const Dtype* bottom_data = bottom[0]->gpu_data();
         Dtype* top_data = top[0]->mutable_gpu_data();
         const Dtype* tick_data = this->ticks_blob_.gpu_data();
@@ -55,7 +56,7 @@ void BatchReductionLayer<Dtype>::Forward_gpu(
             kMean, kForward, pos_,
             (Dtype*)bottom_data, top_data);
     }else{
-        // Top-K reduction only supports CPU implementation
+        // Top-K, SUMSQ and ASUM reductions only support CPU implementation
         Forward_cpu(bottom, top);
     }
 
@@ -64,7 +65,8 @@ void BatchReductionLayer<Dtype>::Forward_gpu(
 template <typename Dtype>
 void BatchReductionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-    if ((op_ != ReductionParameter_ReductionOp_TOPK)){
+    if (op_ == ReductionParameter_ReductionOp_SUM ||
+        op_ == ReductionParameter_ReductionOp_MEAN){
         const Dtype *top_diff = top[0]->gpu_diff();
         Dtype *bottom_diff = bottom[0]->mutable_gpu_diff();
         const Dtype *tick_data = this->ticks_blob_.gpu_data();
@@ -80,7 +82,7 @@ void BatchReductionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
             kMean, kForward, pos_,
             bottom_diff, (Dtype*)top_diff);
     }else{
-        // Top-K reduction only supports CPU implementation
+        // Top-K, SUMSQ and ASUM reductions only support CPU implementation
         Backward_cpu(top, propagate_down, bottom);
     }
 }
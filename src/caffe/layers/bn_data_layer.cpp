@@ -1,17 +1,27 @@
 #include <algorithm>
+#include <cmath>
 #include <vector>
 
+#include "boost/bind/bind.hpp"
+
 #include "caffe/common_layers.hpp"
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
+#ifdef USE_MPI
+#include "caffe/util/mpi_functions.hpp"
+#endif
 
 namespace caffe {
 
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
 template <typename Dtype>
 void BNDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-#ifdef USE_MPI
   this->x_norm_gpu_data_ = NULL;
   this->x_norm_cpu_data_ = NULL;
 
@@ -20,6 +30,7 @@ void BNDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   this->decay_ = 1 - this->layer_param_.bn_param().momentum();
   this->moving_average_ = this->layer_param_.bn_param().moving_average();
   this->rebn_ = this->layer_param_.bn_param().rebn();
+  this->frozen_ = false;
   this->axis_ = 1;
   CHECK(this->axis_ == 1 || this->axis_ == 2) << "axis_ should be 1 or 2";
   this->channels_ = bottom[0]->LegacyShape(this->axis_);
@@ -96,13 +107,13 @@ void BNDataLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     CHECK_EQ(this->max_ds_.size(), this->relax_iter_.size());
   }
 
-#endif
+  const int num_threads = this->layer_param_.bn_param().num_threads();
+  num_threads_ = num_threads ? num_threads : caffe_hardware_threads();
 }
 
 template <typename Dtype>
 void BNDataLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-#ifdef USE_MPI
   // Figure out the dimensions
   this->num_ = bottom[0]->num();
   if (this->axis_ == 2)
@@ -118,19 +129,246 @@ void BNDataLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   top[0]->ReshapeLike(*bottom[0]);
   this->x_norm_.ReshapeLike(*bottom[0]);
   this->x_std_.Reshape(1, this->channels_, 1, 1);
-#endif
+  mean_sq_.Reshape(1, this->channels_, 1, 1);
+  channel_coeffs_.Reshape(1, 1, 4, this->channels_);
 }
 
 template <typename Dtype>
 void BNDataLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-  NOT_IMPLEMENTED;
+  int ranks = 1;
+#ifdef USE_MPI
+  ranks = Caffe::MPI_all_rank();
+#endif
+  const int channels = this->channels_;
+  const Dtype* bottom_data = bottom[0]->cpu_data();
+  Dtype* mean = blob_mean_->mutable_cpu_data();
+  Dtype* var = blob_var_->mutable_cpu_data();
+  Dtype* history_mean = this->blobs_[2]->mutable_cpu_data();
+  Dtype* history_var = this->blobs_[3]->mutable_cpu_data();
+
+  this->update_max_rd();
+
+  // Training uses the statistics of the batch unless the moving averages are
+  // asked for, as the GPU kernels do.
+  batch_stats_ = this->phase_ == TRAIN &&
+      (this->param_propagate_down_[0] || !moving_average_);
+  const bool save_mean = this->phase_ == TRAIN && this->param_propagate_down_[0];
+  if (batch_stats_) {
+    // One pass over the data gives the mean and variance of each rank, and a
+    // single reduction of those the statistics of the whole batch.
+    Dtype* mean_sq = mean_sq_.mutable_cpu_data();
+    caffe_parallel_for(channels, num_threads_, boost::bind(
+        &BNDataLayer<Dtype>::statistics_channels, this, bottom_data, mean,
+        var, mean_sq, _1, _2, _3));
+#ifdef USE_MPI
+    if (ranks > 1) {
+      mpi_force_synchronize();
+      caffe_iallreduce(mean, channels);
+      caffe_iallreduce(var, channels);
+      caffe_iallreduce(mean_sq, channels);
+      mpi_force_synchronize();
+    }
+#endif
+    // the spread of the rank means adds to the mean of their variances
+    for (int c = 0; c < channels; ++c) {
+      var[c] += mean_sq[c] - mean[c] * mean[c];
+    }
+    if (this->rebn_) {
+      // batch renorm clips the batch statistics against the moving ones
+      Dtype* r = this->r_.mutable_cpu_data();
+      Dtype* d = this->d_.mutable_cpu_data();
+      for (int c = 0; c < channels; ++c) {
+        const Dtype history_std = sqrt(history_var[c] + this->bn_eps_);
+        const Dtype batch_std = sqrt(var[c] + this->bn_eps_);
+        d[c] = std::max(-this->max_d_, std::min(this->max_d_,
+            (mean[c] - history_mean[c]) / history_std));
+        r[c] = std::max(Dtype(1) / this->max_r_, std::min(this->max_r_,
+            batch_std / history_std));
+      }
+    }
+    if (save_mean) {
+      const int m = num_ * hw_ * ranks;
+      const Dtype bias_correction_factor = m > 1 ? Dtype(m) / (m - 1) : 1;
+      caffe_cpu_axpby(channels, decay_, mean, Dtype(1) - decay_,
+          history_mean);
+      caffe_cpu_axpby(channels, decay_ * bias_correction_factor, var,
+          Dtype(1) - decay_ * bias_correction_factor, history_var);
+    }
+  } else {
+    caffe_copy(channels, history_mean, mean);
+    caffe_copy(channels, history_var, var);
+  }
+
+  // x_norm = x * alpha + beta and top = x * top_alpha + top_beta
+  const Dtype* scale_data = this->blobs_[0]->cpu_data();
+  const Dtype* shift_data = this->blobs_[1]->cpu_data();
+  const bool renorm = this->rebn_ && batch_stats_;
+  Dtype* x_std = x_std_.mutable_cpu_data();
+  Dtype* coeffs = channel_coeffs_.mutable_cpu_data();
+  for (int c = 0; c < channels; ++c) {
+    x_std[c] = sqrt(var[c] + this->bn_eps_);
+    const Dtype alpha = renorm ? this->r_.cpu_data()[c] / x_std[c]
+        : Dtype(1) / x_std[c];
+    const Dtype beta = (renorm ? this->d_.cpu_data()[c] : Dtype(0))
+        - mean[c] * alpha;
+    coeffs[c] = alpha;
+    coeffs[channels + c] = beta;
+    coeffs[2 * channels + c] = alpha * scale_data[c];
+    coeffs[3 * channels + c] = beta * scale_data[c] + shift_data[c];
+  }
+  caffe_parallel_for(channels, num_threads_, boost::bind(
+      &BNDataLayer<Dtype>::normalize_channels, this, bottom_data, coeffs,
+      x_norm_.mutable_cpu_data(), top[0]->mutable_cpu_data(), _1, _2, _3));
+}
+
+template <typename Dtype>
+void BNDataLayer<Dtype>::statistics_channels(const Dtype* bottom_data,
+    Dtype* mean, Dtype* var, Dtype* mean_sq, int thread_id, int begin,
+    int end) {
+  // Planes are merged with Chan et al.'s update of Welford's moments; the
+  // results are divided by the number of ranks so that summing them over
+  // the ranks averages them.
+  int ranks = 1;
+#ifdef USE_MPI
+  ranks = Caffe::MPI_all_rank();
+#endif
+  for (int c = begin; c < end; ++c) {
+    Dtype channel_mean = 0, channel_m2 = 0;
+    for (int n = 0; n < num_; ++n) {
+      const Dtype* x = bottom_data + (n * channels_ + c) * hw_;
+      Dtype sum = 0;
+      for (int i = 0; i < hw_; ++i) {
+        sum += x[i];
+      }
+      const Dtype plane_mean = sum / hw_;
+      Dtype m2 = 0;
+      for (int i = 0; i < hw_; ++i) {
+        m2 += (x[i] - plane_mean) * (x[i] - plane_mean);
+      }
+      const Dtype delta = plane_mean - channel_mean;
+      const Dtype weight = Dtype(1) / (n + 1);
+      channel_mean += delta * weight;
+      channel_m2 += m2 + delta * delta * hw_ * n * weight;
+    }
+    mean[c] = channel_mean / ranks;
+    var[c] = channel_m2 / (num_ * hw_) / ranks;
+    mean_sq[c] = channel_mean * channel_mean / ranks;
+  }
+}
+
+template <typename Dtype>
+void BNDataLayer<Dtype>::normalize_channels(const Dtype* bottom_data,
+    const Dtype* coeffs, Dtype* x_norm, Dtype* top_data, int thread_id,
+    int begin, int end) {
+  for (int c = begin; c < end; ++c) {
+    const Dtype alpha = coeffs[c];
+    const Dtype beta = coeffs[channels_ + c];
+    const Dtype top_alpha = coeffs[2 * channels_ + c];
+    const Dtype top_beta = coeffs[3 * channels_ + c];
+    for (int n = 0; n < num_; ++n) {
+      const int offset = (n * channels_ + c) * hw_;
+      const Dtype* x = bottom_data + offset;
+      Dtype* x_hat = x_norm + offset;
+      Dtype* y = top_data + offset;
+      for (int i = 0; i < hw_; ++i) {
+        x_hat[i] = x[i] * alpha + beta;
+        y[i] = x[i] * top_alpha + top_beta;
+      }
+    }
+  }
 }
 
 template <typename Dtype>
 void BNDataLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  NOT_IMPLEMENTED;
+  int ranks = 1;
+#ifdef USE_MPI
+  ranks = Caffe::MPI_all_rank();
+#endif
+  const int channels = this->channels_;
+  const Dtype* top_diff = top[0]->cpu_diff();
+  const Dtype* x_norm = x_norm_.cpu_data();
+  // Per channel sums of the top grad and of the top grad times x_norm, over
+  // the batch of all the ranks.
+  Dtype* sum_diff = blob_shift_->mutable_cpu_data();
+  Dtype* sum_diff_x_norm = blob_scale_->mutable_cpu_data();
+  caffe_parallel_for(channels, num_threads_, boost::bind(
+      &BNDataLayer<Dtype>::gradient_sums_channels, this, top_diff, x_norm,
+      sum_diff, sum_diff_x_norm, _1, _2, _3));
+#ifdef USE_MPI
+  if (ranks > 1) {
+    mpi_force_synchronize();
+    caffe_iallreduce(sum_diff, channels);
+    caffe_iallreduce(sum_diff_x_norm, channels);
+    mpi_force_synchronize();
+  }
+#endif
+  if (this->param_propagate_down_[0]) {
+    caffe_axpy(channels, Dtype(1), sum_diff_x_norm,
+        this->blobs_[0]->mutable_cpu_diff());
+  }
+  if (this->param_propagate_down_[1]) {
+    caffe_axpy(channels, Dtype(1), sum_diff,
+        this->blobs_[1]->mutable_cpu_diff());
+  }
+
+  if (propagate_down[0]) {
+    // bottom grad = factor * (top grad - x_norm * k_x_norm - k_diff), where
+    // the k are zero for the moving averages, which are constants
+    const Dtype* scale_data = this->blobs_[0]->cpu_data();
+    const Dtype* x_std = x_std_.cpu_data();
+    const Dtype inv_count = Dtype(1) / (num_ * hw_ * ranks);
+    Dtype* coeffs = channel_coeffs_.mutable_cpu_data();
+    for (int c = 0; c < channels; ++c) {
+      coeffs[c] = scale_data[c] / x_std[c];
+      if (this->rebn_ && batch_stats_) {
+        coeffs[c] *= this->r_.cpu_data()[c];
+      }
+      coeffs[channels + c] =
+          batch_stats_ ? sum_diff_x_norm[c] * inv_count : Dtype(0);
+      coeffs[2 * channels + c] =
+          batch_stats_ ? sum_diff[c] * inv_count : Dtype(0);
+    }
+    caffe_parallel_for(channels, num_threads_, boost::bind(
+        &BNDataLayer<Dtype>::bottom_diff_channels, this, top_diff, x_norm,
+        coeffs, bottom[0]->mutable_cpu_diff(), _1, _2, _3));
+  }
+}
+
+template <typename Dtype>
+void BNDataLayer<Dtype>::gradient_sums_channels(const Dtype* top_diff,
+    const Dtype* x_norm, Dtype* sum_diff, Dtype* sum_diff_x_norm,
+    int thread_id, int begin, int end) {
+  for (int c = begin; c < end; ++c) {
+    Dtype diff_sum = 0, diff_dot = 0;
+    for (int n = 0; n < num_; ++n) {
+      const int offset = (n * channels_ + c) * hw_;
+      for (int i = offset; i < offset + hw_; ++i) {
+        diff_sum += top_diff[i];
+        diff_dot += top_diff[i] * x_norm[i];
+      }
+    }
+    sum_diff[c] = diff_sum;
+    sum_diff_x_norm[c] = diff_dot;
+  }
+}
+
+template <typename Dtype>
+void BNDataLayer<Dtype>::bottom_diff_channels(const Dtype* top_diff,
+    const Dtype* x_norm, const Dtype* coeffs, Dtype* bottom_diff,
+    int thread_id, int begin, int end) {
+  for (int c = begin; c < end; ++c) {
+    const Dtype factor = coeffs[c];
+    const Dtype k_x_norm = coeffs[channels_ + c];
+    const Dtype k_diff = coeffs[2 * channels_ + c];
+    for (int n = 0; n < num_; ++n) {
+      const int offset = (n * channels_ + c) * hw_;
+      for (int i = offset; i < offset + hw_; ++i) {
+        bottom_diff[i] = (top_diff[i] - x_norm[i] * k_x_norm - k_diff) * factor;
+      }
+    }
+  }
 }
 
 #ifdef CPU_ONLY
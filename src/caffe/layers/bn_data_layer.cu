@@ -282,6 +282,9 @@ void BNDataLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
                        top_data,this->x_norm_.mutable_gpu_data(),this->x_std_.mutable_gpu_data(), scale_data,shift_data, local_var_);
     }
   }
+#else
+  // without MPI the batch is the local one, which the CPU path handles
+  Forward_cpu(bottom, top);
 #endif
 }
 
@@ -445,6 +448,8 @@ void BNDataLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     caffe_iallreduce(this->blobs_[3]->mutable_cpu_data(), this->channels_);
     mpi_force_synchronize();
   }
+#else
+  Backward_cpu(top, propagate_down, bottom);
 #endif // USE_MPI
 }
 
@@ -14,6 +14,7 @@ void BNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   bn_momentum_ = this->layer_param_.bn_param().momentum();
   bn_eps_ = this->layer_param_.bn_param().eps();
   rebn_ = this->layer_param_.bn_param().rebn();
+  relu_ = this->layer_param_.bn_param().relu();
   // Initialize parameters
   if (this->blobs_.size() > 0) {
     LOG(INFO) << "Skipping parameter initialization";
@@ -140,310 +141,190 @@ void BNLayer<Dtype>::update_max_rd()
 template <typename Dtype>
 void BNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   const vector<Blob<Dtype>*>& top) {
-  const Dtype* const_bottom_data = bottom[0]->cpu_data();
-  const Dtype* const_top_data = top[0]->cpu_data();
+  const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-
   const Dtype* scale_data = this->blobs_[0]->cpu_data();
   const Dtype* shift_data = this->blobs_[1]->cpu_data();
+  const int spatial_dim = height_ * width_;
+  const bool use_batch_stats = !frozen_ && this->phase_ != TEST;
 
   update_max_rd();
 
-  // Mean normalization
-  if (frozen_ || this->phase_ == TEST) {
-    // Use the moving average mean
-    caffe_copy(batch_statistic_.count(), this->blobs_[2]->cpu_data(),
-        batch_statistic_.mutable_cpu_data());
-  } else {
-    // Compute the mean by averaging over spatial and batch dimensions.
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1) / (height_ * width_), const_bottom_data,
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_,
-        Dtype(1) / num_, spatial_statistic_.cpu_data(),
-        batch_sum_multiplier_.cpu_data(), Dtype(0),
-        batch_statistic_.mutable_cpu_data());
-    //renorm
-    if (rebn_)
-      for (int i=0; i<channels_; i++)
-      {
-        Dtype s1 = batch_statistic_.cpu_data()[i] - this->blobs_[2]->cpu_data()[i] , s2 = sqrt(this->blobs_[3]->cpu_data()[i] + bn_eps_);
-
-        if (s2 * this->max_d_ <= s1)
-          this->d_.mutable_cpu_data()[i] = this->max_d_;
-        else if (-s2 * this->max_d_ >= s1)
-          this->d_.mutable_cpu_data()[i] = -this->max_d_;
-        else
-          this->d_.mutable_cpu_data()[i] = s1 / s2;
+  // Per channel mean and variance, from the moving averages or the batch.
+  Dtype* mean = batch_statistic_.mutable_cpu_data();
+  Dtype* var = spatial_statistic_.mutable_cpu_data();
+  if (use_batch_stats) {
+    for (int c = 0; c < channels_; ++c) {
+      // Each plane is small enough to go over twice while it is in cache,
+      // and the planes are merged with Chan et al.'s update of Welford's
+      // running moments, so memory is streamed only once.
+      Dtype channel_mean = 0, channel_m2 = 0;
+      for (int n = 0; n < num_; ++n) {
+        const Dtype* x = bottom_data + (n * channels_ + c) * spatial_dim;
+        Dtype sum = 0;
+        for (int i = 0; i < spatial_dim; ++i) {
+          sum += x[i];
+        }
+        const Dtype plane_mean = sum / spatial_dim;
+        Dtype m2 = 0;
+        for (int i = 0; i < spatial_dim; ++i) {
+          m2 += (x[i] - plane_mean) * (x[i] - plane_mean);
+        }
+        const Dtype delta = plane_mean - channel_mean;
+        const Dtype weight = Dtype(1) / (n + 1);
+        channel_mean += delta * weight;
+        channel_m2 += m2 + delta * delta * spatial_dim * n * weight;
       }
-
-
-    // Add to the moving average
-    if (!frozen_) {
-      caffe_cpu_axpby(batch_statistic_.count(),
-          Dtype(1) - bn_momentum_, batch_statistic_.cpu_data(),
-          bn_momentum_, this->blobs_[2]->mutable_cpu_data());
+      mean[c] = channel_mean;
+      var[c] = channel_m2 / (num_ * spatial_dim);
     }
-  }
-  // Broadcast the mean vector
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(-1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  // Subtract
-  caffe_add(broadcast_buffer_.count(), const_bottom_data,
-      broadcast_buffer_.cpu_data(), top_data);
-
-  // Variance normalization
-  if (frozen_ || this->phase_ == TEST) {
-    // Use the moving average variance
-    caffe_copy(batch_statistic_.count(), this->blobs_[3]->cpu_data(),
-        batch_statistic_.mutable_cpu_data());
-  } else {
-    // calculate batch variance
-    caffe_powx(broadcast_buffer_.count(), const_top_data, Dtype(2),
-        broadcast_buffer_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1) / (height_ * width_), broadcast_buffer_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1) / num_,
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(0), batch_statistic_.mutable_cpu_data());
-
-    //renorm
-    if (rebn_)
-      for (int i=0; i<channels_; i++)
-      {
-        Dtype s1 = sqrt(batch_statistic_.cpu_data()[i] + bn_eps_) , s2 = sqrt(this->blobs_[3]->cpu_data()[i] + bn_eps_);
-
-        if (s2 * this->max_r_ <= s1)
-          this->r_.mutable_cpu_data()[i] = this->max_r_;
-        else if (s2 / this->max_r_ >= s1)
-          this->r_.mutable_cpu_data()[i] = Dtype(1)/this->max_r_;
-        else
-          this->r_.mutable_cpu_data()[i] = s1 / s2;
+    if (rebn_) {
+      // batch renorm clips the batch statistics against the moving ones
+      const Dtype* moving_mean = this->blobs_[2]->cpu_data();
+      const Dtype* moving_var = this->blobs_[3]->cpu_data();
+      Dtype* r = r_.mutable_cpu_data();
+      Dtype* d = d_.mutable_cpu_data();
+      for (int c = 0; c < channels_; ++c) {
+        const Dtype moving_std = sqrt(moving_var[c] + bn_eps_);
+        const Dtype batch_std = sqrt(var[c] + bn_eps_);
+        d[c] = std::max(-max_d_, std::min(max_d_,
+            (mean[c] - moving_mean[c]) / moving_std));
+        r[c] = std::max(Dtype(1) / max_r_, std::min(max_r_,
+            batch_std / moving_std));
       }
-      
+    }
     // Add to the moving average
-    caffe_cpu_axpby(batch_statistic_.count(),
-        Dtype(1) - bn_momentum_, batch_statistic_.cpu_data(),
-        bn_momentum_, this->blobs_[3]->mutable_cpu_data());
-  }
-
-  // Add eps
-  caffe_add_scalar(batch_statistic_.count(), bn_eps_,
-                   batch_statistic_.mutable_cpu_data());
-  // Inverse standard deviation
-  caffe_powx(batch_statistic_.count(), batch_statistic_.cpu_data(),
-             Dtype(-0.5), batch_statistic_.mutable_cpu_data());
-
-  // Broadcast the inverse std
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  // Multiply with the inverse std
-  caffe_mul(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
-
-
-  if (!frozen_ && this->phase_ != TEST && rebn_)
-  {
-    // Broadcast the r
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-          Dtype(1), batch_sum_multiplier_.cpu_data(), r_.cpu_data(),
-          Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1),
-        spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), broadcast_buffer_.mutable_cpu_data());
-    // Multiply r
-    caffe_mul(broadcast_buffer_.count(), const_top_data,
-        broadcast_buffer_.cpu_data(), top_data);
-
-
-    // Broadcast the d
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-          Dtype(1), batch_sum_multiplier_.cpu_data(), d_.cpu_data(),
-          Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1),
-        spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), broadcast_buffer_.mutable_cpu_data());
-    // Add d
-    caffe_add(broadcast_buffer_.count(), const_top_data,
-        broadcast_buffer_.cpu_data(), top_data);
+    if (!this->recomputing_) {
+      caffe_cpu_axpby(channels_, Dtype(1) - bn_momentum_, mean, bn_momentum_,
+          this->blobs_[2]->mutable_cpu_data());
+      caffe_cpu_axpby(channels_, Dtype(1) - bn_momentum_, var, bn_momentum_,
+          this->blobs_[3]->mutable_cpu_data());
+    }
+  } else {
+    caffe_copy(channels_, this->blobs_[2]->cpu_data(), mean);
+    caffe_copy(channels_, this->blobs_[3]->cpu_data(), var);
   }
 
-
-  // Save the normalized inputs and std for backprop
-  if (!frozen_) {
-    caffe_copy(broadcast_buffer_.count(), const_top_data,
-        x_norm_.mutable_cpu_data());
-    caffe_copy(batch_statistic_.count(), batch_statistic_.cpu_data(),
-        x_inv_std_.mutable_cpu_data());
+  // Normalize, scale and shift in a single pass, saving the normalized
+  // inputs and inverse std for backprop unless frozen.
+  Dtype* inv_std = x_inv_std_.mutable_cpu_data();
+  Dtype* x_norm = frozen_ ? NULL : x_norm_.mutable_cpu_data();
+  const bool renorm = rebn_ && use_batch_stats;
+  for (int c = 0; c < channels_; ++c) {
+    inv_std[c] = Dtype(1) / sqrt(var[c] + bn_eps_);
+    // x_norm = (x - mean) * alpha + beta and top = x_norm * scale + shift
+    const Dtype alpha = renorm ? inv_std[c] * r_.cpu_data()[c] : inv_std[c];
+    const Dtype beta = renorm ? d_.cpu_data()[c] : Dtype(0);
+    const Dtype top_alpha = alpha * scale_data[c];
+    const Dtype top_beta = (beta - mean[c] * alpha) * scale_data[c]
+        + shift_data[c];
+    for (int n = 0; n < num_; ++n) {
+      const int offset = (n * channels_ + c) * spatial_dim;
+      const Dtype* x = bottom_data + offset;
+      Dtype* y = top_data + offset;
+      if (x_norm) {
+        Dtype* x_hat = x_norm + offset;
+        for (int i = 0; i < spatial_dim; ++i) {
+          x_hat[i] = (x[i] - mean[c]) * alpha + beta;
+        }
+      }
+      if (relu_) {
+        for (int i = 0; i < spatial_dim; ++i) {
+          y[i] = std::max(x[i] * top_alpha + top_beta, Dtype(0));
+        }
+      } else {
+        for (int i = 0; i < spatial_dim; ++i) {
+          y[i] = x[i] * top_alpha + top_beta;
+        }
+      }
+    }
   }
-
-  // Scale
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), scale_data,
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  caffe_mul(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
-
-  // Shift
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-      Dtype(1), batch_sum_multiplier_.cpu_data(), shift_data,
-      Dtype(0), spatial_statistic_.mutable_cpu_data());
-  caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-      height_ * width_, 1, Dtype(1),
-      spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-      Dtype(0), broadcast_buffer_.mutable_cpu_data());
-  caffe_add(broadcast_buffer_.count(), const_top_data,
-      broadcast_buffer_.cpu_data(), top_data);
 }
 
 template <typename Dtype>
 void BNLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  const Dtype* top_diff = top[0]->cpu_diff();
+  // The fused ReLU passes the gradient where its output is positive.
+  const Dtype* top_data = relu_ ? top[0]->cpu_data() : NULL;
+  const Dtype* scale_data = this->blobs_[0]->cpu_data();
+  const int spatial_dim = height_ * width_;
   if (frozen_) {
     if (propagate_down[0]) {
-      const Dtype* const_top_diff = top[0]->cpu_diff();
       Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-      // Use the moving average variance
-      caffe_copy(batch_statistic_.count(), this->blobs_[3]->cpu_data(),
-          batch_statistic_.mutable_cpu_data());
-      caffe_add_scalar(batch_statistic_.count(), bn_eps_,
-          batch_statistic_.mutable_cpu_data());
-      caffe_powx(batch_statistic_.count(), batch_statistic_.cpu_data(),
-          Dtype(-0.5), batch_statistic_.mutable_cpu_data());
-      // Divide slope with std
-      caffe_mul(batch_statistic_.count(), this->blobs_[0]->cpu_data(),
-          batch_statistic_.cpu_data(), batch_statistic_.mutable_cpu_data());
-      // Broadcast
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-          Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-          Dtype(0), spatial_statistic_.mutable_cpu_data());
-      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-          height_ * width_, 1, Dtype(1),
-          spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-          Dtype(0), broadcast_buffer_.mutable_cpu_data());
-      // Elementwise multiply top grad with (slope / std)
-      caffe_mul(broadcast_buffer_.count(), const_top_diff,
-          broadcast_buffer_.cpu_data(), bottom_diff);
+      const Dtype* var = this->blobs_[3]->cpu_data();
+      for (int c = 0; c < channels_; ++c) {
+        // Multiply the top grad with (slope / std)
+        const Dtype factor = scale_data[c] / sqrt(var[c] + bn_eps_);
+        for (int n = 0; n < num_; ++n) {
+          const int offset = (n * channels_ + c) * spatial_dim;
+          for (int i = offset; i < offset + spatial_dim; ++i) {
+            bottom_diff[i] = (top_data && top_data[i] <= 0) ? Dtype(0)
+                : top_diff[i] * factor;
+          }
+        }
+      }
     }
     return;
   }
 
-  // gradient w.r.t. slope
+  // Per channel sums of the top grad and of the top grad times x_hat.
+  const Dtype* x_norm = x_norm_.cpu_data();
+  Dtype* sum_diff = spatial_statistic_.mutable_cpu_data();
+  Dtype* sum_diff_x_norm = batch_statistic_.mutable_cpu_data();
+  for (int c = 0; c < channels_; ++c) {
+    Dtype diff_sum = 0, diff_dot = 0;
+    for (int n = 0; n < num_; ++n) {
+      const int offset = (n * channels_ + c) * spatial_dim;
+      if (top_data) {
+        for (int i = offset; i < offset + spatial_dim; ++i) {
+          const Dtype diff = top_data[i] > 0 ? top_diff[i] : Dtype(0);
+          diff_sum += diff;
+          diff_dot += diff * x_norm[i];
+        }
+      } else {
+        for (int i = offset; i < offset + spatial_dim; ++i) {
+          diff_sum += top_diff[i];
+          diff_dot += top_diff[i] * x_norm[i];
+        }
+      }
+    }
+    sum_diff[c] = diff_sum;
+    sum_diff_x_norm[c] = diff_dot;
+  }
+  // gradient w.r.t. slope and bias
   if (this->param_propagate_down_[0]) {
-    const Dtype* const_top_diff = top[0]->cpu_diff();
-    Dtype* scale_diff = this->blobs_[0]->mutable_cpu_diff();
-    caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(), const_top_diff,
-        broadcast_buffer_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), broadcast_buffer_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(1), scale_diff);
+    caffe_axpy(channels_, Dtype(1), sum_diff_x_norm,
+        this->blobs_[0]->mutable_cpu_diff());
   }
-
-  // gradient w.r.t. bias
   if (this->param_propagate_down_[1]) {
-    const Dtype* const_top_diff = top[0]->cpu_diff();
-    Dtype* shift_diff = this->blobs_[1]->mutable_cpu_diff();
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), const_top_diff, spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(1), shift_diff);
+    caffe_axpy(channels_, Dtype(1), sum_diff,
+        this->blobs_[1]->mutable_cpu_diff());
   }
 
-  // gradient w.r.t. normalized inputs
+  // gradient w.r.t. the inputs: with g = slope * top grad,
+  // (g - mean(g) - x_hat * mean(x_hat * g)) times the inverse std (and r)
   if (propagate_down[0]) {
-    const Dtype* const_top_diff = top[0]->cpu_diff();
-    const Dtype* const_bottom_diff = bottom[0]->cpu_diff();
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-    const Dtype* scale_data = this->blobs_[0]->cpu_data();
-
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), scale_data,
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1), spatial_statistic_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        broadcast_buffer_.mutable_cpu_data());
-    caffe_mul(broadcast_buffer_.count(), const_top_diff,
-        broadcast_buffer_.cpu_data(), broadcast_buffer_.mutable_cpu_data());
-
-    // sum of x_hat * (dl / dx_hat)
-    caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(),
-        broadcast_buffer_.cpu_data(), bottom_diff);
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), const_bottom_diff, spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(0), batch_statistic_.mutable_cpu_data());
-
-    // x_hat times the sum
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1),
-        spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), bottom_diff);
-    caffe_mul(broadcast_buffer_.count(), x_norm_.cpu_data(),
-        const_bottom_diff, bottom_diff);
-
-    // Subtract the average of x_hat times the sum
-    caffe_cpu_gemv<Dtype>(CblasNoTrans, num_ * channels_, height_ * width_,
-        Dtype(1), broadcast_buffer_.cpu_data(),
-        spatial_sum_multiplier_.cpu_data(), Dtype(0),
-        spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemv<Dtype>(CblasTrans, num_, channels_, Dtype(1),
-        spatial_statistic_.cpu_data(), batch_sum_multiplier_.cpu_data(),
-        Dtype(0), batch_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), batch_statistic_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1),
-        spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-        Dtype(1), bottom_diff);
-    caffe_cpu_axpby(broadcast_buffer_.count(), Dtype(1),
-        broadcast_buffer_.cpu_data(), Dtype(-1) / (num_ * height_ * width_),
-        bottom_diff);
-
-    // Multiply with the inverse std and r(if rebn)
-    if (rebn_)
-      caffe_mul(channels_, r_.cpu_data(), x_inv_std_.cpu_data(), x_inv_std_.mutable_cpu_data());
-
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_, channels_, 1,
-        Dtype(1), batch_sum_multiplier_.cpu_data(), x_inv_std_.cpu_data(),
-        Dtype(0), spatial_statistic_.mutable_cpu_data());
-    caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_ * channels_,
-        height_ * width_, 1, Dtype(1),
-        spatial_statistic_.cpu_data(), spatial_sum_multiplier_.cpu_data(),
-        Dtype(0), broadcast_buffer_.mutable_cpu_data());
-    caffe_mul(broadcast_buffer_.count(), const_bottom_diff,
-        broadcast_buffer_.cpu_data(), bottom_diff);
+    const Dtype* inv_std = x_inv_std_.cpu_data();
+    const Dtype inv_count = Dtype(1) / (num_ * spatial_dim);
+    for (int c = 0; c < channels_; ++c) {
+      Dtype factor = scale_data[c] * inv_std[c];
+      if (rebn_) {
+        factor *= r_.cpu_data()[c];
+      }
+      const Dtype mean_diff = sum_diff[c] * inv_count;
+      const Dtype mean_diff_x_norm = sum_diff_x_norm[c] * inv_count;
+      for (int n = 0; n < num_; ++n) {
+        const int offset = (n * channels_ + c) * spatial_dim;
+        for (int i = offset; i < offset + spatial_dim; ++i) {
+          const Dtype diff = (top_data && top_data[i] <= 0) ? Dtype(0)
+              : top_diff[i];
+          bottom_diff[i] = (diff - mean_diff - x_norm[i] * mean_diff_x_norm)
+              * factor;
+        }
+      }
+    }
   }
 }
 
@@ -9,6 +9,23 @@
 
 namespace caffe {
 
+template <typename Dtype>
+__global__ void BNReLUForward(const int n, Dtype* data) {
+  CUDA_KERNEL_LOOP(index, n) {
+    data[index] = data[index] > 0 ? data[index] : Dtype(0);
+  }
+}
+
+template <typename Dtype>
+__global__ void BNReLUBackward(const int n, const Dtype* top_data,
+    Dtype* top_diff) {
+  CUDA_KERNEL_LOOP(index, n) {
+    if (top_data[index] <= 0) {
+      top_diff[index] = 0;
+    }
+  }
+}
+
 template <typename Dtype>
 void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
   const vector<Blob<Dtype>*>& top) {
@@ -38,7 +55,7 @@ void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
         batch_statistic_.mutable_gpu_data());
 
     // Add to the moving average
-    if (!frozen_) {
+    if (!frozen_ && !this->recomputing_) {
       caffe_gpu_axpby(batch_statistic_.count(),
           Dtype(1) - bn_momentum_, batch_statistic_.gpu_data(),
           bn_momentum_, this->blobs_[2]->mutable_gpu_data());
@@ -75,9 +92,11 @@ void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
         Dtype(0), batch_statistic_.mutable_gpu_data());
 
     // Add to the moving average
-    caffe_gpu_axpby(batch_statistic_.count(),
-        Dtype(1) - bn_momentum_, batch_statistic_.gpu_data(),
-        bn_momentum_, this->blobs_[3]->mutable_gpu_data());
+    if (!this->recomputing_) {
+      caffe_gpu_axpby(batch_statistic_.count(),
+          Dtype(1) - bn_momentum_, batch_statistic_.gpu_data(),
+          bn_momentum_, this->blobs_[3]->mutable_gpu_data());
+    }
     if (this->rebn_)
       caffe_copy(channels_, batch_statistic_.gpu_data(), this->r_.mutable_gpu_data()); // temp buffer
   }
@@ -208,11 +227,28 @@ void BNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
     caffe_gpu_add(broadcast_buffer_.count(), const_top_data,
         broadcast_buffer_.gpu_data(), top_data); 
   }
+
+  if (relu_) {
+    const int count = top[0]->count();
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    BNReLUForward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
+        count, top_data);
+    CUDA_POST_KERNEL_CHECK;
+  }
 }
 
 template <typename Dtype>
 void BNLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
+  if (relu_) {
+    // Mask the top grad by the fused ReLU in place, like an in-place ReLU
+    // layer would.
+    const int count = top[0]->count();
+    // NOLINT_NEXT_LINE(whitespace/operators)
+    BNReLUBackward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
+        count, top[0]->gpu_data(), top[0]->mutable_gpu_diff());
+    CUDA_POST_KERNEL_CHECK;
+  }
   if (frozen_) {
     if (propagate_down[0]) {
       const Dtype* const_top_diff = top[0]->gpu_diff();
@@ -47,7 +47,8 @@ void CuDNNBNLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
         bottom_desc_, bottom_data,
         top_desc_, top_data,
         bn_param_desc_, scale_data, bias_data,
-        1 - this->bn_momentum_,
+        // leave the running averages untouched when recomputing
+        this->recomputing_ ? Dtype(0) : 1 - this->bn_momentum_,
         running_mean_data, running_variance_data,
         epsilon,
         save_mean_data, save_inv_variance_data));
@@ -3,6 +3,7 @@
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/interp.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -28,6 +29,8 @@ void InterpLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   pad_end_ = interp_param.pad_end();
   CHECK_LE(pad_beg_, 0) << "Only supports non-pos padding (cropping) for now";
   CHECK_LE(pad_end_, 0) << "Only supports non-pos padding (cropping) for now";
+  num_threads_ = interp_param.num_threads() ? interp_param.num_threads()
+      : caffe_hardware_threads();
 }
 
 template <typename Dtype>
@@ -76,7 +79,8 @@ void InterpLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
   if(interp_type_ == "bilinear"){
     caffe_cpu_interp2<Dtype,false>(num_ * channels_,
       bottom[0]->cpu_data(), - pad_beg_, - pad_beg_, height_in_eff_, width_in_eff_, height_in_, width_in_,
-      top[0]->mutable_cpu_data(), 0, 0, height_out_, width_out_, height_out_, width_out_);
+      top[0]->mutable_cpu_data(), 0, 0, height_out_, width_out_, height_out_, width_out_,
+      num_threads_);
   }
   else{
     caffe_cpu_nninterp2<Dtype,false>(num_ * channels_,
@@ -93,7 +97,8 @@ void InterpLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   if (interp_type_ == "bilinear"){
     caffe_cpu_interp2_backward<Dtype,false>(num_ * channels_,
       bottom[0]->mutable_cpu_diff(), - pad_beg_, - pad_beg_, height_in_eff_, width_in_eff_, height_in_, width_in_,
-      top[0]->cpu_diff(), 0, 0, height_out_, width_out_, height_out_, width_out_);
+      top[0]->cpu_diff(), 0, 0, height_out_, width_out_, height_out_, width_out_,
+      num_threads_);
   }
   else{
     caffe_cpu_nninterp2_backward<Dtype,false>(num_ * channels_,
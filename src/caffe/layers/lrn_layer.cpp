@@ -1,11 +1,32 @@
+#include <algorithm>
 #include <vector>
 
+#include "boost/bind/bind.hpp"
+
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
+// The spatial positions per tile of the cross channel kernels: the running
+// sums of a tile stay in L1 while it is walked down all the channels.
+static const int kLRNTile = 64;
+
+// s^-beta, with a cheaper form for the usual beta of 0.75.
+template <typename Dtype>
+static inline Dtype lrn_pow(const Dtype s, const Dtype beta) {
+  if (beta == Dtype(0.75)) {
+    return Dtype(1) / sqrt(s * sqrt(s));
+  }
+  return pow(s, -beta);
+}
+
 template <typename Dtype>
 void LRNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -15,6 +36,8 @@ void LRNLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   alpha_ = this->layer_param_.lrn_param().alpha();
   beta_ = this->layer_param_.lrn_param().beta();
   k_ = this->layer_param_.lrn_param().k();
+  num_threads_ = this->layer_param_.lrn_param().num_threads() ?
+      this->layer_param_.lrn_param().num_threads() : caffe_hardware_threads();
   if (this->layer_param_.lrn_param().norm_region() ==
       LRNParameter_NormRegion_WITHIN_CHANNEL) {
     // Set up split_layer_ to use inputs in the numerator and denominator.
@@ -108,48 +131,56 @@ void LRNLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void LRNLayer<Dtype>::CrossChannelForward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  Dtype* top_data = top[0]->mutable_cpu_data();
-  Dtype* scale_data = scale_.mutable_cpu_data();
-  // start with the constant value
-  for (int i = 0; i < scale_.count(); ++i) {
-    scale_data[i] = k_;
-  }
-  Blob<Dtype> padded_square(1, channels_ + size_ - 1, height_, width_);
-  Dtype* padded_square_data = padded_square.mutable_cpu_data();
-  caffe_set(padded_square.count(), Dtype(0), padded_square_data);
-  Dtype alpha_over_size = alpha_ / size_;
-  // go through the images
-  for (int n = 0; n < num_; ++n) {
-    // compute the padded square
-    caffe_sqr(channels_ * height_ * width_,
-        bottom_data + bottom[0]->offset(n),
-        padded_square_data + padded_square.offset(0, pre_pad_));
-    // Create the first channel scale
-    for (int c = 0; c < size_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c),
-          scale_data + scale_.offset(n, 0));
-    }
-    for (int c = 1; c < channels_; ++c) {
-      // copy previous scale
-      caffe_copy<Dtype>(height_ * width_,
-          scale_data + scale_.offset(n, c - 1),
-          scale_data + scale_.offset(n, c));
-      // add head
-      caffe_axpy<Dtype>(height_ * width_, alpha_over_size,
-          padded_square_data + padded_square.offset(0, c + size_ - 1),
-          scale_data + scale_.offset(n, c));
-      // subtract tail
-      caffe_axpy<Dtype>(height_ * width_, -alpha_over_size,
-          padded_square_data + padded_square.offset(0, c - 1),
-          scale_data + scale_.offset(n, c));
+  caffe_parallel_for(num_, num_threads_, boost::bind(
+      &LRNLayer<Dtype>::cross_channel_forward_images, this,
+      bottom[0]->cpu_data(), scale_.mutable_cpu_data(),
+      top[0]->mutable_cpu_data(), _1, _2, _3));
+}
+
+template <typename Dtype>
+void LRNLayer<Dtype>::cross_channel_forward_images(const Dtype* bottom_data,
+    Dtype* scale_data, Dtype* top_data, int thread_id, int begin, int end) {
+  const int spatial_dim = height_ * width_;
+  const Dtype alpha_over_size = alpha_ / size_;
+  Dtype sum[kLRNTile];
+  for (int n = begin; n < end; ++n) {
+    const int offset = n * channels_ * spatial_dim;
+    for (int s = 0; s < spatial_dim; s += kLRNTile) {
+      const int tile = std::min(kLRNTile, spatial_dim - s);
+      const Dtype* x = bottom_data + offset + s;
+      Dtype* scale = scale_data + offset + s;
+      Dtype* y = top_data + offset + s;
+      // the squares of the channels ahead of the first window's head
+      std::fill(sum, sum + tile, Dtype(0));
+      for (int c = 0; c < std::min(pre_pad_, channels_); ++c) {
+        const Dtype* x_c = x + c * spatial_dim;
+        for (int i = 0; i < tile; ++i) {
+          sum[i] += x_c[i] * x_c[i];
+        }
+      }
+      // Slide the window down the channels, computing the output with the
+      // scale.
+      for (int c = 0; c < channels_; ++c) {
+        if (c + pre_pad_ < channels_) {
+          const Dtype* head = x + (c + pre_pad_) * spatial_dim;
+          for (int i = 0; i < tile; ++i) {
+            sum[i] += head[i] * head[i];
+          }
+        }
+        const int index = c * spatial_dim;
+        for (int i = 0; i < tile; ++i) {
+          scale[index + i] = k_ + alpha_over_size * sum[i];
+          y[index + i] = x[index + i] * lrn_pow(scale[index + i], beta_);
+        }
+        if (c - pre_pad_ >= 0) {
+          const Dtype* tail = x + (c - pre_pad_) * spatial_dim;
+          for (int i = 0; i < tile; ++i) {
+            sum[i] -= tail[i] * tail[i];
+          }
+        }
+      }
     }
   }
-
-  // In the end, compute output
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, top_data);
-  caffe_mul<Dtype>(scale_.count(), top_data, bottom_data, top_data);
 }
 
 template <typename Dtype>
@@ -181,53 +212,55 @@ template <typename Dtype>
 void LRNLayer<Dtype>::CrossChannelBackward_cpu(
     const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
     const vector<Blob<Dtype>*>& bottom) {
-  const Dtype* top_diff = top[0]->cpu_diff();
-  const Dtype* top_data = top[0]->cpu_data();
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  const Dtype* scale_data = scale_.cpu_data();
-  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  Blob<Dtype> padded_ratio(1, channels_ + size_ - 1, height_, width_);
-  Blob<Dtype> accum_ratio(1, 1, height_, width_);
-  Dtype* padded_ratio_data = padded_ratio.mutable_cpu_data();
-  Dtype* accum_ratio_data = accum_ratio.mutable_cpu_data();
-  // We hack a little bit by using the diff() to store an additional result
-  Dtype* accum_ratio_times_bottom = accum_ratio.mutable_cpu_diff();
-  caffe_set(padded_ratio.count(), Dtype(0), padded_ratio_data);
-  Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
-
-  caffe_powx<Dtype>(scale_.count(), scale_data, -beta_, bottom_diff);
-  caffe_mul<Dtype>(scale_.count(), top_diff, bottom_diff, bottom_diff);
+  caffe_parallel_for(num_, num_threads_, boost::bind(
+      &LRNLayer<Dtype>::cross_channel_backward_images, this,
+      top[0]->cpu_diff(), top[0]->cpu_data(), bottom[0]->cpu_data(),
+      scale_.cpu_data(), bottom[0]->mutable_cpu_diff(), _1, _2, _3));
+}
 
-  // go through individual data
-  int inverse_pre_pad = size_ - (size_ + 1) / 2;
-  for (int n = 0; n < num_; ++n) {
-    int block_offset = scale_.offset(n);
-    // first, compute diff_i * y_i / s_i
-    caffe_mul<Dtype>(channels_ * height_ * width_,
-        top_diff + block_offset, top_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    caffe_div<Dtype>(channels_ * height_ * width_,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad),
-        scale_data + block_offset,
-        padded_ratio_data + padded_ratio.offset(0, inverse_pre_pad));
-    // Now, compute the accumulated ratios and the bottom diff
-    caffe_set(accum_ratio.count(), Dtype(0), accum_ratio_data);
-    for (int c = 0; c < size_ - 1; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
-    }
-    for (int c = 0; c < channels_; ++c) {
-      caffe_axpy<Dtype>(height_ * width_, 1.,
-          padded_ratio_data + padded_ratio.offset(0, c + size_ - 1),
-          accum_ratio_data);
-      // compute bottom diff
-      caffe_mul<Dtype>(height_ * width_,
-          bottom_data + top[0]->offset(n, c),
-          accum_ratio_data, accum_ratio_times_bottom);
-      caffe_axpy<Dtype>(height_ * width_, -cache_ratio_value,
-          accum_ratio_times_bottom, bottom_diff + top[0]->offset(n, c));
-      caffe_axpy<Dtype>(height_ * width_, -1.,
-          padded_ratio_data + padded_ratio.offset(0, c), accum_ratio_data);
+template <typename Dtype>
+void LRNLayer<Dtype>::cross_channel_backward_images(const Dtype* top_diff,
+    const Dtype* top_data, const Dtype* bottom_data, const Dtype* scale_data,
+    Dtype* bottom_diff, int thread_id, int begin, int end) {
+  const int spatial_dim = height_ * width_;
+  const Dtype cache_ratio_value = 2. * alpha_ * beta_ / size_;
+  // the sum of diff_i * y_i / s_i over the window of each position
+  Dtype accum_ratio[kLRNTile];
+  for (int n = begin; n < end; ++n) {
+    const int offset = n * channels_ * spatial_dim;
+    for (int s = 0; s < spatial_dim; s += kLRNTile) {
+      const int tile = std::min(kLRNTile, spatial_dim - s);
+      const Dtype* dy = top_diff + offset + s;
+      const Dtype* y = top_data + offset + s;
+      const Dtype* x = bottom_data + offset + s;
+      const Dtype* scale = scale_data + offset + s;
+      Dtype* dx = bottom_diff + offset + s;
+      std::fill(accum_ratio, accum_ratio + tile, Dtype(0));
+      for (int c = 0; c < std::min(pre_pad_, channels_); ++c) {
+        const int index = c * spatial_dim;
+        for (int i = index; i < index + tile; ++i) {
+          accum_ratio[i - index] += dy[i] * y[i] / scale[i];
+        }
+      }
+      for (int c = 0; c < channels_; ++c) {
+        if (c + pre_pad_ < channels_) {
+          const int head = (c + pre_pad_) * spatial_dim;
+          for (int i = head; i < head + tile; ++i) {
+            accum_ratio[i - head] += dy[i] * y[i] / scale[i];
+          }
+        }
+        const int index = c * spatial_dim;
+        for (int i = index; i < index + tile; ++i) {
+          dx[i] = dy[i] * lrn_pow(scale[i], beta_)
+              - cache_ratio_value * x[i] * accum_ratio[i - index];
+        }
+        if (c - pre_pad_ >= 0) {
+          const int tail = (c - pre_pad_) * spatial_dim;
+          for (int i = tail; i < tail + tile; ++i) {
+            accum_ratio[i - tail] -= dy[i] * y[i] / scale[i];
+          }
+        }
+      }
     }
   }
 }
@@ -1,12 +1,24 @@
 #include <algorithm>
 #include <vector>
 
+#include "boost/bind/bind.hpp"
+
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
+#include "caffe/util/region_index.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
+// The pixels the CPU forward selects at a time. The probabilities of a tile
+// are swept once per class, and the tiles are split over the threads.
+static const int kMaskTile = 256;
+
 template <typename Dtype>
 void MaskLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -14,8 +26,11 @@ void MaskLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   threshold_ = this->layer_param_.mask_param().threshold();
   prev_mask_ = this->layer_param_.mask_param().prev_mask();
   ignore_label_ = this->layer_param_.mask_param().ignore_label();
+  exit_fraction_ = this->layer_param_.mask_param().exit_fraction();
   if (prev_mask_)
     CHECK_GE(bottom.size(), 2);
+  const int num_threads = this->layer_param_.mask_param().num_threads();
+  num_threads_ = num_threads ? num_threads : caffe_hardware_threads();
 }
 
 template <typename Dtype>
@@ -34,9 +49,13 @@ void MaskLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     CHECK_EQ(bottom[i]->channels(), 1);
   }
   num_ = bottom[0]->num();
+  channels_ = bottom[0]->channels();
   spatial_dim_ = bottom[0]->height() * bottom[0]->width();
+  tiles_ = (spatial_dim_ + kMaskTile - 1) / kMaskTile;
+  keep_.resize(num_ * spatial_dim_);
+  tile_start_.resize(num_ * tiles_);
   top[0]->Reshape(num_, 1, bottom[0]->height(), bottom[0]->width());
-  top[1]->Reshape(num_, 1, 2, spatial_dim_ + 1);
+  top[1]->Reshape(num_, 1, 1, region_index_width<Dtype>(spatial_dim_));
   if (top.size() > 2)
     top[2]->Reshape(num_, 1, 1, 1);
 }
@@ -45,9 +64,6 @@ void MaskLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void MaskLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-  int channels = bottom[0]->channels();
-  
-  const Dtype *prob = bottom[0]->cpu_data();
   const Dtype *prev_mask = NULL;
   const Dtype *label = NULL;
 
@@ -61,141 +77,106 @@ void MaskLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     if (bottom.size() > 1)
       label = bottom[1]->cpu_data();
 
-  Dtype *mask = top[0]->mutable_cpu_data();
-  Dtype *idx = top[1]->mutable_cpu_data();
-
-
+  // The selection is a stream compaction in three phases. First every tile
+  // flags its selected pixels and counts them.
+  caffe_parallel_for(num_ * tiles_, num_threads_, boost::bind(
+      &MaskLayer<Dtype>::select_tiles, this, bottom[0]->cpu_data(),
+      prev_mask, label, _1, _2, _3));
+  // Then a prefix sum over the tiles of each image gives every tile the
+  // column of its first selected pixel.
+  vector<int> counts(num_, 0);
   for (int l = 0; l < num_; l++)
   {
-    int cnt = 0;
-    if (prev_mask != NULL && label != NULL)
-    {
-      for (int i = 0; i < bottom[0]->height(); i++)
-        for (int j = 0; j < bottom[0]->width(); j++)
-        {
-          const int index = i * bottom[0]->width() + j;
-          mask[index] = Dtype(-1);
-          if (static_cast<int>(prev_mask[index]) == -1)
-            continue;
-
-          const int label_value = static_cast<int>(label[index]);
-          if (label_value != ignore_label_)
-          {
-            //not ignore label
-            if (prob[label_value * spatial_dim_ + index] > threshold_)
-              continue;
-          }
-          else
-          {
-            //ignore label
-            bool flag = false;
-            for (int k=0; k < channels; k++)
-              if (prob[k * spatial_dim_ + index] > threshold_)
-              {
-                flag = true;
-                break;
-              }
-            if (flag) continue;
-          }
-          //keep pixel (i, j)
-          idx[1 + cnt] = Dtype(i);
-          idx[spatial_dim_ + 2 + cnt] = Dtype(j);
-          mask[index] = Dtype(cnt++);
-        }
+    for (int t = l * tiles_; t < (l + 1) * tiles_; ++t) {
+      const int tile_cnt = tile_start_[t];
+      tile_start_[t] = counts[l];
+      counts[l] += tile_cnt;
     }
-    else if (prev_mask != NULL && label == NULL)
-    {
-      for (int i = 0; i < bottom[0]->height(); i++)
-          for (int j = 0; j < bottom[0]->width(); j++)
-          {
-            const int index = i * bottom[0]->width() + j;
-            mask[index] = Dtype(-1);
-            //prev mask
-            if (static_cast<int>(prev_mask[index]) == -1)
-              continue;
-
-            //get max probability
-            bool flag = false;
-            for (int k=0; k < channels; k++)
-              if (prob[k * spatial_dim_ + index] > threshold_)
-              {
-                flag = true;
-                break;
-              }
-            if (flag) continue;
-            //keep pixel (i, j)
-            idx[1 + cnt] = Dtype(i);
-            idx[spatial_dim_ + 2 + cnt] = Dtype(j);
-            mask[index] = Dtype(cnt++);
-        }
+    // too few pixels left are not worth another stage
+    if (counts[l] > 0 && counts[l] < exit_fraction_ * spatial_dim_) {
+      std::fill(keep_.begin() + l * spatial_dim_,
+          keep_.begin() + (l + 1) * spatial_dim_, 0);
+      std::fill(tile_start_.begin() + l * tiles_,
+          tile_start_.begin() + (l + 1) * tiles_, 0);
+      counts[l] = 0;
     }
-    else if (prev_mask == NULL && label != NULL)
-    {
-      for (int i = 0; i < bottom[0]->height(); i++)
-        for (int j = 0; j < bottom[0]->width(); j++)
-        {
-          const int index = i * bottom[0]->width() + j;
-          mask[index] = Dtype(-1);
-          //has label
-          const int label_value = static_cast<int>(label[index]);
-          if (label_value != ignore_label_)
-          {
-            //not ignore label
-            if (prob[label_value * spatial_dim_ + index] > threshold_)
-              continue;
-          }
-          else
-          {
-            //ignore label
-            bool flag = false;
-            for (int k=0; k < channels; k++)
-              if (prob[k * spatial_dim_ + index] > threshold_)
-              {
-                flag = true;
-                break;
-              }
-            if (flag) continue;
-          }
-          //keep pixel (i, j)
-          idx[1 + cnt] = Dtype(i);
-          idx[spatial_dim_ + 2 + cnt] = Dtype(j);
-          mask[index] = Dtype(cnt++);
-        }
+  }
+  // Last the tiles write the mask and the pixels of the index, in the same
+  // raster order as a serial scan.
+  const int index_stride = top[1]->count(1) * sizeof(Dtype) / sizeof(int);
+  caffe_parallel_for(num_ * tiles_, num_threads_, boost::bind(
+      &MaskLayer<Dtype>::scatter_tiles, this, top[0]->mutable_cpu_data(),
+      region_index_mutable_cpu(top[1], 0), index_stride, _1, _2, _3));
+  for (int l = 0; l < num_; l++)
+  {
+    region_index_finish(counts[l], region_index_mutable_cpu(top[1], l));
+    if (top.size() > 2)
+      top[2]->mutable_cpu_data()[l] = Dtype(counts[l]);
+  }
+}
+
+template <typename Dtype>
+void MaskLayer<Dtype>::select_tiles(const Dtype* prob, const Dtype* prev_mask,
+    const Dtype* label, int thread_id, int begin, int end) {
+  int label_value[kMaskTile];
+  for (int t = begin; t < end; ++t) {
+    const int l = t / tiles_;
+    const int j0 = (t % tiles_) * kMaskTile;
+    const int tile = std::min(kMaskTile, spatial_dim_ - j0);
+    const int offset = l * spatial_dim_ + j0;
+    unsigned char* keep = &keep_[offset];
+    for (int j = 0; j < tile; ++j) {
+      keep[j] = prev_mask == NULL ||
+          static_cast<int>(prev_mask[offset + j]) != -1;
     }
-    else if (prev_mask == NULL && label == NULL)
-    {
-      for (int i = 0; i < bottom[0]->height(); i++)
-          for (int j = 0; j < bottom[0]->width(); j++)
-          {
-            const int index = i * bottom[0]->width() + j;
-            mask[index] = Dtype(-1);
-            //get max probability
-            bool flag = false;
-            for (int k=0; k < channels; k++)
-              if (prob[k * spatial_dim_ + index] > threshold_)
-              {
-                flag = true;
-                break;
-              }
-            if (flag) continue;
-            //keep pixel (i, j)
-            idx[1 + cnt] = Dtype(i);
-            idx[spatial_dim_ + 2 + cnt] = Dtype(j);
-            mask[index] = Dtype(cnt++);
+    if (label != NULL) {
+      for (int j = 0; j < tile; ++j) {
+        label_value[j] = static_cast<int>(label[offset + j]);
+      }
+    }
+    // A pixel is dropped once a class it tests is above the threshold: a
+    // labelled pixel tests its own class, an ignored or unlabelled one all
+    // of them. The compares are branch free, so that they vectorize.
+    for (int c = 0; c < channels_; ++c) {
+      const Dtype* prob_c = prob + (l * channels_ + c) * spatial_dim_ + j0;
+      if (label == NULL) {
+        for (int j = 0; j < tile; ++j) {
+          keep[j] &= !(prob_c[j] > threshold_);
         }
+      } else {
+        for (int j = 0; j < tile; ++j) {
+          keep[j] &= !((prob_c[j] > threshold_) &
+              ((label_value[j] == c) | (label_value[j] == ignore_label_)));
+        }
+      }
+    }
+    int cnt = 0;
+    for (int j = 0; j < tile; ++j) {
+      cnt += keep[j];
+    }
+    tile_start_[t] = cnt;
+  }
+}
+
+template <typename Dtype>
+void MaskLayer<Dtype>::scatter_tiles(Dtype* mask, int* index,
+    const int index_stride, int thread_id, int begin, int end) {
+  for (int t = begin; t < end; ++t) {
+    const int l = t / tiles_;
+    const int j0 = (t % tiles_) * kMaskTile;
+    const int tile = std::min(kMaskTile, spatial_dim_ - j0);
+    const int offset = l * spatial_dim_ + j0;
+    const unsigned char* keep = &keep_[offset];
+    int* pixels = region_index_pixels(index + l * index_stride);
+    int m = tile_start_[t];
+    for (int j = 0; j < tile; ++j) {
+      if (keep[j]) {
+        mask[offset + j] = Dtype(m);
+        pixels[m++] = j0 + j;
+      } else {
+        mask[offset + j] = Dtype(-1);
+      }
     }
-    idx[0] = Dtype(cnt);
-    idx[spatial_dim_ + 1] = Dtype(cnt);
-    if (top.size() > 2)
-      top[2]->mutable_cpu_data()[l] = Dtype(cnt);
-    
-    prob += spatial_dim_ * bottom[0]->channels();
-    if (prev_mask != NULL)
-      prev_mask +=spatial_dim_;
-    if (label != NULL)
-      label +=spatial_dim_;
-    mask += spatial_dim_;
-    idx += 2 * (spatial_dim_ + 1);
   }
 }
 
@@ -2,14 +2,21 @@
 #include <cfloat>
 #include <vector>
 
+#include "boost/bind/bind.hpp"
+
 #include "caffe/common.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/syncedmem.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
 using std::min;
 using std::max;
 
@@ -76,6 +83,8 @@ void PoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
     CHECK_LT(pad_h_, kernel_h_);
     CHECK_LT(pad_w_, kernel_w_);
   }
+  num_threads_ = pool_param.num_threads() ? pool_param.num_threads()
+      : caffe_hardware_threads();
 }
 
 template <typename Dtype>
@@ -117,6 +126,17 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     max_idx_.Reshape(bottom[0]->num(), channels_, pooled_height_,
         pooled_width_);
   }
+  compact_mask_ = this->layer_param_.pooling_param().pool() ==
+      PoolingParameter_PoolMethod_MAX && top.size() == 1
+      && kernel_h_ * kernel_w_ <= 256;
+  if (compact_mask_) {
+    const size_t size = top[0]->count();
+    if (!max_offset_) {
+      max_offset_.reset(new SyncedMemory(size));
+    } else {
+      max_offset_->Resize(size);
+    }
+  }
   // If stochastic pooling, we will initialize the random index part.
   if (this->layer_param_.pooling_param().pool() ==
       PoolingParameter_PoolMethod_STOCHASTIC) {
@@ -125,107 +145,278 @@ void PoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   }
 }
 
-// TODO(Yangqing): Is there a faster way to do pooling in the channel-first
-// case?
+// The outputs [begin, end) along one axis whose windows lie wholly inside
+// the input, and so need no clipping.
+static inline void pool_interior(const int pad, const int stride,
+    const int kernel, const int size, const int pooled_size, int* begin,
+    int* end) {
+  *begin = std::min(pooled_size, (pad + stride - 1) / stride);
+  *end = size + pad >= kernel ?
+      std::min(pooled_size, (size + pad - kernel) / stride + 1) : 0;
+  *end = std::max(*begin, *end);
+}
+
+// Max pools the outputs [pw_begin, pw_end) of a row of KxK windows with
+// stride 2 lying wholly inside the input, whose first window starts at in.
+// The window size is fixed so that the loops unroll into straight selects.
+template <typename Dtype, int K>
+static void max_pool_row_s2(const Dtype* in, const int width,
+    const int pw_begin, const int pw_end, Dtype* out,
+    unsigned char* offsets) {
+  for (int pw = pw_begin; pw < pw_end; ++pw) {
+    const Dtype* window = in + 2 * pw;
+    Dtype value = window[0];
+    int offset = 0;
+    for (int i = 0; i < K; ++i) {
+      for (int j = 0; j < K; ++j) {
+        if (window[i * width + j] > value) {
+          value = window[i * width + j];
+          offset = i * K + j;
+        }
+      }
+    }
+    out[pw] = value;
+    offsets[pw] = offset;
+  }
+}
+
+// Average pools a row like max_pool_row_s2.
+template <typename Dtype, int K>
+static void ave_pool_row_s2(const Dtype* in, const int width,
+    const int pw_begin, const int pw_end, Dtype* out) {
+  for (int pw = pw_begin; pw < pw_end; ++pw) {
+    const Dtype* window = in + 2 * pw;
+    Dtype sum = 0;
+    for (int i = 0; i < K; ++i) {
+      for (int j = 0; j < K; ++j) {
+        sum += window[i * width + j];
+      }
+    }
+    out[pw] = sum / (K * K);
+  }
+}
+
 template <typename Dtype>
 void PoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   const Dtype* bottom_data = bottom[0]->cpu_data();
   Dtype* top_data = top[0]->mutable_cpu_data();
-  const int top_count = top[0]->count();
+  const int planes = bottom[0]->num() * channels_;
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
-  int* mask = NULL;  // suppress warnings about uninitalized variables
   Dtype* top_mask = NULL;
-  // Different pooling methods. We explicitly do the switch outside the for
-  // loop to save time, although this results in more code.
+  int* mask = NULL;
+  unsigned char* offsets = NULL;
+  // Each thread pools whole (num, channel) planes. We explicitly do the
+  // switch outside the loops to save time, although this results in more
+  // code.
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // Initialize
     if (use_top_mask) {
       top_mask = top[1]->mutable_cpu_data();
-      caffe_set(top_count, Dtype(-1), top_mask);
+    } else if (compact_mask_) {
+      offsets = static_cast<unsigned char*>(max_offset_->mutable_cpu_data());
     } else {
       mask = max_idx_.mutable_cpu_data();
-      caffe_set(top_count, -1, mask);
     }
-    caffe_set(top_count, Dtype(-FLT_MAX), top_data);
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_);
-            int wend = min(wstart + kernel_w_, width_);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            const int pool_index = ph * pooled_width_ + pw;
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                const int index = h * width_ + w;
-                if (bottom_data[index] > top_data[pool_index]) {
-                  top_data[pool_index] = bottom_data[index];
-                  if (use_top_mask) {
-                    top_mask[pool_index] = static_cast<Dtype>(index);
-                  } else {
-                    mask[pool_index] = index;
-                  }
-                }
-              }
+    caffe_parallel_for(planes, num_threads_, boost::bind(
+        &PoolingLayer<Dtype>::max_forward_planes, this, bottom_data,
+        top_data, top_mask, mask, offsets, _1, _2, _3));
+    break;
+  case PoolingParameter_PoolMethod_AVE:
+    caffe_parallel_for(planes, num_threads_, boost::bind(
+        &PoolingLayer<Dtype>::ave_forward_planes, this, bottom_data,
+        top_data, _1, _2, _3));
+    break;
+  case PoolingParameter_PoolMethod_STOCHASTIC:
+    if (this->phase_ == TRAIN) {
+      // Draw the thresholds up front: the random generator is not shared
+      // with the worker threads.
+      Dtype* rand_idx = rand_idx_.mutable_cpu_data();
+      caffe_rng_uniform(rand_idx_.count(), Dtype(0), Dtype(1), rand_idx);
+      caffe_parallel_for(planes, num_threads_, boost::bind(
+          &PoolingLayer<Dtype>::sto_forward_planes, this, bottom_data,
+          rand_idx, top_data, _1, _2, _3));
+    } else {
+      caffe_parallel_for(planes, num_threads_, boost::bind(
+          &PoolingLayer<Dtype>::sto_forward_planes, this, bottom_data,
+          static_cast<Dtype*>(NULL), top_data, _1, _2, _3));
+    }
+    break;
+  default:
+    LOG(FATAL) << "Unknown pooling method.";
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::max_forward_planes(const Dtype* bottom_data,
+    Dtype* top_data, Dtype* top_mask, int* mask, unsigned char* offsets,
+    int thread_id, int begin, int end) {
+  const int bottom_dim = height_ * width_;
+  const int top_dim = pooled_height_ * pooled_width_;
+  // The interior windows of the common 2x2 and 3x3 stride 2 poolings have
+  // unrolled kernels writing the compact mask.
+  const bool fast = offsets && stride_h_ == 2 && stride_w_ == 2
+      && kernel_h_ == kernel_w_ && (kernel_h_ == 2 || kernel_h_ == 3);
+  int ph_begin, ph_end, pw_begin, pw_end;
+  pool_interior(pad_h_, stride_h_, kernel_h_, height_, pooled_height_,
+      &ph_begin, &ph_end);
+  pool_interior(pad_w_, stride_w_, kernel_w_, width_, pooled_width_,
+      &pw_begin, &pw_end);
+  for (int p = begin; p < end; ++p) {
+    const Dtype* plane = bottom_data + p * bottom_dim;
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      const int pool_row = p * top_dim + ph * pooled_width_;
+      const int hstart = ph * stride_h_ - pad_h_;
+      const bool fast_row = fast && ph >= ph_begin && ph < ph_end;
+      if (fast_row) {
+        const Dtype* in = plane + hstart * width_ - pad_w_;
+        if (kernel_h_ == 2) {
+          max_pool_row_s2<Dtype, 2>(in, width_, pw_begin, pw_end,
+              top_data + pool_row, offsets + pool_row);
+        } else {
+          max_pool_row_s2<Dtype, 3>(in, width_, pw_begin, pw_end,
+              top_data + pool_row, offsets + pool_row);
+        }
+      }
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        if (fast_row && pw >= pw_begin && pw < pw_end) {
+          pw = pw_end - 1;
+          continue;
+        }
+        const int wstart = pw * stride_w_ - pad_w_;
+        const int hend = min(hstart + kernel_h_, height_);
+        const int wend = min(wstart + kernel_w_, width_);
+        int max_h = max(hstart, 0), max_w = max(wstart, 0);
+        Dtype value = plane[max_h * width_ + max_w];
+        for (int h = max(hstart, 0); h < hend; ++h) {
+          for (int w = max(wstart, 0); w < wend; ++w) {
+            if (plane[h * width_ + w] > value) {
+              value = plane[h * width_ + w];
+              max_h = h;
+              max_w = w;
             }
           }
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
+        const int pool_index = pool_row + pw;
+        top_data[pool_index] = value;
+        if (top_mask) {
+          top_mask[pool_index] = max_h * width_ + max_w;
+        } else if (offsets) {
+          offsets[pool_index] = (max_h - hstart) * kernel_w_ + max_w - wstart;
         } else {
-          mask += top[0]->offset(0, 1);
+          mask[pool_index] = max_h * width_ + max_w;
         }
       }
     }
-    break;
-  case PoolingParameter_PoolMethod_AVE:
-    for (int i = 0; i < top_count; ++i) {
-      top_data[i] = 0;
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::ave_forward_planes(const Dtype* bottom_data,
+    Dtype* top_data, int thread_id, int begin, int end) {
+  const int bottom_dim = height_ * width_;
+  const int top_dim = pooled_height_ * pooled_width_;
+  const bool fast = stride_h_ == 2 && stride_w_ == 2
+      && kernel_h_ == kernel_w_ && (kernel_h_ == 2 || kernel_h_ == 3);
+  int ph_begin, ph_end, pw_begin, pw_end;
+  pool_interior(pad_h_, stride_h_, kernel_h_, height_, pooled_height_,
+      &ph_begin, &ph_end);
+  pool_interior(pad_w_, stride_w_, kernel_w_, width_, pooled_width_,
+      &pw_begin, &pw_end);
+  for (int p = begin; p < end; ++p) {
+    const Dtype* plane = bottom_data + p * bottom_dim;
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      Dtype* out = top_data + p * top_dim + ph * pooled_width_;
+      const int hstart = ph * stride_h_ - pad_h_;
+      const bool fast_row = fast && ph >= ph_begin && ph < ph_end;
+      if (fast_row) {
+        const Dtype* in = plane + hstart * width_ - pad_w_;
+        if (kernel_h_ == 2) {
+          ave_pool_row_s2<Dtype, 2>(in, width_, pw_begin, pw_end, out);
+        } else {
+          ave_pool_row_s2<Dtype, 3>(in, width_, pw_begin, pw_end, out);
+        }
+      }
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        if (fast_row && pw >= pw_begin && pw < pw_end) {
+          pw = pw_end - 1;
+          continue;
+        }
+        const int wstart = pw * stride_w_ - pad_w_;
+        int hend = min(hstart + kernel_h_, height_ + pad_h_);
+        int wend = min(wstart + kernel_w_, width_ + pad_w_);
+        const int pool_size = (hend - hstart) * (wend - wstart);
+        hend = min(hend, height_);
+        wend = min(wend, width_);
+        Dtype sum = 0;
+        for (int h = max(hstart, 0); h < hend; ++h) {
+          for (int w = max(wstart, 0); w < wend; ++w) {
+            sum += plane[h * width_ + w];
+          }
+        }
+        out[pw] = sum / pool_size;
+      }
     }
-    // The main loop
-    for (int n = 0; n < bottom[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                top_data[ph * pooled_width_ + pw] +=
-                    bottom_data[h * width_ + w];
-              }
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::sto_forward_planes(const Dtype* bottom_data,
+    Dtype* rand_idx, Dtype* top_data, int thread_id, int begin, int end) {
+  const int bottom_dim = height_ * width_;
+  const int top_dim = pooled_height_ * pooled_width_;
+  for (int p = begin; p < end; ++p) {
+    const Dtype* plane = bottom_data + p * bottom_dim;
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      const int hstart = ph * stride_h_;
+      const int hend = min(hstart + kernel_h_, height_);
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        const int wstart = pw * stride_w_;
+        const int wend = min(wstart + kernel_w_, width_);
+        const int pool_index = p * top_dim + ph * pooled_width_ + pw;
+        if (!rand_idx) {
+          // At test time, weight the activations by their probabilities.
+          // Starting the sum at FLT_MIN avoids dividing by zero.
+          Dtype cumsum = FLT_MIN;
+          Dtype cumvalues = 0;
+          for (int h = hstart; h < hend; ++h) {
+            for (int w = wstart; w < wend; ++w) {
+              cumsum += plane[h * width_ + w];
+              cumvalues += plane[h * width_ + w] * plane[h * width_ + w];
+            }
+          }
+          top_data[pool_index] = cumvalues / cumsum;
+          continue;
+        }
+        // In training, sample an activation in proportion to its value and
+        // keep its index in place of the uniform threshold.
+        Dtype cumsum = 0;
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            cumsum += plane[h * width_ + w];
+          }
+        }
+        const Dtype thres = rand_idx[pool_index] * cumsum;
+        int index = -1;
+        cumsum = 0;
+        for (int h = hstart; h < hend && index < 0; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            cumsum += plane[h * width_ + w];
+            if (cumsum >= thres) {
+              index = h * width_ + w;
+              break;
             }
-            top_data[ph * pooled_width_ + pw] /= pool_size;
           }
         }
-        // compute offset
-        bottom_data += bottom[0]->offset(0, 1);
-        top_data += top[0]->offset(0, 1);
+        if (index < 0) {
+          // rounding left the threshold above the last partial sum
+          index = (hend - 1) * width_ + wend - 1;
+        }
+        rand_idx[pool_index] = index;
+        top_data[pool_index] = plane[index];
       }
     }
-    break;
-  case PoolingParameter_PoolMethod_STOCHASTIC:
-    NOT_IMPLEMENTED;
-    break;
-  default:
-    LOG(FATAL) << "Unknown pooling method.";
   }
 }
 
@@ -237,75 +428,101 @@ void PoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
   }
   const Dtype* top_diff = top[0]->cpu_diff();
   Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-  // Different pooling methods. We explicitly do the switch outside the for
-  // loop to save time, although this results in more codes.
-  caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
+  const int planes = top[0]->num() * channels_;
   // We'll output the mask to top[1] if it's of size >1.
   const bool use_top_mask = top.size() > 1;
-  const int* mask = NULL;  // suppress warnings about uninitialized variables
   const Dtype* top_mask = NULL;
+  const int* mask = NULL;
+  const unsigned char* offsets = NULL;
   switch (this->layer_param_.pooling_param().pool()) {
   case PoolingParameter_PoolMethod_MAX:
-    // The main loop
     if (use_top_mask) {
       top_mask = top[1]->cpu_data();
+    } else if (compact_mask_) {
+      offsets = static_cast<const unsigned char*>(max_offset_->cpu_data());
     } else {
       mask = max_idx_.cpu_data();
     }
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            const int index = ph * pooled_width_ + pw;
-            const int bottom_index =
-                use_top_mask ? top_mask[index] : mask[index];
-            bottom_diff[bottom_index] += top_diff[index];
-          }
-        }
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
-        if (use_top_mask) {
-          top_mask += top[0]->offset(0, 1);
+    caffe_parallel_for(planes, num_threads_, boost::bind(
+        &PoolingLayer<Dtype>::max_backward_planes, this, top_diff, top_mask,
+        mask, offsets, bottom_diff, _1, _2, _3));
+    break;
+  case PoolingParameter_PoolMethod_AVE:
+    caffe_parallel_for(planes, num_threads_, boost::bind(
+        &PoolingLayer<Dtype>::ave_backward_planes, this, top_diff,
+        bottom_diff, _1, _2, _3));
+    break;
+  case PoolingParameter_PoolMethod_STOCHASTIC:
+    // The forward pass left the index of the sampled activation.
+    caffe_parallel_for(planes, num_threads_, boost::bind(
+        &PoolingLayer<Dtype>::max_backward_planes, this, top_diff,
+        rand_idx_.cpu_data(), static_cast<const int*>(NULL),
+        static_cast<const unsigned char*>(NULL), bottom_diff, _1, _2, _3));
+    break;
+  default:
+    LOG(FATAL) << "Unknown pooling method.";
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::max_backward_planes(const Dtype* top_diff,
+    const Dtype* top_mask, const int* mask, const unsigned char* offsets,
+    Dtype* bottom_diff, int thread_id, int begin, int end) {
+  const int bottom_dim = height_ * width_;
+  const int top_dim = pooled_height_ * pooled_width_;
+  caffe_set(bottom_dim * (end - begin), Dtype(0),
+      bottom_diff + begin * bottom_dim);
+  for (int p = begin; p < end; ++p) {
+    Dtype* plane_diff = bottom_diff + p * bottom_dim;
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      const int hstart = ph * stride_h_ - pad_h_;
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        const int index = p * top_dim + ph * pooled_width_ + pw;
+        int bottom_index;
+        if (top_mask) {
+          bottom_index = static_cast<int>(top_mask[index]);
+        } else if (offsets) {
+          const int wstart = pw * stride_w_ - pad_w_;
+          bottom_index = (hstart + offsets[index] / kernel_w_) * width_
+              + wstart + offsets[index] % kernel_w_;
         } else {
-          mask += top[0]->offset(0, 1);
+          bottom_index = mask[index];
         }
+        plane_diff[bottom_index] += top_diff[index];
       }
     }
-    break;
-  case PoolingParameter_PoolMethod_AVE:
-    // The main loop
-    for (int n = 0; n < top[0]->num(); ++n) {
-      for (int c = 0; c < channels_; ++c) {
-        for (int ph = 0; ph < pooled_height_; ++ph) {
-          for (int pw = 0; pw < pooled_width_; ++pw) {
-            int hstart = ph * stride_h_ - pad_h_;
-            int wstart = pw * stride_w_ - pad_w_;
-            int hend = min(hstart + kernel_h_, height_ + pad_h_);
-            int wend = min(wstart + kernel_w_, width_ + pad_w_);
-            int pool_size = (hend - hstart) * (wend - wstart);
-            hstart = max(hstart, 0);
-            wstart = max(wstart, 0);
-            hend = min(hend, height_);
-            wend = min(wend, width_);
-            for (int h = hstart; h < hend; ++h) {
-              for (int w = wstart; w < wend; ++w) {
-                bottom_diff[h * width_ + w] +=
-                  top_diff[ph * pooled_width_ + pw] / pool_size;
-              }
-            }
+  }
+}
+
+template <typename Dtype>
+void PoolingLayer<Dtype>::ave_backward_planes(const Dtype* top_diff,
+    Dtype* bottom_diff, int thread_id, int begin, int end) {
+  const int bottom_dim = height_ * width_;
+  const int top_dim = pooled_height_ * pooled_width_;
+  caffe_set(bottom_dim * (end - begin), Dtype(0),
+      bottom_diff + begin * bottom_dim);
+  for (int p = begin; p < end; ++p) {
+    Dtype* plane_diff = bottom_diff + p * bottom_dim;
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      for (int pw = 0; pw < pooled_width_; ++pw) {
+        int hstart = ph * stride_h_ - pad_h_;
+        int wstart = pw * stride_w_ - pad_w_;
+        int hend = min(hstart + kernel_h_, height_ + pad_h_);
+        int wend = min(wstart + kernel_w_, width_ + pad_w_);
+        int pool_size = (hend - hstart) * (wend - wstart);
+        hstart = max(hstart, 0);
+        wstart = max(wstart, 0);
+        hend = min(hend, height_);
+        wend = min(wend, width_);
+        const Dtype diff =
+            top_diff[p * top_dim + ph * pooled_width_ + pw] / pool_size;
+        for (int h = hstart; h < hend; ++h) {
+          for (int w = wstart; w < wend; ++w) {
+            plane_diff[h * width_ + w] += diff;
           }
         }
-        // offset
-        bottom_diff += bottom[0]->offset(0, 1);
-        top_diff += top[0]->offset(0, 1);
       }
     }
-    break;
-  case PoolingParameter_PoolMethod_STOCHASTIC:
-    NOT_IMPLEMENTED;
-    break;
-  default:
-    LOG(FATAL) << "Unknown pooling method.";
   }
 }
 
@@ -50,8 +50,12 @@ void PowerLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
     const int count = bottom[0]->count();
     const Dtype* top_diff = top[0]->cpu_diff();
-    if (diff_scale_ == Dtype(0) || power_ == Dtype(1)) {
+    if (diff_scale_ == Dtype(0)) {
       caffe_set(count, diff_scale_, bottom_diff);
+    } else if (power_ == Dtype(1)) {
+      // Special case for y = shift + scale * x
+      //     -> dy/dx = scale, applied directly so that it works in place
+      caffe_cpu_scale(count, diff_scale_, top_diff, bottom_diff);
     } else {
       const Dtype* bottom_data = bottom[0]->cpu_data();
       // Compute dy/dx = scale * power * (shift + scale * x)^(power - 1)
@@ -88,7 +92,7 @@ void PowerLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
         }
       }
     }
-    if (diff_scale_ != Dtype(0)) {
+    if (diff_scale_ != Dtype(0) && power_ != Dtype(1)) {
       caffe_mul(count, top_diff, bottom_diff, bottom_diff);
     }
   }
@@ -39,8 +39,12 @@ void PowerLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
     const int count = bottom[0]->count();
     const Dtype* top_diff = top[0]->gpu_diff();
-    if (diff_scale_ == Dtype(0) || power_ == Dtype(1)) {
+    if (diff_scale_ == Dtype(0)) {
       caffe_gpu_set(count, diff_scale_, bottom_diff);
+    } else if (power_ == Dtype(1)) {
+      // Special case for y = shift + scale * x
+      //     -> dy/dx = scale, applied directly so that it works in place
+      caffe_gpu_scale(count, diff_scale_, top_diff, bottom_diff);
     } else {
       const Dtype* bottom_data = bottom[0]->gpu_data();
       // Compute dy/dx = scale * power * (shift + scale * x)^(power - 1)
@@ -77,7 +81,9 @@ void PowerLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
         }
       }
     }
-    caffe_gpu_mul(count, top_diff, bottom_diff, bottom_diff);
+    if (power_ != Dtype(1)) {
+      caffe_gpu_mul(count, top_diff, bottom_diff, bottom_diff);
+    }
   }
 }
 
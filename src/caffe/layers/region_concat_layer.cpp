@@ -2,6 +2,7 @@
 
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/region_index.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -20,13 +21,37 @@ void RegionConcatLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void RegionConcatLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  NOT_IMPLEMENTED;
+  // Both inputs hold the channels of the mask_cnt active pixels of an image
+  // back to back, so each image is two contiguous copies.
+  Dtype* top_data = top[0]->mutable_cpu_data();
+  for (int i = 0; i < bottom[0]->num(); i++) {
+    const int mask_cnt = region_index_count(region_index_cpu(*bottom[2], i));
+    const int count0 = bottom[0]->channels() * mask_cnt;
+    caffe_copy(count0, bottom[0]->cpu_data() + bottom[0]->offset(i),
+        top_data + top[0]->offset(i));
+    caffe_copy(bottom[1]->channels() * mask_cnt,
+        bottom[1]->cpu_data() + bottom[1]->offset(i),
+        top_data + top[0]->offset(i) + count0);
+  }
 }
 
 template <typename Dtype>
 void RegionConcatLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  NOT_IMPLEMENTED;
+  const Dtype* top_diff = top[0]->cpu_diff();
+  for (int i = 0; i < bottom[0]->num(); i++) {
+    const int mask_cnt = region_index_count(region_index_cpu(*bottom[2], i));
+    const int count0 = bottom[0]->channels() * mask_cnt;
+    if (propagate_down[0]) {
+      caffe_copy(count0, top_diff + top[0]->offset(i),
+          bottom[0]->mutable_cpu_diff() + bottom[0]->offset(i));
+    }
+    if (propagate_down[1]) {
+      caffe_copy(bottom[1]->channels() * mask_cnt,
+          top_diff + top[0]->offset(i) + count0,
+          bottom[1]->mutable_cpu_diff() + bottom[1]->offset(i));
+    }
+  }
 }
 
 #ifdef CPU_ONLY
@@ -2,6 +2,7 @@
 
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/region_index.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -21,7 +22,7 @@ void RegionConcatLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
 
   for (int i=0; i<bottom[0]->num(); i++)
   {
-    int mask_cnt = static_cast<int>(bottom[2]->cpu_data()[i]);
+    int mask_cnt = region_index_count(region_index_cpu(*bottom[2], i));
     int nthreads = bottom[0]->channels() * mask_cnt;
     region_concat<Dtype><<<CAFFE_GET_BLOCKS(nthreads), CAFFE_CUDA_NUM_THREADS>>>(
         nthreads, bottom[0]->gpu_data() + bottom[0]->offset(i), top_data);
@@ -39,7 +40,7 @@ void RegionConcatLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
 
   for (int i=0; i<bottom[0]->num(); i++)
   {
-    int mask_cnt = static_cast<int>(bottom[2]->cpu_data()[i]);
+    int mask_cnt = region_index_count(region_index_cpu(*bottom[2], i));
     int nthreads = bottom[0]->channels() * mask_cnt;
     if (propagate_down[0])
       region_concat<Dtype><<<CAFFE_GET_BLOCKS(nthreads), CAFFE_CUDA_NUM_THREADS>>>(
@@ -1,19 +1,16 @@
+#include <algorithm>
 #include <vector>
 
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/region_im2col.hpp"
+#include "caffe/util/region_index.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
-template <typename Dtype>
-Blob<Dtype>* RegionConvolutionLayer<Dtype>::col_buffer_ = new Blob<Dtype>();
-
-template <typename Dtype>
-Blob<Dtype>* RegionConvolutionLayer<Dtype>::top_buffer_ = new Blob<Dtype>();
-
 template <typename Dtype>
 void RegionConvolutionLayer<Dtype>::compute_output_shape() {
   this->height_out_ = (this->height_ + 2 * this->pad_h_ - (this->dilation_h_ * (this->kernel_h_ - 1) + 1)) + 1;
@@ -42,6 +39,20 @@ void RegionConvolutionLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& botto
 
   input_compression_ = this->layer_param_.region_convolution_param().input_compression();
   output_compression_ = this->layer_param_.region_convolution_param().output_compression();
+  num_threads_ = this->layer_param_.region_convolution_param().num_threads();
+  if (num_threads_ == 0) {
+    num_threads_ = caffe_hardware_threads();
+  }
+  // A fourth bottom is summed with the output as by RegionSumLayer, during
+  // the scatter of the active pixels.
+  fuse_sum_ = bottom.size() > 3;
+  if (fuse_sum_) {
+    const EltwiseParameter& eltwise_param = this->layer_param_.eltwise_param();
+    sum_op1_ = eltwise_param.coeff_size() > 0 ? eltwise_param.coeff(0) : 1;
+    sum_op2_ = eltwise_param.coeff_size() > 1 ? eltwise_param.coeff(1) : 1;
+    CHECK(!output_compression_)
+        << "The fused sum needs a dense output";
+  }
 
 
 
@@ -136,8 +147,9 @@ void RegionConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 
   CHECK_EQ(bottom[2]->num(), num_);
   CHECK_EQ(bottom[2]->channels(), 1);
-  CHECK_EQ(bottom[2]->height(), 2);
-  CHECK_EQ(bottom[2]->width(), spatial_dim_ + 1);
+  CHECK_EQ(bottom[2]->height(), 1);
+  CHECK_EQ(bottom[2]->width(), region_index_width<Dtype>(spatial_dim_))
+      << "bottom[2] must be the region index of a MaskLayer";
 
   // Shape the tops.
   compute_output_shape();
@@ -150,23 +162,36 @@ void RegionConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
     top[0]->Reshape(num_, num_output_, height_out_, width_out_);
   else
     top[0]->Reshape(num_, num_output_, 1, spatial_dim_);
+  if (fuse_sum_)
+    CHECK(bottom[3]->shape() == top[0]->shape())
+        << "The summed bottom must have the shape of the output";
     
   conv_in_height_ = height_;
   conv_in_width_ = width_;
   conv_out_spatial_dim_ = height_out_ * width_out_;
   
   kernel_dim_ = conv_in_channels_ * kernel_h_ * kernel_w_;
-  // The im2col result buffer will only hold one image at a time to avoid
-  // overly large memory usage. In the special case of 1x1 convolution
-  // it goes lazily unused to save memory.
-
-
-  if (col_buffer_->count() < kernel_dim_ * height_out_ * width_out_)
-    col_buffer_->Reshape(1, kernel_dim_, height_out_, width_out_);
+  // The im2col result buffer and the output buffer will only hold one image
+  // at a time to avoid overly large memory usage. Both live in the workspace
+  // shared by the layers of the net, the output buffer behind the im2col one.
+  // When they do not fit under the workspace limit, the CPU path unrolls
+  // chunk_pixels_ active pixels at a time, and passes the output of each
+  // chunk through a buffer of its own behind the output buffer.
+  const size_t top_size = conv_out_channels_ * conv_out_spatial_dim_;
+  const size_t limit = this->workspace()->limit() / sizeof(Dtype);
+  chunk_pixels_ = conv_out_spatial_dim_;
+  if (Caffe::mode() == Caffe::CPU && limit > 0
+      && (kernel_dim_ + conv_out_channels_) * chunk_pixels_ > limit) {
+    const size_t pixel_size = kernel_dim_ + 2 * conv_out_channels_;
+    chunk_pixels_ = std::max<int>(1, std::min<size_t>(chunk_pixels_ - 1,
+        limit > top_size ? (limit - top_size) / pixel_size : 0));
+  }
+  top_buffer_offset_ = kernel_dim_ * chunk_pixels_;
+  chunk_buffer_offset_ = top_buffer_offset_ + top_size;
+  this->workspace()->Reserve(sizeof(Dtype) * (chunk_buffer_offset_
+      + (chunk_pixels_ < conv_out_spatial_dim_ ?
+         conv_out_channels_ * chunk_pixels_ : 0)));
 
-  if (top_buffer_->count() < conv_out_channels_ * height_out_ * width_out_)
-    top_buffer_->Reshape(1, conv_out_channels_, height_out_, width_out_);
-  
   // Set up the all ones "bias multiplier" for adding biases by BLAS
   if (bias_term_) {
     vector<int> bias_multiplier_shape(1, height_out_ * width_out_);
@@ -182,13 +207,179 @@ void RegionConvolutionLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void RegionConvolutionLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  NOT_IMPLEMENTED;
+  const Dtype* weights = this->blobs_[0]->cpu_data();
+  Dtype* col_buffer = this->workspace()->template mutable_cpu_data<Dtype>();
+  Dtype* top_buffer =
+      this->workspace()->template mutable_cpu_data<Dtype>(top_buffer_offset_);
+  Dtype* chunk_buffer =
+      this->workspace()->template mutable_cpu_data<Dtype>(chunk_buffer_offset_);
+  for (int n = 0; n < num_; ++n) {
+    const Dtype* bottom_data = bottom[0]->cpu_data() + bottom[0]->offset(n);
+    const Dtype* mask_data = bottom[1]->cpu_data() + bottom[1]->offset(n);
+    const int* index = region_index_cpu(*bottom[2], n);
+    const int* pixels = region_index_pixels(index);
+    const int* runs = region_index_runs(index);
+    const int num_runs = region_index_num_runs(index);
+    const int mask_cnt = region_index_count(index);
+    Dtype* top_data = top[0]->mutable_cpu_data() + top[0]->offset(n);
+    for (int p = 0; p < mask_cnt; p += chunk_pixels_) {
+      const int cnt = std::min(chunk_pixels_, mask_cnt - p);
+      Dtype* chunk_top = (cnt < mask_cnt) ? chunk_buffer : top_buffer;
+      // gather the windows of the active pixels only
+      if (!input_compression_) {
+        region_im2col_cpu(bottom_data, pixels, mask_cnt,
+            conv_in_channels_, conv_in_height_, conv_in_width_, kernel_h_,
+            kernel_w_, pad_h_, pad_w_, dilation_h_, dilation_w_, col_buffer,
+            num_threads_, p, cnt);
+      } else {
+        compression_region_im2col_cpu(bottom_data, mask_data, pixels,
+            mask_cnt, conv_in_channels_, conv_in_height_,
+            conv_in_width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+            dilation_h_, dilation_w_, col_buffer, num_threads_, p, cnt);
+      }
+      caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_,
+          cnt, kernel_dim_, (Dtype)1., weights, col_buffer,
+          (Dtype)0., chunk_top);
+      if (bias_term_) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, num_output_,
+            cnt, 1, (Dtype)1., this->blobs_[1]->cpu_data(),
+            bias_multiplier_.cpu_data(), (Dtype)1., chunk_top);
+      }
+      if (chunk_top != top_buffer) {
+        for (int c = 0; c < conv_out_channels_; ++c) {
+          caffe_copy(cnt, chunk_top + c * cnt, top_buffer + c * mask_cnt + p);
+        }
+      }
+    }
+    // move back, a run of adjacent active pixels at a time
+    if (fuse_sum_) {
+      caffe_cpu_scale(top[0]->count(1), sum_op1_,
+          bottom[3]->cpu_data() + bottom[3]->offset(n), top_data);
+      for (int c = 0; c < conv_out_channels_; ++c) {
+        const Dtype* buffer = top_buffer + c * mask_cnt;
+        Dtype* top_c = top_data + c * conv_out_spatial_dim_;
+        for (int r = 0; r < num_runs; ++r) {
+          Dtype* run = top_c + runs[2 * r];
+          for (int k = 0; k < runs[2 * r + 1]; ++k) {
+            run[k] += sum_op2_ * buffer[k];
+          }
+          buffer += runs[2 * r + 1];
+        }
+      }
+    } else if (!output_compression_) {
+      caffe_set(top[0]->count(1), Dtype(0), top_data);
+      for (int c = 0; c < conv_out_channels_; ++c) {
+        const Dtype* buffer = top_buffer + c * mask_cnt;
+        Dtype* top_c = top_data + c * conv_out_spatial_dim_;
+        for (int r = 0; r < num_runs; ++r) {
+          std::copy(buffer, buffer + runs[2 * r + 1], top_c + runs[2 * r]);
+          buffer += runs[2 * r + 1];
+        }
+      }
+    } else {
+      caffe_copy(conv_out_channels_ * mask_cnt, top_buffer, top_data);
+    }
+  }
 }
 
 template <typename Dtype>
 void RegionConvolutionLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  NOT_IMPLEMENTED;
+  const Dtype* weights = this->blobs_[0]->cpu_data();
+  Dtype* col_buffer = this->workspace()->template mutable_cpu_data<Dtype>();
+  Dtype* top_buffer =
+      this->workspace()->template mutable_cpu_data<Dtype>(top_buffer_offset_);
+  Dtype* chunk_buffer =
+      this->workspace()->template mutable_cpu_data<Dtype>(chunk_buffer_offset_);
+  if (fuse_sum_ && propagate_down[3]) {
+    caffe_cpu_scale(top[0]->count(), sum_op1_, top[0]->cpu_diff(),
+        bottom[3]->mutable_cpu_diff());
+  }
+  for (int n = 0; n < num_; ++n) {
+    const Dtype* top_diff = top[0]->cpu_diff() + top[0]->offset(n);
+    const Dtype* bottom_data = bottom[0]->cpu_data() + bottom[0]->offset(n);
+    const Dtype* mask_data = bottom[1]->cpu_data() + bottom[1]->offset(n);
+    const int* index = region_index_cpu(*bottom[2], n);
+    const int* pixels = region_index_pixels(index);
+    const int* runs = region_index_runs(index);
+    const int num_runs = region_index_num_runs(index);
+    const int mask_cnt = region_index_count(index);
+    if (propagate_down[0]) {
+      caffe_set(bottom[0]->count(1), Dtype(0),
+          bottom[0]->mutable_cpu_diff() + bottom[0]->offset(n));
+    }
+    if (mask_cnt == 0) {
+      continue;
+    }
+    // pick out the gradient of the active outputs
+    if (!output_compression_) {
+      for (int c = 0; c < conv_out_channels_; ++c) {
+        const Dtype* top_diff_c = top_diff + c * conv_out_spatial_dim_;
+        Dtype* buffer = top_buffer + c * mask_cnt;
+        for (int r = 0; r < num_runs; ++r) {
+          buffer = std::copy(top_diff_c + runs[2 * r],
+              top_diff_c + runs[2 * r] + runs[2 * r + 1], buffer);
+        }
+      }
+    } else {
+      caffe_copy(conv_out_channels_ * mask_cnt, top_diff, top_buffer);
+    }
+    if (fuse_sum_) {
+      caffe_scal(conv_out_channels_ * mask_cnt, sum_op2_, top_buffer);
+    }
+    // Bias gradient, if necessary.
+    if (bias_term_ && this->param_propagate_down_[1]) {
+      caffe_cpu_gemv<Dtype>(CblasNoTrans, num_output_, mask_cnt, 1.,
+          top_buffer, bias_multiplier_.cpu_data(), 1.,
+          this->blobs_[1]->mutable_cpu_diff());
+    }
+    Dtype* bottom_diff = propagate_down[0] ?
+        bottom[0]->mutable_cpu_diff() + bottom[0]->offset(n) : NULL;
+    for (int p = 0; p < mask_cnt; p += chunk_pixels_) {
+      const int cnt = std::min(chunk_pixels_, mask_cnt - p);
+      Dtype* chunk_top = top_buffer;
+      if (cnt < mask_cnt) {
+        chunk_top = chunk_buffer;
+        for (int c = 0; c < conv_out_channels_; ++c) {
+          caffe_copy(cnt, top_buffer + c * mask_cnt + p, chunk_top + c * cnt);
+        }
+      }
+      // weight gradient
+      if (this->param_propagate_down_[0]) {
+        if (!input_compression_) {
+          region_im2col_cpu(bottom_data, pixels, mask_cnt,
+              conv_in_channels_, conv_in_height_, conv_in_width_, kernel_h_,
+              kernel_w_, pad_h_, pad_w_, dilation_h_, dilation_w_, col_buffer,
+              num_threads_, p, cnt);
+        } else {
+          compression_region_im2col_cpu(bottom_data, mask_data, pixels,
+              mask_cnt, conv_in_channels_, conv_in_height_,
+              conv_in_width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+              dilation_h_, dilation_w_, col_buffer, num_threads_, p, cnt);
+        }
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_,
+            kernel_dim_, cnt, (Dtype)1., chunk_top, col_buffer,
+            (Dtype)1., this->blobs_[0]->mutable_cpu_diff());
+      }
+      // data gradient
+      if (propagate_down[0]) {
+        caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_,
+            cnt, conv_out_channels_, (Dtype)1., weights, chunk_top,
+            (Dtype)0., col_buffer);
+        if (!input_compression_) {
+          region_col2im_cpu(col_buffer, pixels, mask_data, mask_cnt,
+              conv_in_channels_, conv_in_height_, conv_in_width_, kernel_h_,
+              kernel_w_, pad_h_, pad_w_, dilation_h_, dilation_w_,
+              bottom_diff, num_threads_, p, cnt);
+        } else {
+          compression_region_col2im_cpu(col_buffer, pixels, mask_data,
+              mask_cnt, conv_in_channels_, conv_in_height_,
+              conv_in_width_, kernel_h_, kernel_w_, pad_h_, pad_w_,
+              dilation_h_, dilation_w_, bottom_diff, num_threads_, p, cnt);
+        }
+      }
+    }
+  }
 }
 
 #ifdef CPU_ONLY
@@ -3,6 +3,7 @@
 #include "caffe/filler.hpp"
 #include "caffe/layer.hpp"
 #include "caffe/util/region_im2col.hpp"
+#include "caffe/util/region_index.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/vision_layers.hpp"
 
@@ -31,30 +32,32 @@ void RegionConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bott
   const Dtype* weights = this->blobs_[0]->gpu_data();
   const Dtype* bottom_data = bottom[0]->gpu_data();
   Dtype* top_data = top[0]->mutable_gpu_data();
-  Dtype* top_buffer = top_buffer_->mutable_gpu_data();
+  Dtype* col_buffer = this->workspace()->template mutable_gpu_data<Dtype>();
+  Dtype* top_buffer =
+      this->workspace()->template mutable_gpu_data<Dtype>(top_buffer_offset_);
   const Dtype* mask_data = bottom[1]->gpu_data();
-  const Dtype* index_1 = bottom[2]->gpu_data()+bottom[2]->offset(0, 0, 0, 1);
-  const Dtype* index_2 = bottom[2]->gpu_data()+bottom[2]->offset(0, 0, 1, 1);
+  // the count comes from the host copy MaskLayer wrote, without a sync
+  int mask_cnt_ = region_index_count(region_index_cpu(*bottom[2], 0));
+  const int* pixels = region_index_pixels(region_index_gpu(*bottom[2], 0));
   const int count = top[0]->count();
-  int mask_cnt_ = bottom[2]->cpu_data()[0];
 
   if (mask_cnt_!=0)
   {
     //region im2col
     if (!input_compression_)
     {
-      region_im2col_gpu(bottom_data, index_1, index_2, mask_cnt_, conv_in_channels_, conv_in_height_, conv_in_width_,
-            kernel_h_, kernel_w_, pad_h_, pad_w_, dilation_h_, dilation_w_, col_buffer_->mutable_gpu_data());
+      region_im2col_gpu(bottom_data, pixels, mask_cnt_, conv_in_channels_, conv_in_height_, conv_in_width_,
+            kernel_h_, kernel_w_, pad_h_, pad_w_, dilation_h_, dilation_w_, col_buffer);
     }
     else
     {
-      compression_region_im2col_gpu(bottom_data, bottom[1]->gpu_data(), index_1, index_2, mask_cnt_, conv_in_channels_, conv_in_height_, conv_in_width_,
-            kernel_h_, kernel_w_, pad_h_, pad_w_, dilation_h_, dilation_w_, col_buffer_->mutable_gpu_data());
+      compression_region_im2col_gpu(bottom_data, bottom[1]->gpu_data(), pixels, mask_cnt_, conv_in_channels_, conv_in_height_, conv_in_width_,
+            kernel_h_, kernel_w_, pad_h_, pad_w_, dilation_h_, dilation_w_, col_buffer);
     }
 
     //gemmm
     caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, conv_out_channels_, mask_cnt_, kernel_dim_,
-        (Dtype)1., weights, col_buffer_->gpu_data(),
+        (Dtype)1., weights, col_buffer,
         (Dtype)0., top_buffer);
 
     //bias
@@ -69,30 +72,32 @@ void RegionConvolutionLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bott
   if (!output_compression_)
   {
     move_back_kernel<Dtype><<<CAFFE_GET_BLOCKS(conv_out_spatial_dim_ * conv_out_channels_), CAFFE_CUDA_NUM_THREADS>>>(
-          conv_out_spatial_dim_ * conv_out_channels_, mask_data, top_buffer_->gpu_data(), conv_out_spatial_dim_, mask_cnt_,
+          conv_out_spatial_dim_ * conv_out_channels_, mask_data, top_buffer, conv_out_spatial_dim_, mask_cnt_,
           top_data);
   }
   else
   {
     compression_move_back_kernel<Dtype><<<CAFFE_GET_BLOCKS(mask_cnt_ * conv_out_channels_), CAFFE_CUDA_NUM_THREADS>>>(
-        mask_cnt_ * conv_out_channels_, top_buffer_->gpu_data(), top_data);
+        mask_cnt_ * conv_out_channels_, top_buffer, top_data);
   }
   CUDA_POST_KERNEL_CHECK;
+  if (fuse_sum_)
+  {
+    caffe_gpu_axpby(count, sum_op1_, bottom[3]->gpu_data(), sum_op2_,
+        top_data);
+  }
 }
 
 
 
 template <typename Dtype>
 __global__ void pick_out_kernel(const int n, const Dtype* data_diff,
-    const int height, const int width,
-    const Dtype* index_1, const Dtype* index_2,
+    const int spatial_dim, const int* pixels,
     const int mask_cnt, Dtype* diff_buffer) {
   CUDA_KERNEL_LOOP(index, n) {
     const int m_index = index % mask_cnt;
     const int c = index / mask_cnt;
-    const int h = index_1[m_index];
-    const int w = index_2[m_index];
-    diff_buffer[index] = data_diff[(c * height + h) * width + w];
+    diff_buffer[index] = data_diff[c * spatial_dim + pixels[m_index]];
   }
 }
 
@@ -118,10 +123,13 @@ void RegionConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top
   Dtype* bottom_diff = bottom[0]->mutable_gpu_diff();
 
   const Dtype* mask_data = bottom[1]->gpu_data();
-  const Dtype* index_1 = bottom[2]->gpu_data()+bottom[2]->offset(0, 0, 0, 1);
-  const Dtype* index_2 = bottom[2]->gpu_data()+bottom[2]->offset(0, 0, 1, 1);
+  // the count comes from the host copy MaskLayer wrote, without a sync
+  int mask_cnt_ = region_index_count(region_index_cpu(*bottom[2], 0));
+  const int* pixels = region_index_pixels(region_index_gpu(*bottom[2], 0));
   const int count = top[0]->count();
-  int mask_cnt_ = bottom[2]->cpu_data()[0];
+  Dtype* col_buffer = this->workspace()->template mutable_gpu_data<Dtype>();
+  Dtype* top_buffer =
+      this->workspace()->template mutable_gpu_data<Dtype>(top_buffer_offset_);
 
   //pick_out_kernel
   int num_kernels = conv_out_channels_ * mask_cnt_;
@@ -129,19 +137,25 @@ void RegionConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top
   if (!output_compression_)
   {
     pick_out_kernel<Dtype><<<CAFFE_GET_BLOCKS(num_kernels), CAFFE_CUDA_NUM_THREADS>>>(
-          num_kernels, top_diff, height_out_, width_out_, index_1, index_2, mask_cnt_, top_buffer_->mutable_gpu_diff());
+          num_kernels, top_diff, conv_out_spatial_dim_, pixels, mask_cnt_, top_buffer);
   }
   else
   {
     compression_pick_out_kernel<Dtype><<<CAFFE_GET_BLOCKS(num_kernels), CAFFE_CUDA_NUM_THREADS>>>(
-        num_kernels, top_diff, top_buffer_->mutable_gpu_diff());
+        num_kernels, top_diff, top_buffer);
+  }
+  if (fuse_sum_)
+  {
+    caffe_gpu_scal(num_kernels, sum_op2_, top_buffer);
+    if (propagate_down[3])
+      caffe_gpu_scale(count, sum_op1_, top_diff, bottom[3]->mutable_gpu_diff());
   }
 
 
   // Bias gradient, if necessary.
   if (this->bias_term_ && this->param_propagate_down_[1]) {
     caffe_gpu_gemv<Dtype>(CblasNoTrans, num_output_, mask_cnt_, 1.,
-        top_buffer_->gpu_diff(), bias_multiplier_.gpu_data(), 1., this->blobs_[1]->mutable_gpu_diff());
+        top_buffer, bias_multiplier_.gpu_data(), 1., this->blobs_[1]->mutable_gpu_diff());
   }
 
   // weight gradient
@@ -149,17 +163,17 @@ void RegionConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top
 
     if (!input_compression_)
     {
-      region_im2col_gpu(bottom_data, index_1, index_2, mask_cnt_, conv_in_channels_, conv_in_height_, conv_in_width_,
-            kernel_h_, kernel_w_, pad_h_, pad_w_, dilation_h_, dilation_w_, col_buffer_->mutable_gpu_data());
+      region_im2col_gpu(bottom_data, pixels, mask_cnt_, conv_in_channels_, conv_in_height_, conv_in_width_,
+            kernel_h_, kernel_w_, pad_h_, pad_w_, dilation_h_, dilation_w_, col_buffer);
     }
     else
     {
-      compression_region_im2col_gpu(bottom_data, bottom[1]->gpu_data(), index_1, index_2, mask_cnt_, conv_in_channels_, conv_in_height_, conv_in_width_,
-            kernel_h_, kernel_w_, pad_h_, pad_w_, dilation_h_, dilation_w_, col_buffer_->mutable_gpu_data());
+      compression_region_im2col_gpu(bottom_data, bottom[1]->gpu_data(), pixels, mask_cnt_, conv_in_channels_, conv_in_height_, conv_in_width_,
+            kernel_h_, kernel_w_, pad_h_, pad_w_, dilation_h_, dilation_w_, col_buffer);
     }
     caffe_gpu_gemm<Dtype>(CblasNoTrans, CblasTrans, conv_out_channels_,
         kernel_dim_, mask_cnt_,
-        (Dtype)1., top_buffer_->gpu_diff() , col_buffer_->gpu_data(),
+        (Dtype)1., top_buffer , col_buffer,
         (Dtype)1., this->blobs_[0]->mutable_gpu_diff());
   }
 
@@ -167,13 +181,13 @@ void RegionConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top
   if (propagate_down[0]) {
     caffe_gpu_gemm<Dtype>(CblasTrans, CblasNoTrans, kernel_dim_,
         mask_cnt_, conv_out_channels_,
-        (Dtype)1., weights , top_buffer_->gpu_diff(),
-        (Dtype)0., col_buffer_->mutable_gpu_data());
+        (Dtype)1., weights , top_buffer,
+        (Dtype)0., col_buffer);
     caffe_gpu_set(bottom[0]->count(), static_cast<Dtype>(0), bottom_diff);
     if (!input_compression_)
     {
-      region_col2im_gpu(col_buffer_->gpu_data(), 
-          index_1, index_2, mask_data,
+      region_col2im_gpu(col_buffer, 
+          pixels, mask_data,
           mask_cnt_, conv_in_channels_,
           conv_in_height_, conv_in_width_, kernel_h_, kernel_w_,
           pad_h_, pad_w_, dilation_h_, dilation_w_,
@@ -181,8 +195,8 @@ void RegionConvolutionLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top
     }
     else
     {
-      compression_region_col2im_gpu(col_buffer_->gpu_data(), 
-          index_1, index_2, mask_data,
+      compression_region_col2im_gpu(col_buffer, 
+          pixels, mask_data,
           mask_cnt_, conv_in_channels_,
           conv_in_height_, conv_in_width_, kernel_h_, kernel_w_,
           pad_h_, pad_w_, dilation_h_, dilation_w_,
@@ -1,34 +1,112 @@
 #include <vector>
 
+#include "boost/bind/bind.hpp"
+
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
+#include "caffe/util/region_index.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
 template <typename Dtype>
 void RegionSumLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
 	op1_ = this->layer_param().eltwise_param().coeff(0);
 	op2_ = this->layer_param().eltwise_param().coeff(1);	
+  const int num_threads = this->layer_param().eltwise_param().num_threads();
+  num_threads_ = num_threads ? num_threads : caffe_hardware_threads();
 }
 
 template <typename Dtype>
 void RegionSumLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
   top[0]->ReshapeLike(*bottom[0]);
+  channels_ = bottom[0]->channels();
+  spatial_dim_ = bottom[0]->count(2);
+  data1_dim_ = bottom[1]->count(1);
+  CHECK_EQ(bottom[3]->count(1), region_index_width<Dtype>(spatial_dim_))
+      << "bottom[3] must be the region index of the mask";
+  mask_counts_.resize(bottom[0]->num());
+}
+
+template <typename Dtype>
+const int* RegionSumLayer<Dtype>::mask_counts(const Blob<Dtype>& index) {
+  for (int n = 0; n < mask_counts_.size(); ++n) {
+    mask_counts_[n] = region_index_count(region_index_cpu(index, n));
+  }
+  return &mask_counts_[0];
 }
 
 template <typename Dtype>
 void RegionSumLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  NOT_IMPLEMENTED;
+  // The whole batch at once: the (image, channel) planes are split over the
+  // threads.
+  caffe_parallel_for(top[0]->count(0, 2), num_threads_, boost::bind(
+      &RegionSumLayer<Dtype>::forward_planes, this, bottom[0]->cpu_data(),
+      bottom[1]->cpu_data(), bottom[2]->cpu_data(), mask_counts(*bottom[3]),
+      top[0]->mutable_cpu_data(), _1, _2, _3));
+}
+
+template <typename Dtype>
+void RegionSumLayer<Dtype>::forward_planes(const Dtype* data0,
+    const Dtype* data1, const Dtype* mask_data, const int* mask_counts,
+    Dtype* top_data, int thread_id, int begin, int end) {
+  for (int p = begin; p < end; ++p) {
+    const int n = p / channels_;
+    const int c = p % channels_;
+    const int mask_cnt = mask_counts[n];
+    const Dtype* data0_c = data0 + p * spatial_dim_;
+    const Dtype* data1_c = data1 + n * data1_dim_ + c * mask_cnt;
+    const Dtype* mask = mask_data + n * spatial_dim_;
+    Dtype* top_c = top_data + p * spatial_dim_;
+    for (int i = 0; i < spatial_dim_; ++i) {
+      const int m = mask[i];
+      top_c[i] = data0_c[i] * op1_ + (m == -1 ? 0 : data1_c[m] * op2_);
+    }
+  }
 }
 
 template <typename Dtype>
 void RegionSumLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  NOT_IMPLEMENTED;
+  caffe_parallel_for(top[0]->count(0, 2), num_threads_, boost::bind(
+      &RegionSumLayer<Dtype>::backward_planes, this, top[0]->cpu_diff(),
+      bottom[2]->cpu_data(), mask_counts(*bottom[3]),
+      propagate_down[0] ? bottom[0]->mutable_cpu_diff() : NULL,
+      propagate_down[1] ? bottom[1]->mutable_cpu_diff() : NULL,
+      _1, _2, _3));
+}
+
+template <typename Dtype>
+void RegionSumLayer<Dtype>::backward_planes(const Dtype* top_diff,
+    const Dtype* mask_data, const int* mask_counts, Dtype* diff0,
+    Dtype* diff1, int thread_id, int begin, int end) {
+  for (int p = begin; p < end; ++p) {
+    const int n = p / channels_;
+    const int c = p % channels_;
+    const Dtype* top_c = top_diff + p * spatial_dim_;
+    if (diff0 != NULL) {
+      caffe_cpu_scale(spatial_dim_, op1_, top_c, diff0 + p * spatial_dim_);
+    }
+    if (diff1 != NULL) {
+      const int mask_cnt = mask_counts[n];
+      Dtype* diff1_c = diff1 + n * data1_dim_ + c * mask_cnt;
+      const Dtype* mask = mask_data + n * spatial_dim_;
+      for (int i = 0; i < spatial_dim_; ++i) {
+        const int m = mask[i];
+        if (m != -1) {
+          diff1_c[m] = top_c[i] * op2_;
+        }
+      }
+    }
+  }
 }
 
 #ifdef CPU_ONLY
@@ -2,6 +2,7 @@
 
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/region_index.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
@@ -30,7 +31,7 @@ void RegionSumLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
 
   for (int i=0; i<bottom[0]->num(); i++)
   {
-    int mask_cnt = static_cast<int>(bottom[3]->cpu_data()[i]);
+    int mask_cnt = region_index_count(region_index_cpu(*bottom[3], i));
     forward_kernel<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
         count, bottom_data0, bottom_data1, mask_data, spatial_dim, op1_, op2_, mask_cnt,
         top_data);
@@ -68,7 +69,7 @@ void RegionSumLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
 
   for (int i=0; i<bottom[0]->num(); i++)
   {
-    int mask_cnt = static_cast<int>(bottom[3]->cpu_data()[i]);
+    int mask_cnt = region_index_count(region_index_cpu(*bottom[3], i));
     backward_kernel<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
         count, bottom_data0, bottom_data1, mask_data, spatial_dim, op1_, op2_, mask_cnt,
         top_data);
@@ -5,8 +5,13 @@
 // Written by Ross Girshick
 // ------------------------------------------------------------------
 
-#include <cfloat>
+#include <cstring>
+#include <vector>
 
+#include "boost/bind/bind.hpp"
+
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
 using std::max;
@@ -16,6 +21,10 @@ using std::ceil;
 
 namespace caffe {
 
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
 template <typename Dtype>
 void ROIPoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
@@ -28,6 +37,8 @@ void ROIPoolingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
   pooled_width_ = roi_pool_param.pooled_w();
   spatial_scale_ = roi_pool_param.spatial_scale();
   LOG(INFO) << "Spatial scale: " << spatial_scale_;
+  num_threads_ = roi_pool_param.num_threads() ? roi_pool_param.num_threads()
+      : caffe_hardware_threads();
 }
 
 template <typename Dtype>
@@ -45,24 +56,29 @@ void ROIPoolingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
 template <typename Dtype>
 void ROIPoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  const Dtype* bottom_data = bottom[0]->cpu_data();
-  const Dtype* bottom_rois = bottom[1]->cpu_data();
-  // Number of ROIs
-  int num_rois = bottom[1]->num();
-  int batch_size = bottom[0]->num();
-  int top_count = top[0]->count();
-  Dtype* top_data = top[0]->mutable_cpu_data();
-  caffe_set(top_count, Dtype(-FLT_MAX), top_data);
-  int* argmax_data = max_idx_.mutable_cpu_data();
-  caffe_set(top_count, -1, argmax_data);
+  caffe_parallel_for(bottom[1]->num(), num_threads_, boost::bind(
+      &ROIPoolingLayer<Dtype>::forward_rois, this, bottom[0]->cpu_data(),
+      bottom[0]->num(), bottom[1]->cpu_data(), top[0]->mutable_cpu_data(),
+      max_idx_.mutable_cpu_data(), _1, _2, _3));
+}
 
+template <typename Dtype>
+void ROIPoolingLayer<Dtype>::forward_rois(const Dtype* bottom_data,
+    const int batch_size, const Dtype* bottom_rois, Dtype* top_data,
+    int* argmax_data, int thread_id, int begin, int end) {
+  const int pooled_dim = pooled_height_ * pooled_width_;
+  // the clipped [start, end) of the rows and columns of every bin, which
+  // are the same for all the channels of a ROI
+  vector<int> hstart(pooled_height_), hend(pooled_height_);
+  vector<int> wstart(pooled_width_), wend(pooled_width_);
   // For each ROI R = [batch_index x1 y1 x2 y2]: max pool over R
-  for (int n = 0; n < num_rois; ++n) {
-    int roi_batch_ind = bottom_rois[0];
-    int roi_start_w = round(bottom_rois[1] * spatial_scale_);
-    int roi_start_h = round(bottom_rois[2] * spatial_scale_);
-    int roi_end_w = round(bottom_rois[3] * spatial_scale_);
-    int roi_end_h = round(bottom_rois[4] * spatial_scale_);
+  for (int n = begin; n < end; ++n) {
+    const Dtype* roi = bottom_rois + n * 5;
+    int roi_batch_ind = roi[0];
+    int roi_start_w = round(roi[1] * spatial_scale_);
+    int roi_start_h = round(roi[2] * spatial_scale_);
+    int roi_end_w = round(roi[3] * spatial_scale_);
+    int roi_end_h = round(roi[4] * spatial_scale_);
     CHECK_GE(roi_batch_ind, 0);
     CHECK_LT(roi_batch_ind, batch_size);
 
@@ -72,64 +88,94 @@ void ROIPoolingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
                              / static_cast<Dtype>(pooled_height_);
     const Dtype bin_size_w = static_cast<Dtype>(roi_width)
                              / static_cast<Dtype>(pooled_width_);
-
-    const Dtype* batch_data = bottom_data + bottom[0]->offset(roi_batch_ind);
+    // Compute pooling region for this output unit:
+    //  start (included) = floor(ph * roi_height / pooled_height_)
+    //  end (excluded) = ceil((ph + 1) * roi_height / pooled_height_)
+    for (int ph = 0; ph < pooled_height_; ++ph) {
+      hstart[ph] = static_cast<int>(floor(static_cast<Dtype>(ph)
+                                          * bin_size_h));
+      hend[ph] = static_cast<int>(ceil(static_cast<Dtype>(ph + 1)
+                                       * bin_size_h));
+      hstart[ph] = min(max(hstart[ph] + roi_start_h, 0), height_);
+      hend[ph] = min(max(hend[ph] + roi_start_h, 0), height_);
+    }
+    for (int pw = 0; pw < pooled_width_; ++pw) {
+      wstart[pw] = static_cast<int>(floor(static_cast<Dtype>(pw)
+                                          * bin_size_w));
+      wend[pw] = static_cast<int>(ceil(static_cast<Dtype>(pw + 1)
+                                       * bin_size_w));
+      wstart[pw] = min(max(wstart[pw] + roi_start_w, 0), width_);
+      wend[pw] = min(max(wend[pw] + roi_start_w, 0), width_);
+    }
 
     for (int c = 0; c < channels_; ++c) {
+      const Dtype* batch_data = bottom_data +
+          (roi_batch_ind * channels_ + c) * height_ * width_;
+      Dtype* top = top_data + (n * channels_ + c) * pooled_dim;
+      int* argmax = argmax_data + (n * channels_ + c) * pooled_dim;
       for (int ph = 0; ph < pooled_height_; ++ph) {
         for (int pw = 0; pw < pooled_width_; ++pw) {
-          // Compute pooling region for this output unit:
-          //  start (included) = floor(ph * roi_height / pooled_height_)
-          //  end (excluded) = ceil((ph + 1) * roi_height / pooled_height_)
-          int hstart = static_cast<int>(floor(static_cast<Dtype>(ph)
-                                              * bin_size_h));
-          int wstart = static_cast<int>(floor(static_cast<Dtype>(pw)
-                                              * bin_size_w));
-          int hend = static_cast<int>(ceil(static_cast<Dtype>(ph + 1)
-                                           * bin_size_h));
-          int wend = static_cast<int>(ceil(static_cast<Dtype>(pw + 1)
-                                           * bin_size_w));
-
-          hstart = min(max(hstart + roi_start_h, 0), height_);
-          hend = min(max(hend + roi_start_h, 0), height_);
-          wstart = min(max(wstart + roi_start_w, 0), width_);
-          wend = min(max(wend + roi_start_w, 0), width_);
-
-          bool is_empty = (hend <= hstart) || (wend <= wstart);
-
           const int pool_index = ph * pooled_width_ + pw;
-          if (is_empty) {
-            top_data[pool_index] = 0;
-            argmax_data[pool_index] = -1;
+          if (hend[ph] <= hstart[ph] || wend[pw] <= wstart[pw]) {
+            // If nothing is pooled, argmax = -1 causes nothing to be
+            // backprop'd
+            top[pool_index] = 0;
+            argmax[pool_index] = -1;
+            continue;
           }
-
-          for (int h = hstart; h < hend; ++h) {
-            for (int w = wstart; w < wend; ++w) {
-              const int index = h * width_ + w;
-              if (batch_data[index] > top_data[pool_index]) {
-                top_data[pool_index] = batch_data[index];
-                argmax_data[pool_index] = index;
+          int max_index = hstart[ph] * width_ + wstart[pw];
+          Dtype max_value = batch_data[max_index];
+          for (int h = hstart[ph]; h < hend[ph]; ++h) {
+            const Dtype* row = batch_data + h * width_;
+            for (int w = wstart[pw]; w < wend[pw]; ++w) {
+              if (row[w] > max_value) {
+                max_value = row[w];
+                max_index = h * width_ + w;
               }
             }
           }
+          top[pool_index] = max_value;
+          argmax[pool_index] = max_index;
         }
       }
-      // Increment all data pointers by one channel
-      batch_data += bottom[0]->offset(0, 1);
-      top_data += top[0]->offset(0, 1);
-      argmax_data += max_idx_.offset(0, 1);
     }
-    // Increment ROI data pointer
-    bottom_rois += bottom[1]->offset(1);
   }
 }
 
 template <typename Dtype>
 void ROIPoolingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  NOT_IMPLEMENTED;
+  if (!propagate_down[0]) {
+    return;
+  }
+  Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
+  caffe_set(bottom[0]->count(), Dtype(0), bottom_diff);
+  caffe_parallel_for(channels_, num_threads_, boost::bind(
+      &ROIPoolingLayer<Dtype>::backward_channels, this, top[0]->cpu_diff(),
+      bottom[1]->cpu_data(), top[0]->num(), max_idx_.cpu_data(), bottom_diff,
+      _1, _2, _3));
 }
 
+template <typename Dtype>
+void ROIPoolingLayer<Dtype>::backward_channels(const Dtype* top_diff,
+    const Dtype* bottom_rois, const int num_rois, const int* argmax_data,
+    Dtype* bottom_diff, int thread_id, int begin, int end) {
+  const int pooled_dim = pooled_height_ * pooled_width_;
+  for (int c = begin; c < end; ++c) {
+    for (int n = 0; n < num_rois; ++n) {
+      const int roi_batch_ind = bottom_rois[n * 5];
+      Dtype* batch_diff = bottom_diff +
+          (roi_batch_ind * channels_ + c) * height_ * width_;
+      const Dtype* top = top_diff + (n * channels_ + c) * pooled_dim;
+      const int* argmax = argmax_data + (n * channels_ + c) * pooled_dim;
+      for (int i = 0; i < pooled_dim; ++i) {
+        if (argmax[i] >= 0) {
+          batch_diff[argmax[i]] += top[i];
+        }
+      }
+    }
+  }
+}
 
 #ifdef CPU_ONLY
 STUB_GPU(ROIPoolingLayer);
@@ -31,7 +31,7 @@ void ScaleLayer<Dtype>::Forward_gpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   const int count = top[0]->count();
   const Dtype* bottom_data = bottom[0]->gpu_data();
-  if (bottom[0] == top[0]) {
+  if (bottom[0]->data() == top[0]->data()) {
     // in-place computation; need to store bottom data before overwriting it.
     // Note that this is only necessary for Backward; we could skip this if not
     // doing Backward, but Caffe currently provides no way of knowing whether
@@ -67,7 +67,7 @@ void ScaleLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
   if ((!scale_param && propagate_down[1]) ||
       (scale_param && this->param_propagate_down_[0])) {
     const Dtype* top_diff = top[0]->gpu_diff();
-    const bool in_place = (bottom[0] == top[0]);
+    const bool in_place = (bottom[0]->data() == top[0]->data());
     const Dtype* bottom_data = (in_place ? &temp_ : bottom[0])->gpu_data();
     // Hack: store big eltwise product in bottom[0] diff, except in the special
     // case where this layer itself does the eltwise product, in which case we
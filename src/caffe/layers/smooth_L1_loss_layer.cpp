@@ -5,14 +5,30 @@
 // Written by Ross Girshick
 // ------------------------------------------------------------------
 
+#include <cmath>
+#include <vector>
+
+#include "boost/bind/bind.hpp"
+
 #include "caffe/loss_layers.hpp"
+#include "caffe/util/parallel.hpp"
 
 namespace caffe {
 
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
 template <typename Dtype>
 void SmoothL1LossLayer<Dtype>::LayerSetUp(
   const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  has_weights_ = (bottom.size() == 3);
+  has_weights_ = (bottom.size() >= 3);
+  has_outside_weights_ = (bottom.size() == 4);
+  const SmoothL1LossParameter& smooth_l1_loss_param =
+      this->layer_param_.smooth_l1_loss_param();
+  sigma2_ = smooth_l1_loss_param.sigma() * smooth_l1_loss_param.sigma();
+  const int num_threads = smooth_l1_loss_param.num_threads();
+  num_threads_ = num_threads ? num_threads : caffe_hardware_threads();
 }
 
 template <typename Dtype>
@@ -27,6 +43,11 @@ void SmoothL1LossLayer<Dtype>::Reshape(
     CHECK_EQ(bottom[0]->height(), bottom[2]->height());
     CHECK_EQ(bottom[0]->width(), bottom[2]->width());
   }
+  if (has_outside_weights_) {
+    CHECK_EQ(bottom[0]->channels(), bottom[3]->channels());
+    CHECK_EQ(bottom[0]->height(), bottom[3]->height());
+    CHECK_EQ(bottom[0]->width(), bottom[3]->width());
+  }
   diff_.Reshape(bottom[0]->num(), bottom[0]->channels(),
       bottom[0]->height(), bottom[0]->width());
   errors_.Reshape(bottom[0]->num(), bottom[0]->channels(),
@@ -36,13 +57,69 @@ void SmoothL1LossLayer<Dtype>::Reshape(
 template <typename Dtype>
 void SmoothL1LossLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
     const vector<Blob<Dtype>*>& top) {
-  NOT_IMPLEMENTED;
+  // A single pass computes the loss and its gradient, which is all that
+  // Backward needs. Each thread sums its own loss, and the sums are added in
+  // thread order. The threads share the data of diff_, which is taken here
+  // since mutable_cpu_data() is not safe to call from several of them.
+  partial_loss_.assign(num_threads_, Dtype(0));
+  caffe_parallel_for(bottom[0]->count(), num_threads_, boost::bind(
+      &SmoothL1LossLayer<Dtype>::forward_range, this, bottom[0]->cpu_data(),
+      bottom[1]->cpu_data(), has_weights_ ? bottom[2]->cpu_data() : NULL,
+      has_outside_weights_ ? bottom[3]->cpu_data() : NULL,
+      diff_.mutable_cpu_data(), _1, _2, _3));
+  Dtype loss = 0;
+  for (int i = 0; i < num_threads_; ++i) {
+    loss += partial_loss_[i];
+  }
+  top[0]->mutable_cpu_data()[0] = loss / bottom[0]->num();
+}
+
+template <typename Dtype>
+void SmoothL1LossLayer<Dtype>::forward_range(const Dtype* data0,
+    const Dtype* data1, const Dtype* inside_weights,
+    const Dtype* outside_weights, Dtype* diff, int thread_id, int begin,
+    int end) {
+  // f(x) = 0.5 * (sigma * x)^2    if |x| < 1 / sigma^2
+  //        |x| - 0.5 / sigma^2    otherwise
+  Dtype loss = 0;
+  for (int i = begin; i < end; ++i) {
+    Dtype val = data0[i] - data1[i];
+    if (inside_weights) {
+      val *= inside_weights[i];
+    }
+    const Dtype abs_val = std::fabs(val);
+    Dtype error, grad;
+    if (abs_val < 1 / sigma2_) {
+      error = 0.5 * val * val * sigma2_;
+      grad = sigma2_ * val;
+    } else {
+      error = abs_val - 0.5 / sigma2_;
+      grad = (Dtype(0) < val) - (val < Dtype(0));
+    }
+    if (inside_weights) {
+      grad *= inside_weights[i];
+    }
+    if (outside_weights) {
+      error *= outside_weights[i];
+      grad *= outside_weights[i];
+    }
+    loss += error;
+    diff[i] = grad;
+  }
+  partial_loss_[thread_id] = loss;
 }
 
 template <typename Dtype>
 void SmoothL1LossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  NOT_IMPLEMENTED;
+  for (int i = 0; i < 2; ++i) {
+    if (propagate_down[i]) {
+      const Dtype sign = (i == 0) ? 1 : -1;
+      const Dtype alpha = sign * top[0]->cpu_diff()[0] / bottom[i]->num();
+      caffe_cpu_scale(bottom[i]->count(), alpha, diff_.cpu_data(),
+          bottom[i]->mutable_cpu_diff());
+    }
+  }
 }
 
 #ifdef CPU_ONLY
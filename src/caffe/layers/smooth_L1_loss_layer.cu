@@ -10,16 +10,17 @@
 namespace caffe {
 
 template <typename Dtype>
-__global__ void SmoothL1Forward(const int n, const Dtype* in, Dtype* out) {
-  // f(x) = 0.5 * x^2    if |x| < 1
-  //        |x| - 0.5    otherwise
+__global__ void SmoothL1Forward(const int n, const Dtype* in, Dtype* out,
+    Dtype sigma2) {
+  // f(x) = 0.5 * (sigma * x)^2    if |x| < 1 / sigma^2
+  //        |x| - 0.5 / sigma^2    otherwise
   CUDA_KERNEL_LOOP(index, n) {
     Dtype val = in[index];
     Dtype abs_val = abs(val);
-    if (abs_val < 1) {
-      out[index] = 0.5 * val * val;
+    if (abs_val < 1.0 / sigma2) {
+      out[index] = 0.5 * val * val * sigma2;
     } else {
-      out[index] = abs_val - 0.5;
+      out[index] = abs_val - 0.5 / sigma2;
     }
   }
 }
@@ -41,8 +42,15 @@ void SmoothL1LossLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
         diff_.mutable_gpu_data());  // d := w * (b0 - b1)
   }
   SmoothL1Forward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
-      count, diff_.gpu_data(), errors_.mutable_gpu_data());
+      count, diff_.gpu_data(), errors_.mutable_gpu_data(), sigma2_);
   CUDA_POST_KERNEL_CHECK;
+  if (has_outside_weights_) {
+    caffe_gpu_mul(
+        count,
+        bottom[3]->gpu_data(),
+        errors_.gpu_data(),
+        errors_.mutable_gpu_data());  // e := w_out * e
+  }
 
   Dtype loss;
   caffe_gpu_asum(count, errors_.gpu_data(), &loss);
@@ -50,14 +58,15 @@ void SmoothL1LossLayer<Dtype>::Forward_gpu(const vector<Blob<Dtype>*>& bottom,
 }
 
 template <typename Dtype>
-__global__ void SmoothL1Backward(const int n, const Dtype* in, Dtype* out) {
-  // f'(x) = x         if |x| < 1
-  //       = sign(x)   otherwise
+__global__ void SmoothL1Backward(const int n, const Dtype* in, Dtype* out,
+    Dtype sigma2) {
+  // f'(x) = sigma^2 * x   if |x| < 1 / sigma^2
+  //       = sign(x)       otherwise
   CUDA_KERNEL_LOOP(index, n) {
     Dtype val = in[index];
     Dtype abs_val = abs(val);
-    if (abs_val < 1) {
-      out[index] = val;
+    if (abs_val < 1.0 / sigma2) {
+      out[index] = sigma2 * val;
     } else {
       out[index] = (Dtype(0) < val) - (val < Dtype(0));
     }
@@ -69,8 +78,22 @@ void SmoothL1LossLayer<Dtype>::Backward_gpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
   int count = diff_.count();
   SmoothL1Backward<Dtype><<<CAFFE_GET_BLOCKS(count), CAFFE_CUDA_NUM_THREADS>>>(
-      count, diff_.gpu_data(), diff_.mutable_gpu_data());
+      count, diff_.gpu_data(), diff_.mutable_gpu_data(), sigma2_);
   CUDA_POST_KERNEL_CHECK;
+  if (has_weights_) {
+    caffe_gpu_mul(
+        count,
+        bottom[2]->gpu_data(),
+        diff_.gpu_data(),
+        diff_.mutable_gpu_data());  // d := w_in * f'(d)
+  }
+  if (has_outside_weights_) {
+    caffe_gpu_mul(
+        count,
+        bottom[3]->gpu_data(),
+        diff_.gpu_data(),
+        diff_.mutable_gpu_data());  // d := w_out * d
+  }
   for (int i = 0; i < 2; ++i) {
     if (propagate_down[i]) {
       const Dtype sign = (i == 0) ? 1 : -1;
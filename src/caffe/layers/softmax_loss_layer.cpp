@@ -2,20 +2,28 @@
 #include <cfloat>
 #include <vector>
 
+#include "boost/bind/bind.hpp"
+
 #include "caffe/layer.hpp"
 #include "caffe/layer_factory.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
 
 namespace caffe {
 
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
 template <typename Dtype>
 void SoftmaxWithLossLayer<Dtype>::LayerSetUp(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
   LossLayer<Dtype>::LayerSetUp(bottom, top);
   LayerParameter softmax_param(this->layer_param_);
   softmax_param.set_type("Softmax");
+  softmax_param.clear_loss_weight();
   softmax_layer_ = LayerRegistry<Dtype>::CreateLayer(softmax_param);
   softmax_bottom_vec_.clear();
   softmax_bottom_vec_.push_back(bottom[0]);
@@ -29,6 +37,8 @@ void SoftmaxWithLossLayer<Dtype>::LayerSetUp(
     ignore_label_ = this->layer_param_.loss_param().ignore_label();
   }
   normalize_ = this->layer_param_.loss_param().normalize();
+  const int num_threads = this->layer_param_.softmax_param().num_threads();
+  num_threads_ = num_threads ? num_threads : caffe_hardware_threads();
 }
 
 template <typename Dtype>
@@ -53,28 +63,27 @@ void SoftmaxWithLossLayer<Dtype>::Reshape(
     temp.resize(inner_num_);
 }
 
+// The pixels handled at a time by the CPU kernels: the scores of a tile over
+// all the classes stay in cache between the passes of its softmax.
+static const int kSoftmaxLossTile = 64;
+
 template <typename Dtype>
 void SoftmaxWithLossLayer<Dtype>::Forward_cpu(
     const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
-  // The forward pass computes the softmax prob values.
-  softmax_layer_->Forward(softmax_bottom_vec_, softmax_top_vec_);
-  const Dtype* prob_data = prob_.cpu_data();
-  const Dtype* label = bottom[1]->cpu_data();
-  int dim = prob_.count() / outer_num_;
+  // The softmax and the loss are computed together, a tile of pixels at a
+  // time, rather than by the internal SoftmaxLayer.
+  const int tiles = (inner_num_ + kSoftmaxLossTile - 1) / kSoftmaxLossTile;
+  vector<Dtype> thread_loss(num_threads_, Dtype(0));
+  vector<int> thread_count(num_threads_, 0);
+  caffe_parallel_for(outer_num_ * tiles, num_threads_, boost::bind(
+      &SoftmaxWithLossLayer<Dtype>::forward_tiles, this, bottom[0]->cpu_data(),
+      bottom[1]->cpu_data(), prob_.mutable_cpu_data(), &thread_loss[0],
+      &thread_count[0], _1, _2, _3));
   int count = 0;
   Dtype loss = 0;
-  for (int i = 0; i < outer_num_; ++i) {
-    for (int j = 0; j < inner_num_; j++) {
-      const int label_value = static_cast<int>(label[i * inner_num_ + j]);
-      if (has_ignore_label_ && label_value == ignore_label_) {
-        continue;
-      }
-      DCHECK_GE(label_value, 0);
-      DCHECK_LT(label_value, prob_.shape(softmax_axis_));
-      loss -= log(std::max(prob_data[i * dim + label_value * inner_num_ + j],
-                           Dtype(FLT_MIN)));
-      ++count;
-    }
+  for (int t = 0; t < num_threads_; ++t) {
+    loss += thread_loss[t];
+    count += thread_count[t];
   }
   if (normalize_) {
     top[0]->mutable_cpu_data()[0] = loss / count;
@@ -86,6 +95,67 @@ void SoftmaxWithLossLayer<Dtype>::Forward_cpu(
   }
 }
 
+template <typename Dtype>
+void SoftmaxWithLossLayer<Dtype>::forward_tiles(const Dtype* bottom_data,
+    const Dtype* label, Dtype* prob_data, Dtype* thread_loss,
+    int* thread_count, int thread_id, int begin, int end) {
+  const int channels = prob_.shape(softmax_axis_);
+  const int dim = channels * inner_num_;
+  const int tiles = (inner_num_ + kSoftmaxLossTile - 1) / kSoftmaxLossTile;
+  Dtype max_value[kSoftmaxLossTile];
+  Dtype sum[kSoftmaxLossTile];
+  int count = 0;
+  Dtype loss = 0;
+  for (int t = begin; t < end; ++t) {
+    const int i = t / tiles;
+    const int j0 = (t % tiles) * kSoftmaxLossTile;
+    const int tile = std::min(kSoftmaxLossTile, inner_num_ - j0);
+    const Dtype* x = bottom_data + i * dim + j0;
+    Dtype* prob = prob_data + i * dim + j0;
+    // max over the classes, for numerical stability
+    std::copy(x, x + tile, max_value);
+    for (int c = 1; c < channels; ++c) {
+      const Dtype* x_c = x + c * inner_num_;
+      for (int j = 0; j < tile; ++j) {
+        max_value[j] = std::max(max_value[j], x_c[j]);
+      }
+    }
+    // exponentiate and sum
+    std::fill(sum, sum + tile, Dtype(0));
+    for (int c = 0; c < channels; ++c) {
+      const Dtype* x_c = x + c * inner_num_;
+      Dtype* prob_c = prob + c * inner_num_;
+      for (int j = 0; j < tile; ++j) {
+        prob_c[j] = exp(x_c[j] - max_value[j]);
+        sum[j] += prob_c[j];
+      }
+    }
+    // normalize
+    for (int j = 0; j < tile; ++j) {
+      sum[j] = Dtype(1) / sum[j];
+    }
+    for (int c = 0; c < channels; ++c) {
+      Dtype* prob_c = prob + c * inner_num_;
+      for (int j = 0; j < tile; ++j) {
+        prob_c[j] *= sum[j];
+      }
+    }
+    for (int j = 0; j < tile; ++j) {
+      const int label_value = static_cast<int>(label[i * inner_num_ + j0 + j]);
+      if (has_ignore_label_ && label_value == ignore_label_) {
+        continue;
+      }
+      DCHECK_GE(label_value, 0);
+      DCHECK_LT(label_value, channels);
+      loss -= log(std::max(prob[label_value * inner_num_ + j],
+                           Dtype(FLT_MIN)));
+      ++count;
+    }
+  }
+  thread_loss[thread_id] = loss;
+  thread_count[thread_id] = count;
+}
+
 template <typename Dtype>
 void SoftmaxWithLossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
     const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
@@ -94,31 +164,53 @@ void SoftmaxWithLossLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
                << " Layer cannot backpropagate to label inputs.";
   }
   if (propagate_down[0]) {
-    Dtype* bottom_diff = bottom[0]->mutable_cpu_diff();
-    const Dtype* prob_data = prob_.cpu_data();
-    caffe_copy(prob_.count(), prob_data, bottom_diff);
     const Dtype* label = bottom[1]->cpu_data();
-    int dim = prob_.count() / outer_num_;
-    int count = 0;
-    for (int i = 0; i < outer_num_; ++i) {
-      for (int j = 0; j < inner_num_; ++j) {
-        const int label_value = static_cast<int>(label[i * inner_num_ + j]);
-        if (has_ignore_label_ && label_value == ignore_label_) {
-          for (int c = 0; c < bottom[0]->shape(softmax_axis_); ++c) {
-            bottom_diff[i * dim + c * inner_num_ + j] = 0;
-          }
-        } else {
-          bottom_diff[i * dim + label_value * inner_num_ + j] -= 1;
-          ++count;
-        }
+    int count = outer_num_ * inner_num_;
+    if (has_ignore_label_) {
+      for (int i = 0; i < outer_num_ * inner_num_; ++i) {
+        count -= static_cast<int>(label[i]) == ignore_label_;
       }
     }
     // Scale gradient
     const Dtype loss_weight = top[0]->cpu_diff()[0];
-    if (normalize_) {
-      caffe_scal(prob_.count(), loss_weight / count, bottom_diff);
-    } else {
-      caffe_scal(prob_.count(), loss_weight / outer_num_, bottom_diff);
+    const Dtype scale = normalize_ ? loss_weight / count
+        : loss_weight / outer_num_;
+    const int tiles = (inner_num_ + kSoftmaxLossTile - 1) / kSoftmaxLossTile;
+    caffe_parallel_for(outer_num_ * tiles, num_threads_, boost::bind(
+        &SoftmaxWithLossLayer<Dtype>::backward_tiles, this, prob_.cpu_data(),
+        label, scale, bottom[0]->mutable_cpu_diff(), _1, _2, _3));
+  }
+}
+
+template <typename Dtype>
+void SoftmaxWithLossLayer<Dtype>::backward_tiles(const Dtype* prob_data,
+    const Dtype* label, const Dtype scale, Dtype* bottom_diff, int thread_id,
+    int begin, int end) {
+  const int channels = prob_.shape(softmax_axis_);
+  const int dim = channels * inner_num_;
+  const int tiles = (inner_num_ + kSoftmaxLossTile - 1) / kSoftmaxLossTile;
+  for (int t = begin; t < end; ++t) {
+    const int i = t / tiles;
+    const int j0 = (t % tiles) * kSoftmaxLossTile;
+    const int tile = std::min(kSoftmaxLossTile, inner_num_ - j0);
+    const Dtype* prob = prob_data + i * dim + j0;
+    Dtype* diff = bottom_diff + i * dim + j0;
+    for (int c = 0; c < channels; ++c) {
+      const Dtype* prob_c = prob + c * inner_num_;
+      Dtype* diff_c = diff + c * inner_num_;
+      for (int j = 0; j < tile; ++j) {
+        diff_c[j] = scale * prob_c[j];
+      }
+    }
+    for (int j = 0; j < tile; ++j) {
+      const int label_value = static_cast<int>(label[i * inner_num_ + j0 + j]);
+      if (has_ignore_label_ && label_value == ignore_label_) {
+        for (int c = 0; c < channels; ++c) {
+          diff[c * inner_num_ + j] = 0;
+        }
+      } else {
+        diff[label_value * inner_num_ + j] -= scale;
+      }
     }
   }
 }
@@ -1,14 +1,25 @@
+#include <algorithm>
+#include <cmath>
 #include <vector>
 
+#include "boost/bind/bind.hpp"
+
 #include "caffe/layer.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
 namespace caffe {
 
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
 template <typename Dtype>
 void WarpingLayer<Dtype>::LayerSetUp(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
+  const int num_threads = this->layer_param_.warping_param().num_threads();
+  num_threads_ = num_threads ? num_threads : caffe_hardware_threads();
 }
 
 template <typename Dtype>
@@ -28,19 +39,149 @@ void WarpingLayer<Dtype>::Reshape(const vector<Blob<Dtype>*>& bottom,
   head_.Reshape(num_, 1, bottom[0]->height(), bottom[0]->width());
   edge_.Reshape(num_, 1, spatial_dim_+10, 16); // prev, h, w, weight * 4 edges
 
+  tap_index_.resize(num_ * spatial_dim_ * 4);
+  tap_weight_.resize(num_ * spatial_dim_ * 4);
+
   top[0]->ReshapeLike(*(bottom[0]));
 }
 
 template <typename Dtype>
 void WarpingLayer<Dtype>::Forward_cpu(const vector<Blob<Dtype>*>& bottom,
       const vector<Blob<Dtype>*>& top) {
-  NOT_IMPLEMENTED;
+  // The taps depend on the flow only, so they are found once per pixel and
+  // then applied to every channel.
+  const int rows = num_ * height_;
+  caffe_parallel_for(rows, num_threads_, boost::bind(
+      &WarpingLayer<Dtype>::compute_taps, this, bottom[1]->cpu_data(),
+      _1, _2, _3));
+  caffe_parallel_for(rows, num_threads_, boost::bind(
+      &WarpingLayer<Dtype>::forward_rows, this, bottom[0]->cpu_data(),
+      top[0]->mutable_cpu_data(), _1, _2, _3));
+}
+
+template <typename Dtype>
+void WarpingLayer<Dtype>::compute_taps(const Dtype* flow_data,
+    int thread_id, int begin, int end) {
+  for (int row = begin; row < end; ++row) {
+    const int n = row / height_;
+    const int h = row % height_;
+    const Dtype* flow_w = flow_data + (n * 2 * height_ + h) * width_;
+    const Dtype* flow_h = flow_w + spatial_dim_;
+    int* index = &tap_index_[row * width_ * 4];
+    Dtype* weight = &tap_weight_[row * width_ * 4];
+    for (int w = 0; w < width_; ++w, index += 4, weight += 4) {
+      const Dtype sh = h + flow_h[w];
+      const Dtype sw = w + flow_w[w];
+      const int th = std::floor(sh);
+      const int tw = std::floor(sw);
+      const Dtype fh = sh - th;
+      const Dtype fw = sw - tw;
+      const int h0 = std::min(std::max(th, 0), height_ - 1) * width_;
+      const int h1 = std::min(std::max(th + 1, 0), height_ - 1) * width_;
+      const int w0 = std::min(std::max(tw, 0), width_ - 1);
+      const int w1 = std::min(std::max(tw + 1, 0), width_ - 1);
+      index[0] = h0 + w0;
+      index[1] = h1 + w0;
+      index[2] = h0 + w1;
+      index[3] = h1 + w1;
+      weight[0] = (1 - fh) * (1 - fw);
+      weight[1] = fh * (1 - fw);
+      weight[2] = (1 - fh) * fw;
+      weight[3] = fh * fw;
+    }
+  }
+}
+
+template <typename Dtype>
+void WarpingLayer<Dtype>::forward_rows(const Dtype* bottom_data,
+    Dtype* top_data, int thread_id, int begin, int end) {
+  for (int row = begin; row < end; ++row) {
+    const int n = row / height_;
+    const int h = row % height_;
+    const int* index = &tap_index_[row * width_ * 4];
+    const Dtype* weight = &tap_weight_[row * width_ * 4];
+    for (int c = 0; c < channels_; ++c) {
+      const Dtype* in = bottom_data + (n * channels_ + c) * spatial_dim_;
+      Dtype* out = top_data + (n * channels_ + c) * spatial_dim_ + h * width_;
+      for (int w = 0; w < width_; ++w) {
+        const int k = 4 * w;
+        out[w] = in[index[k]] * weight[k] + in[index[k + 1]] * weight[k + 1] +
+            in[index[k + 2]] * weight[k + 2] + in[index[k + 3]] * weight[k + 3];
+      }
+    }
+  }
 }
 
 template <typename Dtype>
 void WarpingLayer<Dtype>::Backward_cpu(const vector<Blob<Dtype>*>& top,
       const vector<bool>& propagate_down, const vector<Blob<Dtype>*>& bottom) {
-  NOT_IMPLEMENTED;
+  // Reuses the taps of the forward pass. The input gradient is scattered
+  // plane by plane, so that every element is accumulated by one thread in a
+  // fixed order and the result does not depend on the number of threads.
+  const Dtype* top_diff = top[0]->cpu_diff();
+  if (propagate_down[0]) {
+    caffe_parallel_for(num_ * channels_, num_threads_, boost::bind(
+        &WarpingLayer<Dtype>::backward_data_planes, this, top_diff,
+        bottom[0]->mutable_cpu_diff(), _1, _2, _3));
+  }
+  if (propagate_down[1]) {
+    caffe_parallel_for(num_ * height_, num_threads_, boost::bind(
+        &WarpingLayer<Dtype>::backward_flow_rows, this, top_diff,
+        bottom[0]->cpu_data(), bottom[1]->mutable_cpu_diff(), _1, _2, _3));
+  }
+}
+
+template <typename Dtype>
+void WarpingLayer<Dtype>::backward_data_planes(const Dtype* top_diff,
+    Dtype* bottom_diff, int thread_id, int begin, int end) {
+  for (int p = begin; p < end; ++p) {
+    const int n = p / channels_;
+    const Dtype* diff = top_diff + p * spatial_dim_;
+    const int* index = &tap_index_[n * spatial_dim_ * 4];
+    const Dtype* weight = &tap_weight_[n * spatial_dim_ * 4];
+    Dtype* in_diff = bottom_diff + p * spatial_dim_;
+    caffe_set(spatial_dim_, Dtype(0), in_diff);
+    for (int i = 0; i < spatial_dim_; ++i) {
+      const int k = 4 * i;
+      in_diff[index[k]] += weight[k] * diff[i];
+      in_diff[index[k + 1]] += weight[k + 1] * diff[i];
+      in_diff[index[k + 2]] += weight[k + 2] * diff[i];
+      in_diff[index[k + 3]] += weight[k + 3] * diff[i];
+    }
+  }
+}
+
+template <typename Dtype>
+void WarpingLayer<Dtype>::backward_flow_rows(const Dtype* top_diff,
+    const Dtype* bottom_data, Dtype* flow_diff, int thread_id, int begin,
+    int end) {
+  // The weights are products of (1 - fh or fh) and (1 - fw or fw), whose
+  // derivatives along the flow are -1 and 1; the fractions are sums of
+  // weights.
+  for (int row = begin; row < end; ++row) {
+    const int n = row / height_;
+    const int h = row % height_;
+    const int* index = &tap_index_[row * width_ * 4];
+    const Dtype* weight = &tap_weight_[row * width_ * 4];
+    Dtype* diff_w = flow_diff + (n * 2 * height_ + h) * width_;
+    Dtype* diff_h = diff_w + spatial_dim_;
+    caffe_set(width_, Dtype(0), diff_w);
+    caffe_set(width_, Dtype(0), diff_h);
+    for (int c = 0; c < channels_; ++c) {
+      const Dtype* in = bottom_data + (n * channels_ + c) * spatial_dim_;
+      const Dtype* diff =
+          top_diff + (n * channels_ + c) * spatial_dim_ + h * width_;
+      for (int w = 0; w < width_; ++w) {
+        const int k = 4 * w;
+        const Dtype v0 = in[index[k]], v1 = in[index[k + 1]];
+        const Dtype v2 = in[index[k + 2]], v3 = in[index[k + 3]];
+        const Dtype fh = weight[k + 1] + weight[k + 3];
+        const Dtype fw = weight[k + 2] + weight[k + 3];
+        diff_h[w] += diff[w] * ((1 - fw) * (v1 - v0) + fw * (v3 - v2));
+        diff_w[w] += diff[w] * ((1 - fh) * (v2 - v0) + fh * (v3 - v1));
+      }
+    }
+  }
 }
 
 #ifdef CPU_ONLY
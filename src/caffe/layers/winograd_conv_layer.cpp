@@ -0,0 +1,374 @@
+#include <vector>
+
+#include "boost/bind/bind.hpp"
+
+#include "caffe/layer.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/parallel.hpp"
+#include "caffe/util/winograd.hpp"
+#include "caffe/vision_layers.hpp"
+
+namespace caffe {
+
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::LayerSetUp(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::LayerSetUp(bottom, top);
+  CHECK(this->kernel_h_ == 3 && this->kernel_w_ == 3)
+      << "Winograd convolution only supports 3x3 kernels.";
+  CHECK(this->stride_h_ == 1 && this->stride_w_ == 1)
+      << "Winograd convolution only supports stride 1.";
+  CHECK(this->dilation_h_ == 1 && this->dilation_w_ == 1)
+      << "Winograd convolution does not support dilation.";
+  tile_ = this->layer_param_.convolution_param().winograd_tile();
+  CHECK(tile_ == 2 || tile_ == 4) << "winograd_tile must be 2 or 4.";
+  alpha_ = tile_ + 2;
+  bt_.resize(alpha_ * alpha_);
+  g_.resize(alpha_ * 3);
+  at_.resize(tile_ * alpha_);
+  winograd_matrices(tile_, &bt_[0], &g_[0], &at_[0]);
+  // The backward pass runs the transforms transposed.
+  b_.resize(bt_.size());
+  gt_.resize(g_.size());
+  a_.resize(at_.size());
+  for (int i = 0; i < alpha_; ++i) {
+    for (int j = 0; j < alpha_; ++j) {
+      b_[j * alpha_ + i] = bt_[i * alpha_ + j];
+    }
+    for (int j = 0; j < 3; ++j) {
+      gt_[j * alpha_ + i] = g_[i * 3 + j];
+    }
+    for (int j = 0; j < tile_; ++j) {
+      a_[i * tile_ + j] = at_[j * alpha_ + i];
+    }
+  }
+  vector<int> weight_shape(4);
+  weight_shape[0] = this->group_;
+  weight_shape[1] = alpha_ * alpha_;
+  weight_shape[2] = this->num_output_ / this->group_;
+  weight_shape[3] = this->channels_ / this->group_;
+  transformed_weights_.Reshape(weight_shape);
+  cached_weights_ = NULL;
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Reshape(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  ConvolutionLayer<Dtype>::Reshape(bottom, top);
+  tiles_h_ = (this->height_out_ + tile_ - 1) / tile_;
+  tiles_w_ = (this->width_out_ + tile_ - 1) / tile_;
+  // Each thread transforms the tiles of one image and group at a time, and
+  // accumulates its own weight gradient in the Winograd domain.
+  const int tiles = tiles_h_ * tiles_w_;
+  const int alpha2 = alpha_ * alpha_;
+  winograd_buffer_size_ = alpha2 * tiles
+      * (this->channels_ + this->num_output_) / this->group_
+      + transformed_weights_.count();
+  // Under a workspace limit, split over fewer threads.
+  const size_t limit = this->workspace()->limit() / sizeof(Dtype);
+  while (limit > 0 && this->cpu_threads_ > 1
+      && winograd_buffer_size_ * this->cpu_threads_ > limit) {
+    --this->cpu_threads_;
+  }
+  this->workspace()->Reserve(
+      sizeof(Dtype) * winograd_buffer_size_ * this->cpu_threads());
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::transform_weights() {
+  const SyncedMemory* weights = this->blobs_[0]->data().get();
+  if (weights == cached_weights_
+      && weights->version() == cached_version_) {
+    return;
+  }
+  const int alpha2 = alpha_ * alpha_;
+  const int out_channels = this->num_output_ / this->group_;
+  const int in_channels = this->channels_ / this->group_;
+  const int stride = out_channels * in_channels;
+  const Dtype* weight = this->blobs_[0]->cpu_data();
+  Dtype* transformed = transformed_weights_.mutable_cpu_data();
+  for (int g = 0; g < this->group_; ++g) {
+    for (int k = 0; k < out_channels; ++k) {
+      for (int c = 0; c < in_channels; ++c) {
+        winograd_transform(&g_[0], alpha_, 3,
+            weight + ((g * out_channels + k) * in_channels + c) * 9, 1,
+            transformed + g * alpha2 * stride + k * in_channels + c, stride);
+      }
+    }
+  }
+  cached_weights_ = weights;
+  cached_version_ = weights->version();
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::transform_input(const Dtype* input,
+    Dtype* tiles) {
+  const int in_channels = this->channels_ / this->group_;
+  const int num_tiles = tiles_h_ * tiles_w_;
+  const int stride = in_channels * num_tiles;
+  Dtype d[6 * 6];
+  for (int c = 0; c < in_channels; ++c) {
+    const Dtype* channel = input + c * this->height_ * this->width_;
+    for (int th = 0; th < tiles_h_; ++th) {
+      for (int tw = 0; tw < tiles_w_; ++tw) {
+        // gather the input tile, padding with zeros
+        const int h0 = th * tile_ - this->pad_h_;
+        const int w0 = tw * tile_ - this->pad_w_;
+        for (int i = 0; i < alpha_; ++i) {
+          for (int j = 0; j < alpha_; ++j) {
+            const int h = h0 + i;
+            const int w = w0 + j;
+            d[i * alpha_ + j] = (h >= 0 && h < this->height_ && w >= 0
+                && w < this->width_) ? channel[h * this->width_ + w] : 0;
+          }
+        }
+        winograd_transform(&bt_[0], alpha_, alpha_, d, 1,
+            tiles + c * num_tiles + th * tiles_w_ + tw, stride);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::transform_output_diff(
+    const Dtype* output_diff, Dtype* tiles) {
+  const int out_channels = this->num_output_ / this->group_;
+  const int num_tiles = tiles_h_ * tiles_w_;
+  const int stride = out_channels * num_tiles;
+  const int output_dim = this->height_out_ * this->width_out_;
+  Dtype dy[4 * 4];
+  for (int k = 0; k < out_channels; ++k) {
+    const Dtype* channel = output_diff + k * output_dim;
+    for (int th = 0; th < tiles_h_; ++th) {
+      for (int tw = 0; tw < tiles_w_; ++tw) {
+        // the outputs cropped at the border have no gradient
+        for (int i = 0; i < tile_; ++i) {
+          for (int j = 0; j < tile_; ++j) {
+            const int h = th * tile_ + i;
+            const int w = tw * tile_ + j;
+            dy[i * tile_ + j] = (h < this->height_out_ && w < this->width_out_)
+                ? channel[h * this->width_out_ + w] : 0;
+          }
+        }
+        winograd_transform(&a_[0], alpha_, tile_, dy, 1,
+            tiles + k * num_tiles + th * tiles_w_ + tw, stride);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::inverse_output(const Dtype* tiles,
+    Dtype* output) {
+  const int out_channels = this->num_output_ / this->group_;
+  const int num_tiles = tiles_h_ * tiles_w_;
+  const int stride = out_channels * num_tiles;
+  const int output_dim = this->height_out_ * this->width_out_;
+  Dtype y[4 * 4];
+  for (int k = 0; k < out_channels; ++k) {
+    Dtype* channel = output + k * output_dim;
+    for (int th = 0; th < tiles_h_; ++th) {
+      for (int tw = 0; tw < tiles_w_; ++tw) {
+        winograd_transform(&at_[0], tile_, alpha_,
+            tiles + k * num_tiles + th * tiles_w_ + tw, stride, y, 1);
+        // crop the tile at the border
+        for (int i = 0; i < tile_ && th * tile_ + i < this->height_out_; ++i) {
+          for (int j = 0; j < tile_ && tw * tile_ + j < this->width_out_;
+               ++j) {
+            channel[(th * tile_ + i) * this->width_out_ + tw * tile_ + j] =
+                y[i * tile_ + j];
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::inverse_input_diff(const Dtype* tiles,
+    Dtype* input_diff) {
+  const int in_channels = this->channels_ / this->group_;
+  const int num_tiles = tiles_h_ * tiles_w_;
+  const int stride = in_channels * num_tiles;
+  Dtype dx[6 * 6];
+  for (int c = 0; c < in_channels; ++c) {
+    Dtype* channel = input_diff + c * this->height_ * this->width_;
+    for (int th = 0; th < tiles_h_; ++th) {
+      for (int tw = 0; tw < tiles_w_; ++tw) {
+        winograd_transform(&b_[0], alpha_, alpha_,
+            tiles + c * num_tiles + th * tiles_w_ + tw, stride, dx, 1);
+        // the input tiles overlap, so accumulate, skipping the padding
+        const int h0 = th * tile_ - this->pad_h_;
+        const int w0 = tw * tile_ - this->pad_w_;
+        for (int i = 0; i < alpha_; ++i) {
+          const int h = h0 + i;
+          if (h < 0 || h >= this->height_) {
+            continue;
+          }
+          for (int j = 0; j < alpha_; ++j) {
+            const int w = w0 + j;
+            if (w >= 0 && w < this->width_) {
+              channel[h * this->width_ + w] += dx[i * alpha_ + j];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::forward_images(const Dtype* input,
+    const Dtype* weights, const Dtype* bias, Dtype* output, int thread_id,
+    int begin, int end) {
+  const int alpha2 = alpha_ * alpha_;
+  const int in_channels = this->channels_ / this->group_;
+  const int out_channels = this->num_output_ / this->group_;
+  const int num_tiles = tiles_h_ * tiles_w_;
+  const int input_dim = in_channels * this->height_ * this->width_;
+  const int output_dim = out_channels * this->height_out_ * this->width_out_;
+  Dtype* V = winograd_buffers_ + thread_id * winograd_buffer_size_;
+  Dtype* M = V + alpha2 * in_channels * num_tiles;
+  for (int n = begin; n < end; ++n) {
+    for (int g = 0; g < this->group_; ++g) {
+      transform_input(input + (n * this->group_ + g) * input_dim, V);
+      // one product per element of the transformed tiles
+      for (int xi = 0; xi < alpha2; ++xi) {
+        caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasNoTrans, out_channels,
+            num_tiles, in_channels, (Dtype)1.,
+            weights + (g * alpha2 + xi) * out_channels * in_channels,
+            V + xi * in_channels * num_tiles,
+            (Dtype)0., M + xi * out_channels * num_tiles);
+      }
+      inverse_output(M, output + (n * this->group_ + g) * output_dim);
+    }
+    if (bias) {
+      this->forward_cpu_bias(output + n * this->group_ * output_dim, bias);
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::backward_images(const Dtype* input,
+    const Dtype* output_diff, const Dtype* weights, Dtype* input_diff,
+    bool weight_gradient, int thread_id, int begin, int end) {
+  const int alpha2 = alpha_ * alpha_;
+  const int in_channels = this->channels_ / this->group_;
+  const int out_channels = this->num_output_ / this->group_;
+  const int num_tiles = tiles_h_ * tiles_w_;
+  const int input_dim = in_channels * this->height_ * this->width_;
+  const int output_dim = out_channels * this->height_out_ * this->width_out_;
+  Dtype* V = winograd_buffers_ + thread_id * winograd_buffer_size_;
+  Dtype* M = V + alpha2 * in_channels * num_tiles;
+  Dtype* weights_diff = M + alpha2 * out_channels * num_tiles;
+  if (weight_gradient) {
+    caffe_set(transformed_weights_.count(), Dtype(0), weights_diff);
+  }
+  for (int n = begin; n < end; ++n) {
+    for (int g = 0; g < this->group_; ++g) {
+      const int offset = (n * this->group_ + g);
+      transform_output_diff(output_diff + offset * output_dim, M);
+      // gradient w.r.t. the transformed weights
+      if (weight_gradient) {
+        transform_input(input + offset * input_dim, V);
+        for (int xi = 0; xi < alpha2; ++xi) {
+          caffe_cpu_gemm<Dtype>(CblasNoTrans, CblasTrans, out_channels,
+              in_channels, num_tiles, (Dtype)1.,
+              M + xi * out_channels * num_tiles,
+              V + xi * in_channels * num_tiles, (Dtype)1.,
+              weights_diff + (g * alpha2 + xi) * out_channels * in_channels);
+        }
+      }
+      // gradient w.r.t. bottom data, if necessary.
+      if (input_diff) {
+        for (int xi = 0; xi < alpha2; ++xi) {
+          caffe_cpu_gemm<Dtype>(CblasTrans, CblasNoTrans, in_channels,
+              num_tiles, out_channels, (Dtype)1.,
+              weights + (g * alpha2 + xi) * out_channels * in_channels,
+              M + xi * out_channels * num_tiles,
+              (Dtype)0., V + xi * in_channels * num_tiles);
+        }
+        caffe_set(input_dim, Dtype(0), input_diff + offset * input_dim);
+        inverse_input_diff(V, input_diff + offset * input_dim);
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Forward_cpu(
+    const vector<Blob<Dtype>*>& bottom, const vector<Blob<Dtype>*>& top) {
+  transform_weights();
+  const Dtype* weights = transformed_weights_.cpu_data();
+  const Dtype* bias = this->bias_term_ ? this->blobs_[1]->cpu_data() : NULL;
+  winograd_buffers_ = this->workspace()->template mutable_cpu_data<Dtype>();
+  for (int i = 0; i < bottom.size(); ++i) {
+    caffe_parallel_for(this->num_, this->cpu_threads(), boost::bind(
+        &WinogradConvolutionLayer<Dtype>::forward_images, this,
+        bottom[i]->cpu_data(), weights, bias, top[i]->mutable_cpu_data(),
+        _1, _2, _3));
+  }
+}
+
+template <typename Dtype>
+void WinogradConvolutionLayer<Dtype>::Backward_cpu(
+    const vector<Blob<Dtype>*>& top, const vector<bool>& propagate_down,
+    const vector<Blob<Dtype>*>& bottom) {
+  transform_weights();
+  const Dtype* weights = transformed_weights_.cpu_data();
+  Dtype* weight_diff = this->blobs_[0]->mutable_cpu_diff();
+  const int alpha2 = alpha_ * alpha_;
+  const int out_channels = this->num_output_ / this->group_;
+  const int in_channels = this->channels_ / this->group_;
+  const int threads = this->cpu_threads();
+  for (int i = 0; i < top.size(); ++i) {
+    const Dtype* top_diff = top[i]->cpu_diff();
+    // Bias gradient, if necessary.
+    if (this->bias_term_ && this->param_propagate_down_[1]) {
+      Dtype* bias_diff = this->blobs_[1]->mutable_cpu_diff();
+      for (int n = 0; n < this->num_; ++n) {
+        this->backward_cpu_bias(bias_diff, top_diff + top[i]->offset(n));
+      }
+    }
+    if (!this->param_propagate_down_[0] && !propagate_down[i]) {
+      continue;
+    }
+    winograd_buffers_ = this->workspace()->template mutable_cpu_data<Dtype>();
+    const int ranges = caffe_parallel_for(this->num_, threads, boost::bind(
+        &WinogradConvolutionLayer<Dtype>::backward_images, this,
+        bottom[i]->cpu_data(), top_diff, weights,
+        propagate_down[i] ? bottom[i]->mutable_cpu_diff() : NULL,
+        this->param_propagate_down_[0], _1, _2, _3));
+    // Sum the gradients of the threads and take them back to the filters.
+    // Only the threads that ran have cleared theirs.
+    if (this->param_propagate_down_[0] && ranges > 0) {
+      const int offset = alpha2 * tiles_h_ * tiles_w_
+          * (in_channels + out_channels);
+      Dtype* transformed_diff = winograd_buffers_ + offset;
+      for (int t = 1; t < ranges; ++t) {
+        caffe_axpy<Dtype>(transformed_weights_.count(), Dtype(1),
+            transformed_diff + t * winograd_buffer_size_, transformed_diff);
+      }
+      const int stride = out_channels * in_channels;
+      Dtype dw[3 * 3];
+      for (int g = 0; g < this->group_; ++g) {
+        for (int k = 0; k < out_channels; ++k) {
+          for (int c = 0; c < in_channels; ++c) {
+            winograd_transform(&gt_[0], 3, alpha_, transformed_diff
+                + g * alpha2 * stride + k * in_channels + c, stride, dw, 1);
+            caffe_axpy<Dtype>(9, Dtype(1), dw, weight_diff
+                + ((g * out_channels + k) * in_channels + c) * 9);
+          }
+        }
+      }
+    }
+  }
+}
+
+INSTANTIATE_CLASS(WinogradConvolutionLayer);
+
+}  // namespace caffe
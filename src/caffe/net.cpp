@@ -12,6 +12,7 @@
 #include "caffe/util/insert_splits.hpp"
 #include "caffe/util/io.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/region_index.hpp"
 #include "caffe/util/upgrade_proto.hpp"
 
 #include "caffe/util/channel.hpp"
@@ -79,6 +80,10 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   param_id_vecs_.resize(param.layer_size());
   top_id_vecs_.resize(param.layer_size());
   bottom_need_backward_.resize(param.layer_size());
+  // the scratch memory shared by the layers of this net
+  workspace_.reset(new Workspace(
+      static_cast<size_t>(param.mem_param().workspace_limit_mb()) << 20));
+  release_workspace_ = param.mem_param().release_workspace();
 
   for (int layer_id = 0; layer_id < param.layer_size(); ++layer_id) {
     // Inherit phase from net if unset.
@@ -95,6 +100,7 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
           << "either 0 or bottom_size times ";
     }
     layers_.push_back(LayerRegistry<Dtype>::CreateLayer(layer_param));
+    layers_[layer_id]->set_workspace(workspace_.get());
     layer_names_.push_back(layer_param.name());
     LOG(INFO) << "Creating Layer " << layer_param.name();
     bool need_backward = false;
@@ -299,6 +305,7 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
   debug_info_ = param.debug_info();
   LOG(INFO) << "Network initialization done.";
   LOG(INFO) << "Memory required for data: " << memory_used_ * sizeof(Dtype);
+  LOG(INFO) << "Workspace required: " << workspace_->size();
 
   // optimize memory
   optimize_memory_ = (param.mem_param().optimize_train() && phase_ == TRAIN) ||
@@ -309,6 +316,19 @@ void Net<Dtype>::Init(const NetParameter& in_param) {
     excluded_blob_names_.insert(param.mem_param().exclude_blob(ex_id));
   }
 
+  in_place_ = param.mem_param().in_place();
+
+  // activation recomputation is planned along with the memory optimization
+  recompute_ = param.mem_param().recompute();
+  recompute_segment_ids_.assign(layers_.size(), -1);
+  layer_compress_ids_.assign(layers_.size(), vector<int>());
+
+  // skipping the exited cascade stages is for inference only
+  cascade_early_exit_ = param.cascade_early_exit() && phase_ == TEST;
+  if (cascade_early_exit_) {
+    PlanCascadeExit();
+  }
+
   // launch memory optimization if necessary
   if (!debug_info_ && optimize_memory_) {
     MemoryOptimize_v2();
@@ -576,11 +596,32 @@ Dtype Net<Dtype>::ForwardFromTo(int start, int end) {
     }
   }
   for (int i = start; i <= end; ++i) {
+    if (cascade_early_exit_) {
+      bool exited = false;
+      for (int j = 0; j < layer_exit_masks_[i].size(); ++j) {
+        exited |= mask_exited_[layer_exit_masks_[i][j]];
+      }
+      if (exited) {
+        // a skipped Mask layer has no stage to run either
+        if (mask_layer_[i]) {
+          mask_exited_[i] = true;
+          ClearMask(i);
+        }
+        continue;
+      }
+    }
     // LOG(ERROR) << "Forwarding " << layer_names_[i];
     Dtype layer_loss = layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
     loss += layer_loss;
+    if (cascade_early_exit_ && mask_layer_[i]) {
+      mask_exited_[i] = MaskExited(i);
+    }
     if (debug_info_) { ForwardDebugInfo(i); }
+    for (int j = 0; j < layer_compress_ids_[i].size(); ++j) {
+      CompressBlob(layer_compress_ids_[i][j]);
+    }
   }
+  if (release_workspace_) { workspace_->Release(); }
 
 #ifdef USE_CUDNN
   if (Caffe::mode() == Caffe::GPU)
@@ -645,7 +686,23 @@ void Net<Dtype>::BackwardFromTo(int start, int end) {
   CHECK_GE(end, 0);
   CHECK_LT(start, layers_.size());
 
+  int recomputed_segment = -1;
   for (int i = start; i >= end; --i) {
+    // Regenerate the activations discarded in the forward pass once we enter
+    // a recompute segment from above.
+    const int segment_id = recompute_segment_ids_[i];
+    if (segment_id >= 0 && segment_id != recomputed_segment) {
+      if (recomputed_segment >= 0) { ReleaseSegment(recomputed_segment); }
+      RecomputeSegment(segment_id);
+      recomputed_segment = segment_id;
+    }
+    // Widen the packed activations of the layers we are about to reach.
+    for (int c = 0; c < compress_ranges_.size(); ++c) {
+      if (!compress_widened_[c] && compress_ranges_[c].first <= i &&
+          i <= compress_ranges_[c].second) {
+        WidenBlob(c);
+      }
+    }
     if (optimize_memory_) {
       // Manually set the bottom diff to zero if it is not backpropagated.
       // If not set, they may be corrupted when memory optimization is on.
@@ -709,6 +766,171 @@ void Net<Dtype>::BackwardFromTo(int start, int end) {
 #endif //USE_MPI
 
     }
+    if (segment_id >= 0 && i == recompute_segments_[segment_id].first) {
+      ReleaseSegment(segment_id);
+      recomputed_segment = -1;
+    }
+    for (int c = 0; c < compress_ranges_.size(); ++c) {
+      if (compress_widened_[c] && compress_ranges_[c].first == i) {
+        ReleaseWidenedBlob(c);
+      }
+    }
+  }
+  if (recomputed_segment >= 0) { ReleaseSegment(recomputed_segment); }
+  for (int c = 0; c < compress_ranges_.size(); ++c) {
+    if (compress_widened_[c]) { ReleaseWidenedBlob(c); }
+  }
+  if (release_workspace_) { workspace_->Release(); }
+}
+
+template <typename Dtype>
+void Net<Dtype>::RecomputeSegment(int segment_id) {
+  const vector<int>& blob_ids = recompute_blob_ids_[segment_id];
+  for (int i = 0; i < blob_ids.size(); ++i) {
+    const int blob_id = blob_ids[i];
+    recompute_data_storage_[blob_id]->Resize(
+        blobs_[blob_id]->count() * sizeof(Dtype));
+    blobs_[blob_id]->SetDataStorage(recompute_data_storage_[blob_id]);
+  }
+  for (int i = recompute_segments_[segment_id].first;
+       i <= recompute_segments_[segment_id].second; ++i) {
+    if (!layer_recompute_[i]) { continue; }
+    layers_[i]->set_recomputing(true);
+    layers_[i]->Forward(bottom_vecs_[i], top_vecs_[i]);
+    layers_[i]->set_recomputing(false);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::ReleaseSegment(int segment_id) {
+  const vector<int>& blob_ids = recompute_blob_ids_[segment_id];
+  for (int i = 0; i < blob_ids.size(); ++i) {
+    blobs_[blob_ids[i]]->SetDataStorage(forward_data_storage_[blob_ids[i]]);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::CompressBlob(int compress_id) {
+  const Blob<Dtype>* blob = blobs_[compress_blob_ids_[compress_id][0]].get();
+  compress_storage_[compress_id]->Resize(blob->count() * sizeof(uint16_t));
+  uint16_t* packed = static_cast<uint16_t*>(
+      compress_storage_[compress_id]->mutable_cpu_data());
+  if (compress_precisions_[compress_id] == LayerParameter_StoragePrecision_FLOAT16) {
+    caffe_cpu_float2half(blob->count(), blob->cpu_data(), packed);
+  } else {
+    caffe_cpu_float2bfloat16(blob->count(), blob->cpu_data(), packed);
+  }
+}
+
+template <typename Dtype>
+void Net<Dtype>::WidenBlob(int compress_id) {
+  const vector<int>& blob_ids = compress_blob_ids_[compress_id];
+  for (int i = 0; i < blob_ids.size(); ++i) {
+    blobs_[blob_ids[i]]->SetDataStorage(recompute_data_storage_[blob_ids[i]]);
+  }
+  Blob<Dtype>* blob = blobs_[blob_ids[0]].get();
+  const uint16_t* packed = static_cast<const uint16_t*>(
+      compress_storage_[compress_id]->cpu_data());
+  if (compress_precisions_[compress_id] == LayerParameter_StoragePrecision_FLOAT16) {
+    caffe_cpu_half2float(blob->count(), packed, blob->mutable_cpu_data());
+  } else {
+    caffe_cpu_bfloat162float(blob->count(), packed, blob->mutable_cpu_data());
+  }
+  compress_widened_[compress_id] = true;
+}
+
+template <typename Dtype>
+void Net<Dtype>::ReleaseWidenedBlob(int compress_id) {
+  const vector<int>& blob_ids = compress_blob_ids_[compress_id];
+  for (int i = 0; i < blob_ids.size(); ++i) {
+    blobs_[blob_ids[i]]->SetDataStorage(forward_data_storage_[blob_ids[i]]);
+  }
+  compress_widened_[compress_id] = false;
+}
+
+template <typename Dtype>
+void Net<Dtype>::PlanCascadeExit() {
+  // A Region layer reads nothing but its dense inputs for an image without
+  // active pixels, so its dense outputs stay valid when its mask exits. Its
+  // compressed outputs then hold no column, and neither do the outputs of
+  // the layers they feed, which are not worth running. That includes the
+  // Mask layer of a later stage, whose stage then exits as well. An image
+  // that exits alone stays in the batch: with no active pixel its stage only
+  // costs the dense copies, which a smaller batch would need as well.
+  vector<int> blob_mask(blobs_.size(), -1);
+  vector<vector<int> > blob_exit_masks(blobs_.size());
+  layer_exit_masks_.assign(layers_.size(), vector<int>());
+  mask_exited_.assign(layers_.size(), false);
+  mask_layer_.assign(layers_.size(), false);
+  for (int i = 0; i < layers_.size(); ++i) {
+    const string type = layers_[i]->type();
+    const LayerParameter& layer_param = layers_[i]->layer_param();
+    vector<int> masks;
+    const bool region = type.compare(0, 6, "Region") == 0;
+    for (int j = 0; j < bottom_id_vecs_[i].size(); ++j) {
+      const int blob_id = bottom_id_vecs_[i][j];
+      if (region) {
+        // the outputs of a Region layer only depend on the mask it reads
+        if (blob_mask[blob_id] >= 0) {
+          masks.push_back(blob_mask[blob_id]);
+        }
+      } else {
+        masks.insert(masks.end(), blob_exit_masks[blob_id].begin(),
+            blob_exit_masks[blob_id].end());
+      }
+    }
+    std::sort(masks.begin(), masks.end());
+    masks.erase(std::unique(masks.begin(), masks.end()), masks.end());
+    if (type == "Mask") {
+      mask_layer_[i] = true;
+      for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+        blob_mask[top_id_vecs_[i][j]] = i;
+      }
+    }
+    const bool compressed_output = type == "RegionConcat" ||
+        (type == "RegionConvolution" &&
+         layer_param.region_convolution_param().output_compression());
+    if (!region) {
+      layer_exit_masks_[i] = masks;
+    } else if (!compressed_output) {
+      masks.clear();
+    }
+    for (int j = 0; j < top_id_vecs_[i].size(); ++j) {
+      const int blob_id = top_id_vecs_[i][j];
+      blob_exit_masks[blob_id] = masks;
+      // the copies of a mask made by a split are the mask
+      if (type == "Split" && bottom_id_vecs_[i].size() == 1) {
+        blob_mask[blob_id] = blob_mask[bottom_id_vecs_[i][0]];
+      }
+    }
+    if (!layer_exit_masks_[i].empty()) {
+      LOG(INFO) << layer_names_[i] << " is skipped when its cascade stage "
+          << "exits";
+    }
+  }
+}
+
+template <typename Dtype>
+bool Net<Dtype>::MaskExited(int layer_id) const {
+  const Blob<Dtype>& index = *top_vecs_[layer_id][1];
+  for (int n = 0; n < index.num(); ++n) {
+    if (region_index_count(region_index_cpu(index, n)) > 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+template <typename Dtype>
+void Net<Dtype>::ClearMask(int layer_id) {
+  // the dense outputs of its Region layers must not see the last pass
+  const vector<Blob<Dtype>*>& top = top_vecs_[layer_id];
+  caffe_set(top[0]->count(), Dtype(-1), top[0]->mutable_cpu_data());
+  for (int n = 0; n < top[1]->num(); ++n) {
+    region_index_finish(0, region_index_mutable_cpu(top[1], n));
+  }
+  if (top.size() > 2) {
+    caffe_set(top[2]->count(), Dtype(0), top[2]->mutable_cpu_data());
   }
 }
 
@@ -1070,7 +1292,11 @@ inline string create_or_link(boost::unordered_map<string, string>& record,
                              const string& blob_name, const string& suffix){
   string name = blob_name + suffix;
   if (record.find(name) != record.end()){
-    return record[name];
+    // follow the links up to the root of the union
+    while (record[name] != name){
+      name = record[name];
+    }
+    return name;
   }else{
     record[name] = name;
     return name;
@@ -1126,6 +1352,74 @@ void Net<Dtype>::MemoryOptimize_v2(){
     }
   }
 
+  // Let layers run in place where they allow it: the top takes over the data
+  // and diff of the bottom when the bottom is read by this layer only and its
+  // producer does not need it in Backward any more. This chains through runs
+  // like BN -> Scale -> ReLU, which then use a single buffer.
+  if (in_place_) {
+    vector<int> blob_consumers(blobs_.size(), 0);
+    vector<int> blob_producers(blobs_.size(), -1);
+    for (int i = 0; i < layers_.size(); ++i) {
+      for (int i_bottom = 0; i_bottom < bottom_id_vecs_[i].size(); ++i_bottom) {
+        ++blob_consumers[bottom_id_vecs_[i][i_bottom]];
+      }
+      for (int i_top = 0; i_top < top_id_vecs_[i].size(); ++i_top) {
+        blob_producers[top_id_vecs_[i][i_top]] = i;
+      }
+    }
+    std::set<int> kept_blob_ids(net_output_blob_indices_.begin(),
+                                net_output_blob_indices_.end());
+    for (int i = 0; i < blobs_.size(); ++i) {
+      if (excluded_blob_names_.count(blob_names_[i])) kept_blob_ids.insert(i);
+    }
+    std::set<int> in_place_blob_ids;
+    for (int i = 0; i < layers_.size(); ++i) {
+      if (!layers_[i]->AllowInPlace() || bottom_id_vecs_[i].size() == 0) continue;
+      const int bottom_id = bottom_id_vecs_[i][0];
+      const int top_id = top_id_vecs_[i][0];
+      const int producer_id = blob_producers[bottom_id];
+      if (top_id == bottom_id || producer_id < 0 ||
+          bottom_vecs_[producer_id].size() == 0 ||
+          blob_consumers[bottom_id] != 1 ||
+          blobs_[top_id]->count() != blobs_[bottom_id]->count() ||
+          kept_blob_ids.count(bottom_id) || kept_blob_ids.count(top_id)) {
+        continue;
+      }
+      const string& bottom_name = blob_names_[bottom_id];
+      const string& top_name = blob_names_[top_id];
+      string root_bottom_data_name = create_or_link(share_record, bottom_name, "_data");
+      // the bottom may only share its data with earlier links of the chain
+      if (root_bottom_data_name != bottom_name + "_data" &&
+          !in_place_blob_ids.count(bottom_id)) {
+        continue;
+      }
+      if (phase_ == TRAIN) {
+        // recomputed and packed activations need the bottom intact
+        bool keep = false;
+        for (int l = 0; l < 2; ++l) {
+          const LayerParameter& lp = layers_[l == 0 ? i : producer_id]->layer_param();
+          keep |= (recompute_ && lp.recompute()) ||
+              lp.top_storage() != LayerParameter_StoragePrecision_FULL;
+        }
+        if (keep) continue;
+        const vector<int>& producer_tops = top_id_vecs_[producer_id];
+        const int i_top = std::find(producer_tops.begin(), producer_tops.end(),
+                                    bottom_id) - producer_tops.begin();
+        if (layers_[producer_id]->BackwardUsesTopData(i_top)) continue;
+      }
+
+      string root_top_data_name = create_or_link(share_record, top_name, "_data");
+      string root_top_diff_name = create_or_link(share_record, top_name, "_diff");
+      string root_bottom_diff_name = create_or_link(share_record, bottom_name, "_diff");
+      share_record[root_top_data_name] = root_bottom_data_name;
+      if (root_bottom_diff_name != root_top_diff_name) {
+        share_record[root_bottom_diff_name] = root_top_diff_name;
+      }
+      in_place_blob_ids.insert(top_id);
+      LOG(INFO)<<"layer "<<layer_names_[i]<<" runs in place on "<<bottom_name;
+    }
+  }
+
   // Color the excluded sets
   for (std::set<string>::iterator it = excluded_blob_names_.begin(); it != excluded_blob_names_.end(); ++it){
     exclude_both(share_record, excluded_names_, *it);
@@ -1163,12 +1457,179 @@ void Net<Dtype>::MemoryOptimize_v2(){
     }
   }
 
+  // Find the recompute segments: runs of consecutive layers marked with
+  // recompute. Segments where nothing needs backward are dropped since their
+  // activations are released in the forward pass anyway.
+  if (phase_ == TRAIN && recompute_) {
+    for (int i = 0; i < layers_.size(); ++i) {
+      if (!layers_[i]->layer_param().recompute()) continue;
+      if (bottom_vecs_[i].size() == 0 || !layers_[i]->AllowRecompute()) {
+        LOG(WARNING) << "layer " << layer_names_[i]
+            << " cannot be recomputed, keeping its outputs";
+        continue;
+      }
+      if (i > 0 && recompute_segment_ids_[i - 1] >= 0) {
+        recompute_segment_ids_[i] = recompute_segment_ids_[i - 1];
+        recompute_segments_.back().second = i;
+      } else {
+        recompute_segment_ids_[i] = recompute_segments_.size();
+        recompute_segments_.push_back(make_pair(i, i));
+      }
+    }
+    for (int seg = recompute_segments_.size() - 1; seg >= 0; --seg) {
+      bool need_backward = false;
+      for (int i = recompute_segments_[seg].first;
+           i <= recompute_segments_[seg].second; ++i) {
+        need_backward |= layer_need_backward_[i];
+      }
+      if (need_backward) continue;
+      for (int i = recompute_segments_[seg].first;
+           i <= recompute_segments_[seg].second; ++i) {
+        recompute_segment_ids_[i] = -1;
+      }
+      for (int i = recompute_segments_[seg].second + 1; i < layers_.size(); ++i) {
+        if (recompute_segment_ids_[i] > seg) recompute_segment_ids_[i] -= 1;
+      }
+      recompute_segments_.erase(recompute_segments_.begin() + seg);
+    }
+  }
+
+  // A data block can be discarded if every layer touching it lives in the
+  // same segment. The segment's kept blobs act as checkpoints.
+  std::set<string> recompute_names;
+  boost::unordered_map<string, int> root_segment;
+  for (int i = 0; i < layers_.size(); ++i) {
+    for (int j = 0; j < bottom_vecs_[i].size() + top_vecs_[i].size(); ++j) {
+      const int blob_id = (j < bottom_vecs_[i].size()) ? bottom_id_vecs_[i][j]
+          : top_id_vecs_[i][j - bottom_vecs_[i].size()];
+      string root_name = create_or_link(share_record, blob_names_[blob_id], "_data");
+      if (root_segment.find(root_name) == root_segment.end()) {
+        root_segment[root_name] = recompute_segment_ids_[i];
+      } else if (root_segment[root_name] != recompute_segment_ids_[i]) {
+        root_segment[root_name] = -1;
+      }
+    }
+  }
+  for (boost::unordered_map<string, int>::iterator it = root_segment.begin();
+       it != root_segment.end(); ++it) {
+    if (it->second >= 0 && !check_exclude(excluded_names_, it->first)) {
+      recompute_names.insert(it->first);
+    }
+  }
+  // A layer is run again only if all its outputs were discarded, and a
+  // discarded block must be regenerated by the layers writing it.
+  layer_recompute_.assign(layers_.size(), false);
+  for (bool changed = true; changed; ) {
+    changed = false;
+    for (int i = 0; i < layers_.size(); ++i) {
+      if (recompute_segment_ids_[i] < 0) continue;
+      bool rerun = top_vecs_[i].size() > 0;
+      for (int i_top = 0; i_top < top_vecs_[i].size(); ++i_top) {
+        string root_name = create_or_link(share_record,
+            blob_names_[top_id_vecs_[i][i_top]], "_data");
+        rerun &= recompute_names.find(root_name) != recompute_names.end();
+      }
+      layer_recompute_[i] = rerun;
+      if (rerun) continue;
+      for (int i_top = 0; i_top < top_vecs_[i].size(); ++i_top) {
+        string root_name = create_or_link(share_record,
+            blob_names_[top_id_vecs_[i][i_top]], "_data");
+        if (recompute_names.erase(root_name)) changed = true;
+      }
+    }
+  }
+  for (int i = 0; i < layers_.size(); ++i) {
+    if (layer_recompute_[i]) {
+      LOG(INFO) << "layer " << layer_names_[i] << " will be recomputed in segment "
+          << recompute_segment_ids_[i];
+    }
+  }
+  recompute_blob_ids_.resize(recompute_segments_.size());
+
+  // Activations held in reduced precision: their data is packed into 16 bits
+  // after the last layer reading it in the forward pass, and widened into a
+  // slot that lives while the backward pass runs over the layers touching it.
+  boost::unordered_map<string, int> compress_index;
+  vector<string> compress_roots;
+  if (phase_ == TRAIN) {
+    for (int i = 0; i < layers_.size(); ++i) {
+      const LayerParameter_StoragePrecision precision =
+          layers_[i]->layer_param().top_storage();
+      if (precision == LayerParameter_StoragePrecision_FULL) continue;
+      // the mask columns and the region index are integers, not activations
+      if (string(layers_[i]->type()) == "Mask") {
+        LOG(INFO) << "layer " << layer_names_[i]
+            << " keeps its tops in full precision";
+        continue;
+      }
+      for (int i_top = 0; i_top < top_vecs_[i].size(); ++i_top) {
+        string root_name = create_or_link(share_record,
+            blob_names_[top_id_vecs_[i][i_top]], "_data");
+        if (check_exclude(excluded_names_, root_name) ||
+            recompute_names.find(root_name) != recompute_names.end() ||
+            compress_index.find(root_name) != compress_index.end()) {
+          continue;
+        }
+        compress_index[root_name] = compress_roots.size();
+        compress_roots.push_back(root_name);
+        compress_precisions_.push_back(precision);
+      }
+    }
+    compress_ranges_.assign(compress_roots.size(), make_pair(-1, -1));
+    for (int i = 0; i < layers_.size(); ++i) {
+      for (int j = 0; j < bottom_vecs_[i].size() + top_vecs_[i].size(); ++j) {
+        const int blob_id = (j < bottom_vecs_[i].size()) ? bottom_id_vecs_[i][j]
+            : top_id_vecs_[i][j - bottom_vecs_[i].size()];
+        string root_name = create_or_link(share_record, blob_names_[blob_id], "_data");
+        if (compress_index.find(root_name) == compress_index.end()) continue;
+        pair<int, int>& range = compress_ranges_[compress_index[root_name]];
+        if (range.first < 0) range.first = i;
+        range.second = i;
+      }
+    }
+    // Nothing to keep for activations the backward pass does not read.
+    for (int c = compress_roots.size() - 1; c >= 0; --c) {
+      bool need_backward = false;
+      for (int i = compress_ranges_[c].first; i <= compress_ranges_[c].second; ++i) {
+        need_backward |= layer_need_backward_[i];
+      }
+      if (need_backward) continue;
+      compress_roots.erase(compress_roots.begin() + c);
+      compress_precisions_.erase(compress_precisions_.begin() + c);
+      compress_ranges_.erase(compress_ranges_.begin() + c);
+    }
+    compress_index.clear();
+    for (int c = 0; c < compress_roots.size(); ++c) {
+      compress_index[compress_roots[c]] = c;
+      layer_compress_ids_[compress_ranges_[c].second].push_back(c);
+      LOG(INFO) << "blob " << compress_roots[c] << " will be held in "
+          << LayerParameter_StoragePrecision_Name(compress_precisions_[c])
+          << " between layers " << layer_names_[compress_ranges_[c].first]
+          << " and " << layer_names_[compress_ranges_[c].second];
+    }
+    compress_blob_ids_.resize(compress_roots.size());
+    for (int i_blob = 0; i_blob < blobs_.size(); ++i_blob) {
+      const string data_name = blob_names_[i_blob] + "_data";
+      string root_name = create_or_link(share_record, blob_names_[i_blob], "_data");
+      if (compress_index.find(root_name) == compress_index.end()) continue;
+      vector<int>& blob_ids = compress_blob_ids_[compress_index[root_name]];
+      if (data_name == root_name) {
+        blob_ids.insert(blob_ids.begin(), i_blob);
+      } else {
+        blob_ids.push_back(i_blob);
+      }
+    }
+  }
+
   // Pre-works done
   // Dry run to determine dependencies.
 
   vector<SlotMeta> slots;
   boost::unordered_map<string, int> slot_index;
 
+  vector<int> recompute_slots;
+  vector<int> compress_slots(compress_roots.size(), -1);
+
   int direction = 1;
   string str_direction = "forward";
   for (int i = 0; i >= 0;){
@@ -1178,6 +1639,51 @@ void Net<Dtype>::MemoryOptimize_v2(){
     LOG(INFO)<< "layer " <<i<< " layer name: "<<layer_names_[i]<< " direction: "<<str_direction;
     string suffix = (direction>0)?"_data":"_diff";
 
+    // Entering a recompute segment from above: its discarded data blocks are
+    // produced again and held until the segment's backward pass is done.
+    const int segment_id = recompute_segment_ids_[i];
+    if (direction < 0 && segment_id >= 0 && recompute_segments_[segment_id].second == i) {
+      for (int l = recompute_segments_[segment_id].first; l <= i; ++l) {
+        if (!layer_recompute_[l]) continue;
+        for (int i_top = 0; i_top < top_vecs_[l].size(); ++i_top) {
+          const int blob_id = top_id_vecs_[l][i_top];
+          const string& top_name = blob_names_[blob_id];
+          string root_full_name = create_or_link(share_record, top_name, "_data") + "_re";
+          string top_full_name = top_name + "_data_re";
+
+          vector<int>& blob_ids = recompute_blob_ids_[segment_id];
+          if (std::find(blob_ids.begin(), blob_ids.end(), blob_id) == blob_ids.end()) {
+            blob_ids.push_back(blob_id);
+          }
+
+          int idx = FindSlot(slots, top_full_name);
+          if (idx == -1){
+            if (root_full_name == top_full_name){
+              idx = (int)AcquireSlot(slots, top_full_name, 1);
+              slot_index[top_full_name] = idx;
+              recompute_slots.push_back(idx);
+              LOG(INFO)<<"blob "<<top_full_name<<" acquired new slot "<<idx;
+            }else{
+              slot_index[top_full_name] = slot_index[root_full_name];
+              slots[slot_index[root_full_name]].IncRef();
+            }
+          } else {
+            slots[idx].IncRef();
+          }
+        }
+      }
+    }
+
+    // Reaching the last layer touching a packed activation from above: it is
+    // widened into its own slot until the backward pass leaves its first layer.
+    if (direction < 0) {
+      for (int j = 0; j < layer_compress_ids_[i].size(); ++j) {
+        const int c = layer_compress_ids_[i][j];
+        compress_slots[c] = (int)AcquireSlot(slots, compress_roots[c] + "_wide", 1);
+        LOG(INFO)<<"blob "<<compress_roots[c]<<" widened into slot "<<compress_slots[c];
+      }
+    }
+
     // Find slot for each layer output data
     for (int i_out = 0; i_out < layer_output.size(); ++i_out){
       const string& output_name = blob_names_[(direction>0)?top_id_vecs_[i][i_out]:bottom_id_vecs_[i][i_out]];
@@ -1218,7 +1724,9 @@ void Net<Dtype>::MemoryOptimize_v2(){
 
       string input_full_name = input_name + suffix;
 
-      if (phase_ == TRAIN && layer_need_backward_[i] && direction > 0) {
+      if (phase_ == TRAIN && layer_need_backward_[i] && direction > 0 &&
+          recompute_names.find(root_full_name) == recompute_names.end() &&
+          compress_index.find(root_full_name) == compress_index.end()) {
         LOG(INFO)<<"skipping deref";
         continue;
       }
@@ -1228,6 +1736,24 @@ void Net<Dtype>::MemoryOptimize_v2(){
       LOG(INFO)<<"deref slot "<<idx<<" held by blob "<<root_full_name;
     }
 
+    // Leaving a recompute segment: the regenerated data is no longer needed.
+    if (direction < 0 && segment_id >= 0 && recompute_segments_[segment_id].first == i) {
+      for (int j = 0; j < recompute_slots.size(); ++j) {
+        while (!slots[recompute_slots[j]].Empty()) {
+          slots[recompute_slots[j]].DerefOne();
+        }
+        LOG(INFO)<<"release recompute slot "<<recompute_slots[j];
+      }
+      recompute_slots.clear();
+    }
+    if (direction < 0) {
+      for (int c = 0; c < compress_roots.size(); ++c) {
+        if (compress_ranges_[c].first != i) continue;
+        slots[compress_slots[c]].DerefOne();
+        LOG(INFO)<<"release widened slot "<<compress_slots[c];
+      }
+    }
+
     // reverse once we reach the end of forward
     if (direction > 0 && i == layers_.size() - 1) {
       direction = -1;
@@ -1245,6 +1771,9 @@ void Net<Dtype>::MemoryOptimize_v2(){
     shared_storage_[i_mem].reset(new SyncedMemory(1));
   }
 
+  forward_data_storage_.resize(blobs_.size());
+  recompute_data_storage_.resize(blobs_.size());
+
   size_t count_raw = 0;
   size_t count_opt = 0;
   for (int i_blob = 0; i_blob < blobs_.size(); ++i_blob){
@@ -1265,6 +1794,15 @@ void Net<Dtype>::MemoryOptimize_v2(){
     LOG(INFO) << "blob " << i_blob
         << " name " << blob_names_[i_blob]
         << " data idx " << idx;
+    if (slot_index.find(name + "_data_re") != slot_index.end()) {
+      idx = slot_index[name + "_data_re"];
+      forward_data_storage_[i_blob] = blobs_[i_blob]->data();
+      recompute_data_storage_[i_blob] = shared_storage_[idx];
+      shared_storage_[idx]->Resize(bytes);
+      LOG(INFO) << "blob " << i_blob
+          << " name " << blob_names_[i_blob]
+          << " recompute data idx " << idx;
+    }
     if (slot_index.find(name + "_diff") != slot_index.end()) {
       idx = slot_index[name + "_diff"];
       blobs_[i_blob]->SetDiffStorage(shared_storage_[idx]);
@@ -1277,6 +1815,24 @@ void Net<Dtype>::MemoryOptimize_v2(){
         << " diff idx " << idx;
   }
 
+  // Packed activations keep their forward slot and borrow the widened one in
+  // the backward pass.
+  compress_storage_.resize(compress_roots.size());
+  compress_widened_.assign(compress_roots.size(), false);
+  for (int c = 0; c < compress_roots.size(); ++c) {
+    const vector<int>& blob_ids = compress_blob_ids_[c];
+    const size_t count = blobs_[blob_ids[0]]->count();
+    shared_storage_[compress_slots[c]]->Resize(count * sizeof(Dtype));
+    for (int j = 0; j < blob_ids.size(); ++j) {
+      forward_data_storage_[blob_ids[j]] = blobs_[blob_ids[j]]->data();
+      recompute_data_storage_[blob_ids[j]] = shared_storage_[compress_slots[c]];
+    }
+    compress_storage_[c].reset(new SyncedMemory(count * sizeof(uint16_t)));
+    count_opt += count * sizeof(uint16_t);
+    LOG(INFO) << "blob " << compress_roots[c]
+        << " widened data idx " << compress_slots[c];
+  }
+
   for (int i_mem = 0; i_mem < shared_storage_.size(); i_mem++){
     LOG(INFO) << "storage memory slot " << i_mem
         << " size " << shared_storage_[i_mem]->size();
@@ -1284,7 +1840,30 @@ void Net<Dtype>::MemoryOptimize_v2(){
   }
 
   LOG(INFO) << "raw memory " << count_raw << " opt memory " << count_opt;
+  LOG(INFO) << "workspace memory " << workspace_->size();
+
+}
 
+template <typename Dtype>
+vector<SyncedMemory*> Net<Dtype>::activation_storages() const {
+  vector<shared_ptr<SyncedMemory> > all(shared_storage_);
+  for (int i = 0; i < blobs_.size(); ++i) {
+    all.push_back(blobs_[i]->data());
+    all.push_back(blobs_[i]->diff());
+  }
+  all.insert(all.end(), forward_data_storage_.begin(),
+      forward_data_storage_.end());
+  all.insert(all.end(), recompute_data_storage_.begin(),
+      recompute_data_storage_.end());
+  all.insert(all.end(), compress_storage_.begin(), compress_storage_.end());
+  set<SyncedMemory*> seen;
+  vector<SyncedMemory*> storages;
+  for (int i = 0; i < all.size(); ++i) {
+    if (all[i] && seen.insert(all[i].get()).second) {
+      storages.push_back(all[i].get());
+    }
+  }
+  return storages;
 }
 
 INSTANTIATE_CLASS(Net);
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/common_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class BatchReductionLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  BatchReductionLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 6, 3, 4)),
+        blob_top_(new Blob<Dtype>()) {
+    // Distinct values a step of 0.1 apart and away from zero, so that
+    // neither the top-k selection nor the sign changes within the step of
+    // the gradient check.
+    const int count = blob_bottom_->count();
+    for (int i = 0; i < count; ++i) {
+      blob_bottom_->mutable_cpu_data()[i] =
+          Dtype((i * 7) % count - count / 2) / 10 + Dtype(0.05);
+    }
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~BatchReductionLayerTest() {
+    delete blob_bottom_;
+    delete blob_top_;
+  }
+
+  void SetParam(LayerParameter* layer_param,
+      ReductionParameter_ReductionOp op) {
+    BatchReductionParameter* batch_reduction_param =
+        layer_param->mutable_batch_reduction_param();
+    batch_reduction_param->mutable_reduction_param()->set_operation(op);
+    batch_reduction_param->mutable_reduction_param()->set_axis(1);
+    batch_reduction_param->mutable_reduction_param()->set_k(2);
+    batch_reduction_param->set_num_threads(3);
+  }
+
+  void TestForward(ReductionParameter_ReductionOp op) {
+    LayerParameter layer_param;
+    SetParam(&layer_param, op);
+    BatchReductionLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    ASSERT_EQ(blob_top_->num_axes(), 3);
+    EXPECT_EQ(blob_top_->shape(0), 2);
+    EXPECT_EQ(blob_top_->shape(1), 3);
+    EXPECT_EQ(blob_top_->shape(2), 4);
+    const int tick = 6;
+    const int step = 3 * 4;
+    for (int n = 0; n < 2; ++n) {
+      for (int i = 0; i < step; ++i) {
+        vector<Dtype> values;
+        for (int t = 0; t < tick; ++t) {
+          values.push_back(
+              blob_bottom_->cpu_data()[(n * tick + t) * step + i]);
+        }
+        std::sort(values.begin(), values.end(), std::greater<Dtype>());
+        Dtype expected = 0;
+        for (int t = 0; t < tick; ++t) {
+          switch (op) {
+          case ReductionParameter_ReductionOp_SUMSQ:
+            expected += values[t] * values[t];
+            break;
+          case ReductionParameter_ReductionOp_ASUM:
+            expected += std::fabs(values[t]);
+            break;
+          case ReductionParameter_ReductionOp_TOPK:
+            expected += t < 2 ? values[t] / 2 : 0;
+            break;
+          default:
+            LOG(FATAL) << "Unknown reduction op: "
+                << ReductionParameter_ReductionOp_Name(op);
+          }
+        }
+        EXPECT_NEAR(blob_top_->cpu_data()[n * step + i], expected, 1e-4);
+      }
+    }
+  }
+
+  void TestGradient(ReductionParameter_ReductionOp op) {
+    LayerParameter layer_param;
+    SetParam(&layer_param, op);
+    BatchReductionLayer<Dtype> layer(layer_param);
+    GradientChecker<Dtype> checker(1e-3, 1e-2);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(BatchReductionLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(BatchReductionLayerTest, TestTopK) {
+  this->TestForward(ReductionParameter_ReductionOp_TOPK);
+}
+
+TYPED_TEST(BatchReductionLayerTest, TestTopKGradient) {
+  this->TestGradient(ReductionParameter_ReductionOp_TOPK);
+}
+
+TYPED_TEST(BatchReductionLayerTest, TestTopKTies) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The first input of every position is the largest and the other five
+  // tie, so the second one selected must be the earliest of them whichever
+  // thread handles the position.
+  const int tick = 6;
+  const int step = 3 * 4;
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    this->blob_bottom_->mutable_cpu_data()[i] =
+        (i / step) % tick == 0 ? 2 : 1;
+  }
+  LayerParameter layer_param;
+  this->SetParam(&layer_param, ReductionParameter_ReductionOp_TOPK);
+  // five threads over the twelve positions, in ranges of two and three
+  layer_param.mutable_batch_reduction_param()->set_num_threads(5);
+  BatchReductionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_set(this->blob_top_->count(), Dtype(1),
+      this->blob_top_->mutable_cpu_diff());
+  vector<bool> propagate_down(1, true);
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_EQ(this->blob_top_->cpu_data()[i], Dtype(1.5));
+  }
+  for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+    EXPECT_EQ(this->blob_bottom_->cpu_diff()[i],
+        (i / step) % tick < 2 ? Dtype(0.5) : Dtype(0));
+  }
+}
+
+TYPED_TEST(BatchReductionLayerTest, TestSumOfSquares) {
+  this->TestForward(ReductionParameter_ReductionOp_SUMSQ);
+}
+
+TYPED_TEST(BatchReductionLayerTest, TestSumOfSquaresGradient) {
+  this->TestGradient(ReductionParameter_ReductionOp_SUMSQ);
+}
+
+TYPED_TEST(BatchReductionLayerTest, TestAbsSum) {
+  this->TestForward(ReductionParameter_ReductionOp_ASUM);
+}
+
+TYPED_TEST(BatchReductionLayerTest, TestAbsSumGradient) {
+  this->TestGradient(ReductionParameter_ReductionOp_ASUM);
+}
+
+}  // namespace caffe
@@ -104,6 +104,54 @@ TYPED_TEST(BNLayerTest, TestBackward) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(BNLayerTest, TestForwardReLU) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+
+  BNParameter* bn_param = layer_param.mutable_bn_param();
+  FillerParameter *slope_param = bn_param->mutable_slope_filler();
+  slope_param->set_value(2);
+  FillerParameter *bias_param = bn_param->mutable_bias_filler();
+  bias_param->set_value(0.5);
+  bn_param->set_eps(0.);
+  bn_param->set_frozen(false);
+
+  // The same layer without the ReLU gives the reference.
+  BNLayer<Dtype> linear_layer(layer_param);
+  Blob<Dtype> linear_top;
+  vector<Blob<Dtype>*> linear_top_vec(1, &linear_top);
+  linear_layer.SetUp(this->blob_bottom_vec_, linear_top_vec);
+  linear_layer.Forward(this->blob_bottom_vec_, linear_top_vec);
+
+  bn_param->set_relu(true);
+  BNLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(std::max(linear_top.cpu_data()[i], Dtype(0)),
+        this->blob_top_->cpu_data()[i], 1e-5);
+  }
+}
+
+TYPED_TEST(BNLayerTest, TestBackwardReLU) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+
+  BNParameter* bn_param = layer_param.mutable_bn_param();
+  FillerParameter *slope_param = bn_param->mutable_slope_filler();
+  slope_param->set_value(1);
+  FillerParameter *bias_param = bn_param->mutable_bias_filler();
+  bias_param->set_value(0.5);
+  bn_param->set_eps(0.);
+  bn_param->set_frozen(false);
+  bn_param->set_relu(true);
+
+  BNLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
 TYPED_TEST(BNLayerTest, TestForwardFrozen) {
   typedef typename TypeParam::Dtype Dtype;
   LayerParameter layer_param;
@@ -209,6 +257,133 @@ TYPED_TEST(BNLayerTest, TestBackwardFrozen) {
   }
 }
 
+template <typename TypeParam>
+class BNDataLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+ protected:
+  BNDataLayerTest()
+      : blob_bottom_(new Blob<Dtype>(5, 3, 3, 4)),
+        blob_top_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    filler_param.set_mean(2);
+    filler_param.set_std(3);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~BNDataLayerTest() { delete blob_bottom_; delete blob_top_; }
+
+  void SetUpParam(BNParameter* bn_param, Dtype slope, Dtype bias) {
+    bn_param->mutable_slope_filler()->set_value(slope);
+    bn_param->mutable_bias_filler()->set_value(bias);
+    bn_param->set_eps(0.);
+    bn_param->set_num_threads(2);
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(BNDataLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(BNDataLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetUpParam(layer_param.mutable_bn_param(), 1, 0);
+  BNDataLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+
+  int num = this->blob_bottom_->num();
+  int channels = this->blob_bottom_->channels();
+  int height = this->blob_bottom_->height();
+  int width = this->blob_bottom_->width();
+  for (int j = 0; j < channels; ++j) {
+    Dtype sum = 0, var = 0;
+    for (int i = 0; i < num; ++i) {
+      for (int k = 0; k < height; ++k) {
+        for (int l = 0; l < width; ++l) {
+          Dtype data = this->blob_top_->data_at(i, j, k, l);
+          sum += data;
+          var += data * data;
+        }
+      }
+    }
+    sum /= height * width * num;
+    var /= height * width * num;
+
+    const Dtype kErrorBound = 0.001;
+    EXPECT_NEAR(0, sum, kErrorBound);
+    EXPECT_NEAR(1, var, kErrorBound);
+  }
+}
+
+TYPED_TEST(BNDataLayerTest, TestForwardLargeMeanThreaded) {
+  typedef typename TypeParam::Dtype Dtype;
+  // A mean a thousand times the deviation cancels the variance out of the
+  // mean of squares. Each thread merges the planes of its own channel over
+  // the batch, here with more threads than the three channels.
+  FillerParameter filler_param;
+  filler_param.set_mean(1000);
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  this->SetUpParam(layer_param.mutable_bn_param(), 1, 0);
+  layer_param.mutable_bn_param()->set_num_threads(4);
+  BNDataLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const int num = this->blob_bottom_->num();
+  const int spatial_dim = this->blob_bottom_->count(2);
+  for (int c = 0; c < this->blob_bottom_->channels(); ++c) {
+    Dtype sum = 0, var = 0;
+    for (int n = 0; n < num; ++n) {
+      const Dtype* top = this->blob_top_->cpu_data() +
+          this->blob_top_->offset(n, c);
+      for (int i = 0; i < spatial_dim; ++i) {
+        sum += top[i];
+        var += top[i] * top[i];
+      }
+    }
+    EXPECT_NEAR(0, sum / (num * spatial_dim), 0.001);
+    EXPECT_NEAR(1, var / (num * spatial_dim), 0.001);
+  }
+}
+
+TYPED_TEST(BNDataLayerTest, TestForwardMatchesBN) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetUpParam(layer_param.mutable_bn_param(), 2, 0.5);
+  layer_param.mutable_bn_param()->set_frozen(false);
+
+  BNLayer<Dtype> bn_layer(layer_param);
+  Blob<Dtype> bn_top;
+  vector<Blob<Dtype>*> bn_top_vec(1, &bn_top);
+  bn_layer.SetUp(this->blob_bottom_vec_, bn_top_vec);
+  bn_layer.Forward(this->blob_bottom_vec_, bn_top_vec);
+
+  BNDataLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(bn_top.cpu_data()[i], this->blob_top_->cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(BNDataLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetUpParam(layer_param.mutable_bn_param(), 1.5, 0.5);
+  BNDataLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
 #ifdef USE_CUDNN
 template <typename Dtype>
 class CuDNNBNLayerTest : public GPUDeviceTest<Dtype> {
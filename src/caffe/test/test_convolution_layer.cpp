@@ -1,11 +1,13 @@
 #include <cstring>
 #include <vector>
 
+#include "boost/bind/bind.hpp"
 #include "gtest/gtest.h"
 
 #include "caffe/blob.hpp"
 #include "caffe/common.hpp"
 #include "caffe/filler.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/vision_layers.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
@@ -13,6 +15,10 @@
 
 namespace caffe {
 
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
 // Reference convolution for checking results:
 // accumulate through explicit loops over input, output, and filters.
 template <typename Dtype>
@@ -41,6 +47,13 @@ void caffe_conv(const Blob<Dtype>* in, ConvolutionParameter* conv_param,
     stride_h = conv_param->stride_h();
     stride_w = conv_param->stride_w();
   }
+  int dilation_h, dilation_w;
+  if (!conv_param->has_dilation_h()) {
+    dilation_h = dilation_w = conv_param->dilation();
+  } else {
+    dilation_h = conv_param->dilation_h();
+    dilation_w = conv_param->dilation_w();
+  }
   // Groups
   int groups = conv_param->group();
   int o_g = out->channels() / groups;
@@ -60,8 +73,8 @@ void caffe_conv(const Blob<Dtype>* in, ConvolutionParameter* conv_param,
             for (int x = 0; x < out->width(); x++) {
               for (int p = 0; p < kernel_h; p++) {
                 for (int q = 0; q < kernel_w; q++) {
-                  int in_y = y * stride_h - pad_h + p;
-                  int in_x = x * stride_w - pad_w + q;
+                  int in_y = y * stride_h - pad_h + p * dilation_h;
+                  int in_x = x * stride_w - pad_w + q * dilation_w;
                   if (in_y >= 0 && in_y < in->height()
                     && in_x >= 0 && in_x < in->width()) {
                     out_data[out->offset(n, o + o_head, y, x)] +=
@@ -421,6 +434,432 @@ TYPED_TEST(ConvolutionLayerTest, TestGradientGroup) {
       this->blob_top_vec_);
 }
 
+TYPED_TEST(ConvolutionLayerTest, TestThreadedConvolutionGroup) {
+  typedef typename TypeParam::Dtype Dtype;
+  // an odd number of images that does not split evenly over the threads
+  this->blob_bottom_->Reshape(5, 3, 6, 4);
+  FillerParameter filler_param;
+  filler_param.set_value(1.);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->set_num_threads(2);
+  convolution_param->set_batch_im2col(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  const Dtype* top_data;
+  const Dtype* ref_top_data;
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  top_data = this->blob_top_->cpu_data();
+  ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestThreadedGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(5, 3, 6, 4);
+  FillerParameter filler_param;
+  filler_param.set_value(1.);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_num_output(2);
+  convolution_param->set_num_threads(3);
+  convolution_param->set_batch_im2col(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestThreaded1x1Gradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(1);
+  convolution_param->set_stride(1);
+  convolution_param->set_num_output(2);
+  convolution_param->set_num_threads(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestDepthwiseConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(2);
+  convolution_param->set_dilation(2);
+  convolution_param->set_num_output(6);
+  convolution_param->set_group(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestDepthwiseGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_pad(2);
+  convolution_param->set_dilation(2);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->set_num_threads(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestDilatedBandedConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(2);
+  convolution_param->set_dilation(2);
+  convolution_param->set_num_output(4);
+  // two output rows at a time, over three bands
+  convolution_param->set_im2col_band(8);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new ConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Check against reference convolution.
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestDilatedBandedGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_stride(2);
+  convolution_param->set_pad(2);
+  convolution_param->set_dilation(2);
+  convolution_param->set_num_output(2);
+  convolution_param->set_num_threads(2);
+  convolution_param->set_im2col_band(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  ConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestWinogradConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int tiles[] = {2, 4};
+  for (int t = 0; t < 2; ++t) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->set_kernel_size(3);
+    convolution_param->set_pad(1);
+    convolution_param->set_num_output(4);
+    convolution_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+    convolution_param->set_winograd_tile(tiles[t]);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("constant");
+    convolution_param->mutable_bias_filler()->set_value(0.1);
+    shared_ptr<Layer<Dtype> > layer(
+        new WinogradConvolutionLayer<Dtype>(layer_param));
+    layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    // Check against reference convolution.
+    caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+        this->MakeReferenceTop(this->blob_top_));
+    const Dtype* top_data = this->blob_top_->cpu_data();
+    const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+    }
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestWinogradConvolutionGroup) {
+  typedef typename TypeParam::Dtype Dtype;
+  // no padding, and outputs that do not fill the last tiles
+  this->blob_bottom_->Reshape(3, 3, 9, 7);
+  FillerParameter filler_param;
+  filler_param.set_value(1.);
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->set_num_threads(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("constant");
+  convolution_param->mutable_bias_filler()->set_value(0.1);
+  shared_ptr<Layer<Dtype> > layer(
+      new WinogradConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestWinogradWeightUpdate) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(2);
+  convolution_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  shared_ptr<Layer<Dtype> > layer(
+      new WinogradConvolutionLayer<Dtype>(layer_param));
+  layer->SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // An update must invalidate the cached transformed weights.
+  Blob<Dtype>* weights = layer->blobs()[0].get();
+  caffe_set(weights->count(), Dtype(0.5), weights->mutable_cpu_diff());
+  weights->Update();
+  layer->Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_conv(this->blob_bottom_, convolution_param, layer->blobs(),
+      this->MakeReferenceTop(this->blob_top_));
+  const Dtype* top_data = this->blob_top_->cpu_data();
+  const Dtype* ref_top_data = this->ref_blob_top_->cpu_data();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    EXPECT_NEAR(top_data[i], ref_top_data[i], 1e-4);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestWinogradGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int tiles[] = {2, 4};
+  for (int t = 0; t < 2; ++t) {
+    LayerParameter layer_param;
+    ConvolutionParameter* convolution_param =
+        layer_param.mutable_convolution_param();
+    convolution_param->set_kernel_size(3);
+    convolution_param->set_pad(1);
+    convolution_param->set_num_output(2);
+    convolution_param->set_num_threads(2);
+    convolution_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+    convolution_param->set_winograd_tile(tiles[t]);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+    WinogradConvolutionLayer<Dtype> layer(layer_param);
+    // The convolution is linear in each input, so a large step is still
+    // exact while keeping the rounding of the transforms out of the estimate.
+    GradientChecker<Dtype> checker(1e-1, 1e-3);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_);
+  }
+}
+
+TYPED_TEST(ConvolutionLayerTest, TestWinogradGradientGroup) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_num_output(3);
+  convolution_param->set_group(3);
+  convolution_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+  convolution_param->set_winograd_tile(2);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  WinogradConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-1, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+// Runs the backward pass of layers[n] for each n in [begin, end).
+template <typename Dtype>
+void BackwardLayers(const vector<shared_ptr<Layer<Dtype> > >* layers,
+    const vector<vector<Blob<Dtype>*> >* tops,
+    const vector<vector<Blob<Dtype>*> >* bottoms, int thread_id, int begin,
+    int end) {
+  const vector<bool> propagate_down(1, true);
+  for (int n = begin; n < end; ++n) {
+    (*layers)[n]->Backward((*tops)[n], propagate_down, (*bottoms)[n]);
+  }
+}
+
+template <typename Dtype>
+class NestedConvolutionLayerTest : public CPUDeviceTest<Dtype> {
+ protected:
+  shared_ptr<Layer<Dtype> > MakeLayer(const LayerParameter& layer_param) {
+    if (layer_param.convolution_param().engine() ==
+        ConvolutionParameter_Engine_WINOGRAD) {
+      return shared_ptr<Layer<Dtype> >(
+          new WinogradConvolutionLayer<Dtype>(layer_param));
+    }
+    return shared_ptr<Layer<Dtype> >(new ConvolutionLayer<Dtype>(layer_param));
+  }
+
+  // Runs the backward passes of two threaded layers of layer_param inside a
+  // parallel loop, one on the calling thread and one on a worker, where
+  // they fall back to a single range. Their gradients must match those of
+  // the same layer run on one thread.
+  void TestBackwardNested(const LayerParameter& layer_param) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    Blob<Dtype> bottom(3, 2, 6, 5);
+    filler.Fill(&bottom);
+    vector<shared_ptr<Layer<Dtype> > > layers(3);
+    vector<shared_ptr<Workspace> > workspaces(3);
+    vector<shared_ptr<Blob<Dtype> > > blobs;
+    vector<vector<Blob<Dtype>*> > bottoms(3), tops(3);
+    for (int n = 0; n < 3; ++n) {
+      // the last layer runs on one thread and gives the reference
+      LayerParameter param(layer_param);
+      if (n == 2) {
+        param.mutable_convolution_param()->set_num_threads(1);
+      }
+      layers[n] = MakeLayer(param);
+      workspaces[n].reset(new Workspace());
+      layers[n]->set_workspace(workspaces[n].get());
+      blobs.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      blobs.back()->CopyFrom(bottom, false, true);
+      bottoms[n].push_back(blobs.back().get());
+      blobs.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+      tops[n].push_back(blobs.back().get());
+      layers[n]->SetUp(bottoms[n], tops[n]);
+      if (n > 0) {
+        for (int i = 0; i < layers[n]->blobs().size(); ++i) {
+          layers[n]->blobs()[i]->CopyFrom(*layers[0]->blobs()[i]);
+        }
+      }
+      layers[n]->Forward(bottoms[n], tops[n]);
+    }
+    Blob<Dtype> top_diff;
+    top_diff.ReshapeLike(*tops[0][0]);
+    filler.Fill(&top_diff);
+    for (int n = 0; n < 3; ++n) {
+      caffe_copy(top_diff.count(), top_diff.cpu_data(),
+          tops[n][0]->mutable_cpu_diff());
+    }
+    // A first backward pass outside the loop leaves the buffers of the
+    // threaded layers holding gradients.
+    BackwardLayers(&layers, &tops, &bottoms, 0, 0, 3);
+    for (int n = 0; n < 3; ++n) {
+      for (int i = 0; i < layers[n]->blobs().size(); ++i) {
+        Blob<Dtype>* param = layers[n]->blobs()[i].get();
+        caffe_set(param->count(), Dtype(0), param->mutable_cpu_diff());
+      }
+    }
+    BackwardLayers(&layers, &tops, &bottoms, 2, 2, 3);
+    EXPECT_EQ(2, caffe_parallel_for(2, 2, boost::bind(&BackwardLayers<Dtype>,
+        &layers, &tops, &bottoms, _1, _2, _3)));
+    for (int n = 0; n < 2; ++n) {
+      for (int i = 0; i < layers[n]->blobs().size(); ++i) {
+        const Blob<Dtype>* param = layers[n]->blobs()[i].get();
+        const Blob<Dtype>* expected = layers[2]->blobs()[i].get();
+        for (int j = 0; j < param->count(); ++j) {
+          EXPECT_NEAR(expected->cpu_diff()[j], param->cpu_diff()[j], 1e-4);
+        }
+      }
+      for (int j = 0; j < bottom.count(); ++j) {
+        EXPECT_NEAR(bottoms[2][0]->cpu_diff()[j], bottoms[n][0]->cpu_diff()[j],
+            1e-4);
+      }
+    }
+  }
+};
+
+TYPED_TEST_CASE(NestedConvolutionLayerTest, TestDtypes);
+
+TYPED_TEST(NestedConvolutionLayerTest, TestBackwardNested) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->set_num_threads(3);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->TestBackwardNested(layer_param);
+}
+
+TYPED_TEST(NestedConvolutionLayerTest, TestWinogradBackwardNested) {
+  LayerParameter layer_param;
+  ConvolutionParameter* convolution_param =
+      layer_param.mutable_convolution_param();
+  convolution_param->set_kernel_size(3);
+  convolution_param->set_pad(1);
+  convolution_param->set_num_output(4);
+  convolution_param->set_num_threads(3);
+  convolution_param->set_engine(ConvolutionParameter_Engine_WINOGRAD);
+  convolution_param->mutable_weight_filler()->set_type("gaussian");
+  convolution_param->mutable_bias_filler()->set_type("gaussian");
+  this->TestBackwardNested(layer_param);
+}
+
 #ifdef USE_CUDNN
 
 template <typename Dtype>
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class InterpLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  InterpLayerTest()
+      : blob_bottom_(new Blob<Dtype>(2, 3, 4, 5)),
+        blob_top_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~InterpLayerTest() { delete blob_bottom_; delete blob_top_; }
+
+  // The bilinear resampling of every plane of bottom to the size of top,
+  // with the corners of the two grids aligned.
+  void ReferenceInterp(const Blob<Dtype>& bottom, const Blob<Dtype>& top,
+      Blob<Dtype>* reference) {
+    reference->ReshapeLike(top);
+    const int height1 = bottom.height(), width1 = bottom.width();
+    const int height2 = top.height(), width2 = top.width();
+    const float rheight = height2 > 1 ?
+        static_cast<float>(height1 - 1) / (height2 - 1) : 0.f;
+    const float rwidth = width2 > 1 ?
+        static_cast<float>(width1 - 1) / (width2 - 1) : 0.f;
+    for (int n = 0; n < bottom.num(); ++n) {
+      for (int c = 0; c < bottom.channels(); ++c) {
+        for (int h = 0; h < height2; ++h) {
+          const float hr = rheight * h;
+          const int h0 = hr;
+          const int h1 = std::min(h0 + 1, height1 - 1);
+          const Dtype hl = hr - h0;
+          for (int w = 0; w < width2; ++w) {
+            const float wr = rwidth * w;
+            const int w0 = wr;
+            const int w1 = std::min(w0 + 1, width1 - 1);
+            const Dtype wl = wr - w0;
+            reference->mutable_cpu_data()[reference->offset(n, c, h, w)] =
+                (1 - hl) * ((1 - wl) * bottom.data_at(n, c, h0, w0) +
+                    wl * bottom.data_at(n, c, h0, w1)) +
+                hl * ((1 - wl) * bottom.data_at(n, c, h1, w0) +
+                    wl * bottom.data_at(n, c, h1, w1));
+          }
+        }
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(InterpLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(InterpLayerTest, TestForwardZoom) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_zoom_factor(3);
+  InterpLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_->height(), 10);
+  EXPECT_EQ(this->blob_top_->width(), 13);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> reference;
+  this->ReferenceInterp(*this->blob_bottom_, *this->blob_top_, &reference);
+  for (int i = 0; i < reference.count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i], reference.cpu_data()[i],
+        1e-5);
+  }
+}
+
+TYPED_TEST(InterpLayerTest, TestForwardShrinkThreaded) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_height(3);
+  layer_param.mutable_interp_param()->set_width(2);
+  layer_param.mutable_interp_param()->set_num_threads(2);
+  InterpLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> reference;
+  this->ReferenceInterp(*this->blob_bottom_, *this->blob_top_, &reference);
+  for (int i = 0; i < reference.count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i], reference.cpu_data()[i],
+        1e-5);
+  }
+}
+
+TYPED_TEST(InterpLayerTest, TestGradientZoom) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_zoom_factor(2);
+  layer_param.mutable_interp_param()->set_num_threads(2);
+  InterpLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(InterpLayerTest, TestForwardZoomThreaded) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The planes of all images are split as one range, so four threads over
+  // three images of two channels take ranges that cross from one image into
+  // the next.
+  this->blob_bottom_->Reshape(3, 2, 4, 5);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_height(7);
+  layer_param.mutable_interp_param()->set_width(9);
+  layer_param.mutable_interp_param()->set_num_threads(4);
+  InterpLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Blob<Dtype> reference;
+  this->ReferenceInterp(*this->blob_bottom_, *this->blob_top_, &reference);
+  for (int i = 0; i < reference.count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i], reference.cpu_data()[i],
+        1e-5);
+  }
+}
+
+TYPED_TEST(InterpLayerTest, TestGradientZoomThreaded) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(3, 2, 4, 5);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_zoom_factor(2);
+  layer_param.mutable_interp_param()->set_num_threads(4);
+  InterpLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(InterpLayerTest, TestGradientResize) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_interp_param()->set_height(7);
+  layer_param.mutable_interp_param()->set_width(3);
+  InterpLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+}  // namespace caffe
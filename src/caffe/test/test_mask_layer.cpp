@@ -0,0 +1,234 @@
+#include <algorithm>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/region_index.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class MaskLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  MaskLayerTest()
+      : blob_bottom_prob_(new Blob<Dtype>(2, 3, 4, 5)),
+        blob_bottom_label_(new Blob<Dtype>(2, 1, 4, 5)),
+        blob_top_mask_(new Blob<Dtype>()),
+        blob_top_index_(new Blob<Dtype>()),
+        blob_top_count_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_prob_);
+    for (int i = 0; i < blob_bottom_label_->count(); ++i) {
+      blob_bottom_label_->mutable_cpu_data()[i] = caffe_rng_rand() % 4;
+    }
+    blob_bottom_vec_.push_back(blob_bottom_prob_);
+    blob_top_vec_.push_back(blob_top_mask_);
+    blob_top_vec_.push_back(blob_top_index_);
+    blob_top_vec_.push_back(blob_top_count_);
+  }
+  virtual ~MaskLayerTest() {
+    delete blob_bottom_prob_;
+    delete blob_bottom_label_;
+    delete blob_top_mask_;
+    delete blob_top_index_;
+    delete blob_top_count_;
+  }
+
+  // Checks the tops against the pixels selected by active.
+  void CheckTops(const vector<bool>& active) {
+    const int spatial_dim = blob_top_mask_->count(1);
+    for (int n = 0; n < blob_top_mask_->num(); ++n) {
+      const Dtype* mask = blob_top_mask_->cpu_data() + n * spatial_dim;
+      const int* index = region_index_cpu(*blob_top_index_, n);
+      const int* pixels = region_index_pixels(index);
+      int cnt = 0;
+      for (int i = 0; i < spatial_dim; ++i) {
+        if (active[n * spatial_dim + i]) {
+          EXPECT_EQ(mask[i], cnt);
+          EXPECT_EQ(pixels[cnt], i);
+          ++cnt;
+        } else {
+          EXPECT_EQ(mask[i], -1);
+        }
+      }
+      EXPECT_EQ(region_index_count(index), cnt);
+      EXPECT_EQ(blob_top_count_->cpu_data()[n], cnt);
+      // the runs cover the pixels in order, and no two of them touch
+      const int* runs = region_index_runs(index);
+      int m = 0;
+      for (int r = 0; r < region_index_num_runs(index); ++r) {
+        if (r > 0) {
+          EXPECT_GT(runs[2 * r], runs[2 * r - 2] + runs[2 * r - 1]);
+        }
+        for (int k = 0; k < runs[2 * r + 1]; ++k) {
+          EXPECT_EQ(pixels[m++], runs[2 * r] + k);
+        }
+      }
+      EXPECT_EQ(m, cnt);
+    }
+  }
+
+  // Checks a Mask layer of num_threads threads over images of 20x30 pixels,
+  // with the previous mask clearing pixels [clear_begin, clear_end) of the
+  // first image as well as a random third of all pixels.
+  void CheckPrevMask(const int num_threads, const int clear_begin,
+      const int clear_end) {
+    const int spatial_dim = 20 * 30;
+    blob_bottom_prob_->Reshape(2, 3, 20, 30);
+    FillerParameter filler_param;
+    UniformFiller<Dtype> filler(filler_param);
+    filler.Fill(blob_bottom_prob_);
+    blob_bottom_label_->Reshape(2, 1, 20, 30);
+    Blob<Dtype> prev_mask(2, 1, 20, 30);
+    for (int i = 0; i < prev_mask.count(); ++i) {
+      blob_bottom_label_->mutable_cpu_data()[i] = caffe_rng_rand() % 4;
+      prev_mask.mutable_cpu_data()[i] =
+          (i >= clear_begin && i < clear_end) || caffe_rng_rand() % 3 == 0 ?
+          -1 : 0;
+    }
+    blob_bottom_vec_.push_back(&prev_mask);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    LayerParameter layer_param;
+    layer_param.mutable_mask_param()->set_threshold(0.6);
+    layer_param.mutable_mask_param()->set_prev_mask(true);
+    layer_param.mutable_mask_param()->set_ignore_label(3);
+    layer_param.mutable_mask_param()->set_num_threads(num_threads);
+    MaskLayer<Dtype> layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    layer.Forward(blob_bottom_vec_, blob_top_vec_);
+    vector<bool> active(2 * spatial_dim, true);
+    for (int n = 0; n < 2; ++n) {
+      for (int i = 0; i < spatial_dim; ++i) {
+        if (prev_mask.cpu_data()[n * spatial_dim + i] < 0) {
+          active[n * spatial_dim + i] = false;
+        }
+        const int label =
+            blob_bottom_label_->cpu_data()[n * spatial_dim + i];
+        for (int c = 0; c < 3; ++c) {
+          if ((label == 3 || label == c) && blob_bottom_prob_->cpu_data()[
+              (n * 3 + c) * spatial_dim + i] > Dtype(0.6)) {
+            active[n * spatial_dim + i] = false;
+          }
+        }
+      }
+    }
+    CheckTops(active);
+  }
+
+  Blob<Dtype>* const blob_bottom_prob_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_top_mask_;
+  Blob<Dtype>* const blob_top_index_;
+  Blob<Dtype>* const blob_top_count_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(MaskLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(MaskLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_mask_param()->set_threshold(0.7);
+  MaskLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // a pixel stays active while no class is confident
+  const int spatial_dim = 4 * 5;
+  vector<bool> active(2 * spatial_dim, true);
+  for (int n = 0; n < 2; ++n) {
+    for (int c = 0; c < 3; ++c) {
+      for (int i = 0; i < spatial_dim; ++i) {
+        if (this->blob_bottom_prob_->cpu_data()[(n * 3 + c) * spatial_dim + i]
+            > Dtype(0.7)) {
+          active[n * spatial_dim + i] = false;
+        }
+      }
+    }
+  }
+  this->CheckTops(active);
+}
+
+TYPED_TEST(MaskLayerTest, TestForwardLabel) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.push_back(this->blob_bottom_label_);
+  LayerParameter layer_param;
+  layer_param.mutable_mask_param()->set_threshold(0.5);
+  layer_param.mutable_mask_param()->set_ignore_label(3);
+  MaskLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // a labelled pixel stays active while its own class is not confident, an
+  // ignored one while no class is
+  const int spatial_dim = 4 * 5;
+  vector<bool> active(2 * spatial_dim, true);
+  for (int n = 0; n < 2; ++n) {
+    for (int i = 0; i < spatial_dim; ++i) {
+      const int label =
+          this->blob_bottom_label_->cpu_data()[n * spatial_dim + i];
+      for (int c = 0; c < 3; ++c) {
+        if ((label == 3 || label == c) && this->blob_bottom_prob_->cpu_data()[
+            (n * 3 + c) * spatial_dim + i] > Dtype(0.5)) {
+          active[n * spatial_dim + i] = false;
+        }
+      }
+    }
+  }
+  this->CheckTops(active);
+}
+
+TYPED_TEST(MaskLayerTest, TestForwardPrevMaskThreaded) {
+  // images of several tiles each, split over three threads
+  this->CheckPrevMask(3, 0, 0);
+}
+
+TYPED_TEST(MaskLayerTest, TestForwardEmptyTileThreaded) {
+  // Images of two full tiles of 256 pixels and a partial one, split over
+  // four threads. The previous mask clears the middle tile of the first
+  // image, so the pixels of its last tile start where the first tile ended.
+  this->CheckPrevMask(4, 256, 512);
+}
+
+TYPED_TEST(MaskLayerTest, TestForwardExitFraction) {
+  typedef typename TypeParam::Dtype Dtype;
+  // every pixel of the first image is left, two of the second
+  const int spatial_dim = 4 * 5;
+  Dtype* prob = this->blob_bottom_prob_->mutable_cpu_data();
+  caffe_set(3 * spatial_dim, Dtype(0.1), prob);
+  caffe_set(3 * spatial_dim, Dtype(0.9), prob + 3 * spatial_dim);
+  for (int c = 0; c < 3; ++c) {
+    prob[(3 + c) * spatial_dim + 7] = Dtype(0.1);
+    prob[(3 + c) * spatial_dim + 8] = Dtype(0.1);
+  }
+  LayerParameter layer_param;
+  layer_param.mutable_mask_param()->set_threshold(0.5);
+  layer_param.mutable_mask_param()->set_exit_fraction(0.05);
+  vector<bool> active(2 * spatial_dim, false);
+  std::fill(active.begin(), active.begin() + spatial_dim, true);
+  active[spatial_dim + 7] = active[spatial_dim + 8] = true;
+  {
+    MaskLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    this->CheckTops(active);
+  }
+  // 10% of the second image is too little for the next stage
+  layer_param.mutable_mask_param()->set_exit_fraction(0.2);
+  std::fill(active.begin() + spatial_dim, active.end(), false);
+  MaskLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  this->CheckTops(active);
+}
+
+}  // namespace caffe
@@ -150,6 +150,53 @@ TYPED_TEST(CPUMathFunctionsTest, TestCopy) {
   }
 }
 
+TYPED_TEST(CPUMathFunctionsTest, TestHalf) {
+  const int n = this->blob_bottom_->count();
+  const TypeParam* x = this->blob_bottom_->cpu_data();
+  vector<uint16_t> packed(n);
+  TypeParam* y = this->blob_top_->mutable_cpu_data();
+  caffe_cpu_float2half(n, x, &packed[0]);
+  caffe_cpu_half2float(n, &packed[0], y);
+  for (int i = 0; i < n; ++i) {
+    // 11 significant bits, rounded to nearest
+    EXPECT_NEAR(x[i], y[i],
+        std::max(std::fabs(x[i]) / 2048, TypeParam(1e-7)));
+  }
+  // exactly representable values, rounding and overflow
+  const TypeParam special[] = {0, 1, -2, 65504, 65519, 65520, 1.0 / 16777216};
+  const uint16_t expected[] = {0x0000, 0x3c00, 0xc000, 0x7bff, 0x7bff, 0x7c00,
+      0x0001};
+  caffe_cpu_float2half(7, special, &packed[0]);
+  for (int i = 0; i < 7; ++i) {
+    EXPECT_EQ(expected[i], packed[i]);
+  }
+  caffe_cpu_half2float(7, expected, y);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(i < 4 ? special[i] : 65504, y[i]);
+  }
+  EXPECT_TRUE(std::isinf(y[5]));
+  EXPECT_EQ(special[6], y[6]);
+}
+
+TYPED_TEST(CPUMathFunctionsTest, TestBFloat16) {
+  const int n = this->blob_bottom_->count();
+  const TypeParam* x = this->blob_bottom_->cpu_data();
+  vector<uint16_t> packed(n);
+  TypeParam* y = this->blob_top_->mutable_cpu_data();
+  caffe_cpu_float2bfloat16(n, x, &packed[0]);
+  caffe_cpu_bfloat162float(n, &packed[0], y);
+  for (int i = 0; i < n; ++i) {
+    // 8 significant bits, rounded to nearest
+    EXPECT_NEAR(x[i], y[i], std::fabs(x[i]) / 256);
+  }
+  const TypeParam special[] = {0, 1, -2, 1.00390625, 1.01171875};
+  const uint16_t expected[] = {0x0000, 0x3f80, 0xc000, 0x3f80, 0x3f82};
+  caffe_cpu_float2bfloat16(5, special, &packed[0]);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(expected[i], packed[i]);
+  }
+}
+
 #ifndef CPU_ONLY
 
 template <typename Dtype>
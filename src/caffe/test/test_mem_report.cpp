@@ -0,0 +1,133 @@
+#include <string>
+#include <vector>
+
+#include "google/protobuf/text_format.h"
+
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/net.hpp"
+#include "caffe/util/mem_report.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class MemoryReportTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  // An inner product, a sigmoid whose top is held in storage, and a loss.
+  void InitNet(const string& storage) {
+    const string proto =
+        "name: 'MemoryReportNetwork' "
+        "state { phase: TRAIN } "
+        "layer { "
+        "  name: 'data' "
+        "  type: 'DummyData' "
+        "  dummy_data_param { "
+        "    shape { dim: 4 dim: 6 } "
+        "    data_filler { type: 'gaussian' std: 1 } "
+        "    shape { dim: 4 dim: 3 } "
+        "    data_filler { type: 'gaussian' std: 1 } "
+        "  } "
+        "  top: 'data' "
+        "  top: 'target' "
+        "} "
+        "layer { "
+        "  name: 'ip1' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 8 "
+        "    weight_filler { type: 'gaussian' std: 0.5 } "
+        "  } "
+        "  bottom: 'data' "
+        "  top: 'ip1' "
+        "} "
+        "layer { "
+        "  name: 'sigmoid1' "
+        "  type: 'Sigmoid' "
+        "  bottom: 'ip1' "
+        "  top: 'sig1' "
+        "  top_storage: " + storage + " "
+        "} "
+        "layer { "
+        "  name: 'ip2' "
+        "  type: 'InnerProduct' "
+        "  inner_product_param { "
+        "    num_output: 3 "
+        "    weight_filler { type: 'gaussian' std: 0.5 } "
+        "  } "
+        "  bottom: 'sig1' "
+        "  top: 'ip2' "
+        "} "
+        "layer { "
+        "  name: 'loss' "
+        "  type: 'EuclideanLoss' "
+        "  bottom: 'ip2' "
+        "  bottom: 'target' "
+        "  top: 'loss' "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    net_.reset(new Net<Dtype>(param));
+  }
+
+  shared_ptr<Net<Dtype> > net_;
+};
+
+TYPED_TEST_CASE(MemoryReportTest, TestDtypesAndDevices);
+
+TYPED_TEST(MemoryReportTest, TestReport) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->InitNet("FULL");
+  MemoryReport report;
+  ReportMemory(this->net_.get(), &report);
+  const int top_counts[] = {4 * 6 + 4 * 3, 4 * 8, 4 * 8, 4 * 3, 1};
+  const int param_counts[] = {0, 8 * 6 + 8, 0, 3 * 8 + 3, 0};
+  ASSERT_EQ(5, report.layer_top_bytes.size());
+  size_t raw_bytes = 0;
+  size_t param_bytes = 0;
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(top_counts[i] * sizeof(Dtype), report.layer_top_bytes[i]);
+    EXPECT_EQ(2 * param_counts[i] * sizeof(Dtype),
+        report.layer_param_bytes[i]);
+    raw_bytes += 2 * top_counts[i] * sizeof(Dtype);
+    param_bytes += report.layer_param_bytes[i];
+  }
+  EXPECT_EQ(raw_bytes, report.activation_raw_bytes);
+  EXPECT_EQ(param_bytes, report.param_bytes);
+  // Nothing is freed during the pass, so the allocated bytes only grow as
+  // it steps forward, then backward, through the layers.
+  for (int i = 1; i < 5; ++i) {
+    EXPECT_LE(report.forward_allocated_bytes[i - 1],
+        report.forward_allocated_bytes[i]);
+    EXPECT_GE(report.backward_allocated_bytes[i - 1],
+        report.backward_allocated_bytes[i]);
+  }
+  EXPECT_LE(report.forward_allocated_bytes[4],
+      report.backward_allocated_bytes[4]);
+  EXPECT_EQ(report.backward_allocated_bytes[0], report.peak_bytes);
+  EXPECT_LE(report.peak_bytes, report.param_bytes +
+      report.activation_bytes + report.workspace_bytes);
+}
+
+TYPED_TEST(MemoryReportTest, TestReportCountsPackedStorage) {
+  this->InitNet("FULL");
+  MemoryReport full_report;
+  ReportMemory(this->net_.get(), &full_report);
+  this->InitNet("FLOAT16");
+  MemoryReport packed_report;
+  ReportMemory(this->net_.get(), &packed_report);
+  // sig1 is packed once ip2, its last reader, has run
+  const size_t packed_bytes = 4 * 8 * sizeof(uint16_t);
+  EXPECT_EQ(full_report.forward_allocated_bytes[3] -
+      full_report.forward_allocated_bytes[2] + packed_bytes,
+      packed_report.forward_allocated_bytes[3] -
+      packed_report.forward_allocated_bytes[2]);
+  EXPECT_LE(packed_report.peak_bytes, packed_report.param_bytes +
+      packed_report.activation_bytes + packed_report.workspace_bytes);
+}
+
+}  // namespace caffe
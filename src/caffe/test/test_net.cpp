@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <string>
 #include <utility>
 #include <vector>
@@ -10,12 +11,34 @@
 #include "caffe/filler.hpp"
 #include "caffe/net.hpp"
 #include "caffe/util/math_functions.hpp"
+#include "caffe/util/region_index.hpp"
 
 #include "caffe/test/test_caffe_main.hpp"
 #include "caffe/test/test_gradient_check_util.hpp"
 
 namespace caffe {
 
+// A net whose tests can look at the 16-bit copies it holds its reduced
+// precision activations in between the passes.
+template <typename Dtype>
+class PackedStorageNet : public Net<Dtype> {
+ public:
+  explicit PackedStorageNet(const NetParameter& param) : Net<Dtype>(param) {}
+
+  // The packed copy of the named blob, or NULL if it is held in Dtype.
+  SyncedMemory* packed_data(const string& blob_name) const {
+    const int blob_id = this->blob_names_index_.find(blob_name)->second;
+    for (int c = 0; c < this->compress_blob_ids_.size(); ++c) {
+      const vector<int>& blob_ids = this->compress_blob_ids_[c];
+      if (std::find(blob_ids.begin(), blob_ids.end(), blob_id) !=
+          blob_ids.end()) {
+        return this->compress_storage_[c].get();
+      }
+    }
+    return NULL;
+  }
+};
+
 template <typename TypeParam>
 class NetTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -713,6 +736,303 @@ class NetTest : public MultiDeviceTest<TypeParam> {
     InitNetFromProtoString(proto);
   }
 
+  virtual void InitInPlaceNet(bool in_place) {
+    string proto =
+      "name: 'InPlaceTestNetwork' "
+      "state { phase: TRAIN } ";
+    if (!in_place) {
+      proto += "mem_param { in_place: false } ";
+    }
+    proto +=
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { "
+      "    shape { dim: 4 dim: 2 dim: 3 dim: 3 } "
+      "    data_filler { type: 'gaussian' std: 1 } "
+      "    shape { dim: 4 dim: 3 } "
+      "    data_filler { type: 'gaussian' std: 1 } "
+      "  } "
+      "  top: 'data' "
+      "  top: 'target' "
+      "} "
+      "layer { "
+      "  name: 'conv' "
+      "  type: 'Convolution' "
+      "  convolution_param { "
+      "    num_output: 3 "
+      "    kernel_size: 3 "
+      "    pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'constant' value: 0.1 } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'conv' "
+      "} "
+      "layer { "
+      "  name: 'bn' "
+      "  type: 'BN' "
+      "  bn_param { "
+      "    slope_filler { type: 'constant' value: 1 } "
+      "    bias_filler { type: 'constant' value: 0 } "
+      "  } "
+      "  bottom: 'conv' "
+      "  top: 'bn' "
+      "} "
+      "layer { "
+      "  name: 'scale' "
+      "  type: 'Scale' "
+      "  scale_param { "
+      "    filler { type: 'gaussian' std: 1 } "
+      "    bias_term: true "
+      "    bias_filler { type: 'constant' value: 0.2 } "
+      "  } "
+      "  bottom: 'bn' "
+      "  top: 'scale' "
+      "} "
+      "layer { "
+      "  name: 'relu' "
+      "  type: 'ReLU' "
+      "  bottom: 'scale' "
+      "  top: 'relu' "
+      "} "
+      "layer { "
+      "  name: 'ip' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'constant' value: 0.1 } "
+      "  } "
+      "  bottom: 'relu' "
+      "  top: 'ip' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'ip' "
+      "  bottom: 'target' "
+      "  top: 'loss' "
+      "} ";
+    InitNetFromProtoString(proto);
+  }
+
+  virtual void InitRecomputeNet(bool recompute, const string& storage = "") {
+    string proto =
+      "name: 'RecomputeTestNetwork' "
+      "state { phase: TRAIN } ";
+    if (!recompute) {
+      proto += "mem_param { recompute: false } ";
+    }
+    // with a storage precision, the same layers hold their tops in it
+    // instead of recomputing them
+    const string recompute_flag = storage.empty() ? "  recompute: true "
+        : "  top_storage: " + storage + " ";
+    proto +=
+      "layer { "
+      "  name: 'data' "
+      "  type: 'DummyData' "
+      "  dummy_data_param { "
+      "    shape { dim: 4 dim: 6 } "
+      "    data_filler { type: 'gaussian' std: 1 } "
+      "    shape { dim: 4 dim: 3 } "
+      "    data_filler { type: 'gaussian' std: 1 } "
+      "  } "
+      "  top: 'data' "
+      "  top: 'target' "
+      "} "
+      "layer { "
+      "  name: 'ip1' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 8 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'constant' value: 0.1 } "
+      "  } "
+      "  bottom: 'data' "
+      "  top: 'ip1' "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'ip1' "
+      "  top: 'ip1' "
+      + recompute_flag +
+      "} "
+      "layer { "
+      "  name: 'ip2' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 8 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'constant' value: 0.1 } "
+      "  } "
+      "  bottom: 'ip1' "
+      "  top: 'ip2' "
+      + recompute_flag +
+      "} "
+      "layer { "
+      "  name: 'sigmoid2' "
+      "  type: 'Sigmoid' "
+      "  bottom: 'ip2' "
+      "  top: 'sig2' "
+      + recompute_flag +
+      "} "
+      "layer { "
+      "  name: 'ip3' "
+      "  type: 'InnerProduct' "
+      "  inner_product_param { "
+      "    num_output: 3 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'constant' value: 0.1 } "
+      "  } "
+      "  bottom: 'sig2' "
+      "  top: 'ip3' "
+      "} "
+      "layer { "
+      "  name: 'loss' "
+      "  type: 'EuclideanLoss' "
+      "  bottom: 'ip3' "
+      "  bottom: 'target' "
+      "  top: 'loss' "
+      "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    net_.reset(new PackedStorageNet<Dtype>(param));
+  }
+
+  // The packed copy of a blob of a net made by InitRecomputeNet.
+  SyncedMemory* packed_data(const string& blob_name) {
+    return static_cast<PackedStorageNet<Dtype>*>(net_.get())->packed_data(
+        blob_name);
+  }
+
+  // A two-stage cascade, with a second stage when chained whose Mask layer
+  // reads the compressed output of the first and whose dense outputs, one
+  // of them summed with its input, are read by no other layer.
+  virtual void InitCascadeNet(bool early_exit, bool chained = false) {
+    string proto =
+      "name: 'CascadeTestNetwork' "
+      "state { phase: TEST } ";
+    if (early_exit) {
+      proto += "cascade_early_exit: true ";
+    }
+    proto +=
+      "input: 'data' "
+      "input_shape { dim: 2 dim: 2 dim: 4 dim: 5 } "
+      "input: 'prob' "
+      "input_shape { dim: 2 dim: 3 dim: 4 dim: 5 } "
+      "layer { "
+      "  name: 'mask' "
+      "  type: 'Mask' "
+      "  mask_param { threshold: 0.5 } "
+      "  bottom: 'prob' "
+      "  top: 'mask' "
+      "  top: 'index' "
+      "} "
+      "layer { "
+      "  name: 'conv1' "
+      "  type: 'RegionConvolution' "
+      "  convolution_param { "
+      "    num_output: 3 "
+      "    kernel_size: 3 "
+      "    pad: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'constant' value: 0.1 } "
+      "  } "
+      "  region_convolution_param { output_compression: true } "
+      "  bottom: 'data' "
+      "  bottom: 'mask' "
+      "  bottom: 'index' "
+      "  top: 'conv1' "
+      "} "
+      "layer { "
+      "  name: 'relu1' "
+      "  type: 'ReLU' "
+      "  bottom: 'conv1' "
+      "  top: 'relu1' "
+      "} "
+      "layer { "
+      "  name: 'conv2' "
+      "  type: 'RegionConvolution' "
+      "  convolution_param { "
+      "    num_output: 2 "
+      "    kernel_size: 1 "
+      "    weight_filler { type: 'gaussian' std: 0.5 } "
+      "    bias_filler { type: 'constant' value: 0.1 } "
+      "  } "
+      "  region_convolution_param { input_compression: true } "
+      "  bottom: 'relu1' "
+      "  bottom: 'mask' "
+      "  bottom: 'index' "
+      "  bottom: 'data' "
+      "  top: 'out' "
+      "} ";
+    if (chained) {
+      proto +=
+        "layer { "
+        "  name: 'mask2' "
+        "  type: 'Mask' "
+        "  mask_param { threshold: 100 } "
+        "  bottom: 'relu1' "
+        "  top: 'mask2' "
+        "  top: 'index2' "
+        "} "
+        "layer { "
+        "  name: 'conv3' "
+        "  type: 'RegionConvolution' "
+        "  convolution_param { "
+        "    num_output: 2 "
+        "    kernel_size: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.5 } "
+        "    bias_filler { type: 'constant' value: 0.1 } "
+        "  } "
+        "  region_convolution_param { output_compression: true } "
+        "  bottom: 'relu1' "
+        "  bottom: 'mask2' "
+        "  bottom: 'index2' "
+        "  top: 'conv3' "
+        "} "
+        "layer { "
+        "  name: 'relu3' "
+        "  type: 'ReLU' "
+        "  bottom: 'conv3' "
+        "  top: 'relu3' "
+        "} "
+        "layer { "
+        "  name: 'conv4' "
+        "  type: 'RegionConvolution' "
+        "  convolution_param { "
+        "    num_output: 2 "
+        "    kernel_size: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.5 } "
+        "    bias_filler { type: 'constant' value: 0.1 } "
+        "  } "
+        "  bottom: 'relu1' "
+        "  bottom: 'mask2' "
+        "  bottom: 'index2' "
+        "  top: 'dense4' "
+        "} "
+        "layer { "
+        "  name: 'conv5' "
+        "  type: 'RegionConvolution' "
+        "  convolution_param { "
+        "    num_output: 3 "
+        "    kernel_size: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.5 } "
+        "    bias_filler { type: 'constant' value: 0.1 } "
+        "  } "
+        "  eltwise_param { coeff: 0.5 coeff: 2 } "
+        "  bottom: 'relu1' "
+        "  bottom: 'mask2' "
+        "  bottom: 'index2' "
+        "  bottom: 'relu1' "
+        "  top: 'sum5' "
+        "} ";
+    }
+    InitNetFromProtoString(proto);
+  }
+
   int seed_;
   shared_ptr<Net<Dtype> > net_;
 };
@@ -2372,4 +2692,368 @@ TYPED_TEST(NetTest, TestSkipPropagateDown) {
   }
 }
 
+TYPED_TEST(NetTest, TestRecompute) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Discarding the activations of the recompute segment and regenerating
+  // them in the backward pass must not change the loss or the gradients.
+  Caffe::set_random_seed(this->seed_);
+  this->InitRecomputeNet(false);
+  Dtype loss = this->net_->ForwardBackward(vector<Blob<Dtype>*>());
+  vector<shared_ptr<Blob<Dtype> > > params;
+  for (int i = 0; i < this->net_->params().size(); ++i) {
+    const Blob<Dtype>* param = this->net_->params()[i].get();
+    params.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    params[i]->CopyFrom(*param, false, true);
+    params[i]->CopyFrom(*param, true, true);
+  }
+
+  // Only the ip2 activation lies inside the segment (relu1, ip2 and
+  // sigmoid2); ip1 and sig2 are also read by layers outside of it. Holding
+  // everything for backward, the full net gives its memory to no later blob.
+  const char* later_blobs[] = {"ip3", "loss"};
+  for (int i = 0; i < 2; ++i) {
+    EXPECT_NE(this->net_->blob_by_name("ip2")->data(),
+        this->net_->blob_by_name(later_blobs[i])->data());
+  }
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitRecomputeNet(true);
+  Dtype loss_recompute;
+  this->net_->ForwardPrefilled(&loss_recompute);
+  EXPECT_FLOAT_EQ(loss, loss_recompute);
+  // After the forward pass the memory of ip2 either holds a blob computed
+  // after the segment or was never allocated.
+  const shared_ptr<SyncedMemory> released =
+      this->net_->blob_by_name("ip2")->data();
+  bool reused = released->head() == SyncedMemory::UNINITIALIZED;
+  for (int i = 0; i < 2; ++i) {
+    reused |= released == this->net_->blob_by_name(later_blobs[i])->data();
+  }
+  EXPECT_TRUE(reused);
+  this->net_->Backward();
+  ASSERT_EQ(params.size(), this->net_->params().size());
+  for (int i = 0; i < params.size(); ++i) {
+    const Blob<Dtype>* param = this->net_->params()[i].get();
+    ASSERT_EQ(params[i]->count(), param->count());
+    for (int j = 0; j < param->count(); ++j) {
+      EXPECT_FLOAT_EQ(params[i]->cpu_data()[j], param->cpu_data()[j]);
+      EXPECT_FLOAT_EQ(params[i]->cpu_diff()[j], param->cpu_diff()[j]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestReducedPrecisionStorage) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Holding activations in 16 bits between the passes leaves the forward
+  // pass alone and perturbs the gradients by the rounding error only.
+  Caffe::set_random_seed(this->seed_);
+  this->InitRecomputeNet(false);
+  // The activations of the layers given a storage precision are copied as
+  // soon as they are computed, before the net reuses their memory.
+  const char* layers[] = {"relu1", "ip2", "sigmoid2"};
+  const char* names[] = {"ip1", "ip2", "sig2"};
+  vector<shared_ptr<Blob<Dtype> > > activations;
+  Dtype loss = 0;
+  for (int i = 0; i < this->net_->layers().size(); ++i) {
+    loss += this->net_->ForwardFromTo(i, i);
+    for (int j = 0; j < 3; ++j) {
+      if (this->net_->layer_names()[i] == layers[j]) {
+        EXPECT_TRUE(this->packed_data(names[j]) == NULL);
+        activations.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+        activations.back()->CopyFrom(*this->net_->blob_by_name(names[j]),
+            false, true);
+      }
+    }
+  }
+  ASSERT_EQ(3, activations.size());
+  this->net_->Backward();
+  vector<shared_ptr<Blob<Dtype> > > params;
+  for (int i = 0; i < this->net_->params().size(); ++i) {
+    params.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    params[i]->CopyFrom(*this->net_->params()[i], true, true);
+  }
+
+  const char* storages[] = {"FLOAT16", "BFLOAT16"};
+  const Dtype tolerances[] = {1e-3, 1e-2};
+  for (int s = 0; s < 2; ++s) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitRecomputeNet(false, storages[s]);
+    EXPECT_FLOAT_EQ(loss, this->net_->ForwardBackward(vector<Blob<Dtype>*>()));
+    // Each activation is packed into two bytes per value, rounded from the
+    // activation of the full precision net.
+    for (int i = 0; i < 3; ++i) {
+      SyncedMemory* packed = this->packed_data(names[i]);
+      ASSERT_TRUE(packed != NULL);
+      const int count = activations[i]->count();
+      ASSERT_EQ(count * sizeof(uint16_t), packed->size());
+      vector<uint16_t> expected(count);
+      if (s == 0) {
+        caffe_cpu_float2half(count, activations[i]->cpu_data(), &expected[0]);
+      } else {
+        caffe_cpu_float2bfloat16(count, activations[i]->cpu_data(),
+            &expected[0]);
+      }
+      const uint16_t* bits = static_cast<const uint16_t*>(packed->cpu_data());
+      for (int j = 0; j < count; ++j) {
+        EXPECT_EQ(expected[j], bits[j]);
+      }
+    }
+    for (int i = 0; i < params.size(); ++i) {
+      const Blob<Dtype>* param = this->net_->params()[i].get();
+      for (int j = 0; j < param->count(); ++j) {
+        const Dtype expected = params[i]->cpu_diff()[j];
+        EXPECT_NEAR(expected, param->cpu_diff()[j],
+            tolerances[s] * std::max(std::fabs(expected), Dtype(1)));
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestReducedPrecisionStorageKeepsMask) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The mask columns and the region index are integers, which the Mask layer
+  // keeps in full precision whatever its top_storage asks for.
+  const char* storages[] = {"FULL", "FLOAT16"};
+  Dtype loss[2];
+  vector<shared_ptr<Blob<Dtype> > > params;
+  for (int s = 0; s < 2; ++s) {
+    const string proto =
+        "name: 'MaskStorageNetwork' "
+        "state { phase: TRAIN } "
+        "input: 'data' "
+        "input_shape { dim: 2 dim: 2 dim: 4 dim: 5 } "
+        "input: 'prob' "
+        "input_shape { dim: 2 dim: 3 dim: 4 dim: 5 } "
+        "layer { "
+        "  name: 'mask' "
+        "  type: 'Mask' "
+        "  mask_param { threshold: 0.5 } "
+        "  top_storage: " + string(storages[s]) + " "
+        "  bottom: 'prob' "
+        "  top: 'mask' "
+        "  top: 'index' "
+        "} "
+        "layer { "
+        "  name: 'conv' "
+        "  type: 'RegionConvolution' "
+        "  convolution_param { "
+        "    num_output: 3 "
+        "    kernel_size: 3 "
+        "    pad: 1 "
+        "    weight_filler { type: 'gaussian' std: 0.5 } "
+        "    bias_filler { type: 'constant' value: 0.1 } "
+        "  } "
+        "  bottom: 'data' "
+        "  bottom: 'mask' "
+        "  bottom: 'index' "
+        "  top: 'conv' "
+        "  loss_weight: 1 "
+        "} ";
+    NetParameter param;
+    CHECK(google::protobuf::TextFormat::ParseFromString(proto, &param));
+    Caffe::set_random_seed(this->seed_);
+    PackedStorageNet<Dtype> net(param);
+    FillerParameter filler_param;
+    filler_param.set_min(0);
+    filler_param.set_max(1);
+    UniformFiller<Dtype> filler(filler_param);
+    Caffe::set_random_seed(this->seed_);
+    filler.Fill(net.blob_by_name("data").get());
+    filler.Fill(net.blob_by_name("prob").get());
+    loss[s] = net.ForwardBackward(vector<Blob<Dtype>*>());
+    EXPECT_TRUE(net.packed_data("mask") == NULL);
+    EXPECT_TRUE(net.packed_data("index") == NULL);
+    for (int i = 0; i < net.params().size(); ++i) {
+      if (s == 0) {
+        params.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+        params[i]->CopyFrom(*net.params()[i], true, true);
+        continue;
+      }
+      for (int j = 0; j < params[i]->count(); ++j) {
+        EXPECT_EQ(params[i]->cpu_diff()[j], net.params()[i]->cpu_diff()[j]);
+      }
+    }
+  }
+  EXPECT_EQ(loss[0], loss[1]);
+}
+
+TYPED_TEST(NetTest, TestInPlaceChain) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The BN -> Scale -> ReLU chain runs on the storage of the convolution
+  // output, which must not change the loss or the gradients.
+  Caffe::set_random_seed(this->seed_);
+  this->InitInPlaceNet(false);
+  EXPECT_NE(this->net_->blob_by_name("conv")->data(),
+            this->net_->blob_by_name("bn")->data());
+  Dtype loss = this->net_->ForwardBackward(vector<Blob<Dtype>*>());
+  vector<shared_ptr<Blob<Dtype> > > params;
+  for (int i = 0; i < this->net_->params().size(); ++i) {
+    params.push_back(shared_ptr<Blob<Dtype> >(new Blob<Dtype>()));
+    params[i]->CopyFrom(*this->net_->params()[i], true, true);
+  }
+
+  Caffe::set_random_seed(this->seed_);
+  this->InitInPlaceNet(true);
+  const char* chain[] = {"bn", "scale", "relu"};
+  const Blob<Dtype>* conv = this->net_->blob_by_name("conv").get();
+  for (int i = 0; i < 3; ++i) {
+    const Blob<Dtype>* blob = this->net_->blob_by_name(chain[i]).get();
+    EXPECT_EQ(conv->data(), blob->data());
+    EXPECT_EQ(conv->diff(), blob->diff());
+  }
+  // the inner product needs its bottom in Backward
+  EXPECT_NE(this->net_->blob_by_name("relu")->data(),
+            this->net_->blob_by_name("ip")->data());
+  EXPECT_FLOAT_EQ(loss, this->net_->ForwardBackward(vector<Blob<Dtype>*>()));
+  ASSERT_EQ(params.size(), this->net_->params().size());
+  for (int i = 0; i < params.size(); ++i) {
+    const Blob<Dtype>* param = this->net_->params()[i].get();
+    for (int j = 0; j < param->count(); ++j) {
+      EXPECT_FLOAT_EQ(params[i]->cpu_diff()[j], param->cpu_diff()[j]);
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestCascadeEarlyExit) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(2, 2, 4, 5);
+  filler.Fill(&data);
+  Blob<Dtype> prob(2, 3, 4, 5);
+  const Dtype kUnsure = 0.2;
+  const Dtype kSure = 0.9;
+  // The second stage changes the output where no class is sure, so that
+  // with every image sure it only copies the data, whether it runs or not.
+  for (int early_exit = 0; early_exit < 2; ++early_exit) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitCascadeNet(early_exit);
+    Blob<Dtype>* relu1 = this->net_->blob_by_name("relu1").get();
+    const Blob<Dtype>* out = this->net_->blob_by_name("out").get();
+    this->net_->input_blobs()[0]->CopyFrom(data);
+    for (int pass = 0; pass < 2; ++pass) {
+      const bool sure = pass == 0;
+      caffe_set(prob.count(), sure ? kSure : kUnsure,
+          prob.mutable_cpu_data());
+      this->net_->input_blobs()[1]->CopyFrom(prob);
+      caffe_set(relu1->count(), Dtype(-7), relu1->mutable_cpu_data());
+      this->net_->ForwardPrefilled();
+      // the layers between the region convolutions only run when a pixel
+      // of the batch needs them
+      const bool skipped = early_exit && sure;
+      for (int i = 0; i < relu1->count(); ++i) {
+        if (skipped) {
+          EXPECT_EQ(Dtype(-7), relu1->cpu_data()[i]);
+        } else {
+          EXPECT_GE(relu1->cpu_data()[i], 0);
+        }
+      }
+      int changed = 0;
+      for (int i = 0; i < out->count(); ++i) {
+        if (sure) {
+          EXPECT_EQ(data.cpu_data()[i], out->cpu_data()[i]);
+        }
+        changed += out->cpu_data()[i] != data.cpu_data()[i];
+      }
+      if (!sure) {
+        EXPECT_GT(changed, 0);
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestChainedCascadeEarlyExit) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(2, 2, 4, 5);
+  filler.Fill(&data);
+  Blob<Dtype> prob(2, 3, 4, 5);
+  // The second stage selects every pixel it sees, but when the first stage
+  // exits its Mask layer only sees the stale output of the first.
+  for (int early_exit = 0; early_exit < 2; ++early_exit) {
+    Caffe::set_random_seed(this->seed_);
+    this->InitCascadeNet(early_exit, true);
+    Blob<Dtype>* relu1 = this->net_->blob_by_name("relu1").get();
+    Blob<Dtype>* relu3 = this->net_->blob_by_name("relu3").get();
+    this->net_->input_blobs()[0]->CopyFrom(data);
+    for (int pass = 0; pass < 2; ++pass) {
+      const bool sure = pass == 0;
+      caffe_set(prob.count(), Dtype(sure ? 0.9 : 0.2),
+          prob.mutable_cpu_data());
+      this->net_->input_blobs()[1]->CopyFrom(prob);
+      caffe_set(relu1->count(), Dtype(-7), relu1->mutable_cpu_data());
+      caffe_set(relu3->count(), Dtype(-7), relu3->mutable_cpu_data());
+      this->net_->ForwardPrefilled();
+      const bool skipped = early_exit && sure;
+      for (int i = 0; i < relu3->count(); ++i) {
+        if (skipped) {
+          EXPECT_EQ(Dtype(-7), relu3->cpu_data()[i]);
+        } else {
+          EXPECT_GE(relu3->cpu_data()[i], 0);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(NetTest, TestChainedCascadeEarlyExitClearsMask) {
+  typedef typename TypeParam::Dtype Dtype;
+  FillerParameter filler_param;
+  filler_param.set_std(1);
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> data(2, 2, 4, 5);
+  filler.Fill(&data);
+  Blob<Dtype> prob(2, 3, 4, 5);
+  // A pass where the second stage selects every pixel, then one where the
+  // first stage exits: the skipped Mask layer of the second must select
+  // nothing, or its dense outputs would gather the pixels of the first pass.
+  Caffe::set_random_seed(this->seed_);
+  this->InitCascadeNet(true, true);
+  const Blob<Dtype>* mask2 = this->net_->blob_by_name("mask2").get();
+  const Blob<Dtype>* index2 = this->net_->blob_by_name("index2").get();
+  const Blob<Dtype>* relu1 = this->net_->blob_by_name("relu1").get();
+  const Blob<Dtype>* dense4 = this->net_->blob_by_name("dense4").get();
+  const Blob<Dtype>* sum5 = this->net_->blob_by_name("sum5").get();
+  this->net_->input_blobs()[0]->CopyFrom(data);
+  for (int pass = 0; pass < 2; ++pass) {
+    const bool sure = pass == 1;
+    caffe_set(prob.count(), Dtype(sure ? 0.9 : 0.2),
+        prob.mutable_cpu_data());
+    this->net_->input_blobs()[1]->CopyFrom(prob);
+    this->net_->ForwardPrefilled();
+    for (int n = 0; n < 2; ++n) {
+      const int cnt = region_index_count(region_index_cpu(*index2, n));
+      if (sure) {
+        EXPECT_EQ(0, cnt);
+      } else {
+        EXPECT_GT(cnt, 0);
+      }
+    }
+    int active = 0;
+    for (int i = 0; i < mask2->count(); ++i) {
+      active += mask2->cpu_data()[i] != -1;
+    }
+    for (int i = 0; sure && i < dense4->count(); ++i) {
+      EXPECT_EQ(Dtype(0), dense4->cpu_data()[i]);
+    }
+    int changed = 0;
+    for (int i = 0; i < sum5->count(); ++i) {
+      const Dtype residual = Dtype(0.5) * relu1->cpu_data()[i];
+      if (sure) {
+        EXPECT_EQ(residual, sum5->cpu_data()[i]);
+      }
+      changed += sum5->cpu_data()[i] != residual;
+    }
+    if (sure) {
+      EXPECT_EQ(0, active);
+    } else {
+      EXPECT_GT(active, 0);
+      EXPECT_GT(changed, 0);
+    }
+  }
+}
+
 }  // namespace caffe
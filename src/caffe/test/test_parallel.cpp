@@ -0,0 +1,68 @@
+#include <climits>
+#include <vector>
+
+#include "boost/bind/bind.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/common.hpp"
+#include "caffe/util/parallel.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
+// Records the range each thread was given.
+void RecordRange(vector<int>* begins, vector<int>* ends, int thread_id,
+    int begin, int end) {
+  (*begins)[thread_id] = begin;
+  (*ends)[thread_id] = end;
+}
+
+// Records the ranges a nested call runs in.
+void RecordNestedRanges(vector<int>* nested_ranges, int thread_id,
+    int begin, int end) {
+  vector<int> begins(4), ends(4);
+  (*nested_ranges)[thread_id] = caffe_parallel_for(10, 4,
+      boost::bind(&RecordRange, &begins, &ends, _1, _2, _3));
+}
+
+class ParallelForTest : public ::testing::Test {};
+
+TEST_F(ParallelForTest, TestRangesOfLargeCount) {
+  // count * thread_id overflows an int, the ranges must not
+  const int count = INT_MAX - 1;
+  vector<int> begins(4, -1), ends(4, -1);
+  EXPECT_EQ(4, caffe_parallel_for(count, 4,
+      boost::bind(&RecordRange, &begins, &ends, _1, _2, _3)));
+  EXPECT_EQ(0, begins[0]);
+  for (int t = 0; t < 4; ++t) {
+    EXPECT_LT(begins[t], ends[t]);
+    if (t > 0) {
+      EXPECT_EQ(ends[t - 1], begins[t]);
+    }
+  }
+  EXPECT_EQ(count, ends[3]);
+}
+
+TEST_F(ParallelForTest, TestRangesRun) {
+  vector<int> begins(4, -1), ends(4, -1);
+  // no more ranges than elements
+  EXPECT_EQ(3, caffe_parallel_for(3, 4,
+      boost::bind(&RecordRange, &begins, &ends, _1, _2, _3)));
+  EXPECT_EQ(1, caffe_parallel_for(3, 1,
+      boost::bind(&RecordRange, &begins, &ends, _1, _2, _3)));
+  EXPECT_EQ(0, caffe_parallel_for(0, 4,
+      boost::bind(&RecordRange, &begins, &ends, _1, _2, _3)));
+  // Nested calls run serially, on the workers as on the calling thread.
+  vector<int> nested_ranges(2, -1);
+  EXPECT_EQ(2, caffe_parallel_for(2, 2,
+      boost::bind(&RecordNestedRanges, &nested_ranges, _1, _2, _3)));
+  EXPECT_EQ(1, nested_ranges[0]);
+  EXPECT_EQ(1, nested_ranges[1]);
+}
+
+}  // namespace caffe
@@ -606,6 +606,101 @@ TYPED_TEST(PoolingLayerTest, TestGradientAvePadded) {
   }
 }
 
+TYPED_TEST(PoolingLayerTest, TestThreadedMatchesSerial) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_->Reshape(2, 3, 9, 11);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  Blob<Dtype> serial_top, serial_diff;
+  const PoolingParameter_PoolMethod methods[] = {
+      PoolingParameter_PoolMethod_MAX, PoolingParameter_PoolMethod_AVE};
+  for (int m = 0; m < 2; ++m) {
+    for (int kernel = 2; kernel <= 3; ++kernel) {
+      for (int pad = 0; pad < kernel - 1; ++pad) {
+        LayerParameter layer_param;
+        PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+        pooling_param->set_kernel_size(kernel);
+        pooling_param->set_stride(2);
+        pooling_param->set_pad(pad);
+        pooling_param->set_pool(methods[m]);
+        // The serial pass outputs the mask, which keeps it off the unrolled
+        // kernels and the compact mask.
+        for (int threads = 1; threads <= 3; threads += 2) {
+          pooling_param->set_num_threads(threads);
+          vector<Blob<Dtype>*> top_vec(this->blob_top_vec_);
+          if (threads == 1 && methods[m] == PoolingParameter_PoolMethod_MAX) {
+            top_vec.push_back(this->blob_top_mask_);
+          }
+          PoolingLayer<Dtype> layer(layer_param);
+          layer.SetUp(this->blob_bottom_vec_, top_vec);
+          layer.Forward(this->blob_bottom_vec_, top_vec);
+          caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+              this->blob_top_->mutable_cpu_diff());
+          vector<bool> propagate_down(1, true);
+          layer.Backward(top_vec, propagate_down, this->blob_bottom_vec_);
+          if (threads == 1) {
+            serial_top.CopyFrom(*this->blob_top_, false, true);
+            serial_diff.CopyFrom(*this->blob_bottom_, true, true);
+            continue;
+          }
+          for (int i = 0; i < this->blob_top_->count(); ++i) {
+            EXPECT_NEAR(serial_top.cpu_data()[i],
+                this->blob_top_->cpu_data()[i], 1e-5);
+          }
+          for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+            EXPECT_NEAR(serial_diff.cpu_diff()[i],
+                this->blob_bottom_->cpu_diff()[i], 1e-5);
+          }
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(PoolingLayerTest, TestThreadedStochasticMatchesSerial) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Training draws every threshold before the planes are split, so a seeded
+  // run samples the same activations when four threads take the six planes
+  // in uneven ranges of one and two.
+  this->blob_bottom_->Reshape(2, 3, 9, 11);
+  FillerParameter filler_param;
+  filler_param.set_min(0.1);
+  filler_param.set_max(1);
+  UniformFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  Blob<Dtype> serial_top, serial_diff;
+  LayerParameter layer_param;
+  layer_param.set_phase(TRAIN);
+  PoolingParameter* pooling_param = layer_param.mutable_pooling_param();
+  pooling_param->set_kernel_size(3);
+  pooling_param->set_stride(2);
+  pooling_param->set_pool(PoolingParameter_PoolMethod_STOCHASTIC);
+  for (int threads = 1; threads <= 4; threads += 3) {
+    pooling_param->set_num_threads(threads);
+    PoolingLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    Caffe::set_random_seed(1702);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_copy(this->blob_top_->count(), this->blob_top_->cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    vector<bool> propagate_down(1, true);
+    layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    if (threads == 1) {
+      serial_top.CopyFrom(*this->blob_top_, false, true);
+      serial_diff.CopyFrom(*this->blob_bottom_, true, true);
+      continue;
+    }
+    for (int i = 0; i < this->blob_top_->count(); ++i) {
+      EXPECT_EQ(serial_top.cpu_data()[i], this->blob_top_->cpu_data()[i]);
+    }
+    for (int i = 0; i < this->blob_bottom_->count(); ++i) {
+      EXPECT_EQ(serial_diff.cpu_diff()[i], this->blob_bottom_->cpu_diff()[i]);
+    }
+  }
+}
+
 #ifdef USE_CUDNN
 template <typename Dtype>
 class CuDNNPoolingLayerTest : public GPUDeviceTest<Dtype> {
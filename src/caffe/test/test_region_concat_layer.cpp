@@ -0,0 +1,102 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/common_layers.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/region_index.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class RegionConcatLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  RegionConcatLayerTest()
+      : blob_bottom_0_(new Blob<Dtype>(2, 3, 1, 10)),
+        blob_bottom_1_(new Blob<Dtype>(2, 2, 1, 10)),
+        blob_bottom_index_(new Blob<Dtype>(2, region_index_width<Dtype>(10),
+            1, 1)),
+        blob_top_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_0_);
+    filler.Fill(this->blob_bottom_1_);
+    // the first 7 pixels of the first image and 4 of the second are active
+    const int counts[] = {7, 4};
+    for (int n = 0; n < 2; ++n) {
+      int* index = region_index_mutable_cpu(blob_bottom_index_, n);
+      for (int m = 0; m < counts[n]; ++m) {
+        region_index_pixels(index)[m] = m;
+      }
+      region_index_finish(counts[n], index);
+    }
+    blob_bottom_vec_.push_back(blob_bottom_0_);
+    blob_bottom_vec_.push_back(blob_bottom_1_);
+    blob_bottom_vec_.push_back(blob_bottom_index_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~RegionConcatLayerTest() {
+    delete blob_bottom_0_;
+    delete blob_bottom_1_;
+    delete blob_bottom_index_;
+    delete blob_top_;
+  }
+
+  Blob<Dtype>* const blob_bottom_0_;
+  Blob<Dtype>* const blob_bottom_1_;
+  Blob<Dtype>* const blob_bottom_index_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(RegionConcatLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(RegionConcatLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  RegionConcatLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  EXPECT_EQ(this->blob_top_->num(), 2);
+  EXPECT_EQ(this->blob_top_->channels(), 5);
+  EXPECT_EQ(this->blob_top_->width(), 10);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // an image holds the active pixels of the channels of bottom[0], then
+  // those of bottom[1]
+  for (int n = 0; n < 2; ++n) {
+    const int cnt = region_index_count(
+        region_index_cpu(*this->blob_bottom_index_, n));
+    const Dtype* top_data =
+        this->blob_top_->cpu_data() + this->blob_top_->offset(n);
+    for (int c = 0; c < 5; ++c) {
+      for (int m = 0; m < cnt; ++m) {
+        const Dtype expected = c < 3 ?
+            this->blob_bottom_0_->cpu_data()[
+                this->blob_bottom_0_->offset(n) + c * cnt + m] :
+            this->blob_bottom_1_->cpu_data()[
+                this->blob_bottom_1_->offset(n) + (c - 3) * cnt + m];
+        EXPECT_EQ(top_data[c * cnt + m], expected);
+      }
+    }
+  }
+}
+
+TYPED_TEST(RegionConcatLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  RegionConcatLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 1);
+}
+
+}  // namespace caffe
@@ -0,0 +1,303 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/common_layers.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/region_index.hpp"
+#include "caffe/vision_layers.hpp"
+#include "caffe/workspace.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class RegionConvolutionLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  RegionConvolutionLayerTest()
+      : blob_bottom_(new Blob<Dtype>(1, 3, 5, 6)),
+        blob_mask_(new Blob<Dtype>(1, 1, 5, 6)),
+        blob_index_(new Blob<Dtype>(1, 1, 1,
+            region_index_width<Dtype>(5 * 6))),
+        blob_top_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_);
+    blob_bottom_vec_.push_back(blob_bottom_);
+    blob_bottom_vec_.push_back(blob_mask_);
+    blob_bottom_vec_.push_back(blob_index_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~RegionConvolutionLayerTest() {
+    delete blob_bottom_;
+    delete blob_mask_;
+    delete blob_index_;
+    delete blob_top_;
+  }
+
+  // Fills the mask and index blobs the way MaskLayer does, with every
+  // pixel whose index is not a multiple of skip active (all of them for a
+  // skip of 0).
+  int SetActive(const int skip) {
+    const int spatial_dim = blob_mask_->count();
+    Dtype* mask = blob_mask_->mutable_cpu_data();
+    int* index = region_index_mutable_cpu(blob_index_, 0);
+    int cnt = 0;
+    for (int i = 0; i < spatial_dim; ++i) {
+      mask[i] = -1;
+      if (skip > 0 && i % skip == 0) {
+        continue;
+      }
+      region_index_pixels(index)[cnt] = i;
+      mask[i] = cnt++;
+    }
+    region_index_finish(cnt, index);
+    return cnt;
+  }
+
+  void SetConvolutionParam(LayerParameter* layer_param) {
+    ConvolutionParameter* convolution_param =
+        layer_param->mutable_convolution_param();
+    convolution_param->set_kernel_size(3);
+    convolution_param->set_pad(1);
+    convolution_param->set_num_output(4);
+    convolution_param->mutable_weight_filler()->set_type("gaussian");
+    convolution_param->mutable_bias_filler()->set_type("gaussian");
+  }
+
+  Blob<Dtype>* const blob_bottom_;
+  Blob<Dtype>* const blob_mask_;
+  Blob<Dtype>* const blob_index_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(RegionConvolutionLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(RegionConvolutionLayerTest, TestForwardMatchesConvolution) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->SetActive(3);
+  LayerParameter layer_param;
+  this->SetConvolutionParam(&layer_param);
+  layer_param.mutable_region_convolution_param()->set_num_threads(2);
+  RegionConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // the same filters applied densely
+  ConvolutionLayer<Dtype> conv_layer(layer_param);
+  Blob<Dtype> conv_top;
+  vector<Blob<Dtype>*> conv_bottom_vec(1, this->blob_bottom_);
+  vector<Blob<Dtype>*> conv_top_vec(1, &conv_top);
+  conv_layer.SetUp(conv_bottom_vec, conv_top_vec);
+  conv_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  conv_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  conv_layer.Forward(conv_bottom_vec, conv_top_vec);
+  ASSERT_EQ(this->blob_top_->count(), conv_top.count());
+  const int spatial_dim = this->blob_mask_->count();
+  for (int i = 0; i < this->blob_top_->count(); ++i) {
+    const bool active = this->blob_mask_->cpu_data()[i % spatial_dim] >= 0;
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i],
+        active ? conv_top.cpu_data()[i] : 0, 1e-4);
+  }
+}
+
+TYPED_TEST(RegionConvolutionLayerTest, TestForwardCompressed) {
+  typedef typename TypeParam::Dtype Dtype;
+  const int cnt = this->SetActive(4);
+  const int channels = this->blob_bottom_->channels();
+  const int spatial_dim = this->blob_mask_->count();
+  // the dense image whose inactive pixels are zero, and its compressed form
+  Blob<Dtype> dense(1, channels, 5, 6);
+  caffe_set(dense.count(), Dtype(0), dense.mutable_cpu_data());
+  const Dtype* mask = this->blob_mask_->cpu_data();
+  for (int c = 0; c < channels; ++c) {
+    for (int i = 0; i < spatial_dim; ++i) {
+      if (mask[i] >= 0) {
+        dense.mutable_cpu_data()[c * spatial_dim + i] =
+            this->blob_bottom_->cpu_data()[c * spatial_dim + i];
+      }
+    }
+  }
+  this->blob_bottom_->Reshape(1, channels, 1, spatial_dim);
+  for (int c = 0; c < channels; ++c) {
+    for (int i = 0; i < spatial_dim; ++i) {
+      if (mask[i] >= 0) {
+        this->blob_bottom_->mutable_cpu_data()[
+            c * cnt + static_cast<int>(mask[i])] =
+            dense.cpu_data()[c * spatial_dim + i];
+      }
+    }
+  }
+  LayerParameter layer_param;
+  this->SetConvolutionParam(&layer_param);
+  layer_param.mutable_region_convolution_param()->set_input_compression(true);
+  layer_param.mutable_region_convolution_param()->set_output_compression(
+      true);
+  RegionConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  ConvolutionLayer<Dtype> conv_layer(layer_param);
+  Blob<Dtype> conv_top;
+  vector<Blob<Dtype>*> conv_bottom_vec(1, &dense);
+  vector<Blob<Dtype>*> conv_top_vec(1, &conv_top);
+  conv_layer.SetUp(conv_bottom_vec, conv_top_vec);
+  conv_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  conv_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  conv_layer.Forward(conv_bottom_vec, conv_top_vec);
+  for (int c = 0; c < conv_top.channels(); ++c) {
+    for (int i = 0; i < spatial_dim; ++i) {
+      if (mask[i] >= 0) {
+        EXPECT_NEAR(this->blob_top_->cpu_data()[
+            c * cnt + static_cast<int>(mask[i])],
+            conv_top.cpu_data()[c * spatial_dim + i], 1e-4);
+      }
+    }
+  }
+}
+
+TYPED_TEST(RegionConvolutionLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  // With every pixel active the layer is a plain convolution, whose input
+  // gradient is exact.
+  this->SetActive(0);
+  LayerParameter layer_param;
+  this->SetConvolutionParam(&layer_param);
+  layer_param.mutable_region_convolution_param()->set_num_threads(2);
+  RegionConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+}
+
+TYPED_TEST(RegionConvolutionLayerTest, TestForwardChunked) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->SetActive(3);
+  // compressed, so that the chunks also read the channels of the input
+  // at the stride of all active pixels
+  this->blob_bottom_->Reshape(1, 3, 1, 30);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(this->blob_bottom_);
+  LayerParameter layer_param;
+  this->SetConvolutionParam(&layer_param);
+  layer_param.mutable_region_convolution_param()->set_input_compression(true);
+  layer_param.mutable_region_convolution_param()->set_output_compression(
+      true);
+  RegionConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // Room for the output buffer and 7 pixels of im2col (27 rows) and output
+  // (4 rows) at a time, so the 20 active pixels take 3 uneven chunks on CPU.
+  // With four threads splitting each chunk, all but the first start their
+  // pixels partway into a chunk that itself starts partway into the index.
+  const int num_threads[] = {1, 4};
+  for (int t = 0; t < 2; ++t) {
+    layer_param.mutable_region_convolution_param()->set_num_threads(
+        num_threads[t]);
+    Workspace workspace(sizeof(Dtype) * (4 * 30 + (27 + 2 * 4) * 7));
+    RegionConvolutionLayer<Dtype> chunked_layer(layer_param);
+    chunked_layer.set_workspace(&workspace);
+    Blob<Dtype> chunked_top;
+    vector<Blob<Dtype>*> chunked_top_vec(1, &chunked_top);
+    chunked_layer.SetUp(this->blob_bottom_vec_, chunked_top_vec);
+    EXPECT_LE(workspace.size(), workspace.limit());
+    chunked_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+    chunked_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+    chunked_layer.Forward(this->blob_bottom_vec_, chunked_top_vec);
+    for (int i = 0; i < chunked_top.count(); ++i) {
+      EXPECT_NEAR(this->blob_top_->cpu_data()[i], chunked_top.cpu_data()[i],
+          1e-4);
+    }
+  }
+}
+
+TYPED_TEST(RegionConvolutionLayerTest, TestGradientChunked) {
+  typedef typename TypeParam::Dtype Dtype;
+  // The input gradient of the later chunks adds to that of the first, with
+  // the active pixels gathered by one thread and by four.
+  this->SetActive(0);
+  const int num_threads[] = {1, 4};
+  for (int t = 0; t < 2; ++t) {
+    LayerParameter layer_param;
+    this->SetConvolutionParam(&layer_param);
+    layer_param.mutable_region_convolution_param()->set_num_threads(
+        num_threads[t]);
+    Workspace workspace(sizeof(Dtype) * (4 * 30 + (27 + 2 * 4) * 7));
+    RegionConvolutionLayer<Dtype> layer(layer_param);
+    layer.set_workspace(&workspace);
+    GradientChecker<Dtype> checker(1e-2, 1e-3);
+    checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+        this->blob_top_vec_, 0);
+  }
+}
+
+TYPED_TEST(RegionConvolutionLayerTest, TestForwardFusedSum) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->SetActive(3);
+  Blob<Dtype> residual(1, 4, 5, 6);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&residual);
+  LayerParameter layer_param;
+  this->SetConvolutionParam(&layer_param);
+  layer_param.mutable_eltwise_param()->add_coeff(0.5);
+  layer_param.mutable_eltwise_param()->add_coeff(2);
+  this->blob_bottom_vec_.push_back(&residual);
+  RegionConvolutionLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // the same as a compressed RegionConvolution followed by a RegionSum
+  this->blob_bottom_vec_.pop_back();
+  layer_param.mutable_region_convolution_param()->set_output_compression(
+      true);
+  RegionConvolutionLayer<Dtype> conv_layer(layer_param);
+  Blob<Dtype> conv_top;
+  vector<Blob<Dtype>*> conv_top_vec(1, &conv_top);
+  conv_layer.SetUp(this->blob_bottom_vec_, conv_top_vec);
+  conv_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  conv_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  conv_layer.Forward(this->blob_bottom_vec_, conv_top_vec);
+  vector<Blob<Dtype>*> sum_bottom_vec;
+  sum_bottom_vec.push_back(&residual);
+  sum_bottom_vec.push_back(&conv_top);
+  sum_bottom_vec.push_back(this->blob_mask_);
+  sum_bottom_vec.push_back(this->blob_index_);
+  Blob<Dtype> sum_top;
+  vector<Blob<Dtype>*> sum_top_vec(1, &sum_top);
+  RegionSumLayer<Dtype> sum_layer(layer_param);
+  sum_layer.SetUp(sum_bottom_vec, sum_top_vec);
+  sum_layer.Forward(sum_bottom_vec, sum_top_vec);
+  ASSERT_EQ(this->blob_top_->count(), sum_top.count());
+  for (int i = 0; i < sum_top.count(); ++i) {
+    EXPECT_NEAR(this->blob_top_->cpu_data()[i], sum_top.cpu_data()[i], 1e-4);
+  }
+}
+
+TYPED_TEST(RegionConvolutionLayerTest, TestGradientFusedSum) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->SetActive(0);
+  Blob<Dtype> residual(1, 4, 5, 6);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  filler.Fill(&residual);
+  this->blob_bottom_vec_.push_back(&residual);
+  LayerParameter layer_param;
+  this->SetConvolutionParam(&layer_param);
+  layer_param.mutable_eltwise_param()->add_coeff(0.5);
+  layer_param.mutable_eltwise_param()->add_coeff(2);
+  RegionConvolutionLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 3);
+}
+
+}  // namespace caffe
@@ -0,0 +1,139 @@
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/common_layers.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/util/math_functions.hpp"
+#include "caffe/util/region_index.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class RegionSumLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  RegionSumLayerTest()
+      : blob_bottom_dense_(new Blob<Dtype>(2, 3, 4, 5)),
+        blob_bottom_region_(new Blob<Dtype>(2, 3, 1, 4 * 5)),
+        blob_bottom_mask_(new Blob<Dtype>(2, 1, 4, 5)),
+        blob_bottom_index_(new Blob<Dtype>(2, region_index_width<Dtype>(4 * 5),
+            1, 1)),
+        blob_top_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_dense_);
+    filler.Fill(this->blob_bottom_region_);
+    // every other pixel of the first image and every third of the second
+    // are active
+    const int spatial_dim = 4 * 5;
+    for (int n = 0; n < 2; ++n) {
+      Dtype* mask = blob_bottom_mask_->mutable_cpu_data() + n * spatial_dim;
+      int* index = region_index_mutable_cpu(blob_bottom_index_, n);
+      int cnt = 0;
+      for (int i = 0; i < spatial_dim; ++i) {
+        if (i % (n + 2) == 0) {
+          region_index_pixels(index)[cnt] = i;
+          mask[i] = cnt++;
+        } else {
+          mask[i] = -1;
+        }
+      }
+      region_index_finish(cnt, index);
+    }
+    blob_bottom_vec_.push_back(blob_bottom_dense_);
+    blob_bottom_vec_.push_back(blob_bottom_region_);
+    blob_bottom_vec_.push_back(blob_bottom_mask_);
+    blob_bottom_vec_.push_back(blob_bottom_index_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~RegionSumLayerTest() {
+    delete blob_bottom_dense_;
+    delete blob_bottom_region_;
+    delete blob_bottom_mask_;
+    delete blob_bottom_index_;
+    delete blob_top_;
+  }
+
+  void SetParam(LayerParameter* layer_param) {
+    EltwiseParameter* eltwise_param = layer_param->mutable_eltwise_param();
+    eltwise_param->add_coeff(0.5);
+    eltwise_param->add_coeff(-2);
+    eltwise_param->set_num_threads(3);
+  }
+
+  // Runs a RegionSum layer of layer_param and checks its output.
+  void CheckForward(const LayerParameter& layer_param) {
+    RegionSumLayer<Dtype> layer(layer_param);
+    layer.SetUp(blob_bottom_vec_, blob_top_vec_);
+    layer.Forward(blob_bottom_vec_, blob_top_vec_);
+    const int spatial_dim = 4 * 5;
+    for (int n = 0; n < 2; ++n) {
+      const int cnt = region_index_count(
+          region_index_cpu(*blob_bottom_index_, n));
+      const Dtype* mask = blob_bottom_mask_->cpu_data() + n * spatial_dim;
+      for (int c = 0; c < 3; ++c) {
+        const int offset = (n * 3 + c) * spatial_dim;
+        for (int i = 0; i < spatial_dim; ++i) {
+          Dtype expected = 0.5 * blob_bottom_dense_->cpu_data()[offset + i];
+          if (mask[i] >= 0) {
+            expected -= 2 * blob_bottom_region_->cpu_data()[
+                n * 3 * spatial_dim + c * cnt + static_cast<int>(mask[i])];
+          }
+          EXPECT_NEAR(blob_top_->cpu_data()[offset + i], expected, 1e-5);
+        }
+      }
+    }
+  }
+
+  Blob<Dtype>* const blob_bottom_dense_;
+  Blob<Dtype>* const blob_bottom_region_;
+  Blob<Dtype>* const blob_bottom_mask_;
+  Blob<Dtype>* const blob_bottom_index_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(RegionSumLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(RegionSumLayerTest, TestForward) {
+  LayerParameter layer_param;
+  this->SetParam(&layer_param);
+  this->CheckForward(layer_param);
+}
+
+TYPED_TEST(RegionSumLayerTest, TestForwardEmptyImageThreaded) {
+  typedef typename TypeParam::Dtype Dtype;
+  // No pixel of the second image is active, so the threads given its planes
+  // copy the dense input alone.
+  const int spatial_dim = 4 * 5;
+  caffe_set(spatial_dim, Dtype(-1),
+      this->blob_bottom_mask_->mutable_cpu_data() + spatial_dim);
+  region_index_finish(0,
+      region_index_mutable_cpu(this->blob_bottom_index_, 1));
+  LayerParameter layer_param;
+  this->SetParam(&layer_param);
+  layer_param.mutable_eltwise_param()->set_num_threads(4);
+  this->CheckForward(layer_param);
+}
+
+TYPED_TEST(RegionSumLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  this->SetParam(&layer_param);
+  RegionSumLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-3);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 1);
+}
+
+}  // namespace caffe
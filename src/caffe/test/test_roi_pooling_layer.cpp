@@ -4,8 +4,6 @@
 // Licensed under The MIT License [see fast-rcnn/LICENSE for details]
 // Written by Ross Girshick
 // ------------------------------------------------------------------
-#ifndef CPU_ONLY // ROIPooling only has GPU-based unit tests
-
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
@@ -26,8 +24,6 @@ using boost::scoped_ptr;
 
 namespace caffe {
 
-typedef ::testing::Types<GPUDevice<float>, GPUDevice<double> > TestDtypesGPUOnly;
-
 template <typename TypeParam>
 class ROIPoolingLayerTest : public MultiDeviceTest<TypeParam> {
   typedef typename TypeParam::Dtype Dtype;
@@ -86,7 +82,7 @@ class ROIPoolingLayerTest : public MultiDeviceTest<TypeParam> {
   vector<Blob<Dtype>*> blob_top_vec_;
 };
 
-TYPED_TEST_CASE(ROIPoolingLayerTest, TestDtypesGPUOnly);
+TYPED_TEST_CASE(ROIPoolingLayerTest, TestDtypesAndDevices);
 
 TYPED_TEST(ROIPoolingLayerTest, TestGradient) {
   typedef typename TypeParam::Dtype Dtype;
@@ -101,5 +97,91 @@ TYPED_TEST(ROIPoolingLayerTest, TestGradient) {
       this->blob_top_vec_, 0);
 }
 
+TYPED_TEST(ROIPoolingLayerTest, TestThreadedMatchesSerial) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  ROIPoolingParameter* roi_pooling_param =
+      layer_param.mutable_roi_pooling_param();
+  roi_pooling_param->set_pooled_h(3);
+  roi_pooling_param->set_pooled_w(2);
+  vector<bool> propagate_down(2, false);
+  propagate_down[0] = true;
+  ROIPoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> top_diff(this->blob_top_data_->shape());
+  filler.Fill(&top_diff);
+  caffe_copy(top_diff.count(), top_diff.cpu_data(),
+      this->blob_top_data_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  Blob<Dtype> top_serial, bottom_serial;
+  top_serial.CopyFrom(*this->blob_top_data_, false, true);
+  bottom_serial.CopyFrom(*this->blob_bottom_data_, true, true);
+
+  roi_pooling_param->set_num_threads(3);
+  ROIPoolingLayer<Dtype> threaded_layer(layer_param);
+  threaded_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  threaded_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_copy(top_diff.count(), top_diff.cpu_data(),
+      this->blob_top_data_->mutable_cpu_diff());
+  threaded_layer.Backward(this->blob_top_vec_, propagate_down,
+      this->blob_bottom_vec_);
+  for (int i = 0; i < top_serial.count(); ++i) {
+    EXPECT_EQ(this->blob_top_data_->cpu_data()[i], top_serial.cpu_data()[i]);
+  }
+  for (int i = 0; i < bottom_serial.count(); ++i) {
+    EXPECT_EQ(this->blob_bottom_data_->cpu_diff()[i],
+        bottom_serial.cpu_diff()[i]);
+  }
+}
+
+TYPED_TEST(ROIPoolingLayerTest, TestThreadedOverlappingROIs) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Nested ROIs of one image send their gradients to the same pixels, which
+  // is why the backward pass splits the channels rather than the ROIs. The
+  // last ROI hangs off the corner of the image and leaves bins empty.
+  const Dtype rois[] = { 0, 0, 0, 7, 11,  0, 1, 1, 6, 6,  0, 2, 2, 5, 9,
+                         0, 6, 10, 9, 14 };
+  caffe_copy(20, rois, this->blob_bottom_rois_->mutable_cpu_data());
+  LayerParameter layer_param;
+  ROIPoolingParameter* roi_pooling_param =
+      layer_param.mutable_roi_pooling_param();
+  roi_pooling_param->set_pooled_h(3);
+  roi_pooling_param->set_pooled_w(2);
+  vector<bool> propagate_down(2, false);
+  propagate_down[0] = true;
+  ROIPoolingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> top_diff(this->blob_top_data_->shape());
+  filler.Fill(&top_diff);
+  caffe_copy(top_diff.count(), top_diff.cpu_data(),
+      this->blob_top_data_->mutable_cpu_diff());
+  layer.Backward(this->blob_top_vec_, propagate_down, this->blob_bottom_vec_);
+  Blob<Dtype> top_serial, bottom_serial;
+  top_serial.CopyFrom(*this->blob_top_data_, false, true);
+  bottom_serial.CopyFrom(*this->blob_bottom_data_, true, true);
+
+  // four threads take a ROI each, and going backward one channel each
+  roi_pooling_param->set_num_threads(4);
+  ROIPoolingLayer<Dtype> threaded_layer(layer_param);
+  threaded_layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  threaded_layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  caffe_copy(top_diff.count(), top_diff.cpu_data(),
+      this->blob_top_data_->mutable_cpu_diff());
+  threaded_layer.Backward(this->blob_top_vec_, propagate_down,
+      this->blob_bottom_vec_);
+  for (int i = 0; i < top_serial.count(); ++i) {
+    EXPECT_EQ(this->blob_top_data_->cpu_data()[i], top_serial.cpu_data()[i]);
+  }
+  for (int i = 0; i < bottom_serial.count(); ++i) {
+    EXPECT_EQ(this->blob_bottom_data_->cpu_diff()[i],
+        bottom_serial.cpu_diff()[i]);
+  }
+}
+
 }  // namespace caffe
-#endif
\ No newline at end of file
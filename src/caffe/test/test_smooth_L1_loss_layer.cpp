@@ -0,0 +1,131 @@
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/loss_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class SmoothL1LossLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  SmoothL1LossLayerTest()
+      : blob_bottom_data_(new Blob<Dtype>(10, 5, 2, 3)),
+        blob_bottom_label_(new Blob<Dtype>(10, 5, 2, 3)),
+        blob_bottom_inside_weights_(new Blob<Dtype>(10, 5, 2, 3)),
+        blob_bottom_outside_weights_(new Blob<Dtype>(10, 5, 2, 3)),
+        blob_top_loss_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_data_);
+    filler.Fill(this->blob_bottom_label_);
+    FillerParameter weights_param;
+    weights_param.set_min(0);
+    weights_param.set_max(2);
+    UniformFiller<Dtype> weights_filler(weights_param);
+    weights_filler.Fill(this->blob_bottom_inside_weights_);
+    weights_filler.Fill(this->blob_bottom_outside_weights_);
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_label_);
+    blob_bottom_vec_.push_back(blob_bottom_inside_weights_);
+    blob_bottom_vec_.push_back(blob_bottom_outside_weights_);
+    blob_top_vec_.push_back(blob_top_loss_);
+  }
+  virtual ~SmoothL1LossLayerTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_label_;
+    delete blob_bottom_inside_weights_;
+    delete blob_bottom_outside_weights_;
+    delete blob_top_loss_;
+  }
+
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_label_;
+  Blob<Dtype>* const blob_bottom_inside_weights_;
+  Blob<Dtype>* const blob_bottom_outside_weights_;
+  Blob<Dtype>* const blob_top_loss_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(SmoothL1LossLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(SmoothL1LossLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_smooth_l1_loss_param()->set_sigma(2);
+  layer_param.mutable_smooth_l1_loss_param()->set_num_threads(3);
+  SmoothL1LossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  Dtype expected = 0;
+  for (int i = 0; i < this->blob_bottom_data_->count(); ++i) {
+    const Dtype x = this->blob_bottom_inside_weights_->cpu_data()[i] *
+        (this->blob_bottom_data_->cpu_data()[i] -
+         this->blob_bottom_label_->cpu_data()[i]);
+    const Dtype error = std::fabs(x) < 0.25 ? 2 * x * x : std::fabs(x) - 0.125;
+    expected += this->blob_bottom_outside_weights_->cpu_data()[i] * error;
+  }
+  expected /= this->blob_bottom_data_->num();
+  EXPECT_NEAR(this->blob_top_loss_->cpu_data()[0], expected, 1e-4);
+}
+
+TYPED_TEST(SmoothL1LossLayerTest, TestForwardFewerElementsThanThreads) {
+  typedef typename TypeParam::Dtype Dtype;
+  // Three elements leave five of eight partial losses unused, which must
+  // not add stale sums from a larger forward pass before the reshape.
+  LayerParameter layer_param;
+  layer_param.mutable_smooth_l1_loss_param()->set_num_threads(8);
+  this->blob_bottom_vec_.resize(2);
+  SmoothL1LossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  const Dtype values[] = { 0.5, -3, 2 };
+  const Dtype labels[] = { 0, 0, 2 };
+  this->blob_bottom_data_->Reshape(1, 1, 1, 3);
+  this->blob_bottom_label_->Reshape(1, 1, 1, 3);
+  caffe_copy(3, values, this->blob_bottom_data_->mutable_cpu_data());
+  caffe_copy(3, labels, this->blob_bottom_label_->mutable_cpu_data());
+  layer.Reshape(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  // 0.5 * 0.5^2 + (3 - 0.5) + 0
+  EXPECT_NEAR(this->blob_top_loss_->cpu_data()[0], 2.625, 1e-6);
+}
+
+TYPED_TEST(SmoothL1LossLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  const Dtype kLossWeight = 3.7;
+  layer_param.add_loss_weight(kLossWeight);
+  layer_param.mutable_smooth_l1_loss_param()->set_sigma(2);
+  layer_param.mutable_smooth_l1_loss_param()->set_num_threads(3);
+  SmoothL1LossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  GradientChecker<Dtype> checker(1e-3, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 1);
+}
+
+TYPED_TEST(SmoothL1LossLayerTest, TestGradientUnweighted) {
+  typedef typename TypeParam::Dtype Dtype;
+  this->blob_bottom_vec_.resize(2);
+  LayerParameter layer_param;
+  SmoothL1LossLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  GradientChecker<Dtype> checker(1e-3, 1e-2, 1701);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_, 0);
+}
+
+}  // namespace caffe
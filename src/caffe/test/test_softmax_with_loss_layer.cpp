@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
@@ -44,6 +45,62 @@ class SoftmaxWithLossLayerTest : public MultiDeviceTest<TypeParam> {
     delete blob_bottom_label_;
     delete blob_top_loss_;
   }
+  // Checks the softmax and the loss of two images of more pixels than fit
+  // in one tile, split over three threads, with every label of the first
+  // ignored_images ignored.
+  void TestForwardTiled(const int ignored_images) {
+    this->blob_bottom_data_->Reshape(2, 4, 9, 11);
+    this->blob_bottom_label_->Reshape(2, 1, 9, 11);
+    FillerParameter filler_param;
+    filler_param.set_std(10);
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_data_);
+    for (int i = 0; i < this->blob_bottom_label_->count(); ++i) {
+      this->blob_bottom_label_->mutable_cpu_data()[i] =
+          i < ignored_images * 9 * 11 ? 3 : caffe_rng_rand() % 4;
+    }
+    Blob<Dtype> prob;
+    this->blob_top_vec_.push_back(&prob);
+    LayerParameter layer_param;
+    layer_param.add_loss_weight(1);
+    layer_param.add_loss_weight(0);
+    layer_param.mutable_loss_param()->set_ignore_label(3);
+    layer_param.mutable_softmax_param()->set_num_threads(3);
+    SoftmaxWithLossLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    const int inner_num = 9 * 11;
+    double loss = 0;
+    int count = 0;
+    for (int n = 0; n < 2; ++n) {
+      for (int j = 0; j < inner_num; ++j) {
+        const Dtype* x = this->blob_bottom_data_->cpu_data()
+            + n * 4 * inner_num + j;
+        double max_value = x[0];
+        for (int c = 1; c < 4; ++c) {
+          max_value =
+              std::max(max_value, static_cast<double>(x[c * inner_num]));
+        }
+        double sum = 0;
+        for (int c = 0; c < 4; ++c) {
+          sum += exp(x[c * inner_num] - max_value);
+        }
+        for (int c = 0; c < 4; ++c) {
+          EXPECT_NEAR(prob.cpu_data()[(n * 4 + c) * inner_num + j],
+              exp(x[c * inner_num] - max_value) / sum, 1e-5);
+        }
+        const int label =
+            this->blob_bottom_label_->cpu_data()[n * inner_num + j];
+        if (label != 3) {
+          loss -= x[label * inner_num] - max_value - log(sum);
+          ++count;
+        }
+      }
+    }
+    EXPECT_NEAR(this->blob_top_loss_->cpu_data()[0], loss / count,
+        1e-4 * loss / count);
+  }
+
   Blob<Dtype>* const blob_bottom_data_;
   Blob<Dtype>* const blob_bottom_label_;
   Blob<Dtype>* const blob_top_loss_;
@@ -107,4 +164,15 @@ TYPED_TEST(SoftmaxWithLossLayerTest, TestGradientUnnormalized) {
       this->blob_top_vec_, 0);
 }
 
+TYPED_TEST(SoftmaxWithLossLayerTest, TestForwardTiledThreaded) {
+  this->TestForwardTiled(0);
+}
+
+TYPED_TEST(SoftmaxWithLossLayerTest, TestForwardIgnoredImageThreaded) {
+  // Every label of the first image is ignored, so of three threads over the
+  // four tiles the first two count no pixels, and the normalization rests
+  // on the partial count of the last.
+  this->TestForwardTiled(1);
+}
+
 }  // namespace caffe
@@ -68,6 +68,21 @@ TEST_F(SyncedMemoryTest, TestCPUWrite) {
   }
 }
 
+TEST_F(SyncedMemoryTest, TestVersion) {
+  SyncedMemory mem(10);
+  const unsigned int version = mem.version();
+  // reads leave the version alone
+  mem.cpu_data();
+  EXPECT_EQ(mem.version(), version);
+  // while every mutable access counts as a change
+  mem.mutable_cpu_data();
+  EXPECT_EQ(mem.version(), version + 1);
+  mem.mutable_cpu_data();
+  EXPECT_EQ(mem.version(), version + 2);
+  mem.cpu_data();
+  EXPECT_EQ(mem.version(), version + 2);
+}
+
 #ifndef CPU_ONLY  // GPU test
 
 TEST_F(SyncedMemoryTest, TestGPURead) {
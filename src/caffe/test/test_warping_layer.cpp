@@ -0,0 +1,145 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+#include "caffe/test/test_gradient_check_util.hpp"
+
+namespace caffe {
+
+template <typename TypeParam>
+class WarpingLayerTest : public MultiDeviceTest<TypeParam> {
+  typedef typename TypeParam::Dtype Dtype;
+
+ protected:
+  WarpingLayerTest()
+      : blob_bottom_data_(new Blob<Dtype>(2, 3, 4, 5)),
+        blob_bottom_flow_(new Blob<Dtype>(2, 2, 4, 5)),
+        blob_top_(new Blob<Dtype>()) {
+    FillerParameter filler_param;
+    GaussianFiller<Dtype> filler(filler_param);
+    filler.Fill(this->blob_bottom_data_);
+    // Displacements of up to two pixels, some leaving the image, whose
+    // fractions stay clear of the integers where the warp is not smooth.
+    Dtype* flow = blob_bottom_flow_->mutable_cpu_data();
+    for (int i = 0; i < blob_bottom_flow_->count(); ++i) {
+      flow[i] = static_cast<int>(caffe_rng_rand() % 5) - 2 +
+          Dtype(0.2) + Dtype(0.6) * (caffe_rng_rand() % 1000) / 1000;
+    }
+    blob_bottom_vec_.push_back(blob_bottom_data_);
+    blob_bottom_vec_.push_back(blob_bottom_flow_);
+    blob_top_vec_.push_back(blob_top_);
+  }
+  virtual ~WarpingLayerTest() {
+    delete blob_bottom_data_;
+    delete blob_bottom_flow_;
+    delete blob_top_;
+  }
+
+  // The input at (h, w), clamped to the image.
+  Dtype Clamped(const Dtype* in, int h, int w) {
+    const int height = blob_bottom_data_->height();
+    const int width = blob_bottom_data_->width();
+    h = std::min(std::max(h, 0), height - 1);
+    w = std::min(std::max(w, 0), width - 1);
+    return in[h * width + w];
+  }
+
+  Blob<Dtype>* const blob_bottom_data_;
+  Blob<Dtype>* const blob_bottom_flow_;
+  Blob<Dtype>* const blob_top_;
+  vector<Blob<Dtype>*> blob_bottom_vec_;
+  vector<Blob<Dtype>*> blob_top_vec_;
+};
+
+TYPED_TEST_CASE(WarpingLayerTest, TestDtypesAndDevices);
+
+TYPED_TEST(WarpingLayerTest, TestForward) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_warping_param()->set_num_threads(3);
+  WarpingLayer<Dtype> layer(layer_param);
+  layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+  layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+  for (int n = 0; n < 2; ++n) {
+    for (int h = 0; h < 4; ++h) {
+      for (int w = 0; w < 5; ++w) {
+        const Dtype sh = h + this->blob_bottom_flow_->data_at(n, 1, h, w);
+        const Dtype sw = w + this->blob_bottom_flow_->data_at(n, 0, h, w);
+        const int th = std::floor(sh);
+        const int tw = std::floor(sw);
+        const Dtype fh = sh - th;
+        const Dtype fw = sw - tw;
+        for (int c = 0; c < 3; ++c) {
+          const Dtype* in = this->blob_bottom_data_->cpu_data() +
+              this->blob_bottom_data_->offset(n, c);
+          const Dtype expected =
+              (1 - fh) * (1 - fw) * this->Clamped(in, th, tw) +
+              fh * (1 - fw) * this->Clamped(in, th + 1, tw) +
+              (1 - fh) * fw * this->Clamped(in, th, tw + 1) +
+              fh * fw * this->Clamped(in, th + 1, tw + 1);
+          EXPECT_NEAR(this->blob_top_->data_at(n, c, h, w), expected, 1e-5);
+        }
+      }
+    }
+  }
+}
+
+TYPED_TEST(WarpingLayerTest, TestGradient) {
+  typedef typename TypeParam::Dtype Dtype;
+  LayerParameter layer_param;
+  layer_param.mutable_warping_param()->set_num_threads(3);
+  WarpingLayer<Dtype> layer(layer_param);
+  GradientChecker<Dtype> checker(1e-2, 1e-2);
+  checker.CheckGradientExhaustive(&layer, this->blob_bottom_vec_,
+      this->blob_top_vec_);
+}
+
+TYPED_TEST(WarpingLayerTest, TestBackwardConvergingFlowThreaded) {
+  typedef typename TypeParam::Dtype Dtype;
+  // A flow off the bottom right corner clamps most taps onto the last row
+  // and column, so many outputs send their gradient to the same inputs.
+  // Each input plane is still accumulated by one thread in raster order,
+  // and four threads over the six planes give the serial result exactly.
+  caffe_set(this->blob_bottom_flow_->count(), Dtype(2.5),
+      this->blob_bottom_flow_->mutable_cpu_data());
+  FillerParameter filler_param;
+  GaussianFiller<Dtype> filler(filler_param);
+  Blob<Dtype> top_diff(2, 3, 4, 5);
+  filler.Fill(&top_diff);
+  vector<bool> propagate_down(2, true);
+  Blob<Dtype> serial_data_diff, serial_flow_diff;
+  for (int threads = 1; threads <= 4; threads += 3) {
+    LayerParameter layer_param;
+    layer_param.mutable_warping_param()->set_num_threads(threads);
+    WarpingLayer<Dtype> layer(layer_param);
+    layer.SetUp(this->blob_bottom_vec_, this->blob_top_vec_);
+    layer.Forward(this->blob_bottom_vec_, this->blob_top_vec_);
+    caffe_copy(top_diff.count(), top_diff.cpu_data(),
+        this->blob_top_->mutable_cpu_diff());
+    layer.Backward(this->blob_top_vec_, propagate_down,
+        this->blob_bottom_vec_);
+    if (threads == 1) {
+      serial_data_diff.CopyFrom(*this->blob_bottom_data_, true, true);
+      serial_flow_diff.CopyFrom(*this->blob_bottom_flow_, true, true);
+      continue;
+    }
+    for (int i = 0; i < serial_data_diff.count(); ++i) {
+      EXPECT_EQ(serial_data_diff.cpu_diff()[i],
+          this->blob_bottom_data_->cpu_diff()[i]);
+    }
+    for (int i = 0; i < serial_flow_diff.count(); ++i) {
+      EXPECT_EQ(serial_flow_diff.cpu_diff()[i],
+          this->blob_bottom_flow_->cpu_diff()[i]);
+    }
+  }
+}
+
+}  // namespace caffe
@@ -0,0 +1,123 @@
+#include <vector>
+
+#include "boost/thread.hpp"
+#include "gtest/gtest.h"
+
+#include "caffe/blob.hpp"
+#include "caffe/common.hpp"
+#include "caffe/filler.hpp"
+#include "caffe/vision_layers.hpp"
+#include "caffe/workspace.hpp"
+
+#include "caffe/test/test_caffe_main.hpp"
+
+namespace caffe {
+
+class WorkspaceTest : public ::testing::Test {};
+
+TEST_F(WorkspaceTest, TestReserve) {
+  Workspace workspace;
+  EXPECT_EQ(workspace.size(), 0);
+  workspace.Reserve(10 * sizeof(float));
+  EXPECT_EQ(workspace.size(), 10 * sizeof(float));
+  // smaller requests reuse the memory
+  workspace.Reserve(5 * sizeof(float));
+  EXPECT_EQ(workspace.size(), 10 * sizeof(float));
+  float* data = workspace.mutable_cpu_data<float>();
+  EXPECT_TRUE(data);
+  EXPECT_EQ(workspace.mutable_cpu_data<float>(3), data + 3);
+  for (int i = 0; i < 10; ++i) {
+    data[i] = i;
+  }
+  EXPECT_EQ(workspace.mutable_cpu_data<float>()[9], 9);
+}
+
+TEST_F(WorkspaceTest, TestRelease) {
+  Workspace workspace;
+  workspace.Reserve(10 * sizeof(float));
+  workspace.mutable_cpu_data<float>()[9] = 1;
+  workspace.Release();
+  // the reservation survives and the memory comes back on use
+  EXPECT_EQ(workspace.size(), 10 * sizeof(float));
+  EXPECT_TRUE(workspace.mutable_cpu_data<float>());
+  workspace.mutable_cpu_data<float>()[9] = 1;
+}
+
+TEST_F(WorkspaceTest, TestLimit) {
+  Workspace workspace(16);
+  EXPECT_EQ(workspace.limit(), 16);
+  // requests up to the limit are fine
+  workspace.Reserve(16);
+  EXPECT_EQ(workspace.size(), 16);
+}
+
+TEST_F(WorkspaceTest, TestLimitShrinksConvolution) {
+  Caffe::set_mode(Caffe::CPU);
+  Blob<float> bottom(4, 3, 8, 8);
+  FillerParameter filler_param;
+  GaussianFiller<float> filler(filler_param);
+  filler.Fill(&bottom);
+  LayerParameter layer_param;
+  ConvolutionParameter* conv_param = layer_param.mutable_convolution_param();
+  conv_param->set_kernel_size(3);
+  conv_param->set_pad(1);
+  conv_param->set_num_output(4);
+  conv_param->set_num_threads(4);
+  conv_param->set_batch_im2col(4);
+  conv_param->mutable_weight_filler()->set_type("gaussian");
+  conv_param->mutable_bias_filler()->set_type("gaussian");
+  vector<Blob<float>*> bottom_vec(1, &bottom);
+  Blob<float> top, limited_top;
+  vector<Blob<float>*> top_vec(1, &top), limited_top_vec(1, &limited_top);
+  Workspace workspace;
+  ConvolutionLayer<float> layer(layer_param);
+  layer.set_workspace(&workspace);
+  layer.SetUp(bottom_vec, top_vec);
+  // Below the column buffer of a single image (27 x 64 floats) the layer
+  // has to give up batching and threads and unroll in bands of rows.
+  const size_t limit = 1000 * sizeof(float);
+  EXPECT_GT(workspace.size(), limit);
+  Workspace limited_workspace(limit);
+  ConvolutionLayer<float> limited_layer(layer_param);
+  limited_layer.set_workspace(&limited_workspace);
+  limited_layer.SetUp(bottom_vec, limited_top_vec);
+  EXPECT_LE(limited_workspace.size(), limit);
+  limited_layer.blobs()[0]->CopyFrom(*layer.blobs()[0]);
+  limited_layer.blobs()[1]->CopyFrom(*layer.blobs()[1]);
+  layer.Forward(bottom_vec, top_vec);
+  limited_layer.Forward(bottom_vec, limited_top_vec);
+  for (int i = 0; i < top.count(); ++i) {
+    EXPECT_NEAR(top.cpu_data()[i], limited_top.cpu_data()[i], 1e-4);
+  }
+  filler.Fill(&top);
+  limited_top.CopyFrom(top, true);
+  vector<bool> propagate_down(1, true);
+  layer.Backward(top_vec, propagate_down, bottom_vec);
+  vector<float> bottom_diff(bottom.cpu_diff(),
+      bottom.cpu_diff() + bottom.count());
+  limited_layer.Backward(limited_top_vec, propagate_down, bottom_vec);
+  for (int i = 0; i < bottom.count(); ++i) {
+    EXPECT_NEAR(bottom_diff[i], bottom.cpu_diff()[i], 1e-4);
+  }
+  const Blob<float>& weights = *layer.blobs()[0];
+  for (int i = 0; i < weights.count(); ++i) {
+    EXPECT_NEAR(weights.cpu_diff()[i],
+        limited_layer.blobs()[0]->cpu_diff()[i], 1e-3);
+  }
+}
+
+static void GetThreadLocal(Workspace** workspace) {
+  *workspace = Workspace::ThreadLocal();
+}
+
+TEST_F(WorkspaceTest, TestThreadLocal) {
+  Workspace* main_workspace = Workspace::ThreadLocal();
+  EXPECT_EQ(main_workspace, Workspace::ThreadLocal());
+  Workspace* thread_workspace = NULL;
+  boost::thread thread(GetThreadLocal, &thread_workspace);
+  thread.join();
+  EXPECT_TRUE(thread_workspace);
+  EXPECT_NE(main_workspace, thread_workspace);
+}
+
+}  // namespace caffe
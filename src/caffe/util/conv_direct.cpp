@@ -0,0 +1,182 @@
+#include <algorithm>
+#include <cstring>
+
+#include "caffe/util/conv_direct.hpp"
+#include "caffe/util/math_functions.hpp"
+
+namespace caffe {
+
+// The outputs [begin, end) of a row whose input index ow * stride + offset
+// falls inside [0, size). Computing this once per row keeps the inner loops
+// free of bounds checks, so that the compiler can vectorize them.
+static inline void conv_direct_range(const int offset, const int stride,
+    const int size, const int output_size, int* begin, int* end) {
+  *begin = offset < 0 ? (stride - 1 - offset) / stride : 0;
+  *end = offset < size ?
+      std::min(output_size, (size - 1 - offset) / stride + 1) : 0;
+}
+
+enum ConvDirectPass { CONV_DIRECT_FORWARD, CONV_DIRECT_BACKWARD,
+    CONV_DIRECT_WEIGHT };
+
+// Walks the rows touched by every (output channel, input channel, kernel
+// element) of the grouped convolution. Each filter tap is one scalar times a
+// (strided) row of the input, accumulated into a row of the output, or the
+// reverse for the backward passes.
+template <typename Dtype>
+static void conv_direct_cpu(const ConvDirectPass pass, Dtype* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const int group, Dtype* weights,
+    const int num_output, Dtype* data_out) {
+  const int output_h = (height + 2 * pad_h -
+      (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  const int output_w = (width + 2 * pad_w -
+      (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  const int in_channels = channels / group;
+  const int out_channels = num_output / group;
+  for (int oc = 0; oc < num_output; ++oc) {
+    Dtype* output = data_out + oc * output_h * output_w;
+    const int g = oc / out_channels;
+    for (int c = 0; c < in_channels; ++c) {
+      Dtype* input = data_im + (g * in_channels + c) * height * width;
+      Dtype* weight = weights + (oc * in_channels + c) * kernel_h * kernel_w;
+      for (int kh = 0; kh < kernel_h; ++kh) {
+        int oh_begin, oh_end;
+        const int offset_h = kh * dilation_h - pad_h;
+        conv_direct_range(offset_h, stride_h, height, output_h,
+            &oh_begin, &oh_end);
+        for (int kw = 0; kw < kernel_w; ++kw) {
+          int ow_begin, ow_end;
+          const int offset_w = kw * dilation_w - pad_w;
+          conv_direct_range(offset_w, stride_w, width, output_w,
+              &ow_begin, &ow_end);
+          // The tap is read into a local, and the weight pass sums into one,
+          // so that no store to a row can alias it and the row loops keep
+          // it in a register.
+          const Dtype w = weight[kh * kernel_w + kw];
+          Dtype sum = 0;
+          for (int oh = oh_begin; oh < oh_end; ++oh) {
+            Dtype* out_row = output + oh * output_w;
+            Dtype* in_row = input + (oh * stride_h + offset_h) * width;
+            switch (pass) {
+            case CONV_DIRECT_FORWARD:
+              if (stride_w == 1) {
+                for (int ow = ow_begin; ow < ow_end; ++ow) {
+                  out_row[ow] += w * in_row[ow + offset_w];
+                }
+              } else {
+                for (int ow = ow_begin; ow < ow_end; ++ow) {
+                  out_row[ow] += w * in_row[ow * stride_w + offset_w];
+                }
+              }
+              break;
+            case CONV_DIRECT_BACKWARD:
+              if (stride_w == 1) {
+                for (int ow = ow_begin; ow < ow_end; ++ow) {
+                  in_row[ow + offset_w] += w * out_row[ow];
+                }
+              } else {
+                for (int ow = ow_begin; ow < ow_end; ++ow) {
+                  in_row[ow * stride_w + offset_w] += w * out_row[ow];
+                }
+              }
+              break;
+            case CONV_DIRECT_WEIGHT:
+              for (int ow = ow_begin; ow < ow_end; ++ow) {
+                sum += out_row[ow] * in_row[ow * stride_w + offset_w];
+              }
+              break;
+            }
+          }
+          if (pass == CONV_DIRECT_WEIGHT) {
+            weight[kh * kernel_w + kw] += sum;
+          }
+        }
+      }
+    }
+  }
+}
+
+template <typename Dtype>
+void conv_direct_forward_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const int group,
+    const Dtype* weights, const int num_output, Dtype* data_out) {
+  const int output_h = (height + 2 * pad_h -
+      (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  const int output_w = (width + 2 * pad_w -
+      (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  caffe_set(num_output * output_h * output_w, Dtype(0), data_out);
+  conv_direct_cpu(CONV_DIRECT_FORWARD, const_cast<Dtype*>(data_im), channels,
+      height, width, kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w,
+      dilation_h, dilation_w, group, const_cast<Dtype*>(weights), num_output,
+      data_out);
+}
+
+template <typename Dtype>
+void conv_direct_backward_cpu(const Dtype* data_out, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const int group,
+    const Dtype* weights, const int num_output, Dtype* data_im) {
+  caffe_set(channels * height * width, Dtype(0), data_im);
+  conv_direct_cpu(CONV_DIRECT_BACKWARD, data_im, channels, height, width,
+      kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w, dilation_h,
+      dilation_w, group, const_cast<Dtype*>(weights), num_output,
+      const_cast<Dtype*>(data_out));
+}
+
+template <typename Dtype>
+void conv_direct_weight_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w, const int group,
+    const Dtype* data_out, const int num_output, Dtype* weights_diff) {
+  conv_direct_cpu(CONV_DIRECT_WEIGHT, const_cast<Dtype*>(data_im), channels,
+      height, width, kernel_h, kernel_w, pad_h, pad_w, stride_h, stride_w,
+      dilation_h, dilation_w, group, weights_diff, num_output,
+      const_cast<Dtype*>(data_out));
+}
+
+// Explicit instantiation
+template void conv_direct_forward_cpu<float>(const float* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const int group, const float* weights,
+    const int num_output, float* data_out);
+template void conv_direct_forward_cpu<double>(const double* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const int group, const double* weights,
+    const int num_output, double* data_out);
+template void conv_direct_backward_cpu<float>(const float* data_out,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const int group, const float* weights,
+    const int num_output, float* data_im);
+template void conv_direct_backward_cpu<double>(const double* data_out,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const int group, const double* weights,
+    const int num_output, double* data_im);
+template void conv_direct_weight_cpu<float>(const float* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const int group, const float* data_out,
+    const int num_output, float* weights_diff);
+template void conv_direct_weight_cpu<double>(const double* data_im,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w, const int dilation_h,
+    const int dilation_w, const int group, const double* data_out,
+    const int num_output, double* weights_diff);
+
+}  // namespace caffe
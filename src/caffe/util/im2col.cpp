@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <cmath>
 #include <cstdlib>
 #include <cstring>
@@ -34,34 +35,101 @@ void im2col_cpu(const Dtype* data_im, const int channels,
     (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
   const int output_w = (width + 2 * pad_w -
     (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  im2col_cpu(data_im, channels, height, width, kernel_h, kernel_w,
+    pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
+    output_h * output_w, data_col);
+}
+
+// The outputs [begin, end) of a row of output_size whose input index
+// output * stride + offset falls inside [0, size).
+inline void valid_output_range(int offset, int stride, int size,
+    int output_size, int* begin, int* end) {
+  *begin = offset < 0 ? std::min(output_size, (stride - 1 - offset) / stride)
+      : 0;
+  *end = offset < size ?
+      std::min(output_size, (size - 1 - offset) / stride + 1) : 0;
+  *end = std::max(*begin, *end);
+}
+
+// Unrolls the output rows [row_begin, row_end), with consecutive rows of
+// data_col col_stride elements apart. The columns falling into the padding
+// are found once per kernel column, so that the copy itself needs no checks.
+template <typename Dtype>
+static void im2col_band_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int row_begin, const int row_end,
+    const int col_stride, Dtype* data_col) {
+  const int output_w = (width + 2 * pad_w -
+    (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
   const int channel_size = height * width;
+  const int row_gap = col_stride - (row_end - row_begin) * output_w;
   for (int channel = channels; channel--; data_im += channel_size) {
     for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
       for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
-        int input_row = -pad_h + kernel_row * dilation_h;
-        for (int output_rows = output_h; output_rows; output_rows--) {
+        const int col_offset = -pad_w + kernel_col * dilation_w;
+        int col_begin, col_end;
+        valid_output_range(col_offset, stride_w, width, output_w,
+            &col_begin, &col_end);
+        int input_row = -pad_h + kernel_row * dilation_h
+            + row_begin * stride_h;
+        for (int output_row = row_begin; output_row < row_end; output_row++) {
           if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
-            for (int output_cols = output_w; output_cols; output_cols--) {
-              *(data_col++) = 0;
-            }
+            std::fill(data_col, data_col + output_w, Dtype(0));
           } else {
-            int input_col = -pad_w + kernel_col * dilation_w;
-            for (int output_col = output_w; output_col; output_col--) {
-              if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
-                *(data_col++) = data_im[input_row * width + input_col];
-              } else {
-                *(data_col++) = 0;
+            const Dtype* input = data_im + input_row * width;
+            std::fill(data_col, data_col + col_begin, Dtype(0));
+            if (stride_w == 1) {
+              std::copy(input + col_begin + col_offset,
+                  input + col_end + col_offset, data_col + col_begin);
+            } else {
+              for (int output_col = col_begin; output_col < col_end;
+                   output_col++) {
+                data_col[output_col] =
+                    input[output_col * stride_w + col_offset];
               }
-              input_col += stride_w;
             }
+            std::fill(data_col + col_end, data_col + output_w, Dtype(0));
           }
+          data_col += output_w;
           input_row += stride_h;
         }
+        data_col += row_gap;
       }
     }
   }
 }
 
+template <typename Dtype>
+void im2col_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int col_stride, Dtype* data_col) {
+  const int output_h = (height + 2 * pad_h -
+    (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  im2col_band_cpu(data_im, channels, height, width, kernel_h, kernel_w,
+    pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
+    0, output_h, col_stride, data_col);
+}
+
+template <typename Dtype>
+void im2col_rows_cpu(const Dtype* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int row_begin, const int row_end, Dtype* data_col) {
+  const int output_w = (width + 2 * pad_w -
+    (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  im2col_band_cpu(data_im, channels, height, width, kernel_h, kernel_w,
+    pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
+    row_begin, row_end, (row_end - row_begin) * output_w, data_col);
+}
+
 // Explicit instantiation
 template void im2col_cpu<float>(const float* data_im, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
@@ -73,6 +141,26 @@ template void im2col_cpu<double>(const double* data_im, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, const int dilation_h, const int dilation_w,
     double* data_col);
+template void im2col_cpu<float>(const float* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    const int col_stride, float* data_col);
+template void im2col_rows_cpu<float>(const float* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    const int row_begin, const int row_end, float* data_col);
+template void im2col_cpu<double>(const double* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    const int col_stride, double* data_col);
+template void im2col_rows_cpu<double>(const double* data_im, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    const int row_begin, const int row_end, double* data_col);
 
 // Explicit instantiation
 template void im2col_cpu<float>(const float* data_im, const int channels,
@@ -106,35 +194,84 @@ void col2im_cpu(const Dtype* data_col, const int channels,
     const int stride_h, const int stride_w,
     const int dilation_h, const int dilation_w,
     Dtype* data_im) {
-  caffe_set(height * width * channels, Dtype(0), data_im);
   const int output_h = (height + 2 * pad_h -
     (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
   const int output_w = (width + 2 * pad_w -
     (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  col2im_cpu(data_col, channels, height, width, kernel_h, kernel_w,
+    pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
+    output_h * output_w, data_im);
+}
+
+// Accumulates the output rows [row_begin, row_end) of data_col, whose
+// consecutive rows are col_stride elements apart, into data_im.
+template <typename Dtype>
+static void col2im_band_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int row_begin, const int row_end,
+    const int col_stride, Dtype* data_im) {
+  const int output_w = (width + 2 * pad_w -
+    (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
   const int channel_size = height * width;
+  const int row_gap = col_stride - (row_end - row_begin) * output_w;
   for (int channel = channels; channel--; data_im += channel_size) {
     for (int kernel_row = 0; kernel_row < kernel_h; kernel_row++) {
       for (int kernel_col = 0; kernel_col < kernel_w; kernel_col++) {
-        int input_row = -pad_h + kernel_row * dilation_h;
-        for (int output_rows = output_h; output_rows; output_rows--) {
-          if (!is_a_ge_zero_and_a_lt_b(input_row, height)) {
-            data_col += output_w;
-          } else {
-            int input_col = -pad_w + kernel_col * dilation_w;
-            for (int output_col = output_w; output_col; output_col--) {
-              if (is_a_ge_zero_and_a_lt_b(input_col, width)) {
-                data_im[input_row * width + input_col] += *data_col;
-              }
-              data_col++;
-              input_col += stride_w;
+        const int col_offset = -pad_w + kernel_col * dilation_w;
+        int col_begin, col_end;
+        valid_output_range(col_offset, stride_w, width, output_w,
+            &col_begin, &col_end);
+        int input_row = -pad_h + kernel_row * dilation_h
+            + row_begin * stride_h;
+        for (int output_row = row_begin; output_row < row_end; output_row++) {
+          if (is_a_ge_zero_and_a_lt_b(input_row, height)) {
+            Dtype* input = data_im + input_row * width;
+            for (int output_col = col_begin; output_col < col_end;
+                 output_col++) {
+              input[output_col * stride_w + col_offset] += data_col[output_col];
             }
           }
+          data_col += output_w;
           input_row += stride_h;
         }
+        data_col += row_gap;
       }
     }
   }
 }
+
+template <typename Dtype>
+void col2im_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int col_stride, Dtype* data_im) {
+  caffe_set(height * width * channels, Dtype(0), data_im);
+  const int output_h = (height + 2 * pad_h -
+    (dilation_h * (kernel_h - 1) + 1)) / stride_h + 1;
+  col2im_band_cpu(data_col, channels, height, width, kernel_h, kernel_w,
+    pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
+    0, output_h, col_stride, data_im);
+}
+
+template <typename Dtype>
+void col2im_rows_cpu(const Dtype* data_col, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w,
+    const int stride_h, const int stride_w,
+    const int dilation_h, const int dilation_w,
+    const int row_begin, const int row_end, Dtype* data_im) {
+  const int output_w = (width + 2 * pad_w -
+    (dilation_w * (kernel_w - 1) + 1)) / stride_w + 1;
+  col2im_band_cpu(data_col, channels, height, width, kernel_h, kernel_w,
+    pad_h, pad_w, stride_h, stride_w, dilation_h, dilation_w,
+    row_begin, row_end, (row_end - row_begin) * output_w, data_im);
+}
+
 // Explicit instantiation
 template void col2im_cpu<float>(const float* data_col, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
@@ -146,6 +283,27 @@ template void col2im_cpu<double>(const double* data_col, const int channels,
     const int pad_h, const int pad_w, const int stride_h,
     const int stride_w, const int dilation_h, const int dilation_w,
     double* data_im);
+template void col2im_cpu<float>(const float* data_col, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    const int col_stride, float* data_im);
+template void col2im_rows_cpu<float>(const float* data_col, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    const int row_begin, const int row_end, float* data_im);
+template void col2im_cpu<double>(const double* data_col, const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    const int col_stride, double* data_im);
+template void col2im_rows_cpu<double>(const double* data_col,
+    const int channels,
+    const int height, const int width, const int kernel_h, const int kernel_w,
+    const int pad_h, const int pad_w, const int stride_h,
+    const int stride_w, const int dilation_h, const int dilation_w,
+    const int row_begin, const int row_end, double* data_im);
 
 // Explicit instantiation
 template void col2im_cpu<float>(const float* data_col, const int channels,
@@ -2,18 +2,246 @@
 
 #include "caffe/common.hpp"
 #include "caffe/util/interp.hpp"
+#include "caffe/util/parallel.hpp"
 #include <algorithm>
 #include <cmath>
+#include <vector>
+
+#include "boost/bind/bind.hpp"
 
 namespace caffe {
 
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
+// The taps of a bilinear resampling from size1 to size2 samples along one
+// axis: output i reads the source samples index[i] and index[i] + step[i]
+// with the weights 1 - lambda[i] and lambda[i].
+template <typename Dtype>
+struct Interp2Axis {
+  Interp2Axis(const int size1, const int size2)
+      : index(size2), step(size2), lambda(size2) {
+    const float r = (size2 > 1) ?
+        static_cast<float>(size1 - 1) / (size2 - 1) : 0.f;
+    for (int i = 0; i < size2; ++i) {
+      const float i1r = r * i;
+      const int i1 = i1r;
+      index[i] = i1;
+      step[i] = (i1 < size1 - 1) ? 1 : 0;
+      lambda[i] = i1r - i1;
+    }
+  }
+  std::vector<int> index, step;
+  std::vector<Dtype> lambda;
+};
+
+// The tables and crops of one caffe_cpu_interp2(_backward) call, shared by
+// the threads that split its channels.
+template <typename Dtype>
+struct Interp2Tables {
+  Interp2Tables(const int height1, const int width1, const int height2,
+      const int width2) : rows(height1, height2), cols(width1, width2) { }
+  Interp2Axis<Dtype> rows, cols;
+  int channels;
+  int x1, y1, Height1, Width1;
+  int x2, y2, Height2, Width2;
+};
+
+// out[w2] = the source row row1 resampled to the output columns
+template <typename Dtype>
+static void interp2_row(const Interp2Axis<Dtype>& cols, const Dtype* row1,
+    Dtype* out) {
+  const int width2 = cols.index.size();
+  const int* index = &cols.index[0];
+  const int* step = &cols.step[0];
+  const Dtype* lambda = &cols.lambda[0];
+  for (int w2 = 0; w2 < width2; ++w2) {
+    const Dtype* pos1 = row1 + index[w2];
+    out[w2] = (Dtype(1.) - lambda[w2]) * pos1[0] + lambda[w2] * pos1[step[w2]];
+  }
+}
+
+// row1 += the adjoint of interp2_row applied to in
+template <typename Dtype>
+static void interp2_row_backward(const Interp2Axis<Dtype>& cols,
+    const Dtype* in, Dtype* row1) {
+  const int width2 = cols.index.size();
+  const int* index = &cols.index[0];
+  const int* step = &cols.step[0];
+  const Dtype* lambda = &cols.lambda[0];
+  for (int w2 = 0; w2 < width2; ++w2) {
+    Dtype* pos1 = row1 + index[w2];
+    pos1[0] += (Dtype(1.) - lambda[w2]) * in[w2];
+    pos1[step[w2]] += lambda[w2] * in[w2];
+  }
+}
+
+// Planar forward of the channels [begin, end). Every output row blends two
+// source rows that were first resampled horizontally; these are kept in two
+// slots, so that when upsampling each source row is resampled only once and
+// the vertical blend is a plain loop over contiguous memory.
+template <typename Dtype>
+static void interp2_planes(const Interp2Tables<Dtype>* t,
+    const Dtype* data1, Dtype* data2, const int thread_id, const int begin,
+    const int end) {
+  const int height2 = t->rows.index.size();
+  const int width2 = t->cols.index.size();
+  std::vector<Dtype> buffer(2 * width2);
+  for (int c = begin; c < end; ++c) {
+    const Dtype* plane1 = data1 + (c * t->Height1 + t->y1) * t->Width1 + t->x1;
+    Dtype* plane2 = data2 + (c * t->Height2 + t->y2) * t->Width2 + t->x2;
+    Dtype* slot[2] = { &buffer[0], &buffer[width2] };
+    int slot_row[2] = { -1, -1 };
+    for (int h2 = 0; h2 < height2; ++h2) {
+      const int r[2] = { t->rows.index[h2],
+          t->rows.index[h2] + t->rows.step[h2] };
+      const Dtype* row[2];
+      for (int i = 0; i < 2; ++i) {
+        int s = (slot_row[0] == r[i]) ? 0 : (slot_row[1] == r[i]) ? 1 : -1;
+        if (s < 0) {
+          // evict the slot that does not hold the other row
+          s = (slot_row[0] == r[1 - i]) ? 1 : 0;
+          interp2_row(t->cols, plane1 + r[i] * t->Width1, slot[s]);
+          slot_row[s] = r[i];
+        }
+        row[i] = slot[s];
+      }
+      const Dtype h1lambda = t->rows.lambda[h2];
+      const Dtype h0lambda = Dtype(1.) - h1lambda;
+      Dtype* pos2 = plane2 + h2 * t->Width2;
+      for (int w2 = 0; w2 < width2; ++w2) {
+        pos2[w2] = h0lambda * row[0][w2] + h1lambda * row[1][w2];
+      }
+    }
+  }
+}
+
+// Planar backward of the channels [begin, end), the reverse of
+// interp2_planes: the output rows are blended into two slots indexed by
+// source row, and a slot is resampled back into its row when evicted. The
+// channels do not share any source pixels, so the threads never collide.
+template <typename Dtype>
+static void interp2_planes_backward(const Interp2Tables<Dtype>* t,
+    Dtype* data1, const Dtype* data2, const int thread_id, const int begin,
+    const int end) {
+  const int height2 = t->rows.index.size();
+  const int width2 = t->cols.index.size();
+  std::vector<Dtype> buffer(2 * width2);
+  for (int c = begin; c < end; ++c) {
+    Dtype* plane1 = data1 + (c * t->Height1 + t->y1) * t->Width1 + t->x1;
+    const Dtype* plane2 = data2 + (c * t->Height2 + t->y2) * t->Width2 +
+        t->x2;
+    Dtype* slot[2] = { &buffer[0], &buffer[width2] };
+    int slot_row[2] = { -1, -1 };
+    for (int h2 = 0; h2 < height2; ++h2) {
+      const int r[2] = { t->rows.index[h2],
+          t->rows.index[h2] + t->rows.step[h2] };
+      Dtype* row[2];
+      for (int i = 0; i < 2; ++i) {
+        int s = (slot_row[0] == r[i]) ? 0 : (slot_row[1] == r[i]) ? 1 : -1;
+        if (s < 0) {
+          s = (slot_row[0] == r[1 - i]) ? 1 : 0;
+          if (slot_row[s] >= 0) {
+            interp2_row_backward(t->cols, slot[s],
+                plane1 + slot_row[s] * t->Width1);
+          }
+          std::fill(slot[s], slot[s] + width2, Dtype(0));
+          slot_row[s] = r[i];
+        }
+        row[i] = slot[s];
+      }
+      const Dtype h1lambda = t->rows.lambda[h2];
+      const Dtype h0lambda = Dtype(1.) - h1lambda;
+      const Dtype* pos2 = plane2 + h2 * t->Width2;
+      for (int w2 = 0; w2 < width2; ++w2) {
+        row[0][w2] += h0lambda * pos2[w2];
+      }
+      for (int w2 = 0; w2 < width2; ++w2) {
+        row[1][w2] += h1lambda * pos2[w2];
+      }
+    }
+    for (int s = 0; s < 2; ++s) {
+      if (slot_row[s] >= 0) {
+        interp2_row_backward(t->cols, slot[s],
+            plane1 + slot_row[s] * t->Width1);
+      }
+    }
+  }
+}
+
+// Packed forward of the channels [begin, end), with the innermost loop
+// running over contiguous channels.
+template <typename Dtype>
+static void interp2_packed(const Interp2Tables<Dtype>* t,
+    const Dtype* data1, Dtype* data2, const int thread_id, const int begin,
+    const int end) {
+  const int channels = t->channels;
+  const int height2 = t->rows.index.size();
+  const int width2 = t->cols.index.size();
+  for (int h2 = 0; h2 < height2; ++h2) {
+    const int h1 = t->rows.index[h2];
+    const int h1p = t->rows.step[h2] * channels * t->Width1;
+    const Dtype h1lambda = t->rows.lambda[h2];
+    const Dtype h0lambda = Dtype(1.) - h1lambda;
+    for (int w2 = 0; w2 < width2; ++w2) {
+      const int w1 = t->cols.index[w2];
+      const int w1p = t->cols.step[w2] * channels;
+      const Dtype w1lambda = t->cols.lambda[w2];
+      const Dtype w0lambda = Dtype(1.) - w1lambda;
+      const Dtype* pos1 = &data1[channels * ((t->y1 + h1) * t->Width1 +
+          (t->x1 + w1))];
+      Dtype* pos2 = &data2[channels * ((t->y2 + h2) * t->Width2 +
+          (t->x2 + w2))];
+      for (int c = begin; c < end; ++c) {
+        pos2[c] =
+          h0lambda * (w0lambda * pos1[c]       + w1lambda * pos1[c + w1p]) +
+          h1lambda * (w0lambda * pos1[c + h1p] + w1lambda * pos1[c + h1p + w1p]);
+      }
+    }
+  }
+}
+
+// Packed backward of the channels [begin, end).
+template <typename Dtype>
+static void interp2_packed_backward(const Interp2Tables<Dtype>* t,
+    Dtype* data1, const Dtype* data2, const int thread_id, const int begin,
+    const int end) {
+  const int channels = t->channels;
+  const int height2 = t->rows.index.size();
+  const int width2 = t->cols.index.size();
+  for (int h2 = 0; h2 < height2; ++h2) {
+    const int h1 = t->rows.index[h2];
+    const int h1p = t->rows.step[h2] * channels * t->Width1;
+    const Dtype h1lambda = t->rows.lambda[h2];
+    const Dtype h0lambda = Dtype(1.) - h1lambda;
+    for (int w2 = 0; w2 < width2; ++w2) {
+      const int w1 = t->cols.index[w2];
+      const int w1p = t->cols.step[w2] * channels;
+      const Dtype w1lambda = t->cols.lambda[w2];
+      const Dtype w0lambda = Dtype(1.) - w1lambda;
+      Dtype* pos1 = &data1[channels * ((t->y1 + h1) * t->Width1 +
+          (t->x1 + w1))];
+      const Dtype* pos2 = &data2[channels * ((t->y2 + h2) * t->Width2 +
+          (t->x2 + w2))];
+      for (int c = begin; c < end; ++c) {
+        pos1[c] += h0lambda * w0lambda * pos2[c];
+        pos1[c + w1p] += h0lambda * w1lambda * pos2[c];
+        pos1[c + h1p] += h1lambda * w0lambda * pos2[c];
+        pos1[c + h1p + w1p] += h1lambda * w1lambda * pos2[c];
+      }
+    }
+  }
+}
+
 // Bi-linear interpolation
 // IN : [channels height1 width1] cropped from a bigger [Height1 Width1] image
 // OUT: [channels height2 width2] cropped from a bigger [Height2 Width2] image
 template <typename Dtype, bool packed>
 void caffe_cpu_interp2(const int channels,
     const Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
-    Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2) {
+    Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2,
+    const int num_threads) {
   CHECK(x1 >= 0 && y1 >= 0 && height1 > 0 && width1 > 0 && x2 >= 0 && y2 >= 0 && height2 > 0 && width2 > 0);
   CHECK(Width1 >= width1 + x1 && Height1 >= height1 + y1 && Width2 >= width2 + x2 && Height2 >= height2 + y2);
   // special case: just copy
@@ -44,44 +272,13 @@ void caffe_cpu_interp2(const int channels,
     }
     return;
   }
-  const float rheight = (height2 > 1) ? static_cast<float>(height1 - 1) / (height2 - 1) : 0.f;
-  const float rwidth = (width2 > 1) ? static_cast<float>(width1 - 1) / (width2 - 1) : 0.f;
-  for (int h2 = 0; h2 < height2; ++h2) {
-    const float h1r = rheight * h2;
-    const int h1 = h1r;
-    const int h1p = (h1 < height1 - 1) ? 1 : 0;
-    const Dtype h1lambda = h1r - h1;
-    const Dtype h0lambda = Dtype(1.) - h1lambda;
-    for (int w2 = 0; w2 < width2; ++w2) {
-      const float w1r = rwidth * w2;
-      const int w1 = w1r;
-      const int w1p = (w1 < width1 - 1) ? 1 : 0;
-      const Dtype w1lambda = w1r - w1;
-      const Dtype w0lambda = Dtype(1.) - w1lambda;
-      if (packed) {
-        const Dtype* pos1 = &data1[channels * ((y1 + h1) * Width1 + (x1 + w1))];
-        Dtype* pos2 = &data2[channels * ((y2 + h2) * Width2 + (x2 + w2))];
-        for (int c = 0; c < channels; ++c) {
-          pos2[0] =
-            h0lambda * (w0lambda * pos1[0]            + w1lambda * pos1[channels * w1p]) + 
-            h1lambda * (w0lambda * pos1[channels * h1p * Width1] + w1lambda * pos1[channels * (h1p * Width1 + w1p)]);
-          pos1++;
-          pos2++;
-        }
-      }
-      else {
-        const Dtype* pos1 = &data1[(y1 + h1) * Width1 + (x1 + w1)];
-        Dtype* pos2 = &data2[(y2 + h2) * Width2 + (x2 + w2)];
-        for (int c = 0; c < channels; ++c) {
-          pos2[0] =
-            h0lambda * (w0lambda * pos1[0]            + w1lambda * pos1[w1p]) + 
-            h1lambda * (w0lambda * pos1[h1p * Width1] + w1lambda * pos1[h1p * Width1 + w1p]);
-          pos1 += Width1 * Height1;
-          pos2 += Width2 * Height2;
-        }
-      }
-    }
-  }
+  Interp2Tables<Dtype> t(height1, width1, height2, width2);
+  t.channels = channels;
+  t.x1 = x1; t.y1 = y1; t.Height1 = Height1; t.Width1 = Width1;
+  t.x2 = x2; t.y2 = y2; t.Height2 = Height2; t.Width2 = Width2;
+  caffe_parallel_for(channels, num_threads, boost::bind(
+      packed ? &interp2_packed<Dtype> : &interp2_planes<Dtype>,
+      &t, data1, data2, _1, _2, _3));
 }
 
 
@@ -89,7 +286,8 @@ void caffe_cpu_interp2(const int channels,
 template <typename Dtype, bool packed>
 void caffe_cpu_interp2_backward(const int channels,
     Dtype *data1, const int x1, const int y1, const int height1, const int width1, const int Height1, const int Width1,
-    const Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2) {
+    const Dtype *data2, const int x2, const int y2, const int height2, const int width2, const int Height2, const int Width2,
+    const int num_threads) {
   CHECK(x1 >= 0 && y1 >= 0 && height1 > 0 && width1 > 0 && x2 >= 0 && y2 >= 0 && height2 > 0 && width2 > 0);
   CHECK(Width1 >= width1 + x1 && Height1 >= height1 + y1 && Width2 >= width2 + x2 && Height2 >= height2 + y2);
   // special case: same-size matching grids
@@ -120,46 +318,13 @@ void caffe_cpu_interp2_backward(const int channels,
     }
     return;
   }
-  const float rheight = (height2 > 1) ? static_cast<float>(height1 - 1) / (height2 - 1) : 0.f;
-  const float rwidth = (width2 > 1) ? static_cast<float>(width1 - 1) / (width2 - 1) : 0.f;
-  for (int h2 = 0; h2 < height2; ++h2) {
-    const float h1r = rheight * h2;
-    const int h1 = h1r;
-    const int h1p = (h1 < height1 - 1) ? 1 : 0;
-    const Dtype h1lambda = h1r - h1;
-    const Dtype h0lambda = Dtype(1.) - h1lambda;
-    for (int w2 = 0; w2 < width2; ++w2) {
-      const float w1r = rwidth * w2;
-      const int w1 = w1r;
-      const int w1p = (w1 < width1 - 1) ? 1 : 0;
-      const Dtype w1lambda = w1r - w1;
-      const Dtype w0lambda = Dtype(1.) - w1lambda;
-      if (packed) {
-        Dtype* pos1 = &data1[channels * ((y1 + h1) * Width1 + (x1 + w1))];
-        const Dtype* pos2 = &data2[channels * ((y2 + h2) * Width2 + (x2 + w2))];
-        for (int c = 0; c < channels; ++c) {
-          pos1[0] += h0lambda * w0lambda * pos2[0];
-          pos1[channels * w1p] += h0lambda * w1lambda * pos2[0];
-          pos1[channels * h1p * Width1] += h1lambda * w0lambda * pos2[0];
-          pos1[channels * (h1p * Width1 + w1p)] += h1lambda * w1lambda * pos2[0];
-          pos1++;
-          pos2++;
-        }
-      }
-      else {
-        Dtype* pos1 = &data1[(y1 + h1) * Width1 + (x1 + w1)];
-        const Dtype* pos2 = &data2[(y2 + h2) * Width2 + (x2 + w2)];
-        for (int c = 0; c < channels; ++c) {
-          pos1[0] += h0lambda * w0lambda * pos2[0];
-          pos1[w1p] += h0lambda * w1lambda * pos2[0];
-          pos1[h1p * Width1] += h1lambda * w0lambda * pos2[0];
-          pos1[h1p * Width1 + w1p] += h1lambda * w1lambda * pos2[0];
-          pos1 += Width1 * Height1;
-          pos2 += Width2 * Height2;
-        }
-      }
-    }
-  }
+  Interp2Tables<Dtype> t(height1, width1, height2, width2);
+  t.channels = channels;
+  t.x1 = x1; t.y1 = y1; t.Height1 = Height1; t.Width1 = Width1;
+  t.x2 = x2; t.y2 = y2; t.Height2 = Height2; t.Width2 = Width2;
+  caffe_parallel_for(channels, num_threads, boost::bind(
+      packed ? &interp2_packed_backward<Dtype> :
+      &interp2_planes_backward<Dtype>, &t, data1, data2, _1, _2, _3));
 }
 
 // Create Gaussian pyramid of an image. Assume output space is pre-allocated.
@@ -418,13 +583,13 @@ void caffe_gpu_mosaic(const int channels,
   */
 
 // Explicit instances
-template void caffe_cpu_interp2<float,false>(const int, const float *, const int, const int, const int, const int, const int, const int, float *, const int, const int, const int, const int, const int, const int);
-template void caffe_cpu_interp2<float,true>(const int, const float *, const int, const int, const int, const int, const int, const int, float *, const int, const int, const int, const int, const int, const int);
-template void caffe_cpu_interp2<double,false>(const int, const double *, const int, const int, const int, const int, const int, const int, double *, const int, const int, const int, const int, const int, const int);
-template void caffe_cpu_interp2<double,true>(const int, const double *, const int, const int, const int, const int, const int, const int, double *, const int, const int, const int, const int, const int, const int);
+template void caffe_cpu_interp2<float,false>(const int, const float *, const int, const int, const int, const int, const int, const int, float *, const int, const int, const int, const int, const int, const int, const int);
+template void caffe_cpu_interp2<float,true>(const int, const float *, const int, const int, const int, const int, const int, const int, float *, const int, const int, const int, const int, const int, const int, const int);
+template void caffe_cpu_interp2<double,false>(const int, const double *, const int, const int, const int, const int, const int, const int, double *, const int, const int, const int, const int, const int, const int, const int);
+template void caffe_cpu_interp2<double,true>(const int, const double *, const int, const int, const int, const int, const int, const int, double *, const int, const int, const int, const int, const int, const int, const int);
 
-template void caffe_cpu_interp2_backward<float,false>(const int, float *, const int, const int, const int, const int, const int, const int, const float *, const int, const int, const int, const int, const int, const int);
-template void caffe_cpu_interp2_backward<double,false>(const int, double *, const int, const int, const int, const int, const int, const int, const double *, const int, const int, const int, const int, const int, const int);
+template void caffe_cpu_interp2_backward<float,false>(const int, float *, const int, const int, const int, const int, const int, const int, const float *, const int, const int, const int, const int, const int, const int, const int);
+template void caffe_cpu_interp2_backward<double,false>(const int, double *, const int, const int, const int, const int, const int, const int, const double *, const int, const int, const int, const int, const int, const int, const int);
 
 template void caffe_cpu_pyramid2<float,false>(const int, const float *, const int, const int, float *, const int);
 template void caffe_cpu_pyramid2<float,true>(const int, const float *, const int, const int, float *, const int);
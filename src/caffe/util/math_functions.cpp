@@ -1,8 +1,13 @@
 #include <boost/math/special_functions/next.hpp>
 #include <boost/random.hpp>
 
+#include <cstring>
 #include <limits>
 
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
+
 #include "caffe/common.hpp"
 #include "caffe/util/math_functions.hpp"
 #include "caffe/util/rng.hpp"
@@ -394,4 +399,145 @@ void caffe_cpu_scale<double>(const int n, const double alpha, const double *x,
   cblas_dscal(n, alpha, y, 1);
 }
 
+// Scalar float <-> float16 conversions after F. Giesen's branch-light
+// versions, handling subnormals, infinities and NaNs.
+static inline uint16_t float_to_half(const float value) {
+  const uint32_t f32_infinity = 255u << 23;
+  const uint32_t f16_max = (127u + 16) << 23;
+  const uint32_t denorm_magic_bits = ((127u - 15) + (23 - 10) + 1) << 23;
+  uint32_t f;
+  memcpy(&f, &value, sizeof(f));
+  const uint32_t sign = f & 0x80000000u;
+  f ^= sign;
+  uint16_t h;
+  if (f >= f16_max) {
+    // overflow to infinity, NaN stays a (quiet) NaN
+    h = (f > f32_infinity) ? 0x7e00 : 0x7c00;
+  } else if (f < (113u << 23)) {
+    // the result is subnormal or zero: let the float adder do the rounding
+    float denorm_magic, v;
+    memcpy(&denorm_magic, &denorm_magic_bits, sizeof(f));
+    memcpy(&v, &f, sizeof(f));
+    v += denorm_magic;
+    memcpy(&f, &v, sizeof(f));
+    h = static_cast<uint16_t>(f - denorm_magic_bits);
+  } else {
+    const uint32_t mantissa_odd = (f >> 13) & 1;
+    f += ((15u - 127) << 23) + 0xfff;
+    f += mantissa_odd;
+    h = static_cast<uint16_t>(f >> 13);
+  }
+  return h | static_cast<uint16_t>(sign >> 16);
+}
+
+static inline float half_to_float(const uint16_t h) {
+  const uint32_t shifted_exponent = 0x7c00u << 13;
+  uint32_t f = (h & 0x7fffu) << 13;
+  const uint32_t exponent = shifted_exponent & f;
+  f += (127u - 15) << 23;
+  if (exponent == shifted_exponent) {
+    // infinity or NaN
+    f += (128u - 16) << 23;
+  } else if (exponent == 0) {
+    // zero or subnormal: renormalize
+    const uint32_t magic_bits = 113u << 23;
+    float magic, v;
+    memcpy(&magic, &magic_bits, sizeof(f));
+    f += 1u << 23;
+    memcpy(&v, &f, sizeof(f));
+    v -= magic;
+    memcpy(&f, &v, sizeof(f));
+  }
+  f |= static_cast<uint32_t>(h & 0x8000u) << 16;
+  float value;
+  memcpy(&value, &f, sizeof(f));
+  return value;
+}
+
+static inline uint16_t float_to_bfloat16(const float value) {
+  uint32_t f;
+  memcpy(&f, &value, sizeof(f));
+  if ((f & 0x7fffffffu) > 0x7f800000u) {
+    // keep NaN a NaN instead of rounding it to infinity
+    return static_cast<uint16_t>((f >> 16) | 0x40);
+  }
+  f += 0x7fffu + ((f >> 16) & 1);
+  return static_cast<uint16_t>(f >> 16);
+}
+
+static inline float bfloat16_to_float(const uint16_t h) {
+  const uint32_t f = static_cast<uint32_t>(h) << 16;
+  float value;
+  memcpy(&value, &f, sizeof(f));
+  return value;
+}
+
+template <>
+void caffe_cpu_float2half<float>(const int n, const float* x, uint16_t* y) {
+  int i = 0;
+#ifdef __F16C__
+  for (; i + 8 <= n; i += 8) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + i),
+        _mm256_cvtps_ph(_mm256_loadu_ps(x + i), _MM_FROUND_TO_NEAREST_INT));
+  }
+#endif
+  for (; i < n; ++i) {
+    y[i] = float_to_half(x[i]);
+  }
+}
+
+template <>
+void caffe_cpu_float2half<double>(const int n, const double* x, uint16_t* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = float_to_half(static_cast<float>(x[i]));
+  }
+}
+
+template <>
+void caffe_cpu_half2float<float>(const int n, const uint16_t* x, float* y) {
+  int i = 0;
+#ifdef __F16C__
+  for (; i + 8 <= n; i += 8) {
+    _mm256_storeu_ps(y + i, _mm256_cvtph_ps(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + i))));
+  }
+#endif
+  for (; i < n; ++i) {
+    y[i] = half_to_float(x[i]);
+  }
+}
+
+template <>
+void caffe_cpu_half2float<double>(const int n, const uint16_t* x, double* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = half_to_float(x[i]);
+  }
+}
+
+// The bfloat16 loops are plain integer arithmetic that the compiler
+// vectorizes.
+template <typename Dtype>
+void caffe_cpu_float2bfloat16(const int n, const Dtype* x, uint16_t* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = float_to_bfloat16(static_cast<float>(x[i]));
+  }
+}
+
+template void caffe_cpu_float2bfloat16<float>(const int n, const float* x,
+    uint16_t* y);
+template void caffe_cpu_float2bfloat16<double>(const int n, const double* x,
+    uint16_t* y);
+
+template <typename Dtype>
+void caffe_cpu_bfloat162float(const int n, const uint16_t* x, Dtype* y) {
+  for (int i = 0; i < n; ++i) {
+    y[i] = bfloat16_to_float(x[i]);
+  }
+}
+
+template void caffe_cpu_bfloat162float<float>(const int n, const uint16_t* x,
+    float* y);
+template void caffe_cpu_bfloat162float<double>(const int n, const uint16_t* x,
+    double* y);
+
 }  // namespace caffe
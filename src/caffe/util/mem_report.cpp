@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <set>
+#include <vector>
+
+#include "caffe/util/mem_report.hpp"
+
+namespace caffe {
+
+namespace {
+
+// Sums the bytes of the distinct storages that have been allocated.
+size_t AllocatedBytes(const vector<SyncedMemory*>& storages) {
+  std::set<SyncedMemory*> counted;
+  size_t bytes = 0;
+  for (int i = 0; i < storages.size(); ++i) {
+    if (counted.insert(storages[i]).second &&
+        storages[i]->head() != SyncedMemory::UNINITIALIZED) {
+      bytes += storages[i]->size();
+    }
+  }
+  return bytes;
+}
+
+}  // namespace
+
+template <typename Dtype>
+void ReportMemory(Net<Dtype>* net, MemoryReport* report) {
+  const vector<shared_ptr<Layer<Dtype> > >& layers = net->layers();
+  const vector<shared_ptr<Blob<Dtype> > >& params = net->params();
+  vector<SyncedMemory*> param_storages;
+  for (int i = 0; i < params.size(); ++i) {
+    param_storages.push_back(params[i]->data().get());
+    param_storages.push_back(params[i]->diff().get());
+  }
+
+  report->workspace_bytes = net->workspace_size();
+  report->forward_allocated_bytes.resize(layers.size());
+  report->backward_allocated_bytes.resize(layers.size());
+  for (int i = 0; i < layers.size(); ++i) {
+    net->ForwardFromTo(i, i);
+    vector<SyncedMemory*> storages = net->activation_storages();
+    storages.insert(storages.end(), param_storages.begin(),
+        param_storages.end());
+    report->forward_allocated_bytes[i] =
+        AllocatedBytes(storages) + report->workspace_bytes;
+  }
+  for (int i = layers.size() - 1; i >= 0; --i) {
+    net->BackwardFromTo(i, i);
+    vector<SyncedMemory*> storages = net->activation_storages();
+    storages.insert(storages.end(), param_storages.begin(),
+        param_storages.end());
+    report->backward_allocated_bytes[i] =
+        AllocatedBytes(storages) + report->workspace_bytes;
+  }
+  report->peak_bytes = 0;
+  for (int i = 0; i < layers.size(); ++i) {
+    report->peak_bytes = std::max(report->peak_bytes,
+        std::max(report->forward_allocated_bytes[i],
+                 report->backward_allocated_bytes[i]));
+  }
+
+  const vector<SyncedMemory*> storages = net->activation_storages();
+  report->activation_bytes = 0;
+  for (int i = 0; i < storages.size(); ++i) {
+    report->activation_bytes += storages[i]->size();
+  }
+  report->activation_raw_bytes = 0;
+  for (int i = 0; i < net->blobs().size(); ++i) {
+    report->activation_raw_bytes += 2 * net->blobs()[i]->count() *
+        sizeof(Dtype);
+  }
+  std::set<SyncedMemory*> counted;
+  report->param_bytes = 0;
+  for (int i = 0; i < param_storages.size(); ++i) {
+    if (counted.insert(param_storages[i]).second) {
+      report->param_bytes += param_storages[i]->size();
+    }
+  }
+  report->layer_top_bytes.assign(layers.size(), 0);
+  report->layer_param_bytes.assign(layers.size(), 0);
+  for (int i = 0; i < layers.size(); ++i) {
+    const vector<Blob<Dtype>*>& top_vec = net->top_vecs()[i];
+    for (int j = 0; j < top_vec.size(); ++j) {
+      report->layer_top_bytes[i] += top_vec[j]->count() * sizeof(Dtype);
+    }
+    for (int j = 0; j < layers[i]->blobs().size(); ++j) {
+      report->layer_param_bytes[i] += 2 * layers[i]->blobs()[j]->count() *
+          sizeof(Dtype);
+    }
+  }
+}
+
+template void ReportMemory<float>(Net<float>* net, MemoryReport* report);
+template void ReportMemory<double>(Net<double>* net, MemoryReport* report);
+
+}  // namespace caffe
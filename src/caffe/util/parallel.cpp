@@ -0,0 +1,138 @@
+#include <boost/bind/bind.hpp>
+#include <boost/thread.hpp>
+#include <boost/thread/tss.hpp>
+
+#include <stdint.h>
+
+#include <algorithm>
+
+#include "caffe/util/parallel.hpp"
+
+namespace caffe {
+
+int caffe_hardware_threads() {
+  return std::max<int>(boost::thread::hardware_concurrency(), 1);
+}
+
+namespace {
+
+// The start of range t of the num_ranges over [0, count), computed in 64
+// bits since count * t overflows an int for large counts.
+inline int range_begin(const int count, const int t, const int num_ranges) {
+  return static_cast<int>(static_cast<int64_t>(count) * t / num_ranges);
+}
+
+// Worker threads that stay alive between calls, so a layer splitting each
+// forward over threads does not pay a thread creation and join every time.
+// The workers sleep on a condition variable and claim the ranges 1..n-1 of
+// the current call; the caller runs range 0 and waits for the rest.
+class WorkerPool {
+ public:
+  WorkerPool() : func_(NULL), count_(0), num_ranges_(0), next_(0),
+      pending_(0), stop_(false) {}
+  ~WorkerPool() {
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      stop_ = true;
+    }
+    work_.notify_all();
+    workers_.join_all();
+  }
+
+  void Run(const int count, const int num_threads,
+      const boost::function<void(int, int, int)>& func) {
+    while (static_cast<int>(workers_.size()) < num_threads - 1) {
+      workers_.create_thread(boost::bind(&WorkerPool::Work, this));
+    }
+    {
+      boost::mutex::scoped_lock lock(mutex_);
+      func_ = &func;
+      count_ = count;
+      num_ranges_ = num_threads;
+      next_ = 1;
+      pending_ = num_threads - 1;
+    }
+    work_.notify_all();
+    // The caller counts as a worker while it runs range 0, so a nested call
+    // runs serially instead of handing this pool a second set of ranges.
+    in_worker_.reset(new bool(true));
+    func(0, 0, range_begin(count, 1, num_threads));
+    in_worker_.reset();
+    boost::mutex::scoped_lock lock(mutex_);
+    while (pending_ > 0) {
+      done_.wait(lock);
+    }
+    func_ = NULL;
+  }
+
+  /// True on the threads of any pool, and on a caller running its range,
+  /// where nested calls run serially.
+  static bool InWorker() { return in_worker_.get() != NULL; }
+
+ private:
+  void Work() {
+    in_worker_.reset(new bool(true));
+    boost::mutex::scoped_lock lock(mutex_);
+    while (true) {
+      while (!stop_ && next_ >= num_ranges_) {
+        work_.wait(lock);
+      }
+      if (stop_) {
+        return;
+      }
+      const int t = next_++;
+      const boost::function<void(int, int, int)>& func = *func_;
+      const int begin = range_begin(count_, t, num_ranges_);
+      const int end = range_begin(count_, t + 1, num_ranges_);
+      lock.unlock();
+      func(t, begin, end);
+      lock.lock();
+      if (--pending_ == 0) {
+        done_.notify_one();
+      }
+    }
+  }
+
+  boost::thread_group workers_;
+  boost::mutex mutex_;
+  boost::condition_variable work_;
+  boost::condition_variable done_;
+  const boost::function<void(int, int, int)>* func_;
+  int count_;
+  int num_ranges_;
+  int next_;
+  int pending_;
+  bool stop_;
+
+  static boost::thread_specific_ptr<bool> in_worker_;
+};
+
+boost::thread_specific_ptr<bool> WorkerPool::in_worker_;
+
+// One pool per calling thread, like the Caffe context, so nets running on
+// different threads never queue behind each other.
+boost::thread_specific_ptr<WorkerPool> thread_pool_;
+
+}  // namespace
+
+int caffe_parallel_for(const int count, int num_threads,
+    const boost::function<void(int, int, int)>& func) {
+  if (num_threads <= 0) {
+    num_threads = caffe_hardware_threads();
+  }
+  num_threads = std::min(num_threads, count);
+  if (num_threads <= 1 || WorkerPool::InWorker()) {
+    if (count <= 0) {
+      return 0;
+    }
+    func(0, 0, count);
+    return 1;
+  }
+  if (!thread_pool_.get()) {
+    thread_pool_.reset(new WorkerPool());
+  }
+  thread_pool_->Run(count, num_threads, func);
+  return num_threads;
+}
+
+}  // namespace caffe
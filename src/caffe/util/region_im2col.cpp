@@ -1,58 +1,243 @@
-#include <cmath>
-#include <cstdlib>
-#include <cstring>
+#include <algorithm>
+#include <vector>
 
+#include "boost/bind/bind.hpp"
+
+#include "caffe/common.hpp"
+#include "caffe/util/parallel.hpp"
 #include "caffe/util/region_im2col.hpp"
-#include "caffe/util/math_functions.hpp"
 
 namespace caffe {
 
+using boost::placeholders::_1;
+using boost::placeholders::_2;
+using boost::placeholders::_3;
+
 inline bool is_a_ge_zero_and_a_lt_b(int a, int b) {
   return static_cast<unsigned>(a) < static_cast<unsigned>(b);
 }
 
+// The arguments of one region im2col / col2im call, shared by the threads
+// that split its active pixels. pixels holds their linear indices, and the
+// column buffer holds the num_cols columns of the active outputs starting
+// at col_begin.
+template <typename Dtype>
+struct RegionIm2colArgs {
+  const int* pixels;
+  const Dtype* data_mask;
+  int mask_cnt;
+  int col_begin;
+  int num_cols;
+  int channels;
+  int height;
+  int width;
+  int kernel_h;
+  int kernel_w;
+  int pad_h;
+  int pad_w;
+  int dilation_h;
+  int dilation_w;
+  bool compression;
+};
+
+// Gathers the columns [begin, end) of data_col. Every row of the buffer is
+// one (channel, kernel element) pair, and walking the active pixels along it
+// keeps the writes contiguous. With compression, data_im holds the channels
+// of the active pixels only, and data_mask maps a pixel to its column.
 template <typename Dtype>
-void region_im2col_cpu(const Dtype* data_im, const int channels,
-    const int height, const int width, const int kernel_h, const int kernel_w,
-    const int pad_h, const int pad_w,
-    const int stride_h, const int stride_w,
-    const int dilation_h, const int dilation_w,
-    Dtype* data_col) {
-  NOT_IMPLEMENTED;
+static void region_im2col_pixels(const RegionIm2colArgs<Dtype>* a,
+    const Dtype* data_im, Dtype* data_col, const int thread_id,
+    const int begin, const int end) {
+  const int mask_cnt = a->mask_cnt;
+  const int* pixels = a->pixels + a->col_begin;
+  // the coordinates of the pixels, split once out of their linear indices
+  std::vector<int> h_pixel(end - begin), w_pixel(end - begin);
+  for (int m = begin; m < end; ++m) {
+    h_pixel[m - begin] = pixels[m] / a->width;
+    w_pixel[m - begin] = pixels[m] % a->width;
+  }
+  for (int c = 0; c < a->channels; ++c) {
+    const Dtype* im = data_im + (a->compression ? c * mask_cnt :
+        c * a->height * a->width);
+    for (int i = 0; i < a->kernel_h; ++i) {
+      for (int j = 0; j < a->kernel_w; ++j) {
+        Dtype* col = data_col +
+            ((c * a->kernel_h + i) * a->kernel_w + j) * a->num_cols;
+        for (int m = begin; m < end; ++m) {
+          const int h_im = h_pixel[m - begin] - a->pad_h + i * a->dilation_h;
+          const int w_im = w_pixel[m - begin] - a->pad_w + j * a->dilation_w;
+          if (!is_a_ge_zero_and_a_lt_b(h_im, a->height) ||
+              !is_a_ge_zero_and_a_lt_b(w_im, a->width)) {
+            col[m] = 0;
+          } else if (a->compression) {
+            const int k = a->data_mask[h_im * a->width + w_im];
+            col[m] = k >= 0 ? im[k] : 0;
+          } else {
+            col[m] = im[h_im * a->width + w_im];
+          }
+        }
+      }
+    }
+  }
 }
 
-// Explicit instantiation
-template void region_im2col_cpu<float>(const float* data_im, const int channels,
-    const int height, const int width, const int kernel_h, const int kernel_w,
-    const int pad_h, const int pad_w, const int stride_h,
-    const int stride_w, const int dilation_h, const int dilation_w,
-    float* data_col);
-template void region_im2col_cpu<double>(const double* data_im, const int channels,
-    const int height, const int width, const int kernel_h, const int kernel_w,
-    const int pad_h, const int pad_w, const int stride_h,
-    const int stride_w, const int dilation_h, const int dilation_w,
-    double* data_col);
-
-
-template <typename Dtype>
-void region_col2im_cpu(const Dtype* data_col, const int channels,
-    const int height, const int width, const int kernel_h, const int kernel_w,
-    const int pad_h, const int pad_w,
-    const int stride_h, const int stride_w,
-    const int dilation_h, const int dilation_w,
-    Dtype* data_im) {
-  NOT_IMPLEMENTED;
+// Computes the gradient of the active pixels [begin, end) of data_im from
+// the columns of the active outputs whose windows cover them. Every pixel is
+// written by exactly one thread, so there is nothing to synchronize. The
+// columns after the first chunk add to the gradient instead of setting it.
+template <typename Dtype>
+static void region_col2im_pixels(const RegionIm2colArgs<Dtype>* a,
+    const Dtype* data_col, Dtype* data_im, const int thread_id,
+    const int begin, const int end) {
+  const int mask_cnt = a->mask_cnt;
+  const int num_cols = a->num_cols;
+  const int kernel_dim = a->kernel_h * a->kernel_w;
+  const bool accumulate = a->col_begin > 0;
+  // the column read by each kernel element, -1 where the output is inactive
+  // or outside of the buffer
+  std::vector<int> taps(kernel_dim);
+  for (int m = begin; m < end; ++m) {
+    const int h = a->pixels[m] / a->width;
+    const int w = a->pixels[m] % a->width;
+    for (int i = 0; i < a->kernel_h; ++i) {
+      for (int j = 0; j < a->kernel_w; ++j) {
+        const int h_col = h + a->pad_h - i * a->dilation_h;
+        const int w_col = w + a->pad_w - j * a->dilation_w;
+        const int col = (is_a_ge_zero_and_a_lt_b(h_col, a->height) &&
+            is_a_ge_zero_and_a_lt_b(w_col, a->width)) ?
+            static_cast<int>(a->data_mask[h_col * a->width + w_col]) : -1;
+        taps[i * a->kernel_w + j] = (col >= 0
+            && is_a_ge_zero_and_a_lt_b(col - a->col_begin, num_cols)) ?
+            col - a->col_begin : -1;
+      }
+    }
+    for (int c = 0; c < a->channels; ++c) {
+      const Dtype* col = data_col + c * kernel_dim * num_cols;
+      Dtype val = 0;
+      for (int k = 0; k < kernel_dim; ++k) {
+        if (taps[k] >= 0) {
+          val += col[k * num_cols + taps[k]];
+        }
+      }
+      Dtype* im = data_im + (a->compression ? c * mask_cnt + m :
+          (c * a->height + h) * a->width + w);
+      *im = accumulate ? *im + val : val;
+    }
+  }
+}
+
+template <typename Dtype>
+static void region_im2col(const Dtype* data_im, const Dtype* data_mask,
+    const int* pixels, const int mask_cnt,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int dilation_h, const int dilation_w, const bool compression,
+    Dtype* data_col, const int num_threads, const int col_begin,
+    const int col_count) {
+  const int num_cols = col_count < 0 ? mask_cnt - col_begin : col_count;
+  const RegionIm2colArgs<Dtype> args = { pixels, data_mask,
+      mask_cnt, col_begin, num_cols, channels, height, width, kernel_h,
+      kernel_w, pad_h, pad_w, dilation_h, dilation_w, compression };
+  caffe_parallel_for(num_cols, num_threads, boost::bind(
+      &region_im2col_pixels<Dtype>, &args, data_im, data_col, _1, _2, _3));
+}
+
+template <typename Dtype>
+static void region_col2im(const Dtype* data_col, const int* pixels,
+    const Dtype* data_mask, const int mask_cnt,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int dilation_h, const int dilation_w, const bool compression,
+    Dtype* data_im, const int num_threads, const int col_begin,
+    const int col_count) {
+  const int num_cols = col_count < 0 ? mask_cnt - col_begin : col_count;
+  const RegionIm2colArgs<Dtype> args = { pixels, data_mask,
+      mask_cnt, col_begin, num_cols, channels, height, width, kernel_h,
+      kernel_w, pad_h, pad_w, dilation_h, dilation_w, compression };
+  caffe_parallel_for(mask_cnt, num_threads, boost::bind(
+      &region_col2im_pixels<Dtype>, &args, data_col, data_im, _1, _2, _3));
+}
+
+template <typename Dtype>
+void region_im2col_cpu(const Dtype* data_im,
+    const int* pixels, const int mask_cnt,
+    const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int dilation_h, const int dilation_w, Dtype* data_col,
+    const int num_threads, const int col_begin, const int col_count) {
+  region_im2col<Dtype>(data_im, NULL, pixels, mask_cnt, channels,
+      height, width, kernel_h, kernel_w, pad_h, pad_w, dilation_h,
+      dilation_w, false, data_col, num_threads, col_begin, col_count);
 }
+
+template <typename Dtype>
+void compression_region_im2col_cpu(const Dtype* data_im,
+    const Dtype* data_mask, const int* pixels,
+    const int mask_cnt, const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int dilation_h, const int dilation_w, Dtype* data_col,
+    const int num_threads, const int col_begin, const int col_count) {
+  region_im2col<Dtype>(data_im, data_mask, pixels, mask_cnt,
+      channels, height, width, kernel_h, kernel_w, pad_h, pad_w, dilation_h,
+      dilation_w, true, data_col, num_threads, col_begin, col_count);
+}
+
+template <typename Dtype>
+void region_col2im_cpu(const Dtype* data_col,
+    const int* pixels, const Dtype* data_mask,
+    const int mask_cnt, const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int dilation_h, const int dilation_w, Dtype* data_im,
+    const int num_threads, const int col_begin, const int col_count) {
+  region_col2im<Dtype>(data_col, pixels, data_mask, mask_cnt,
+      channels, height, width, kernel_h, kernel_w, pad_h, pad_w, dilation_h,
+      dilation_w, false, data_im, num_threads, col_begin, col_count);
+}
+
+template <typename Dtype>
+void compression_region_col2im_cpu(const Dtype* data_col,
+    const int* pixels, const Dtype* data_mask,
+    const int mask_cnt, const int channels, const int height, const int width,
+    const int kernel_h, const int kernel_w, const int pad_h, const int pad_w,
+    const int dilation_h, const int dilation_w, Dtype* data_im,
+    const int num_threads, const int col_begin, const int col_count) {
+  region_col2im<Dtype>(data_col, pixels, data_mask, mask_cnt,
+      channels, height, width, kernel_h, kernel_w, pad_h, pad_w, dilation_h,
+      dilation_w, true, data_im, num_threads, col_begin, col_count);
+}
+
 // Explicit instantiation
-template void region_col2im_cpu<float>(const float* data_col, const int channels,
-    const int height, const int width, const int kernel_h, const int kernel_w,
-    const int pad_h, const int pad_w, const int stride_h,
-    const int stride_w, const int dilation_h, const int dilation_w,
-    float* data_im);
-template void region_col2im_cpu<double>(const double* data_col, const int channels,
-    const int height, const int width, const int kernel_h, const int kernel_w,
-    const int pad_h, const int pad_w, const int stride_h,
-    const int stride_w, const int dilation_h, const int dilation_w,
-    double* data_im);
+#define INSTANTIATE_REGION_IM2COL_CPU(Dtype) \
+  template void region_im2col_cpu<Dtype>(const Dtype* data_im, \
+      const int* pixels, const int mask_cnt, \
+      const int channels, const int height, const int width, \
+      const int kernel_h, const int kernel_w, const int pad_h, \
+      const int pad_w, const int dilation_h, const int dilation_w, \
+      Dtype* data_col, const int num_threads, const int col_begin, \
+      const int col_count); \
+  template void compression_region_im2col_cpu<Dtype>(const Dtype* data_im, \
+      const Dtype* data_mask, const int* pixels, \
+      const int mask_cnt, const int channels, const int height, \
+      const int width, const int kernel_h, const int kernel_w, \
+      const int pad_h, const int pad_w, const int dilation_h, \
+      const int dilation_w, Dtype* data_col, const int num_threads, \
+      const int col_begin, const int col_count); \
+  template void region_col2im_cpu<Dtype>(const Dtype* data_col, \
+      const int* pixels, const Dtype* data_mask, \
+      const int mask_cnt, const int channels, const int height, \
+      const int width, const int kernel_h, const int kernel_w, \
+      const int pad_h, const int pad_w, const int dilation_h, \
+      const int dilation_w, Dtype* data_im, const int num_threads, \
+      const int col_begin, const int col_count); \
+  template void compression_region_col2im_cpu<Dtype>(const Dtype* data_col, \
+      const int* pixels, const Dtype* data_mask, \
+      const int mask_cnt, const int channels, const int height, \
+      const int width, const int kernel_h, const int kernel_w, \
+      const int pad_h, const int pad_w, const int dilation_h, \
+      const int dilation_w, Dtype* data_im, const int num_threads, \
+      const int col_begin, const int col_count)
+
+INSTANTIATE_REGION_IM2COL_CPU(float);
+INSTANTIATE_REGION_IM2COL_CPU(double);
 
 }  // namespace caffe
@@ -13,12 +13,12 @@ __global__ void region_im2col_gpu_kernel(const int n, const Dtype* data_im,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int dilation_h, const int dilation_w,
-    const Dtype* index_1, const Dtype* index_2,
+    const int* pixels,
     const int mask_cnt, Dtype* data_col) {
   CUDA_KERNEL_LOOP(index, n) {
     const int m_index = index % mask_cnt;
-    const int h_col = index_1[m_index];
-    const int w_col = index_2[m_index];
+    const int h_col = pixels[m_index] / width;
+    const int w_col = pixels[m_index] % width;
     const int c_im = index / mask_cnt;
     const int c_col = c_im * kernel_h * kernel_w;
     const int h_offset = h_col - pad_h;
@@ -42,7 +42,7 @@ __global__ void region_im2col_gpu_kernel(const int n, const Dtype* data_im,
 
 template <typename Dtype>
 void region_im2col_gpu(const Dtype* data_im,
-    const Dtype* index_1, const Dtype* index_2, const int mask_cnt, const int channels,
+    const int* pixels, const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int dilation_h, const int dilation_w,
@@ -55,8 +55,7 @@ void region_im2col_gpu(const Dtype* data_im,
   region_im2col_gpu_kernel<Dtype><<<CAFFE_GET_BLOCKS(num_kernels),
                              CAFFE_CUDA_NUM_THREADS>>>(
       num_kernels, data_im, height, width, kernel_h, kernel_w, pad_h,
-      pad_w, dilation_h, dilation_w, index_1,
-      index_2, mask_cnt, data_col);
+      pad_w, dilation_h, dilation_w, pixels, mask_cnt, data_col);
   CUDA_POST_KERNEL_CHECK;
 }
 
@@ -65,12 +64,12 @@ __global__ void compression_region_im2col_gpu_kernel(const int n, const Dtype* d
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int dilation_h, const int dilation_w,
-    const Dtype* index_1, const Dtype* index_2,
+    const int* pixels,
     const int mask_cnt, Dtype* data_col) {
   CUDA_KERNEL_LOOP(index, n) {
     const int m_index = index % mask_cnt;
-    const int h_col = index_1[m_index];
-    const int w_col = index_2[m_index];
+    const int h_col = pixels[m_index] / width;
+    const int w_col = pixels[m_index] % width;
     const int c_im = index / mask_cnt;
     const int c_col = c_im * kernel_h * kernel_w;
     const int h_offset = h_col - pad_h;
@@ -93,7 +92,7 @@ __global__ void compression_region_im2col_gpu_kernel(const int n, const Dtype* d
 
 template <typename Dtype>
 void compression_region_im2col_gpu(const Dtype* data_im, const Dtype* data_mask,
-    const Dtype* index_1, const Dtype* index_2, const int mask_cnt, const int channels,
+    const int* pixels, const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int dilation_h, const int dilation_w,
@@ -106,31 +105,30 @@ void compression_region_im2col_gpu(const Dtype* data_im, const Dtype* data_mask,
   compression_region_im2col_gpu_kernel<Dtype><<<CAFFE_GET_BLOCKS(num_kernels),
                              CAFFE_CUDA_NUM_THREADS>>>(
       num_kernels, data_im, data_mask, height, width, kernel_h, kernel_w, pad_h,
-      pad_w, dilation_h, dilation_w, index_1,
-      index_2, mask_cnt, data_col);
+      pad_w, dilation_h, dilation_w, pixels, mask_cnt, data_col);
   CUDA_POST_KERNEL_CHECK;
 }
 
 
 // Explicit instantiation
 template void region_im2col_gpu<float>(const float* data_im, 
-    const float* index_1, const float* index_2, const int mask_cnt, const int channels,
+    const int* pixels, const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int dilation_h, const int dilation_w, float* data_col);
 template void region_im2col_gpu<double>(const double* data_im,
-    const double* index_1, const double* index_2, const int mask_cnt, const int channels,
+    const int* pixels, const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int dilation_h, const int dilation_w, double* data_col);
 
 template void compression_region_im2col_gpu<float>(const float* data_im, const float* data_mask,
-    const float* index_1, const float* index_2, const int mask_cnt, const int channels,
+    const int* pixels, const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int dilation_h, const int dilation_w, float* data_col);
 template void compression_region_im2col_gpu<double>(const double* data_im, const double* data_mask,
-    const double* index_1, const double* index_2, const int mask_cnt, const int channels,
+    const int* pixels, const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w,
     const int dilation_h, const int dilation_w, double* data_col);
@@ -143,13 +141,13 @@ __global__ void region_col2im_gpu_kernel(const int n, const Dtype* data_col,
     const int pad_h, const int pad_w,
     const int dilation_h, const int dilation_w,
     const int height_col, const int width_col,
-    const Dtype* index_1, const Dtype* index_2, const Dtype* data_mask,
+    const int* pixels, const Dtype* data_mask,
     const int mask_cnt, Dtype* data_im) {
   CUDA_KERNEL_LOOP(index, n) {
     Dtype val = 0;
     const int m_index = index % mask_cnt;
-    const int h_im = index_1[m_index] + pad_h;
-    const int w_im = index_2[m_index] + pad_w;
+    const int h_im = pixels[m_index] / width + pad_h;
+    const int w_im = pixels[m_index] % width + pad_w;
     const int c_im = index / (mask_cnt);
     int kernel_extent_w = (kernel_w - 1) * dilation_w + 1;
     int kernel_extent_h = (kernel_h - 1) * dilation_h + 1;
@@ -183,7 +181,7 @@ __global__ void region_col2im_gpu_kernel(const int n, const Dtype* data_col,
 
 template <typename Dtype>
 void region_col2im_gpu(const Dtype* data_col, 
-    const Dtype* index_1, const Dtype* index_2, const Dtype* data_mask,
+    const int* pixels, const Dtype* data_mask,
     const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w, const int dilation_h, const int dilation_w,
@@ -199,7 +197,7 @@ void region_col2im_gpu(const Dtype* data_col,
                              CAFFE_CUDA_NUM_THREADS>>>(
       num_kernels, data_col, height, width, channels, kernel_h, kernel_w,
       pad_h, pad_w, dilation_h, dilation_w,
-      height_col, width_col, index_1, index_2, data_mask, mask_cnt, data_im);
+      height_col, width_col, pixels, data_mask, mask_cnt, data_im);
 
   CUDA_POST_KERNEL_CHECK;
 }
@@ -211,13 +209,13 @@ __global__ void compression_region_col2im_gpu_kernel(const int n, const Dtype* d
     const int pad_h, const int pad_w,
     const int dilation_h, const int dilation_w,
     const int height_col, const int width_col,
-    const Dtype* index_1, const Dtype* index_2, const Dtype* data_mask,
+    const int* pixels, const Dtype* data_mask,
     const int mask_cnt, Dtype* data_im) {
   CUDA_KERNEL_LOOP(index, n) {
     Dtype val = 0;
     const int m_index = index % mask_cnt;
-    const int h_im = index_1[m_index] + pad_h;
-    const int w_im = index_2[m_index] + pad_w;
+    const int h_im = pixels[m_index] / width + pad_h;
+    const int w_im = pixels[m_index] % width + pad_w;
     const int c_im = index / (mask_cnt);
     int kernel_extent_w = (kernel_w - 1) * dilation_w + 1;
     int kernel_extent_h = (kernel_h - 1) * dilation_h + 1;
@@ -251,7 +249,7 @@ __global__ void compression_region_col2im_gpu_kernel(const int n, const Dtype* d
 
 template <typename Dtype>
 void compression_region_col2im_gpu(const Dtype* data_col, 
-    const Dtype* index_1, const Dtype* index_2, const Dtype* data_mask,
+    const int* pixels, const Dtype* data_mask,
     const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w, const int dilation_h, const int dilation_w,
@@ -267,32 +265,32 @@ void compression_region_col2im_gpu(const Dtype* data_col,
                              CAFFE_CUDA_NUM_THREADS>>>(
       num_kernels, data_col, height, width, channels, kernel_h, kernel_w,
       pad_h, pad_w, dilation_h, dilation_w,
-      height_col, width_col, index_1, index_2, data_mask, mask_cnt, data_im);
+      height_col, width_col, pixels, data_mask, mask_cnt, data_im);
 
   CUDA_POST_KERNEL_CHECK;
 }
 
 // Explicit instantiation
 template void region_col2im_gpu<float>(const float* data_col,
-    const float* index_1, const float* index_2, const float* data_mask,
+    const int* pixels, const float* data_mask,
     const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w, const int dilation_h, const int dilation_w,
     float* data_im);
 template void region_col2im_gpu<double>(const double* data_col,
-    const double* index_1, const double* index_2, const double* data_mask,
+    const int* pixels, const double* data_mask,
     const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w, const int dilation_h, const int dilation_w,
     double* data_im);
 template void compression_region_col2im_gpu<float>(const float* data_col,
-    const float* index_1, const float* index_2, const float* data_mask,
+    const int* pixels, const float* data_mask,
     const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w, const int dilation_h, const int dilation_w,
     float* data_im);
 template void compression_region_col2im_gpu<double>(const double* data_col,
-    const double* index_1, const double* index_2, const double* data_mask,
+    const int* pixels, const double* data_mask,
     const int mask_cnt, const int channels,
     const int height, const int width, const int kernel_h, const int kernel_w,
     const int pad_h, const int pad_w, const int dilation_h, const int dilation_w,
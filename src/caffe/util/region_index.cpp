@@ -0,0 +1,23 @@
+#include "caffe/util/region_index.hpp"
+
+namespace caffe {
+
+void region_index_finish(const int cnt, int* index) {
+  const int* pixels = index + 2;
+  int* runs = index + 2 + cnt;
+  int num_runs = 0;
+  for (int m = 0; m < cnt; ++m) {
+    if (num_runs > 0 &&
+        pixels[m] == runs[2 * num_runs - 2] + runs[2 * num_runs - 1]) {
+      ++runs[2 * num_runs - 1];
+    } else {
+      runs[2 * num_runs] = pixels[m];
+      runs[2 * num_runs + 1] = 1;
+      ++num_runs;
+    }
+  }
+  index[0] = cnt;
+  index[1] = num_runs;
+}
+
+}  // namespace caffe
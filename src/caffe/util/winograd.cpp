@@ -0,0 +1,101 @@
+#include <algorithm>
+
+#include "caffe/common.hpp"
+#include "caffe/util/winograd.hpp"
+
+namespace caffe {
+
+// F(2x2, 3x3)
+static const double winograd_bt_2[] = {
+  1,  0, -1,  0,
+  0,  1,  1,  0,
+  0, -1,  1,  0,
+  0,  1,  0, -1
+};
+static const double winograd_g_2[] = {
+  1,    0,   0,
+  0.5,  0.5, 0.5,
+  0.5, -0.5, 0.5,
+  0,    0,   1
+};
+static const double winograd_at_2[] = {
+  1, 1,  1,  0,
+  0, 1, -1, -1
+};
+
+// F(4x4, 3x3)
+static const double winograd_bt_4[] = {
+  4,  0, -5,  0, 1, 0,
+  0, -4, -4,  1, 1, 0,
+  0,  4, -4, -1, 1, 0,
+  0, -2, -1,  2, 1, 0,
+  0,  2, -1, -2, 1, 0,
+  0,  4,  0, -5, 0, 1
+};
+static const double winograd_g_4[] = {
+  1. / 4,   0,        0,
+  -1. / 6,  -1. / 6,  -1. / 6,
+  -1. / 6,  1. / 6,   -1. / 6,
+  1. / 24,  1. / 12,  1. / 6,
+  1. / 24,  -1. / 12, 1. / 6,
+  0,        0,        1
+};
+static const double winograd_at_4[] = {
+  1, 1,  1, 1,  1, 0,
+  0, 1, -1, 2, -2, 0,
+  0, 1,  1, 4,  4, 0,
+  0, 1, -1, 8, -8, 1
+};
+
+template <typename Dtype>
+void winograd_matrices(const int tile, Dtype* BT, Dtype* G, Dtype* AT) {
+  CHECK(tile == 2 || tile == 4) << "Winograd tiles must be 2 or 4.";
+  const int alpha = tile + 2;
+  const double* bt = tile == 2 ? winograd_bt_2 : winograd_bt_4;
+  const double* g = tile == 2 ? winograd_g_2 : winograd_g_4;
+  const double* at = tile == 2 ? winograd_at_2 : winograd_at_4;
+  std::copy(bt, bt + alpha * alpha, BT);
+  std::copy(g, g + alpha * 3, G);
+  std::copy(at, at + tile * alpha, AT);
+}
+
+template void winograd_matrices<float>(const int tile, float* BT, float* G,
+    float* AT);
+template void winograd_matrices<double>(const int tile, double* BT,
+    double* G, double* AT);
+
+template <typename Dtype>
+void winograd_transform(const Dtype* L, const int rows, const int cols,
+    const Dtype* in, const int in_stride, Dtype* out, const int out_stride) {
+  // the largest tiles are 6 x 6
+  Dtype temp[6 * 6];
+  // temp = L in
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < cols; ++j) {
+      Dtype sum = 0;
+      for (int k = 0; k < cols; ++k) {
+        sum += L[i * cols + k] * in[(k * cols + j) * in_stride];
+      }
+      temp[i * cols + j] = sum;
+    }
+  }
+  // out = temp L^T
+  for (int i = 0; i < rows; ++i) {
+    for (int j = 0; j < rows; ++j) {
+      Dtype sum = 0;
+      for (int k = 0; k < cols; ++k) {
+        sum += temp[i * cols + k] * L[j * cols + k];
+      }
+      out[(i * rows + j) * out_stride] = sum;
+    }
+  }
+}
+
+template void winograd_transform<float>(const float* L, const int rows,
+    const int cols, const float* in, const int in_stride, float* out,
+    const int out_stride);
+template void winograd_transform<double>(const double* L, const int rows,
+    const int cols, const double* in, const int in_stride, double* out,
+    const int out_stride);
+
+}  // namespace caffe
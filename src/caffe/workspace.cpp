@@ -0,0 +1,35 @@
+#include <cstring>
+
+#include <boost/thread/tss.hpp>
+
+#include "caffe/common.hpp"
+#include "caffe/workspace.hpp"
+
+namespace caffe {
+
+static boost::thread_specific_ptr<Workspace> thread_workspace_;
+
+Workspace* Workspace::ThreadLocal() {
+  if (!thread_workspace_.get()) {
+    thread_workspace_.reset(new Workspace());
+  }
+  return thread_workspace_.get();
+}
+
+void Workspace::Reserve(size_t bytes) {
+  if (bytes <= reserved_) {
+    return;
+  }
+  CHECK(limit_ == 0 || bytes <= limit_)
+      << "Workspace of " << bytes << " bytes exceeds the limit of "
+      << limit_ << " bytes";
+  reserved_ = bytes;
+  mem_->Resize(reserved_);
+}
+
+void Workspace::Release() {
+  // keep the reservation so that the next use allocates the full size at once
+  mem_.reset(new SyncedMemory(reserved_));
+}
+
+}  // namespace caffe
@@ -1,18 +1,23 @@
 #include <glog/logging.h>
 
 #include <cstring>
+#include <iostream>
 #include <map>
 #include <string>
 #include <vector>
 
 #include "boost/algorithm/string.hpp"
 #include "caffe/caffe.hpp"
+#include "caffe/util/mem_report.hpp"
 
 using caffe::Blob;
 using caffe::Caffe;
 using caffe::Net;
 using caffe::Layer;
+using caffe::MemoryReport;
+using caffe::ReportMemory;
 using caffe::shared_ptr;
+using caffe::SyncedMemory;
 using caffe::Timer;
 using caffe::vector;
 
@@ -30,6 +35,8 @@ DEFINE_string(weights, "",
     "Cannot be set simultaneously with snapshot.");
 DEFINE_int32(iterations, 50,
     "The number of iterations to run.");
+DEFINE_bool(json, false,
+    "Optional; print the report of the mem command as JSON on stdout.");
 
 // A simple registry for caffe commands.
 typedef int (*BrewFunction)();
@@ -359,6 +366,155 @@ int time() {
 }
 RegisterBrewFunction(time);
 
+// Helpers for mem. Blobs merged by the memory optimizer share a storage, so
+// the storages are what actually hold the memory.
+typedef std::map<SyncedMemory*, int> StorageMap;
+
+// Number the storages in order of appearance; -1 for a missing one.
+static int StorageId(const shared_ptr<SyncedMemory>& storage,
+    StorageMap* storages) {
+  if (!storage) { return -1; }
+  StorageMap::iterator it = storages->find(storage.get());
+  if (it != storages->end()) { return it->second; }
+  const int id = storages->size();
+  (*storages)[storage.get()] = id;
+  return id;
+}
+
+static caffe::string JsonString(const caffe::string& str) {
+  caffe::string quoted = "\"";
+  for (int i = 0; i < str.size(); ++i) {
+    if (str[i] == '"' || str[i] == '\\') { quoted += '\\'; }
+    quoted += str[i];
+  }
+  return quoted + "\"";
+}
+
+// Mem: report the memory used by the blobs, parameters and workspace of a
+// model after the memory optimization.
+int mem() {
+  CHECK_GT(FLAGS_model.size(), 0) << "Need a model definition to profile.";
+
+  // Set device id and mode
+  if (FLAGS_gpu >= 0) {
+    LOG(INFO) << "Use GPU with device ID " << FLAGS_gpu;
+    Caffe::SetDevice(FLAGS_gpu);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    LOG(INFO) << "Use CPU.";
+    Caffe::set_mode(Caffe::CPU);
+  }
+  // Instantiate the caffe net.
+  Net<float> caffe_net(FLAGS_model, caffe::TRAIN);
+
+  // Storage is allocated on first use, so step through one forward and
+  // backward pass and record what has been allocated at every layer
+  // boundary.
+  MemoryReport report;
+  ReportMemory(&caffe_net, &report);
+
+  // Map the blobs to their storages.
+  const vector<shared_ptr<Layer<float> > >& layers = caffe_net.layers();
+  const vector<shared_ptr<Blob<float> > >& blobs = caffe_net.blobs();
+  const vector<caffe::string>& blob_names = caffe_net.blob_names();
+  StorageMap storages;
+  vector<int> data_storage(blobs.size()), diff_storage(blobs.size());
+  for (int i = 0; i < blobs.size(); ++i) {
+    data_storage[i] = StorageId(blobs[i]->data(), &storages);
+    diff_storage[i] = StorageId(blobs[i]->diff(), &storages);
+  }
+  vector<size_t> storage_bytes(storages.size());
+  for (StorageMap::iterator it = storages.begin(); it != storages.end();
+       ++it) {
+    storage_bytes[it->second] = it->first->size();
+  }
+  vector<vector<caffe::string> > storage_users(storages.size());
+  for (int i = 0; i < blobs.size(); ++i) {
+    if (data_storage[i] >= 0) {
+      storage_users[data_storage[i]].push_back(blob_names[i] + "_data");
+    }
+    if (diff_storage[i] >= 0) {
+      storage_users[diff_storage[i]].push_back(blob_names[i] + "_diff");
+    }
+  }
+
+  if (FLAGS_json) {
+    std::ostream& out = std::cout;
+    out << "{\n  \"name\": " << JsonString(caffe_net.name()) << ",\n"
+        << "  \"param_bytes\": " << report.param_bytes << ",\n"
+        << "  \"activation_raw_bytes\": " << report.activation_raw_bytes
+        << ",\n"
+        << "  \"activation_bytes\": " << report.activation_bytes << ",\n"
+        << "  \"workspace_bytes\": " << report.workspace_bytes << ",\n"
+        << "  \"peak_allocated_bytes\": " << report.peak_bytes
+        << ",\n  \"layers\": [";
+    for (int i = 0; i < layers.size(); ++i) {
+      out << (i ? "," : "") << "\n    {\"name\": "
+          << JsonString(caffe_net.layer_names()[i])
+          << ", \"type\": " << JsonString(layers[i]->type())
+          << ", \"top_bytes\": " << report.layer_top_bytes[i]
+          << ", \"param_bytes\": " << report.layer_param_bytes[i]
+          << ", \"forward_allocated_bytes\": "
+          << report.forward_allocated_bytes[i]
+          << ", \"backward_allocated_bytes\": "
+          << report.backward_allocated_bytes[i] << "}";
+    }
+    out << "\n  ],\n  \"blobs\": [";
+    for (int i = 0; i < blobs.size(); ++i) {
+      out << (i ? "," : "") << "\n    {\"name\": "
+          << JsonString(blob_names[i]) << ", \"shape\": [";
+      for (int j = 0; j < blobs[i]->num_axes(); ++j) {
+        out << (j ? ", " : "") << blobs[i]->shape(j);
+      }
+      out << "], \"bytes\": " << blobs[i]->count() * sizeof(float)
+          << ", \"data_storage\": " << data_storage[i]
+          << ", \"diff_storage\": " << diff_storage[i] << "}";
+    }
+    out << "\n  ],\n  \"storages\": [";
+    for (int i = 0; i < storage_bytes.size(); ++i) {
+      out << (i ? "," : "") << "\n    {\"id\": " << i
+          << ", \"bytes\": " << storage_bytes[i] << ", \"users\": [";
+      for (int j = 0; j < storage_users[i].size(); ++j) {
+        out << (j ? ", " : "") << JsonString(storage_users[i][j]);
+      }
+      out << "]}";
+    }
+    out << "\n  ]\n}" << std::endl;
+    return 0;
+  }
+
+  LOG(INFO) << "*** Memory report ***";
+  for (int i = 0; i < layers.size(); ++i) {
+    LOG(INFO) << std::setfill(' ') << std::setw(10)
+        << caffe_net.layer_names()[i]
+        << "\ttop: " << report.layer_top_bytes[i]
+        << "\tparams: " << report.layer_param_bytes[i]
+        << "\tallocated so far after forward: "
+        << report.forward_allocated_bytes[i]
+        << "\tafter backward: " << report.backward_allocated_bytes[i];
+  }
+  for (int i = 0; i < blobs.size(); ++i) {
+    LOG(INFO) << std::setfill(' ') << std::setw(10) << blob_names[i]
+        << "\t" << blobs[i]->shape_string()
+        << "\tdata storage: " << data_storage[i]
+        << "\tdiff storage: " << diff_storage[i];
+  }
+  for (int i = 0; i < storage_bytes.size(); ++i) {
+    if (storage_users[i].size() < 2) { continue; }
+    LOG(INFO) << "Storage " << i << " (" << storage_bytes[i]
+        << " bytes) is shared by " << boost::join(storage_users[i], ", ");
+  }
+  LOG(INFO) << "Parameters: " << report.param_bytes << " bytes.";
+  LOG(INFO) << "Activations: " << report.activation_bytes << " bytes ("
+      << report.activation_raw_bytes
+      << " bytes without memory optimization).";
+  LOG(INFO) << "Workspace: " << report.workspace_bytes << " bytes.";
+  LOG(INFO) << "Allocated at the end of the pass: " << report.peak_bytes
+      << " bytes.";
+  return 0;
+}
+RegisterBrewFunction(mem);
+
 int main(int argc, char** argv) {
   // Print output to stderr (while still logging).
   FLAGS_alsologtostderr = 1;
@@ -369,7 +525,8 @@ int main(int argc, char** argv) {
       "  train           train or finetune a model\n"
       "  test            score a model\n"
       "  device_query    show GPU diagnostic information\n"
-      "  time            benchmark model execution time");
+      "  time            benchmark model execution time\n"
+      "  mem             report the memory used by a model");
   // Run tool or show usage.
   caffe::GlobalInit(&argc, &argv);
 
@@ -1,19 +1,27 @@
 #include <glog/logging.h>
 
+#include <algorithm>
 #include <cstring>
 #include <map>
+#include <queue>
+#include <set>
 #include <string>
 #include <vector>
 #include <sys/stat.h>
 #include <sys/types.h>
 
 #include "boost/algorithm/string.hpp"
+#include "boost/atomic.hpp"
+#include "boost/bind/bind.hpp"
+#include "boost/date_time/posix_time/posix_time.hpp"
+#include "boost/thread.hpp"
 #include "caffe/caffe.hpp"
 #include "caffe/common.hpp"
 #include "opencv2/opencv.hpp"
 #include "opencv2/core/core.hpp"
 #include "opencv2/highgui/highgui.hpp"
 #include "opencv2/imgproc/imgproc.hpp"
+#include "opencv2/video/tracking.hpp"
 
 #ifdef DTYPE_FP16
 #include "caffe/half/half.hpp"
@@ -28,6 +36,7 @@
 
 using caffe::Blob;
 using caffe::Caffe;
+using caffe::CPUTimer;
 using caffe::Net;
 using caffe::Layer;
 using caffe::shared_ptr;
@@ -54,6 +63,89 @@ DEFINE_string(video_out, "",
     "output video file (postfix .avi is added).");
 DEFINE_double(fps, 20,
   "fps of output video");
+DEFINE_int32(key_interval, 1,
+    "Optional; Run the whole net on every key_interval-th frame only, and "
+    "on the others warp the features of the last key frame along the "
+    "optical flow and run the layers after them.");
+DEFINE_string(feature_blob, "",
+    "Optional; The blob whose features are warped from the last key frame, "
+    "needed with key_interval > 1.");
+DEFINE_double(still_threshold, 0,
+    "Optional; Reuse the last prediction for a frame whose mean absolute "
+    "difference from the last predicted frame is below this (0-255).");
+DEFINE_int32(batch, 1,
+    "Optional; Predict up to this many frames in one forward pass, as many "
+    "as are decoded when the net is free.");
+DEFINE_int32(queue_size, 4,
+    "Optional; The number of frames each queue between the decoding, "
+    "preprocessing, prediction, postprocessing and output threads holds.");
+
+// A queue between two threads of the pipeline. Push waits while it is full
+// and pop while it is empty, so that a slow stage holds back the earlier
+// ones instead of piling their frames up.
+template <typename T>
+class BoundedQueue {
+public:
+  explicit BoundedQueue(size_t capacity) : capacity_(capacity) {}
+  void push(const T& t) {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (queue_.size() >= capacity_) {
+      not_full_.wait(lock);
+    }
+    queue_.push(t);
+    not_empty_.notify_one();
+  }
+  T pop() {
+    boost::mutex::scoped_lock lock(mutex_);
+    while (queue_.empty()) {
+      not_empty_.wait(lock);
+    }
+    T t = queue_.front();
+    queue_.pop();
+    not_full_.notify_one();
+    return t;
+  }
+  bool try_pop(T* t) {
+    boost::mutex::scoped_lock lock(mutex_);
+    if (queue_.empty()) { return false; }
+    *t = queue_.front();
+    queue_.pop();
+    not_full_.notify_one();
+    return true;
+  }
+
+private:
+  const size_t capacity_;
+  std::queue<T> queue_;
+  boost::mutex mutex_;
+  boost::condition_variable not_full_;
+  boost::condition_variable not_empty_;
+};
+
+// A frame on its way through the pipeline.
+struct Frame {
+  Frame() : still(false) {}
+  boost::posix_time::ptime read_time;
+  Mat read_frame;  // as decoded
+  Mat input;  // resized and padded to the net input
+  bool still;  // reuses the prediction of the frame before
+  vector<Mat> prob;  // the net output, a Mat per channel
+  Mat output;  // the masked frame for the output video
+  Mat display;  // the masked frame and the mask side by side
+  Mat prob_concat;  // the channel probabilities side by side
+};
+// a NULL frame ends the stream
+typedef shared_ptr<Frame> FramePtr;
+typedef BoundedQueue<FramePtr> FrameQueue;
+
+// The frames a stage went through and the time it spent on them.
+struct StageStats {
+  explicit StageStats(const string& stage_name)
+      : name(stage_name), frames(0), busy_ms(0) {}
+  string name;
+  int frames;
+  double busy_ms;
+};
 
 class HumanPredictor {
 public:
@@ -61,7 +153,11 @@ public:
   ~HumanPredictor() {};
   bool Init(const std::string &net_file, const std::string &model_file, const bool is_GPU,
    const float* mean_ptr,  const std::string &output_blob, int shrink);
-  bool PredictProb(const cv::Mat& input_frame, std::vector<cv::Mat>& human_prob_mat, cv::Mat& human_mask_mat, cv::Mat *history_human_prob_mat) const;
+  void InitFeatureReuse(const std::string &feature_blob);
+  void BindThread() const;
+  void ReshapeBatch(int batch);
+  void PredictBatch(const vector<Mat>& input_frames, bool key_frame, vector<vector<Mat> >* human_prob_mats);
+  Mat MaskFromProb(const vector<Mat>& human_prob_mat, const Mat* history_human_prob_mat) const;
   vector<int> PadParam(int video_cols, int video_rows);
   Mat show_mask(const cv::Mat&  img_ori, const cv::Mat& prob_mat, int show_channel);
   inline int get_height_in() { return height_network_input; }
@@ -72,6 +168,7 @@ public:
 
 private:
   caffe::Net<float> *model;
+  int gpu_device = -1;
   int height_network_input = 0;
   int width_network_input = 0;
   int height_network_prob = 0;
@@ -82,18 +179,30 @@ private:
   int m_shrink = 0;
   float mean[3]; // bgr mean
   string output_blob_name;
+
+  // Temporal feature reuse: the layer computing the reused features, the
+  // features and grey input of the last key frame, and the flow from the
+  // current frame back to it.
+  int feature_layer = -1;
+  Blob<float>* feature_blob = NULL;
+  Blob<float> key_feature;
+  Blob<float> flow;
+  Mat key_gray;
+  shared_ptr<Layer<float> > warping;
+
+  void Forward(const cv::Mat& input_frame, bool key_frame);
+  Mat FeatureGray(const cv::Mat& input_frame) const;
 };
 
 bool HumanPredictor::Init(const std::string &net_file, const std::string &model_file,
   const bool is_GPU, const float* mean_ptr, const std::string &output_blob, int shrink) {
   if (is_GPU >= 0) {
     LOG(INFO) << "Use GPU with device ID " << is_GPU;
-    Caffe::SetDevice(is_GPU);
-    Caffe::set_mode(Caffe::GPU);
+    gpu_device = is_GPU;
   } else {
     LOG(INFO) << "Use CPU.";
-    Caffe::set_mode(Caffe::CPU);
   }
+  BindThread();
 
   model = new caffe::Net<float>(net_file, caffe::TEST);
   if (model == NULL) { return false; }
@@ -105,14 +214,13 @@ bool HumanPredictor::Init(const std::string &net_file, const std::string &model_
 
   m_shrink = shrink;
 
-  CHECK_EQ(data_blob->num(), 1);
+  // the frames a forward pass predicts set the num of the blobs
   CHECK_EQ(data_blob->channels(), 3);
   height_network_input = data_blob->height();
   width_network_input = data_blob->width();
   CHECK_GT(height_network_input, 0);
   CHECK_GT(width_network_input, 0);
 
-  CHECK_EQ(prob_blob->num(), 1);
   CHECK_EQ(prob_blob->channels(), 2);
   height_network_prob = prob_blob->height();
   width_network_prob = prob_blob->width();
@@ -128,6 +236,108 @@ bool HumanPredictor::Init(const std::string &net_file, const std::string &model_
   return true;
 }
 
+void HumanPredictor::InitFeatureReuse(const std::string &feature_blob_name) {
+  CHECK(model->has_blob(feature_blob_name))
+      << "Unknown feature blob " << feature_blob_name;
+  feature_blob = model->blob_by_name(feature_blob_name).get();
+  const vector<vector<Blob<float>*> >& bottom_vecs = model->bottom_vecs();
+  const vector<vector<Blob<float>*> >& top_vecs = model->top_vecs();
+  for (int i = 0; i < top_vecs.size(); ++i) {
+    for (int j = 0; j < top_vecs[i].size(); ++j) {
+      if (top_vecs[i][j] == feature_blob) { feature_layer = i; }
+    }
+  }
+  CHECK_GE(feature_layer, 0) << feature_blob_name << " is a net input";
+  // The layers after the features run alone on the other frames, so they
+  // may read nothing the earlier layers compute.
+  std::set<const Blob<float>*> head_blobs;
+  head_blobs.insert(feature_blob);
+  for (int i = feature_layer + 1; i < bottom_vecs.size(); ++i) {
+    for (int j = 0; j < bottom_vecs[i].size(); ++j) {
+      CHECK(head_blobs.count(bottom_vecs[i][j]))
+          << model->layer_names()[i] << " reads a blob computed before "
+          << feature_blob_name << ", which is not kept between frames";
+    }
+    head_blobs.insert(top_vecs[i].begin(), top_vecs[i].end());
+  }
+
+  key_feature.ReshapeLike(*feature_blob);
+  flow.Reshape(1, 2, feature_blob->height(), feature_blob->width());
+  caffe::LayerParameter warping_param;
+  warping_param.set_type("Warping");
+  warping_param.mutable_warping_param()->set_num_threads(0);
+  warping.reset(new caffe::WarpingLayer<float>(warping_param));
+  vector<Blob<float>*> warping_bottom(1, &key_feature);
+  warping_bottom.push_back(&flow);
+  vector<Blob<float>*> warping_top(1, feature_blob);
+  warping->SetUp(warping_bottom, warping_top);
+  LOG(INFO) << "Reusing " << feature_blob_name << " of "
+      << model->layer_names()[feature_layer] << " between key frames";
+}
+
+Mat HumanPredictor::FeatureGray(const cv::Mat& input_frame) const {
+  // the flow is found at twice the feature resolution, for sub-feature
+  // precision at little cost
+  Mat gray;
+  cvtColor(input_frame, gray, COLOR_BGR2GRAY);
+  resize(gray, gray, Size(2 * feature_blob->width(),
+      2 * feature_blob->height()), 0, 0, INTER_AREA);
+  return gray;
+}
+
+void HumanPredictor::Forward(const cv::Mat& input_frame, bool key_frame) {
+  if (feature_layer < 0) {
+    model->ForwardPrefilled();
+    return;
+  }
+  if (key_frame || key_gray.empty()) {
+    model->ForwardTo(feature_layer);
+    key_feature.CopyFrom(*feature_blob, false, true);
+    key_gray = FeatureGray(input_frame);
+    model->ForwardFrom(feature_layer + 1);
+    return;
+  }
+  // Where each feature of this frame was in the key frame: Farneback's
+  // flow from this frame back to the key one, in feature pixels.
+  Mat frame_flow;
+  calcOpticalFlowFarneback(FeatureGray(input_frame), key_gray, frame_flow,
+      0.5, 2, 9, 3, 5, 1.1, 0);
+  resize(frame_flow, frame_flow, Size(feature_blob->width(),
+      feature_blob->height()), 0, 0, INTER_AREA);
+  const int spatial_dim = feature_blob->height() * feature_blob->width();
+  float* flow_data = flow.mutable_cpu_data();
+  for (int i = 0; i < spatial_dim; ++i) {
+    const Vec2f& f = frame_flow.at<Vec2f>(i);
+    flow_data[i] = 0.5f * f[0];
+    flow_data[spatial_dim + i] = 0.5f * f[1];
+  }
+  vector<Blob<float>*> warping_bottom(1, &key_feature);
+  warping_bottom.push_back(&flow);
+  vector<Blob<float>*> warping_top(1, feature_blob);
+  warping->Forward(warping_bottom, warping_top);
+  model->ForwardFrom(feature_layer + 1);
+}
+
+// The Caffe mode is kept per thread, so the thread running the net sets it.
+void HumanPredictor::BindThread() const {
+  if (gpu_device >= 0) {
+    Caffe::SetDevice(gpu_device);
+    Caffe::set_mode(Caffe::GPU);
+  } else {
+    Caffe::set_mode(Caffe::CPU);
+  }
+}
+
+// The net keeps one batch size, so that no partial batch reshapes it and
+// reruns the setup of its layers (the cuDNN algorithm search among them).
+void HumanPredictor::ReshapeBatch(int batch) {
+  CHECK(feature_layer < 0 || batch == 1)
+      << "The features of a single key frame are reused";
+  Blob<float>* data_blob = model->blob_by_name("data").get();
+  data_blob->Reshape(batch, 3, height_network_input, width_network_input);
+  model->Reshape();
+}
+
 vector<int> HumanPredictor::PadParam(int video_cols, int video_rows){ 
   float scale = std::min((float)width_network_input / video_cols, (float)height_network_input / video_rows);
 
@@ -148,52 +358,65 @@ vector<int> HumanPredictor::PadParam(int video_cols, int video_rows){
   return pad_vector;
 }
 
-bool HumanPredictor::PredictProb(const cv::Mat& input_frame, std::vector<cv::Mat>& human_prob_mat, cv::Mat& human_mask_mat, cv::Mat *history_human_prob_mat) const
+void HumanPredictor::PredictBatch(const vector<Mat>& input_frames, bool key_frame, vector<vector<Mat> >* human_prob_mats)
 {
-  boost::shared_ptr<caffe::Blob<float> > data_blob = model->blob_by_name("data");
-  boost::shared_ptr<caffe::Blob<float> > prob_blob = model->blob_by_name(output_blob_name);
-
-  CHECK_EQ(input_frame.rows, height_network_input);
-  CHECK_EQ(input_frame.cols, width_network_input);
-  CHECK_EQ(input_frame.channels(), 3);
-
-  int output_channels = prob_blob->channels();
-  human_prob_mat.resize(output_channels);
-  for (int i = 0; i < output_channels; i++) {
-    human_prob_mat[i] = Mat(height_network_prob, width_network_prob, CV_32FC1);
-  }
-
-  Mat bgrFrame[3];
-  split(input_frame, bgrFrame);
-  for (size_t c = 0; c < 3; c++) {
-    bgrFrame[c].convertTo(bgrFrame[c], CV_32F);
-    bgrFrame[c] = bgrFrame[c] - mean[c];
-  }
+  Blob<float>* data_blob = model->blob_by_name("data").get();
+  const Blob<float>* prob_blob = model->blob_by_name(output_blob_name).get();
+  const int num = input_frames.size();
+  CHECK_LE(num, data_blob->num()) << "More frames than the batch size";
 
+  const int input_dim = height_network_input * width_network_input;
   float* data_blob_data = data_blob->mutable_cpu_data();
-  for (size_t c = 0; c < 3; c++) {
-    memcpy(data_blob_data + c * height_network_input * width_network_input,
-        bgrFrame[c].data, sizeof(float) * height_network_input * width_network_input);
+  // A partial batch is padded with frames of the mean color, whose outputs
+  // are dropped.
+  memset(data_blob_data + num * 3 * input_dim, 0,
+      sizeof(float) * (data_blob->num() - num) * 3 * input_dim);
+  for (int n = 0; n < num; ++n) {
+    const Mat& input_frame = input_frames[n];
+    CHECK_EQ(input_frame.rows, height_network_input);
+    CHECK_EQ(input_frame.cols, width_network_input);
+    CHECK_EQ(input_frame.channels(), 3);
+
+    Mat bgrFrame[3];
+    split(input_frame, bgrFrame);
+    for (size_t c = 0; c < 3; c++) {
+      bgrFrame[c].convertTo(bgrFrame[c], CV_32F);
+      bgrFrame[c] = bgrFrame[c] - mean[c];
+      memcpy(data_blob_data + (n * 3 + c) * input_dim, bgrFrame[c].data,
+          sizeof(float) * input_dim);
+    }
   }
 
   Timer forward_timer;
   forward_timer.Start();
-  model->ForwardPrefilled();
+  Forward(input_frames[0], key_frame);
   forward_timer.Stop();
-  LOG(INFO) << "Forward Time: " << forward_timer.MilliSeconds() << " ms.";
+  LOG(INFO) << (key_frame ? "Key " : "") << "Forward Time: "
+      << forward_timer.MilliSeconds() << " ms for " << num << " frames.";
 
+  const int output_channels = prob_blob->channels();
+  const int prob_dim = height_network_prob * width_network_prob;
   const float* prob_blob_data = prob_blob->cpu_data();
-
-  for (int c = 0; c < output_channels; c++) {
-    memcpy(human_prob_mat[c].data, prob_blob_data + 
-      c * height_network_prob * width_network_prob, 
-      sizeof(float) * height_network_prob * width_network_prob);
+  human_prob_mats->resize(num);
+  for (int n = 0; n < num; ++n) {
+    vector<Mat>& human_prob_mat = (*human_prob_mats)[n];
+    human_prob_mat.resize(output_channels);
+    for (int c = 0; c < output_channels; c++) {
+      human_prob_mat[c] = Mat(height_network_prob, width_network_prob, CV_32FC1);
+      memcpy(human_prob_mat[c].data,
+          prob_blob_data + (n * output_channels + c) * prob_dim,
+          sizeof(float) * prob_dim);
+    }
   }
+}
 
-  human_mask_mat = Mat(height_network_prob, width_network_prob, CV_32FC1, Scalar(0));
+Mat HumanPredictor::MaskFromProb(const vector<Mat>& human_prob_mat, const Mat* history_human_prob_mat) const
+{
+  const int output_channels = human_prob_mat.size();
+  Mat human_mask_mat(height_network_prob, width_network_prob, CV_32FC1, Scalar(0));
   for (int i = 0; i < height_network_prob * width_network_prob; i++){
-    int index = 0; int prob = human_prob_mat[0].at<float>(i);
-    if (!history_human_prob_mat)
+    int index = 0; float prob = human_prob_mat[0].at<float>(i);
+    if (history_human_prob_mat)
     {
       if (history_human_prob_mat[0].at<float>(i) <0.5)
         prob = 0.97;
@@ -208,7 +431,7 @@ bool HumanPredictor::PredictProb(const cv::Mat& input_frame, std::vector<cv::Mat
     }
     human_mask_mat.at<float>(i) = (int)(index * 255 / (output_channels - 1));
   }
-  return true;
+  return human_mask_mat;
 }
 
 Mat HumanPredictor::show_mask(const cv::Mat& img_ori, const cv::Mat& prob_mat, int show_channel) {
@@ -258,6 +481,130 @@ bool mk_file_dir(string filename) {
   return true;
 }
 
+// The stages of the pipeline, each on its own thread. Each passes the NULL
+// frame ending the stream on before it returns.
+void ReadFrames(VideoCapture* capture, const boost::atomic<bool>* stop,
+    FrameQueue* out, StageStats* stats) {
+  CPUTimer timer;
+  while (!*stop) {
+    timer.Start();
+    FramePtr frame(new Frame());
+    if (!capture->read(frame->read_frame)) { break; }
+    frame->read_time = boost::posix_time::microsec_clock::universal_time();
+    timer.Stop();
+    stats->busy_ms += timer.MilliSeconds();
+    ++stats->frames;
+    out->push(frame);
+  }
+  out->push(FramePtr());
+}
+
+void PreprocessFrames(HumanPredictor* predictor, const vector<int>& pad,
+    const float* mean, FrameQueue* in, FrameQueue* out, StageStats* stats) {
+  CPUTimer timer;
+  for (FramePtr frame = in->pop(); frame; frame = in->pop()) {
+    timer.Start();
+    resize(frame->read_frame, frame->input, Size(predictor->get_resize_width(), predictor->get_resize_height()));
+    copyMakeBorder(frame->input, frame->input, pad[0], pad[1], pad[2], pad[3],
+       BORDER_CONSTANT, Scalar(mean[0], mean[1], mean[2]) );
+    timer.Stop();
+    stats->busy_ms += timer.MilliSeconds();
+    ++stats->frames;
+    out->push(frame);
+  }
+  out->push(FramePtr());
+}
+
+void PredictFrames(HumanPredictor* predictor, FrameQueue* in, FrameQueue* out,
+    StageStats* stats) {
+  predictor->BindThread();
+  predictor->ReshapeBatch(FLAGS_batch);
+  CPUTimer timer;
+  // the input of the last frame the net ran on
+  Mat last_input;
+  int predicted_frames = 0;
+  bool done = false;
+  while (!done) {
+    // a batch of the frame waited for and those ready behind it
+    vector<FramePtr> frames(1, in->pop());
+    if (!frames[0]) { break; }
+    FramePtr next;
+    while (static_cast<int>(frames.size()) < FLAGS_batch &&
+        in->try_pop(&next)) {
+      if (!next) { done = true; break; }
+      frames.push_back(next);
+    }
+    timer.Start();
+    // Predict by CNN, unless the frame did not change
+    vector<Mat> inputs;
+    for (int n = 0; n < frames.size(); ++n) {
+      Frame* frame = frames[n].get();
+      if (FLAGS_still_threshold > 0 && !last_input.empty()) {
+        Mat frame_diff;
+        absdiff(frame->input, last_input, frame_diff);
+        const Scalar diff = cv::mean(frame_diff);
+        frame->still = (diff[0] + diff[1] + diff[2]) / 3 < FLAGS_still_threshold;
+      }
+      if (!frame->still) {
+        inputs.push_back(frame->input);
+        last_input = frame->input;
+      }
+    }
+    if (!inputs.empty()) {
+      const bool key_frame = predicted_frames % FLAGS_key_interval == 0;
+      vector<vector<Mat> > probs;
+      predictor->PredictBatch(inputs, key_frame, &probs);
+      for (int n = 0, m = 0; n < frames.size(); ++n) {
+        if (!frames[n]->still) { frames[n]->prob = probs[m++]; }
+      }
+      predicted_frames += inputs.size();
+    }
+    timer.Stop();
+    stats->busy_ms += timer.MilliSeconds();
+    stats->frames += frames.size();
+    for (int n = 0; n < frames.size(); ++n) {
+      out->push(frames[n]);
+    }
+  }
+  out->push(FramePtr());
+}
+
+void PostprocessFrames(HumanPredictor* predictor, int video_cols,
+    int video_rows, FrameQueue* in, FrameQueue* out, StageStats* stats) {
+  CPUTimer timer;
+  vector<Mat> human_prob_mat;
+  Mat human_mask_mat, history_human_prob_mat;
+  for (FramePtr frame = in->pop(); frame; frame = in->pop()) {
+    timer.Start();
+    // a still frame shows the prediction of the frame before
+    if (!frame->still || human_prob_mat.empty()) {
+      if (!frame->prob.empty()) { human_prob_mat = frame->prob; }
+      human_mask_mat = predictor->MaskFromProb(human_prob_mat,
+          history_human_prob_mat.empty() ? NULL : &history_human_prob_mat);
+      human_mask_mat.copyTo(history_human_prob_mat);
+    }
+    // Visualization and Output
+    Mat masked_img = predictor->show_mask(frame->read_frame, human_mask_mat, FLAGS_show_channel);
+
+    Mat mask_bgr;
+    cv::cvtColor(human_mask_mat, mask_bgr, cv::COLOR_GRAY2BGR);
+    mask_bgr.convertTo(mask_bgr, CV_8UC3);
+    resize(mask_bgr, mask_bgr, Size(video_cols, video_rows));
+    cv::hconcat(masked_img, mask_bgr, frame->display);
+
+    frame->prob_concat = human_prob_mat[0];
+    for (int i = 1; i < predictor->get_channel_network_prob(); i++){
+      cv::hconcat(frame->prob_concat, human_prob_mat[i], frame->prob_concat);
+    }
+    resize(masked_img, frame->output, Size(video_cols, video_rows));
+    timer.Stop();
+    stats->busy_ms += timer.MilliSeconds();
+    ++stats->frames;
+    out->push(frame);
+  }
+  out->push(FramePtr());
+}
+
 int main(int argc, char** argv) {
   // Initialization
   FLAGS_alsologtostderr = 1;
@@ -287,6 +634,15 @@ int main(int argc, char** argv) {
   HumanPredictor predictor;
   CHECK(predictor.Init(proto_model, weights, 0, mean, FLAGS_output_blob, FLAGS_shrink));
   vector<int> pad = predictor.PadParam(video_cols, video_rows);
+  CHECK_GE(FLAGS_key_interval, 1);
+  CHECK_GE(FLAGS_batch, 1);
+  CHECK_GE(FLAGS_queue_size, 1);
+  if (FLAGS_key_interval > 1) {
+    CHECK(!FLAGS_feature_blob.empty())
+        << "key_interval > 1 needs the feature_blob to reuse";
+    CHECK_EQ(FLAGS_batch, 1) << "Frames reusing features are predicted alone";
+    predictor.InitFeatureReuse(FLAGS_feature_blob);
+  }
 
   // Video initialization
   VideoCapture capture;
@@ -314,55 +670,67 @@ int main(int argc, char** argv) {
   capture.set(CV_CAP_PROP_FRAME_WIDTH, video_cols);
   capture.set(CV_CAP_PROP_FRAME_HEIGHT, video_rows);
 
-  Mat read_frame, temp_frame;
-  Mat history_human_prob_mat; bool flag = false;
-  while (capture.read(read_frame)) {
-    // Prepare Input
-    read_frame.copyTo(temp_frame);
-    resize(temp_frame, temp_frame, Size(predictor.get_resize_width(), predictor.get_resize_height()));
-    copyMakeBorder(temp_frame, temp_frame, pad[0], pad[1], pad[2], pad[3], 
-       BORDER_CONSTANT, Scalar(mean[0], mean[1], mean[2]) );
-
-    // Predict by CNN
-    vector<Mat> human_prob_mat;
-    Mat human_mask_mat;
-
-    if (!flag)
-    {
-      flag = true;
-      predictor.PredictProb(temp_frame, human_prob_mat, human_mask_mat, NULL);
-    }
-    else
-      predictor.PredictProb(temp_frame, human_prob_mat, human_mask_mat, &history_human_prob_mat);
-
-    human_mask_mat.copyTo(history_human_prob_mat);
-    // Visualization and Output
-    Mat masked_img = predictor.show_mask(read_frame, human_mask_mat, FLAGS_show_channel);
-    Mat newImage;
-
-
-    cv::cvtColor(human_mask_mat, human_mask_mat, cv::COLOR_GRAY2BGR);
-    human_mask_mat.convertTo(human_mask_mat, CV_8UC3);
-    resize(human_mask_mat, human_mask_mat, Size(video_cols, video_rows));
-
-    cv::hconcat(masked_img, human_mask_mat, newImage);
-    cv::imshow("Masked Input and Mask", newImage);
-
-    Mat prob_concat = human_prob_mat[0];
-    for (int i = 1; i < predictor.get_channel_network_prob(); i++){
-      cv::hconcat(prob_concat, human_prob_mat[1], prob_concat);
-    }
-    cv::imshow("Channel Probilities", prob_concat);
+  // Decoding, preprocessing, prediction and postprocessing run on threads
+  // of their own, and this one shows and writes the frames, as the windows
+  // must be handled by the main thread.
+  FrameQueue read_queue(FLAGS_queue_size), input_queue(FLAGS_queue_size),
+      prob_queue(FLAGS_queue_size), output_queue(FLAGS_queue_size);
+  StageStats read_stats("read"), preprocess_stats("preprocess"),
+      predict_stats("predict"), postprocess_stats("postprocess"),
+      write_stats("write");
+  boost::atomic<bool> stop(false);
+  const boost::posix_time::ptime start_time =
+      boost::posix_time::microsec_clock::universal_time();
+  boost::thread_group stages;
+  stages.create_thread(boost::bind(&ReadFrames, &capture, &stop,
+      &read_queue, &read_stats));
+  stages.create_thread(boost::bind(&PreprocessFrames, &predictor, pad, mean,
+      &read_queue, &input_queue, &preprocess_stats));
+  stages.create_thread(boost::bind(&PredictFrames, &predictor, &input_queue,
+      &prob_queue, &predict_stats));
+  stages.create_thread(boost::bind(&PostprocessFrames, &predictor,
+      video_cols, video_rows, &prob_queue, &output_queue,
+      &postprocess_stats));
+
+  CPUTimer timer;
+  double total_latency_ms = 0, max_latency_ms = 0;
+  for (FramePtr frame = output_queue.pop(); frame;
+       frame = output_queue.pop()) {
+    // after a key press the frames on their way are only drained
+    if (stop) { continue; }
+    timer.Start();
+    cv::imshow("Masked Input and Mask", frame->display);
+    cv::imshow("Channel Probilities", frame->prob_concat);
 
     if (is_video_out) {
-      Mat tovideo;
-      resize(masked_img, tovideo, Size(video_cols, video_rows));
-      vw << tovideo;
+      vw << frame->output;
     }
 
     if (waitKey(1) != -1)
-      break;
+      stop = true;
+    timer.Stop();
+    write_stats.busy_ms += timer.MilliSeconds();
+    ++write_stats.frames;
+    const double latency_ms = (boost::posix_time::microsec_clock::universal_time()
+        - frame->read_time).total_microseconds() / 1000.;
+    total_latency_ms += latency_ms;
+    max_latency_ms = std::max(max_latency_ms, latency_ms);
+  }
+  stages.join_all();
+
+  const double elapsed_ms = (boost::posix_time::microsec_clock::universal_time()
+      - start_time).total_microseconds() / 1000.;
+  const StageStats* stage_stats[] = {&read_stats, &preprocess_stats,
+      &predict_stats, &postprocess_stats, &write_stats};
+  for (int i = 0; i < 5; ++i) {
+    const StageStats& stats = *stage_stats[i];
+    LOG(INFO) << stats.name << ": " << stats.frames << " frames, "
+        << stats.busy_ms / std::max(stats.frames, 1) << " ms per frame, busy "
+        << 100 * stats.busy_ms / elapsed_ms << "% of the time.";
   }
+  LOG(INFO) << write_stats.frames * 1000. / elapsed_ms << " fps, latency "
+      << total_latency_ms / std::max(write_stats.frames, 1) << " ms mean, "
+      << max_latency_ms << " ms max.";
   LOG(INFO) << "Finished!";
   caffe::GlobalFinalize();
   return 0;